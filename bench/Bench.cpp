@@ -0,0 +1,235 @@
+#include "Bench.h"
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#include <stdexcept>
+#include "ThreadUtils.h"
+
+using namespace std;
+
+static atomic<uint64_t> s_allocations{0};
+
+uint64_t benchAllocations() {
+    return s_allocations.load(memory_order_relaxed);
+}
+
+// Every allocation of the process goes through these; the nothrow and
+// sized variants of the standard library forward to them
+void* operator new(size_t size) {
+    s_allocations.fetch_add(1, memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+void* operator new(size_t size, align_val_t alignment) {
+    s_allocations.fetch_add(1, memory_order_relaxed);
+    size_t align = (size_t)alignment;
+    void* p = aligned_alloc(align, (size + align - 1) / align * align);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size, align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void operator delete(void* p, align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t, align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t, align_val_t) noexcept {
+    free(p);
+}
+
+void BenchState::pauseTiming() {
+    if (m_paused) {
+        return;
+    }
+    m_elapsedNs += ThreadUtils::monotonicNs() - m_startNs;
+    m_allocations += benchAllocations() - m_startAllocations;
+    m_paused = true;
+}
+
+void BenchState::resumeTiming() {
+    if (!m_paused) {
+        return;
+    }
+    m_paused = false;
+    m_startAllocations = benchAllocations();
+    m_startNs = ThreadUtils::monotonicNs();
+}
+
+/**
+ * Constructor
+ *
+ * @param minTimeMs Shortest run reported.
+ * @param filter Only run benchmarks whose name contains it, empty for all.
+ */
+BenchRunner::BenchRunner(unsigned minTimeMs, string filter) :
+    m_minTimeMs(minTimeMs),
+    m_filter(std::move(filter))
+{
+}
+
+bool BenchRunner::selected(const string& name) const {
+    return m_filter.empty() || name.find(m_filter) != string::npos;
+}
+
+/**
+ * Runs a benchmark with growing iteration counts, aiming the next run at
+ * the minimum time from the rate of the previous one, and records the
+ * first run that lasts at least the minimum time.
+ *
+ * @param name Benchmark name, "group/operation[/parameter]".
+ * @param bytesPerOp Payload of one operation, 0 if throughput does not apply.
+ * @param body Runs the operation state.iterations times.
+ */
+void BenchRunner::run(const string& name, size_t bytesPerOp, Body body) {
+    if (!selected(name)) {
+        return;
+    }
+
+    uint64_t minTimeNs = (uint64_t)m_minTimeMs * 1000000;
+    uint64_t iterations = 1;
+    while (true) {
+        BenchState state(iterations);
+        state.resumeTiming();
+        body(state);
+        state.pauseTiming();
+
+        if (state.m_elapsedNs >= minTimeNs || iterations >= MaxIterations) {
+            BenchResult result;
+            result.name = name;
+            result.iterations = iterations;
+            result.nsPerOp = (double)state.m_elapsedNs / iterations;
+            result.allocsPerOp = (double)state.m_allocations / iterations;
+            result.bytesPerOp = bytesPerOp;
+            result.opsPerSecond = state.m_elapsedNs ? iterations * 1e9 / state.m_elapsedNs : 0.0;
+            result.mbPerSecond = result.opsPerSecond * bytesPerOp / 1e6;
+            m_results.push_back(result);
+
+            fprintf(stderr, "%-44s %12" PRIu64 " %12.1f ns/op %8.2f allocs/op", name.c_str(), iterations,
+                result.nsPerOp, result.allocsPerOp);
+            if (bytesPerOp) {
+                fprintf(stderr, " %10.1f MB/s", result.mbPerSecond);
+            }
+            fprintf(stderr, "\n");
+            return;
+        }
+
+        // Aim 20% past the minimum, growing at most 100x and at least 2x per run
+        uint64_t elapsedNs = state.m_elapsedNs ? state.m_elapsedNs : 1;
+        double target = (double)iterations * minTimeNs * 1.2 / elapsedNs;
+        uint64_t next = (uint64_t)min(target, (double)iterations * 100);
+        iterations = min(max(next, iterations * 2), MaxIterations);
+    }
+}
+
+void BenchRunner::skip(const string& name, const string& reason) {
+    if (!selected(name)) {
+        return;
+    }
+    fprintf(stderr, "%-44s skipped: %s\n", name.c_str(), reason.c_str());
+    m_skipped.emplace_back(name, reason);
+}
+
+/**
+ * Escapes a string for a JSON document. Names and reasons are plain ASCII,
+ * only quotes, backslashes and control characters need care.
+ */
+static string jsonString(const string& text) {
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+    return out;
+}
+
+string BenchRunner::reportJson() const {
+    char line[320];
+    string out;
+    snprintf(line, sizeof(line), "{\n  \"minTimeMs\": %u,\n  \"benchmarks\": [", m_minTimeMs);
+    out += line;
+
+    for (size_t i = 0; i < m_results.size(); i++) {
+        const BenchResult& result = m_results[i];
+        out += i ? ",\n    {\"name\": " : "\n    {\"name\": ";
+        out += jsonString(result.name);
+        snprintf(line, sizeof(line), ", \"iterations\": %" PRIu64 ", \"nsPerOp\": %.2f, \"allocsPerOp\": %.3f, "
+            "\"bytesPerOp\": %zu, \"opsPerSecond\": %.1f, \"mbPerSecond\": %.2f}",
+            result.iterations, result.nsPerOp, result.allocsPerOp, result.bytesPerOp, result.opsPerSecond,
+            result.mbPerSecond);
+        out += line;
+    }
+
+    out += "\n  ],\n  \"skipped\": [";
+    for (size_t i = 0; i < m_skipped.size(); i++) {
+        out += i ? ",\n    {\"name\": " : "\n    {\"name\": ";
+        out += jsonString(m_skipped[i].first);
+        out += ", \"reason\": ";
+        out += jsonString(m_skipped[i].second);
+        out += "}";
+    }
+    out += m_skipped.empty() ? "]\n}\n" : "\n  ]\n}\n";
+    return out;
+}
+
+string makeBenchDirectory(const char* tag) {
+    const char* base = getenv("TMPDIR");
+    string pattern = string(base && *base ? base : "/tmp") + "/embeddedui-bench-" + tag + "-XXXXXX";
+    if (!mkdtemp(pattern.data())) {
+        throw runtime_error("mkdtemp failed for " + pattern);
+    }
+    return pattern;
+}
+
+void removeBenchDirectory(const string& path) {
+    error_code ec;
+    filesystem::remove_all(path, ec);
+}
@@ -0,0 +1,92 @@
+/**
+* Micro benchmark harness of jetson-embeddedUI-bench. Each benchmark body
+* repeats one operation a given number of times; the runner grows the count
+* until a run lasts the minimum time and reports the last run as ns/op,
+* heap allocations/op and throughput. Allocations are counted by replacing
+* the global operator new, so they include the library's background threads.
+* Results are written as JSON so runs can be compared.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+//! Process-wide count of operator new calls
+uint64_t benchAllocations();
+
+//! Handed to a benchmark body, runs the operation iterations times
+class BenchState {
+public:
+    explicit BenchState(uint64_t iterations) : iterations(iterations) {}
+
+    //! Exclude setup or teardown inside the body from time and allocations
+    void pauseTiming();
+    void resumeTiming();
+
+    const uint64_t iterations;                  //! Operations to run
+
+private:
+    friend class BenchRunner;
+
+    uint64_t    m_startNs = 0;                  //! Start of the current timed stretch
+    uint64_t    m_startAllocations = 0;
+    uint64_t    m_elapsedNs = 0;                //! Timed so far
+    uint64_t    m_allocations = 0;              //! Counted so far
+    bool        m_paused = true;
+};
+
+//! Outcome of one benchmark
+struct BenchResult {
+    std::string name;
+    uint64_t    iterations;                     //! Operations in the reported run
+    double      nsPerOp;
+    double      allocsPerOp;
+    size_t      bytesPerOp;                     //! Payload per operation, 0 if not a throughput benchmark
+    double      opsPerSecond;
+    double      mbPerSecond;                    //! Payload throughput, 0 if bytesPerOp is 0
+};
+
+class BenchRunner {
+public:
+    typedef std::function<void(BenchState& state)> Body;
+
+    //! \param minTimeMs Shortest run reported
+    //! \param filter Only run benchmarks whose name contains it, empty for all
+    BenchRunner(unsigned minTimeMs, std::string filter);
+
+    //! Time body. bytesPerOp is the payload of one operation, for the throughput.
+    void run(const std::string& name, size_t bytesPerOp, Body body);
+
+    //! True if the filter selects the benchmark name, so a group can skip
+    //! the setup of benchmarks that will not run
+    bool selected(const std::string& name) const;
+
+    //! Note a benchmark that could not run, e.g. no pty support
+    void skip(const std::string& name, const std::string& reason);
+
+    const std::vector<BenchResult>& results() const { return m_results; }
+
+    //! {"minTimeMs": n, "benchmarks": [...], "skipped": [...]}
+    std::string reportJson() const;
+
+private:
+    static constexpr uint64_t MaxIterations = 1000000000ull;
+
+    unsigned                    m_minTimeMs;
+    std::string                 m_filter;
+    std::vector<BenchResult>    m_results;
+    std::vector<std::pair<std::string, std::string>> m_skipped;     //! Name and reason
+};
+
+//! Benchmark groups, each in its own file
+void runWebSystemBenchmarks(BenchRunner& runner);
+void runHardwareBenchmarks(BenchRunner& runner);
+void runPipelineBenchmarks(BenchRunner& runner);
+
+//! Fresh directory below $TMPDIR or /tmp, removed with removeBenchDirectory()
+std::string makeBenchDirectory(const char* tag);
+void removeBenchDirectory(const std::string& path);
@@ -0,0 +1,304 @@
+#include "Bench.h"
+#include "pwm.h"
+#include "SysfsBackend.h"
+#include "ChardevBackend.h"
+#include "SimulatedBackend.h"
+#include "serial.h"
+#include "SerialReactor.h"
+#include "configuration.hpp"
+#include <fcntl.h>
+#include <pty.h>
+#include <sched.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef BENCH_SETTINGS_FILE
+#define BENCH_SETTINGS_FILE "configuration/settings.json"
+#endif
+
+/**
+ * Creates the attributes of pwmchip0/pwm0 as the kernel would after an
+ * export, so SysfsBackend skips the export.
+ *
+ * @param baseDir Stand-in for /sys/class/pwm.
+ */
+static void makeFakePwm(const std::string& baseDir) {
+    std::string chipDir = baseDir + "/pwmchip0";
+    std::filesystem::create_directories(chipDir + "/pwm0");
+    for (const char* attribute : { "export", "unexport", "pwm0/period", "pwm0/duty_cycle", "pwm0/enable" }) {
+        std::ofstream(chipDir + "/" + attribute) << "0\n";
+    }
+}
+
+/**
+ * PWM::setDutyCycle() against a temp-dir sysfs. The file system is tmpfs
+ * rather than sysfs, so this measures the formatting and pwrite() path,
+ * not the PWM driver. The simulated case is the PWM and backend overhead
+ * alone, with the write logged in memory.
+ */
+static void runPwm(BenchRunner& runner) {
+    const std::string changed = "pwm/set-duty-cycle";
+    const std::string unchanged = "pwm/set-duty-cycle-unchanged";
+    const std::string simulated = "pwm/set-duty-cycle-simulated";
+
+    if (runner.selected(simulated)) {
+        SimulatedBackend backend;
+        PWM pwm(backend, "PWM1", 0, 0, 20000);
+        runner.run(simulated, 0, [&](BenchState& state) {
+            for (uint64_t i = 0; i < state.iterations; i++) {
+                pwm.setDutyCycle((i & 1) ? 12500.0f : 37500.0f);
+            }
+        });
+    }
+
+    if (!runner.selected(changed) && !runner.selected(unchanged)) {
+        return;
+    }
+
+    std::string baseDir = makeBenchDirectory("pwm");
+    makeFakePwm(baseDir);
+    {
+        SysfsBackend backend(baseDir);
+        PWM pwm(backend, "PWM1", 0, 0, 20000);
+
+        runner.run(changed, 0, [&](BenchState& state) {
+            for (uint64_t i = 0; i < state.iterations; i++) {
+                pwm.setDutyCycle((i & 1) ? 12500.0f : 37500.0f);
+            }
+        });
+
+        runner.run(unchanged, 0, [&](BenchState& state) {
+            pwm.setDutyCycle(25000.0f);
+            for (uint64_t i = 0; i < state.iterations; i++) {
+                pwm.setDutyCycle(25000.0f);
+            }
+        });
+    }
+    removeBenchDirectory(baseDir);
+}
+
+/**
+ * GPIO outputs on the character device of a gpio-sim chip, named by the
+ * BENCH_GPIOCHIP environment variable (e.g. gpiochip2): four lines of the
+ * chip set one ioctl each, and as one batch with a single ioctl. The values
+ * are read back first, so a wrong line mapping fails the group.
+ */
+static void runGpio(BenchRunner& runner) {
+    const std::string single = "gpio/chardev-set/lines:4";
+    const std::string batched = "gpio/chardev-set-batch/lines:4";
+    if (!runner.selected(single) && !runner.selected(batched)) {
+        return;
+    }
+    const char* chip = getenv("BENCH_GPIOCHIP");
+    if (!chip) {
+        runner.skip("gpio/chardev", "BENCH_GPIOCHIP is not set");
+        return;
+    }
+
+    ChardevBackend backend;
+    std::vector<std::unique_ptr<GpioLine>> lines;
+    try {
+        for (unsigned offset = 0; offset < 4; offset++) {
+            lines.push_back(backend.openGpio(chip, offset, true));
+        }
+    } catch (const std::exception& e) {
+        runner.skip("gpio/chardev", e.what());
+        return;
+    }
+
+    for (bool value : { true, false }) {
+        backend.beginBatch();
+        for (auto& line : lines) {
+            line->setValue(value);
+        }
+        backend.commitBatch();
+        for (auto& line : lines) {
+            if (line->getValue() != value) {
+                throw std::runtime_error(std::string("GPIO read back mismatch on ") + chip);
+            }
+        }
+    }
+
+    runner.run(single, 0, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            for (auto& line : lines) {
+                line->setValue(i & 1);
+            }
+        }
+    });
+
+    runner.run(batched, 0, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            backend.beginBatch();
+            for (auto& line : lines) {
+                line->setValue(i & 1);
+            }
+            backend.commitBatch();
+        }
+    });
+}
+
+//! Read exactly size bytes from a blocking fd
+static void readFully(int fd, char* pBuffer, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::read(fd, pBuffer, size);
+        if (n <= 0) {
+            throw std::runtime_error("pty read failed");
+        }
+        pBuffer += n;
+        size -= (size_t)n;
+    }
+}
+
+//! Write exactly size bytes to a blocking fd
+static void writeFully(int fd, const char* pBuffer, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, pBuffer, size);
+        if (n <= 0) {
+            throw std::runtime_error("pty write failed");
+        }
+        pBuffer += n;
+        size -= (size_t)n;
+    }
+}
+
+/**
+ * Serial over a pty pair, the Serial on the slave and the bench on the
+ * master end. An operation moves one message through the pty and back out
+ * of it, so it includes the pty's own latency.
+ */
+static void runSerial(BenchRunner& runner) {
+    const size_t sizes[] = { 64, 1024 };
+    bool any = false;
+    for (size_t size : sizes) {
+        for (const char* operation : { "write", "read", "reactor-transmit", "reactor-receive" }) {
+            any = any || runner.selected(std::string("serial/") + operation + "/" + std::to_string(size));
+        }
+    }
+    if (!any) {
+        return;
+    }
+
+    int master = -1;
+    int slave = -1;
+    char slaveName[128];
+    if (openpty(&master, &slave, slaveName, nullptr, nullptr) != 0) {
+        runner.skip("serial/", "openpty failed");
+        return;
+    }
+
+    std::vector<char> buffer(1024);
+    std::vector<char> message(1024);
+    for (size_t i = 0; i < message.size(); i++) {
+        message[i] = (char)('A' + i % 26);
+    }
+
+    {
+        Serial serial(slaveName, B115200);
+
+        for (size_t size : sizes) {
+            std::string suffix = "/" + std::to_string(size);
+
+            runner.run("serial/write" + suffix, size, [&](BenchState& state) {
+                for (uint64_t i = 0; i < state.iterations; i++) {
+                    serial.writeBytestream(message.data(), size);
+                    readFully(master, buffer.data(), size);
+                }
+            });
+
+            runner.run("serial/read" + suffix, size, [&](BenchState& state) {
+                for (uint64_t i = 0; i < state.iterations; i++) {
+                    writeFully(master, message.data(), size);
+                    for (size_t received = 0; received < size; ) {
+                        received += serial.read().size();
+                    }
+                }
+            });
+        }
+
+        // Attached to a reactor the writes may be queued and reads come from the ring
+        SerialReactor reactor;
+        std::vector<unsigned> cores;
+        for (unsigned core = 0; core < std::thread::hardware_concurrency(); core++) {
+            cores.push_back(core);
+        }
+        if (reactor.start(cores, 0, SCHED_OTHER) && serial.attach(reactor)) {
+            for (size_t size : sizes) {
+                std::string suffix = "/" + std::to_string(size);
+
+                runner.run("serial/reactor-transmit" + suffix, size, [&](BenchState& state) {
+                    for (uint64_t i = 0; i < state.iterations; i++) {
+                        while (!serial.transmit(message.data(), size)) {
+                            std::this_thread::yield();
+                        }
+                        readFully(master, buffer.data(), size);
+                    }
+                });
+
+                runner.run("serial/reactor-receive" + suffix, size, [&](BenchState& state) {
+                    for (uint64_t i = 0; i < state.iterations; i++) {
+                        writeFully(master, message.data(), size);
+                        while (serial.available() < size) {
+                        }
+                        serial.consume(size);
+                    }
+                });
+            }
+            serial.detach();
+        } else {
+            runner.skip("serial/reactor", "reactor could not be started");
+        }
+        reactor.stop();
+    }
+
+    close(slave);
+    close(master);
+}
+
+/**
+ * Settings load and save of the shipped settings.json, in a temp dir.
+ */
+static void runSettings(BenchRunner& runner) {
+    if (!runner.selected("settings/load") && !runner.selected("settings/save")) {
+        return;
+    }
+    if (!std::filesystem::exists(BENCH_SETTINGS_FILE)) {
+        runner.skip("settings/", std::string(BENCH_SETTINGS_FILE) + " not found");
+        return;
+    }
+
+    std::string directory = makeBenchDirectory("settings");
+    std::string path = directory + "/settings.json";
+    std::filesystem::copy_file(BENCH_SETTINGS_FILE, path);
+    size_t fileSize = std::filesystem::file_size(path);
+
+    runner.run("settings/load", fileSize, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            Settings settings(path);
+        }
+    });
+
+    Settings settings(path);
+    std::string savePath = directory + "/saved.json";
+    runner.run("settings/save", fileSize, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            settings.saveSettings(savePath);
+        }
+    });
+
+    removeBenchDirectory(directory);
+}
+
+void runHardwareBenchmarks(BenchRunner& runner) {
+    runPwm(runner);
+    runGpio(runner);
+    runSerial(runner);
+    runSettings(runner);
+}
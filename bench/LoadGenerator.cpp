@@ -0,0 +1,616 @@
+#include "LoadGenerator.h"
+#include "Commands.h"
+#include "JsonExtractor.h"
+#include "ThreadUtils.h"
+#include <dirent.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+using namespace BinaryProtocol;
+
+static constexpr uint64_t PacingTickNs = 1000000;      //! Credit and wake period of the pacing thread
+
+/**
+ * Constructor
+ * Creates the connection slots; nothing is connected until run().
+ *
+ * @param options Target, load shape and duration.
+ */
+LoadGenerator::LoadGenerator(const Options& options) :
+    m_options(options),
+    m_protocols{
+        { "ws-protocol-text", LoadGenerator::callback, 0, 0, 0, NULL, 0 },
+        { "ws-protocol-binary", LoadGenerator::callback, 0, 0, 0, NULL, 0 },
+        { NULL, NULL, 0, 0, 0, NULL, 0 },
+    },
+    m_pacingThread(INVALID_PTHREAD)
+{
+    for (unsigned i = 0; i < m_options.connections; i++) {
+        m_connections.push_back(make_unique<Connection>());
+        m_connections.back()->index = i;
+        m_connections.back()->pending.resize(SequenceWindow);
+    }
+}
+
+/**
+ * Destructor
+ * Stops the pacing thread and closes all connections.
+ */
+LoadGenerator::~LoadGenerator() {
+    m_exitPacing = true;
+    if (m_pacingThread != INVALID_PTHREAD) {
+        pthread_join(m_pacingThread, nullptr);
+    }
+    m_finished = true;
+    if (m_context) {
+        lws_context_destroy(m_context);
+    }
+}
+
+/**
+ * Connects all clients at the configured connect rate, sends commands for
+ * the load phase and waits for the outstanding acknowledgements.
+ *
+ * @return false if nothing could be measured.
+ */
+bool LoadGenerator::run() {
+    lws_set_log_level(LLL_ERR, nullptr);
+
+    lws_context_creation_info info = {};
+    info.port = CONTEXT_PORT_NO_LISTEN;
+    info.protocols = m_protocols;
+    info.fd_limit_per_thread = (int)m_options.connections + 64;
+    info.user = this;
+    m_context = lws_create_context(&info);
+    if (!m_context) {
+        cerr << "LoadGenerator: Failed to create the client context" << endl;
+        return false;
+    }
+
+    // The pacing thread also wakes the service loop, so the deadlines below are checked every tick
+    vector<unsigned> cores;
+    for (unsigned core = 0; core < thread::hardware_concurrency(); core++) {
+        cores.push_back(core);
+    }
+    m_pacingThread = ThreadUtils::startThread("LoadPacing", LoadGenerator::pacingThread, this, cores,
+        true, true, 0, SCHED_OTHER);
+    if (m_pacingThread == INVALID_PTHREAD) {
+        cerr << "LoadGenerator: Failed to start the pacing thread" << endl;
+        return false;
+    }
+
+    m_serverPid = m_options.serverPid ? m_options.serverPid : findServer();
+
+    // Connection ramp
+    uint64_t rampStartNs = ThreadUtils::monotonicNs();
+    uint64_t connectIntervalNs = 1000000000ull / max(1u, m_options.connectRate);
+    uint64_t rampDeadlineNs = rampStartNs + connectIntervalNs * m_options.connections + 10000000000ull;
+    size_t nextConnection = 0;
+    serviceUntil(rampDeadlineNs, [&]() {
+        uint64_t now = ThreadUtils::monotonicNs();
+        while (nextConnection < m_connections.size() && rampStartNs + nextConnection * connectIntervalNs <= now) {
+            connect(*m_connections[nextConnection++]);
+        }
+        return nextConnection == m_connections.size() &&
+            m_counters.established + m_counters.failed >= m_connections.size();
+    });
+    if (m_counters.established == 0) {
+        cerr << "LoadGenerator: No connection to " << m_options.host << ":" << m_options.port << endl;
+        return false;
+    }
+
+    // Load phase
+    int64_t serverTicks = m_serverPid ? processCpuTicks(m_serverPid) : -1;
+    rusage usageStart;
+    getrusage(RUSAGE_SELF, &usageStart);
+    m_loadStartNs = ThreadUtils::monotonicNs();
+    if (m_options.rate <= 0.0) {
+        // Closed loop: every client keeps inflight commands outstanding, each ack releases the next
+        for (auto& connection : m_connections) {
+            if (connection->open) {
+                connection->credits = m_options.inflight;
+            }
+        }
+    }
+    m_sending = true;
+    serviceUntil(m_loadStartNs + (uint64_t)m_options.durationMs * 1000000ull, []() { return false; });
+    m_sending = false;
+    m_loadEndNs = ThreadUtils::monotonicNs();
+
+    double wallSeconds = (double)(m_loadEndNs - m_loadStartNs) / 1e9;
+    rusage usageEnd;
+    getrusage(RUSAGE_SELF, &usageEnd);
+    auto seconds = [](const timeval& tv) { return (double)tv.tv_sec + (double)tv.tv_usec / 1e6; };
+    double clientSeconds = seconds(usageEnd.ru_utime) - seconds(usageStart.ru_utime) +
+        seconds(usageEnd.ru_stime) - seconds(usageStart.ru_stime);
+    m_clientCpuPercent = 100.0 * clientSeconds / wallSeconds;
+    int64_t serverTicksEnd = m_serverPid ? processCpuTicks(m_serverPid) : -1;
+    if (serverTicks >= 0 && serverTicksEnd >= serverTicks) {
+        m_serverCpuPercent = 100.0 * (double)(serverTicksEnd - serverTicks) / (double)sysconf(_SC_CLK_TCK) /
+            wallSeconds;
+    }
+
+    // Drain: wait for the acks of the last commands
+    serviceUntil(m_loadEndNs + (uint64_t)m_options.drainMs * 1000000ull, [this]() {
+        return m_counters.ok + m_counters.busy + m_counters.invalid + m_counters.unmatched >= m_counters.sent;
+    });
+    return true;
+}
+
+template <class Done>
+void LoadGenerator::serviceUntil(uint64_t deadlineNs, Done&& done) {
+    while (!done() && ThreadUtils::monotonicNs() < deadlineNs) {
+        if (lws_service(m_context, 0) < 0) {
+            cerr << "LoadGenerator: lws_service failed" << endl;
+            break;
+        }
+    }
+}
+
+/**
+ * Requests a client connection. The outcome arrives as
+ * LWS_CALLBACK_CLIENT_ESTABLISHED or LWS_CALLBACK_CLIENT_CONNECTION_ERROR.
+ *
+ * @param connection Connection slot to use.
+ */
+void LoadGenerator::connect(Connection& connection) {
+    lws_client_connect_info ccinfo = {};
+    ccinfo.context = m_context;
+    ccinfo.address = m_options.host.c_str();
+    ccinfo.port = m_options.port;
+    ccinfo.path = "/";
+    ccinfo.host = ccinfo.address;
+    ccinfo.origin = ccinfo.address;
+    ccinfo.protocol = m_options.binary ? "ws-protocol-binary" : "ws-protocol-text";
+    ccinfo.userdata = &connection;
+    ccinfo.pwsi = &connection.wsi;
+
+    connection.connectNs = ThreadUtils::monotonicNs();
+    // lws may already have reported the error through the callback
+    if (!lws_client_connect_via_info(&ccinfo) && !connection.failed) {
+        connection.failed = true;
+        m_counters.failed++;
+    }
+}
+
+void* LoadGenerator::pacingThread(void* arg) {
+    static_cast<LoadGenerator*>(arg)->pace();
+    return nullptr;
+}
+
+/**
+ * Hands out send credits at the target rate, round robin over the open
+ * connections, and wakes the service loop every tick. A client already
+ * holding MaxCredits unsent commands cannot keep up; its credit is counted
+ * as skipped rather than queued without bound.
+ */
+void LoadGenerator::pace() {
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    size_t cursor = 0;
+
+    while (!m_exitPacing) {
+        if (m_sending && m_options.rate > 0.0) {
+            uint64_t elapsedNs = ThreadUtils::monotonicNs() - m_loadStartNs;
+            uint64_t due = (uint64_t)((double)elapsedNs * m_options.rate / 1e9);
+            for (uint64_t issued = m_issued; issued < due; issued++) {
+                Connection* pConnection = nullptr;
+                for (size_t tried = 0; tried < m_connections.size() && !pConnection; tried++) {
+                    Connection& candidate = *m_connections[cursor];
+                    cursor = (cursor + 1) % m_connections.size();
+                    if (candidate.open) {
+                        pConnection = &candidate;
+                    }
+                }
+                if (pConnection && pConnection->credits.load(memory_order_relaxed) < MaxCredits) {
+                    pConnection->credits.fetch_add(1, memory_order_relaxed);
+                } else {
+                    m_skipped++;
+                }
+            }
+            m_issued = max<uint64_t>(m_issued, due);
+        }
+        lws_cancel_service(m_context);
+
+        next.tv_nsec += PacingTickNs;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+    }
+}
+
+//! Asks for a writable callback on every open connection holding credits
+void LoadGenerator::requestWritable() {
+    for (auto& connection : m_connections) {
+        if (connection->open && connection->credits.load(memory_order_relaxed) > 0) {
+            lws_callback_on_writable(connection->wsi);
+        }
+    }
+}
+
+/**
+ * Encodes the next command of a connection. pwm-control alternates between
+ * the setpoints; io-batch sets every configured IO, each to a different
+ * setpoint.
+ *
+ * @param connection Connection the command is sent on.
+ * @param pOut Start of the payload, after LWS_PRE.
+ * @return Payload length.
+ */
+size_t LoadGenerator::encodeCommand(Connection& connection, uint8_t* pOut) {
+    uint32_t sequence = connection.nextSequence++;
+    if (connection.nextSequence == 0) {
+        connection.nextSequence = 1;
+    }
+    unsigned setPoints = max(1u, m_options.setPoints);
+    bool batch = m_options.command == CommandKind::IoBatch;
+
+    Pending& pending = connection.pending[sequence % SequenceWindow];
+    pending.sequence = sequence;
+
+    if (!m_options.binary) {
+        char* pText = (char*)pOut;
+        int len;
+        if (!batch) {
+            len = sprintf(pText, "{\"command\":\"pwm-control\",\"index\":%u,\"seq\":%u}",
+                sequence % setPoints, sequence);
+        } else {
+            len = sprintf(pText, "{\"command\":\"io-batch\",\"seq\":%u,\"updates\":[", sequence);
+            for (size_t i = 0; i < m_options.ios.size(); i++) {
+                len += sprintf(pText + len, "%s{\"io\":%u,\"index\":%u}", i ? "," : "",
+                    (unsigned)m_options.ios[i], (unsigned)((sequence + i) % setPoints));
+            }
+            len += sprintf(pText + len, "]}");
+        }
+        pending.sentNs = ThreadUtils::monotonicNs();
+        return (size_t)len;
+    }
+
+    CommandHeader header = {};
+    header.magic = FrameMagic;
+    header.type = (uint8_t)FrameType::Command;
+    header.opcode = batch ? IoBatchCommand::BinaryOpcode : PwmControlCommand::BinaryOpcode;
+    header.sequence = sequence;
+    memcpy(pOut, &header, sizeof(header));
+    size_t len = sizeof(header);
+    if (!batch) {
+        uint32_t index = sequence % setPoints;
+        memcpy(pOut + len, &index, sizeof(index));
+        len += sizeof(index);
+    } else {
+        pOut[len++] = (uint8_t)m_options.ios.size();
+        for (size_t i = 0; i < m_options.ios.size(); i++) {
+            uint16_t update[2] = { m_options.ios[i], (uint16_t)((sequence + i) % setPoints) };
+            memcpy(pOut + len, update, sizeof(update));
+            len += sizeof(update);
+        }
+    }
+    pending.sentNs = ThreadUtils::monotonicNs();
+    return len;
+}
+
+/**
+ * Sends one command if the connection holds a credit and its socket has
+ * room, and asks to be called again while credits remain.
+ *
+ * @return -1 to close the connection.
+ */
+int LoadGenerator::onWritable(Connection& connection) {
+    if (!m_sending) {
+        connection.credits = 0;
+        return 0;
+    }
+    if (connection.credits.load(memory_order_relaxed) == 0) {
+        return 0;
+    }
+    if (lws_send_pipe_choked(connection.wsi)) {
+        lws_callback_on_writable(connection.wsi);
+        return 0;
+    }
+
+    uint8_t buffer[LWS_PRE + 1024];
+    size_t len = encodeCommand(connection, buffer + LWS_PRE);
+    int written = lws_write(connection.wsi, buffer + LWS_PRE, len, m_options.binary ? LWS_WRITE_BINARY : LWS_WRITE_TEXT);
+    if (written < (int)len) {
+        cerr << "LoadGenerator: Write failed on connection " << connection.index << endl;
+        return -1;
+    }
+    m_counters.sent++;
+    m_counters.sentBytes += len;
+
+    if (connection.credits.fetch_sub(1, memory_order_relaxed) > 1) {
+        lws_callback_on_writable(connection.wsi);
+    }
+    return 0;
+}
+
+/**
+ * Handles a complete message: command acks are matched to their command,
+ * anything else (telemetry, io-state broadcasts) is only counted.
+ *
+ * @param connection Receiving connection.
+ * @param pData Message.
+ * @param len Message length.
+ */
+void LoadGenerator::onReceive(Connection& connection, const char* pData, size_t len) {
+    m_counters.receivedBytes += len;
+
+    if (m_options.binary) {
+        CommandAck ack;
+        if (len == sizeof(ack)) {
+            memcpy(&ack, pData, sizeof(ack));
+            if (ack.magic == FrameMagic && ack.type == (uint8_t)FrameType::CommandAck) {
+                onAck(connection, ack.sequence, (CommandStatus)ack.status);
+                return;
+            }
+        }
+        m_counters.otherMessages++;
+        return;
+    }
+
+    bool isAck = false;
+    uint32_t sequence = 0;
+    CommandStatus status = CommandStatus::Invalid;
+    extractJson(pData, len, [&](const JsonPath& path, const JsonScalar& value) {
+        if (path.is("ack")) {
+            isAck = true;
+        } else if (path.is("seq")) {
+            value.get(sequence);
+        } else if (path.is("status") && value.type == JsonScalar::Type::String) {
+            status = value.string == "ok" ? CommandStatus::Ok :
+                value.string == "busy" ? CommandStatus::Busy : CommandStatus::Invalid;
+        }
+        return true;
+    });
+    if (isAck) {
+        onAck(connection, sequence, status);
+    } else {
+        m_counters.otherMessages++;
+    }
+}
+
+/**
+ * Matches an ack to its command and records the round trip.
+ *
+ * @param connection Connection the ack arrived on.
+ * @param sequence Sequence echoed by the server.
+ * @param status Outcome reported by the server.
+ */
+void LoadGenerator::onAck(Connection& connection, uint32_t sequence, CommandStatus status) {
+    uint64_t now = ThreadUtils::monotonicNs();
+    Pending& pending = connection.pending[sequence % SequenceWindow];
+    if (sequence == 0 || pending.sequence != sequence) {
+        m_counters.unmatched++;
+    } else {
+        pending.sequence = 0;
+        switch (status) {
+        case CommandStatus::Ok:
+            m_counters.ok++;
+            m_latency.record(now - pending.sentNs);
+            break;
+        case CommandStatus::Busy:
+            m_counters.busy++;
+            break;
+        default:
+            m_counters.invalid++;
+            break;
+        }
+    }
+
+    if (m_sending && m_options.rate <= 0.0) {
+        connection.credits.fetch_add(1, memory_order_relaxed);
+        lws_callback_on_writable(connection.wsi);
+    }
+}
+
+int LoadGenerator::callback(lws* wsi, lws_callback_reasons reason, void* user, void* in, size_t len) {
+    LoadGenerator* pSelf = static_cast<LoadGenerator*>(lws_context_user(lws_get_context(wsi)));
+    Connection* pConnection = static_cast<Connection*>(user);
+    if (!pConnection && reason != LWS_CALLBACK_EVENT_WAIT_CANCELLED) {
+        return 0;
+    }
+
+    switch (reason) {
+    case LWS_CALLBACK_CLIENT_ESTABLISHED:
+        pSelf->m_counters.established++;
+        pSelf->m_connectLatency.record(ThreadUtils::monotonicNs() - pConnection->connectNs);
+        pConnection->wsi = wsi;
+        pConnection->open = true;
+        break;
+
+    case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+        cerr << "LoadGenerator: Connection " << pConnection->index << " failed: " <<
+            (in ? (const char*)in : "unknown error") << endl;
+        if (!pConnection->failed) {
+            pConnection->failed = true;
+            pSelf->m_counters.failed++;
+        }
+        pConnection->wsi = nullptr;
+        break;
+
+    case LWS_CALLBACK_CLIENT_CLOSED:
+        if (pConnection->open && !pSelf->m_finished) {
+            pSelf->m_counters.closed++;
+        }
+        pConnection->open = false;
+        pConnection->wsi = nullptr;
+        break;
+
+    case LWS_CALLBACK_CLIENT_RECEIVE:
+        // Acks fit one frame; larger broadcasts may arrive in fragments
+        if (pConnection->rx.empty() && lws_is_final_fragment(wsi) && lws_remaining_packet_payload(wsi) == 0) {
+            pSelf->onReceive(*pConnection, (const char*)in, len);
+        } else {
+            pConnection->rx.append((const char*)in, len);
+            if (lws_is_final_fragment(wsi) && lws_remaining_packet_payload(wsi) == 0) {
+                pSelf->onReceive(*pConnection, pConnection->rx.data(), pConnection->rx.size());
+                pConnection->rx.clear();
+            }
+        }
+        break;
+
+    case LWS_CALLBACK_CLIENT_WRITEABLE:
+        return pSelf->onWritable(*pConnection);
+
+    case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
+        pSelf->requestWritable();
+        break;
+
+    default:
+        break;
+    }
+    return 0;
+}
+
+/**
+ * CPU time of a process so far, from /proc/<pid>/stat.
+ *
+ * @param pid Process id.
+ * @return utime + stime in clock ticks, -1 if the process is gone.
+ */
+int64_t LoadGenerator::processCpuTicks(pid_t pid) {
+    ifstream file("/proc/" + to_string(pid) + "/stat");
+    string stat;
+    if (!getline(file, stat)) {
+        return -1;
+    }
+    // The command name may contain spaces, fields are counted after its ')'
+    size_t end = stat.rfind(')');
+    if (end == string::npos) {
+        return -1;
+    }
+    istringstream fields(stat.substr(end + 2));
+    string field;
+    unsigned long long utime = 0;
+    unsigned long long stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; i++) {
+        if (i == 14) {
+            utime = strtoull(field.c_str(), nullptr, 10);
+        } else if (i == 15) {
+            stime = strtoull(field.c_str(), nullptr, 10);
+        }
+    }
+    return (int64_t)(utime + stime);
+}
+
+/**
+ * Finds a local jetson-embeddedUI process by its command line.
+ *
+ * @return Its pid, 0 if none runs.
+ */
+pid_t LoadGenerator::findServer() {
+    DIR* pDir = opendir("/proc");
+    if (!pDir) {
+        return 0;
+    }
+    pid_t found = 0;
+    while (dirent* pEntry = readdir(pDir)) {
+        char* pEnd;
+        long pid = strtol(pEntry->d_name, &pEnd, 10);
+        if (*pEnd != '\0' || pid <= 0) {
+            continue;
+        }
+        ifstream cmdline(string("/proc/") + pEntry->d_name + "/cmdline");
+        string argv0;
+        if (getline(cmdline, argv0, '\0')) {
+            size_t slash = argv0.rfind('/');
+            if (argv0.substr(slash == string::npos ? 0 : slash + 1) == "jetson-embeddedUI") {
+                found = (pid_t)pid;
+                break;
+            }
+        }
+    }
+    closedir(pDir);
+    return found;
+}
+
+std::string LoadGenerator::reportJson() const {
+    double seconds = m_loadEndNs > m_loadStartNs ? (double)(m_loadEndNs - m_loadStartNs) / 1e9 : 0.0;
+    uint64_t acked = m_counters.ok + m_counters.busy + m_counters.invalid + m_counters.unmatched;
+    uint64_t lost = m_counters.sent > acked ? m_counters.sent - acked : 0;
+    auto us = [](uint64_t ns) { return (double)ns / 1000.0; };
+
+    char line[512];
+    string out = "{\n";
+    snprintf(line, sizeof(line),
+        "  \"target\": {\"host\": \"%s\", \"port\": %d, \"protocol\": \"%s\", \"command\": \"%s\", "
+        "\"ios\": %zu},\n",
+        m_options.host.c_str(), m_options.port, m_options.binary ? "ws-protocol-binary" : "ws-protocol-text",
+        m_options.command == CommandKind::IoBatch ? "io-batch" : "pwm-control", m_options.ios.size());
+    out += line;
+    snprintf(line, sizeof(line),
+        "  \"load\": {\"ratePerSecond\": %.1f, \"inflight\": %u, \"durationMs\": %u, \"drainMs\": %u},\n",
+        m_options.rate, m_options.inflight, m_options.durationMs, m_options.drainMs);
+    out += line;
+    snprintf(line, sizeof(line),
+        "  \"connections\": {\"requested\": %u, \"established\": %" PRIu64 ", \"failed\": %" PRIu64
+        ", \"closedByServer\": %" PRIu64 ", \"connectP50Us\": %.1f, \"connectP99Us\": %.1f, \"connectMaxUs\": %.1f},\n",
+        m_options.connections, m_counters.established, m_counters.failed, m_counters.closed,
+        us(m_connectLatency.percentile(0.5)), us(m_connectLatency.percentile(0.99)), us(m_connectLatency.max()));
+    out += line;
+    snprintf(line, sizeof(line),
+        "  \"commands\": {\"sent\": %" PRIu64 ", \"sentPerSecond\": %.1f, \"ok\": %" PRIu64 ", \"busy\": %" PRIu64
+        ", \"invalid\": %" PRIu64 ", \"lost\": %" PRIu64 ", \"unmatched\": %" PRIu64 ", \"skipped\": %" PRIu64
+        ", \"sentBytes\": %" PRIu64 "},\n",
+        m_counters.sent, seconds > 0.0 ? (double)m_counters.sent / seconds : 0.0, m_counters.ok, m_counters.busy,
+        m_counters.invalid, lost, m_counters.unmatched, m_skipped.load(), m_counters.sentBytes);
+    out += line;
+    snprintf(line, sizeof(line),
+        "  \"latencyUs\": {\"count\": %" PRIu64 ", \"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+        "\"p999\": %.1f, \"max\": %.1f},\n",
+        m_latency.count(), us(m_latency.mean()), us(m_latency.percentile(0.5)), us(m_latency.percentile(0.9)),
+        us(m_latency.percentile(0.99)), us(m_latency.percentile(0.999)), us(m_latency.max()));
+    out += line;
+    snprintf(line, sizeof(line),
+        "  \"received\": {\"otherMessages\": %" PRIu64 ", \"bytes\": %" PRIu64 "},\n",
+        m_counters.otherMessages, m_counters.receivedBytes);
+    out += line;
+    snprintf(line, sizeof(line),
+        "  \"cpuPercent\": {\"serverPid\": %d, \"server\": %.1f, \"client\": %.1f}\n}\n",
+        (int)m_serverPid, m_serverCpuPercent, m_clientCpuPercent);
+    out += line;
+    return out;
+}
+
+std::string LoadGenerator::reportText() const {
+    uint64_t acked = m_counters.ok + m_counters.busy + m_counters.invalid + m_counters.unmatched;
+    uint64_t lost = m_counters.sent > acked ? m_counters.sent - acked : 0;
+    auto us = [](uint64_t ns) { return (double)ns / 1000.0; };
+
+    char line[256];
+    string out;
+    snprintf(line, sizeof(line), "connections  %" PRIu64 "/%u established, %" PRIu64 " failed, %" PRIu64
+        " closed by server\n", m_counters.established, m_options.connections, m_counters.failed, m_counters.closed);
+    out += line;
+    snprintf(line, sizeof(line), "commands     %" PRIu64 " sent, %" PRIu64 " ok, %" PRIu64 " busy, %" PRIu64
+        " invalid, %" PRIu64 " lost, %" PRIu64 " skipped\n",
+        m_counters.sent, m_counters.ok, m_counters.busy, m_counters.invalid, lost, m_skipped.load());
+    out += line;
+    snprintf(line, sizeof(line), "latency us   p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+        us(m_latency.percentile(0.5)), us(m_latency.percentile(0.9)), us(m_latency.percentile(0.99)),
+        us(m_latency.percentile(0.999)), us(m_latency.max()));
+    out += line;
+    if (m_serverCpuPercent >= 0.0) {
+        snprintf(line, sizeof(line), "cpu          server %.1f%% (pid %d), client %.1f%%\n",
+            m_serverCpuPercent, (int)m_serverPid, m_clientCpuPercent);
+    } else {
+        snprintf(line, sizeof(line), "cpu          server not found, client %.1f%%\n", m_clientCpuPercent);
+    }
+    out += line;
+    if (m_skipped > 0) {
+        out += "warning      the client could not send at the target rate, run more loadgen processes\n";
+    }
+    return out;
+}
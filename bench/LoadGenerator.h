@@ -0,0 +1,143 @@
+/**
+* Websocket load generator for WebSystem. Opens many client connections on
+* one libwebsockets client context, sends pwm-control or io-batch commands
+* over ws-protocol-text or ws-protocol-binary at a target rate, and matches
+* every acknowledgement to its command by sequence number to measure the
+* round-trip latency, rejected and lost commands, and the CPU time the
+* server process used meanwhile.
+*
+* A pacing thread hands out send credits and wakes the service loop with
+* lws_cancel_service(), the same way WebSystem wakes its service threads;
+* all lws calls stay on the service thread.
+*/
+
+#pragma once
+
+#include <libwebsockets.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BinaryProtocol.h"
+#include "LatencyHistogram.h"
+
+class LoadGenerator {
+public:
+    enum class CommandKind : uint8_t {
+        PwmControl,             //! pwm-control, alternating setpoints
+        IoBatch                 //! io-batch over the configured IOs
+    };
+
+    struct Options {
+        std::string         host = "127.0.0.1";
+        int                 port = 7800;
+        unsigned            connections = 1;            //! Concurrent websocket clients
+        bool                binary = false;             //! ws-protocol-binary instead of ws-protocol-text
+        CommandKind         command = CommandKind::PwmControl;
+        std::vector<uint16_t> ios = { 1, 2, 3, 4 };     //! IO numbers of an io-batch
+        unsigned            setPoints = 2;              //! Setpoint indices cycled through
+        double              rate = 100.0;               //! Commands per second over all clients, 0 for closed loop
+        unsigned            inflight = 1;               //! Closed loop: unacknowledged commands per client
+        unsigned            connectRate = 200;          //! New connections per second
+        unsigned            durationMs = 10000;         //! Length of the measured load phase
+        unsigned            drainMs = 1000;             //! Time allowed for the last acks
+        pid_t               serverPid = 0;              //! Server process, 0 to find jetson-embeddedUI
+    };
+
+    explicit LoadGenerator(const Options& options);
+    ~LoadGenerator();
+
+    //! Connect, run the load phase and drain. Returns false if the client
+    //! context could not be created or no connection was established.
+    bool run();
+
+    //! Results as a JSON document
+    std::string reportJson() const;
+
+    //! Results as a table for the console
+    std::string reportText() const;
+
+private:
+    static constexpr size_t SequenceWindow = 4096;      //! Outstanding commands tracked per client
+    static constexpr uint32_t MaxCredits = 1024;        //! Send backlog per client before sends are skipped
+
+    //! Send time of a command, found by sequence % SequenceWindow
+    struct Pending {
+        uint32_t sequence = 0;                          //! 0 once acknowledged
+        uint64_t sentNs = 0;
+    };
+
+    //! One client connection, the lws user data of its wsi
+    struct Connection {
+        lws*                    wsi = nullptr;
+        unsigned                index = 0;
+        uint64_t                connectNs = 0;          //! Time the connection was requested
+        std::atomic<bool>       open{false};            //! Established and not closed
+        bool                    failed = false;         //! Connection error reported
+        std::atomic<uint32_t>   credits{0};             //! Commands due to be sent
+        uint32_t                nextSequence = 1;
+        std::string             rx;                     //! Fragments of the message being received
+        std::vector<Pending>    pending;
+    };
+
+    //! Counters, written on the service thread
+    struct Counters {
+        uint64_t established = 0;
+        uint64_t failed = 0;                            //! Connections refused or timed out
+        uint64_t closed = 0;                            //! Closed by the server during the run
+        uint64_t sent = 0;
+        uint64_t sentBytes = 0;
+        uint64_t ok = 0;
+        uint64_t busy = 0;                              //! Rejected by a full command queue
+        uint64_t invalid = 0;                           //! Unknown or invalid command acks
+        uint64_t unmatched = 0;                         //! Acks whose command is no longer tracked
+        uint64_t otherMessages = 0;                     //! Broadcasts such as telemetry
+        uint64_t receivedBytes = 0;
+    };
+
+    static int callback(lws* wsi, lws_callback_reasons reason, void* user, void* in, size_t len);
+    static void* pacingThread(void* arg);
+    void pace();
+
+    void connect(Connection& connection);
+    void onReceive(Connection& connection, const char* pData, size_t len);
+    void onAck(Connection& connection, uint32_t sequence, BinaryProtocol::CommandStatus status);
+    int onWritable(Connection& connection);
+    void requestWritable();
+
+    //! Encode the next command of a connection into the buffer after LWS_PRE
+    size_t encodeCommand(Connection& connection, uint8_t* pOut);
+
+    //! Run the lws service loop until deadlineNs or done() is true
+    template <class Done>
+    void serviceUntil(uint64_t deadlineNs, Done&& done);
+
+    //! utime + stime of a process in clock ticks, -1 if it is gone
+    static int64_t processCpuTicks(pid_t pid);
+    static pid_t findServer();
+
+    Options                     m_options;
+    lws_context*                m_context = nullptr;
+    lws_protocols               m_protocols[3];         //! Both server protocols, so either can be negotiated
+    std::vector<std::unique_ptr<Connection>> m_connections;
+
+    Counters                    m_counters;
+    LatencyHistogram            m_latency;              //! Command to ack, in ns
+    LatencyHistogram            m_connectLatency;       //! Connect request to established, in ns
+
+    std::atomic<bool>           m_sending{false};       //! Load phase, credits are handed out
+    std::atomic<bool>           m_exitPacing{false};
+    std::atomic<uint64_t>       m_issued{0};            //! Credits handed out in the load phase
+    pthread_t                   m_pacingThread;
+    bool                        m_finished = false;     //! Closes from here on are our own
+    std::atomic<uint64_t>       m_skipped{0};           //! Sends dropped because the client could not keep up
+
+    uint64_t                    m_loadStartNs = 0;
+    uint64_t                    m_loadEndNs = 0;
+    pid_t                       m_serverPid = 0;
+    double                      m_serverCpuPercent = -1.0;  //! -1 if the server was not found
+    double                      m_clientCpuPercent = 0.0;
+};
@@ -0,0 +1,457 @@
+#include "Bench.h"
+#include "AssetCache.h"
+#include "BinaryProtocol.h"
+#include "CommandTrace.h"
+#include "Crc32.h"
+#include "HlsSegmentStore.h"
+#include "IO.h"
+#include "LatencyHistogram.h"
+#include "Metrics.h"
+#include "PacketPool.h"
+#include "ProcessSupervisor.h"
+#include "SimulatedBackend.h"
+#include "TelemetryPublisher.h"
+#include "ThreadUtils.h"
+#include "UploadManager.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace BinaryProtocol;
+
+static std::vector<unsigned> allCores() {
+    std::vector<unsigned> cores;
+    for (unsigned core = 0; core < std::thread::hardware_concurrency(); core++) {
+        cores.push_back(core);
+    }
+    return cores;
+}
+
+//! One received upload frame, as the binary receive path hands it over
+static PacketPtr uploadFrame(FrameType type, uint32_t transferId, uint64_t offset, const void* pPayload,
+    size_t length, uint32_t crc) {
+    PacketPtr frame = PacketPool::acquire(sizeof(FrameHeader) + length);
+    FrameHeader header = {};
+    header.magic = FrameMagic;
+    header.type = (uint8_t)type;
+    header.transferId = transferId;
+    header.offset = offset;
+    header.length = (uint32_t)length;
+    header.crc32 = crc;
+    memcpy(frame->payload(), &header, sizeof(header));
+    if (length) {
+        memcpy(frame->payload() + sizeof(header), pPayload, length);
+    }
+    return frame;
+}
+
+/**
+ * UploadManager end to end: one operation is a full-size chunk received,
+ * checksummed, queued and written by the writer thread. Each run is one
+ * transfer, committed and acknowledged before the run ends.
+ */
+static void runUpload(BenchRunner& runner) {
+    const std::string name = "upload/chunk";
+    if (!runner.selected(name)) {
+        return;
+    }
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool resumed = false;
+    int finalStatus = -1;
+
+    UploadManager manager;
+    manager.setTransport(
+        [&](uint32_t, const uint8_t* pData, size_t len) {
+            FrameHeader ack;
+            if (len < sizeof(ack)) {
+                return;
+            }
+            memcpy(&ack, pData, sizeof(ack));
+            if (ack.status != (uint8_t)AckStatus::Ok) {
+                std::lock_guard<std::mutex> lck(mutex);
+                finalStatus = ack.status;
+                changed.notify_all();
+            }
+        },
+        [&](uint32_t) {
+            std::lock_guard<std::mutex> lck(mutex);
+            resumed = true;
+            changed.notify_all();
+        });
+
+    std::string directory = makeBenchDirectory("upload");
+    if (!manager.start(directory, UINT64_MAX, allCores())) {
+        runner.skip(name, "upload writer could not be started");
+        removeBenchDirectory(directory);
+        return;
+    }
+
+    std::vector<uint8_t> chunk(MaxChunkLen);
+    std::mt19937 random(1);
+    for (uint8_t& byte : chunk) {
+        byte = (uint8_t)random();
+    }
+    uint32_t chunkCrc = Crc32::compute(chunk.data(), chunk.size());
+    uint32_t transferId = 0;
+
+    auto submit = [&](PacketPtr&& frame) {
+        if (!manager.submit(1, std::move(frame))) {
+            std::unique_lock<std::mutex> lck(mutex);
+            changed.wait(lck, [&] { return resumed || finalStatus >= 0; });
+            resumed = false;
+        }
+    };
+
+    runner.run(name, chunk.size(), [&](BenchState& state) {
+        const char fileName[] = "bench.bin";
+        UploadBegin begin = {};
+        begin.totalSize = state.iterations * chunk.size();
+        begin.kind = (uint8_t)UploadKind::Firmware;
+        begin.nameLength = sizeof(fileName) - 1;
+        std::vector<uint8_t> beginPayload(sizeof(begin) + begin.nameLength);
+        memcpy(beginPayload.data(), &begin, sizeof(begin));
+        memcpy(beginPayload.data() + sizeof(begin), fileName, begin.nameLength);
+        finalStatus = -1;
+        transferId++;
+        submit(uploadFrame(FrameType::Begin, transferId, 0, beginPayload.data(), beginPayload.size(),
+            Crc32::compute(beginPayload.data(), beginPayload.size())));
+
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            submit(uploadFrame(FrameType::Chunk, transferId, i * chunk.size(), chunk.data(), chunk.size(), chunkCrc));
+        }
+        submit(uploadFrame(FrameType::Commit, transferId, 0, nullptr, 0, 0));
+
+        std::unique_lock<std::mutex> lck(mutex);
+        changed.wait(lck, [&] { return finalStatus >= 0; });
+        if (finalStatus != (int)AckStatus::Complete) {
+            throw std::runtime_error("upload failed with status " + std::to_string(finalStatus));
+        }
+    });
+
+    manager.stop();
+    removeBenchDirectory(directory);
+}
+
+/**
+ * TelemetryPublisher::encode() over twelve GPIO IOs, a keyframe and a delta
+ * frame after two setpoint changes.
+ */
+static void runTelemetry(BenchRunner& runner) {
+    const std::string keyframe = "telemetry/encode-keyframe/ios:12";
+    const std::string delta = "telemetry/encode-delta-2/ios:12";
+    if (!runner.selected(keyframe) && !runner.selected(delta)) {
+        return;
+    }
+
+    std::map<std::string, Settings::IO> ioSettings;
+    for (unsigned i = 1; i <= 12; i++) {
+        Settings::IO io = {};
+        io.pinNumber = (uint8_t)i;
+        io.port = "PCC.07";
+        io.pinFunction = "GPIO";
+        io.pinName = "GPIO" + std::to_string(i);
+        io.direction = "OUTPUT";
+        io.setPoints = { 0, 1 };
+        io.initialValue = 0;
+        io.isEnabled = true;
+        ioSettings["IO" + std::to_string(i)] = io;
+    }
+    IOManager& manager = IOManager::getInstance();
+    manager.initialize(ioSettings, std::make_unique<SimulatedBackend>());
+
+    // start() sizes the scratch buffers; stopping the thread leaves encode() to the bench
+    TelemetryPublisher publisher(manager);
+    if (!publisher.start(1, 60000, allCores(), [](PacketPtr&&) {})) {
+        runner.skip("telemetry/", "publisher thread could not be started");
+        return;
+    }
+    publisher.stop();
+
+    size_t keyframeSize = publisher.encode(ThreadUtils::monotonicNs(), true)->size();
+    runner.run(keyframe, keyframeSize, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            publisher.encode(ThreadUtils::monotonicNs(), true);
+        }
+    });
+
+    runner.run(delta, 0, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            IOManager::Transaction transaction = manager.beginTransaction();
+            transaction.set(3, i & 1);
+            transaction.set(7, i & 1);
+            transaction.commit();
+            publisher.encode(ThreadUtils::monotonicNs(), false);
+        }
+    });
+}
+
+/**
+ * AssetCache build of a small web root and the per-request lookup and
+ * encoding negotiation.
+ */
+static void runAssets(BenchRunner& runner) {
+    const std::string build = "assets/build/files:4";
+    const std::string lookup = "assets/lookup";
+    if (!runner.selected(build) && !runner.selected(lookup)) {
+        return;
+    }
+
+    std::string root = makeBenchDirectory("assets");
+    std::filesystem::create_directories(root + "/js");
+    {
+        std::ofstream html(root + "/index.html");
+        for (int i = 0; i < 400; i++) {
+            html << "<div class=\"io-row\" data-io=\"" << i << "\"><span>IO " << i << "</span></div>\n";
+        }
+        std::ofstream script(root + "/js/app.3f2a91c4.js");
+        for (int i = 0; i < 4000; i++) {
+            script << "function update" << i << "(io){return io.setPoint*" << i << ";}\n";
+        }
+        std::ofstream style(root + "/style.css");
+        for (int i = 0; i < 800; i++) {
+            style << ".io-" << i << "{color:#" << (100000 + i) << ";margin:" << i % 7 << "px}\n";
+        }
+        std::ofstream image(root + "/logo.png", std::ios::binary);
+        std::mt19937 random(2);
+        for (int i = 0; i < 50000; i++) {
+            image.put((char)random());
+        }
+    }
+    std::vector<unsigned> cores = allCores();
+
+    runner.run(build, 0, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            AssetCache cache;
+            cache.start(root, cores);
+            cache.stop();
+        }
+    });
+
+    AssetCache cache;
+    if (cache.start(root, cores)) {
+        runner.run(lookup, 0, [&](BenchState& state) {
+            const std::string path = "js/app.3f2a91c4.js";
+            for (uint64_t i = 0; i < state.iterations; i++) {
+                std::shared_ptr<const AssetCache::Snapshot> pSnapshot = cache.snapshot();
+                auto it = pSnapshot->find(path);
+                if (it != pSnapshot->end()) {
+                    AssetCache::negotiate(*it->second, "gzip, deflate, br");
+                }
+            }
+        });
+        cache.stop();
+    } else {
+        runner.skip(lookup, "asset cache could not be started");
+    }
+
+    removeBenchDirectory(root);
+}
+
+//! Append one 188 byte TS packet with up to 184 payload bytes
+static void tsPacket(std::vector<uint8_t>& out, uint16_t pid, bool unitStart, bool randomAccess,
+    const uint8_t* pPayload, size_t len) {
+    uint8_t packet[188];
+    memset(packet, 0xFF, sizeof(packet));
+    packet[0] = 0x47;
+    packet[1] = (uint8_t)((unitStart ? 0x40 : 0) | ((pid >> 8) & 0x1F));
+    packet[2] = (uint8_t)pid;
+    if (randomAccess) {
+        packet[3] = 0x30;
+        packet[4] = 1;
+        packet[5] = 0x40;
+        memcpy(packet + 6, pPayload, std::min<size_t>(len, 182));
+    } else {
+        packet[3] = 0x10;
+        memcpy(packet + 4, pPayload, std::min<size_t>(len, 184));
+    }
+    out.insert(out.end(), packet, packet + sizeof(packet));
+}
+
+/**
+ * Synthetic H.264 transport stream: PAT, PMT and 25 fps video with a
+ * keyframe every second, each frame 40 packets or about 2.4 Mbit/s.
+ */
+static std::vector<uint8_t> makeTransportStream(unsigned seconds) {
+    const uint8_t pat[] = { 0, 0x00, 0xB0, 13, 0, 1, 0xC1, 0, 0, 0, 1, 0xF0, 0x00, 0, 0, 0, 0 };
+    const uint8_t pmt[] = { 0, 0x02, 0xB0, 18, 0, 1, 0xC1, 0, 0, 0xE1, 0x00, 0xF0, 0x00,
+        0x1B, 0xE1, 0x00, 0xF0, 0x00, 0, 0, 0, 0 };
+    const uint8_t filler[184] = {};
+
+    std::vector<uint8_t> out;
+    uint64_t pts = 90000;
+    for (unsigned frame = 0; frame < seconds * 25; frame++, pts += 3600) {
+        bool keyframe = frame % 25 == 0;
+        if (keyframe) {
+            tsPacket(out, 0x0000, true, false, pat, sizeof(pat));
+            tsPacket(out, 0x1000, true, false, pmt, sizeof(pmt));
+        }
+        const uint8_t pes[14] = { 0, 0, 1, 0xE0, 0, 0, 0x80, 0x80, 5,
+            (uint8_t)(0x21 | ((pts >> 29) & 0x0E)), (uint8_t)(pts >> 22), (uint8_t)(((pts >> 14) & 0xFE) | 1),
+            (uint8_t)(pts >> 7), (uint8_t)(((pts << 1) & 0xFE) | 1) };
+        tsPacket(out, 0x100, true, keyframe, pes, sizeof(pes));
+        for (int i = 1; i < 40; i++) {
+            tsPacket(out, 0x100, false, false, filler, sizeof(filler));
+        }
+    }
+    return out;
+}
+
+/**
+ * HlsSegmentStore::write() in 1316 byte reads, 7 TS packets as ffmpeg's
+ * pipe delivers them, and the playlist fetch of every HLS client poll.
+ */
+static void runHls(BenchRunner& runner) {
+    const std::string write = "hls/write/1316";
+    const std::string playlist = "hls/playlist";
+    if (!runner.selected(write) && !runner.selected(playlist)) {
+        return;
+    }
+
+    const size_t ReadLen = 7 * 188;
+    std::vector<uint8_t> stream = makeTransportStream(20);
+    stream.resize(stream.size() / ReadLen * ReadLen);
+
+    HlsSegmentStore store;
+    size_t offset = 0;
+    runner.run(write, ReadLen, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            store.write(stream.data() + offset, ReadLen);
+            offset += ReadLen;
+            if (offset == stream.size()) {
+                offset = 0;
+            }
+        }
+    });
+
+    if (!store.playlist()) {
+        store.write(stream.data(), stream.size());
+    }
+    runner.run(playlist, 0, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            std::shared_ptr<const std::string> pPlaylist = store.playlist();
+        }
+    });
+}
+
+//! Poll until the supervised child reaches a state
+static void waitForState(const ProcessSupervisor& supervisor, ProcessState state) {
+    while (supervisor.state() != state) {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+/**
+ * ProcessSupervisor start and stop of a child, and the stdout pipe to the
+ * output handler as used for the ffmpeg stream.
+ */
+static void runSupervisor(BenchRunner& runner) {
+    const std::string startStop = "supervisor/start-stop";
+    const std::string output = "supervisor/stdout";
+    if (!runner.selected(startStop) && !runner.selected(output)) {
+        return;
+    }
+
+    const size_t OutputLen = 65536;
+    std::atomic<uint64_t> outputBytes{0};
+
+    ProcessSupervisor supervisor("bench");
+    supervisor.setOutputHandler([&outputBytes](const uint8_t*, size_t len) {
+        outputBytes.fetch_add(len, std::memory_order_relaxed);
+    });
+    if (!supervisor.start(allCores())) {
+        runner.skip("supervisor/", "supervisor thread could not be started");
+        return;
+    }
+
+    runner.run(startStop, 0, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            supervisor.launch({ "sleep", "60" });
+            waitForState(supervisor, ProcessState::Running);
+            supervisor.halt();
+            waitForState(supervisor, ProcessState::Stopped);
+        }
+    });
+
+    if (runner.selected(output)) {
+        supervisor.launch({ "cat", "/dev/zero" });
+        waitForState(supervisor, ProcessState::Running);
+        runner.run(output, OutputLen, [&](BenchState& state) {
+            uint64_t target = outputBytes.load(std::memory_order_relaxed) + state.iterations * OutputLen;
+            while (outputBytes.load(std::memory_order_relaxed) < target) {
+                std::this_thread::yield();
+            }
+        });
+        supervisor.halt();
+        waitForState(supervisor, ProcessState::Stopped);
+    }
+
+    supervisor.stop();
+}
+
+/**
+ * Recording cost of the metrics and latency histograms on the hot paths,
+ * and a scrape of everything registered so far.
+ */
+static void runMetrics(BenchRunner& runner) {
+    Counter& counter = Metrics::counter("bench_operations_total", "Bench counter");
+    Histogram& histogram = Metrics::histogram("bench_duration_seconds", "Bench histogram", {},
+        Histogram::latencyBoundsNs());
+    LatencyHistogram latency;
+
+    runner.run("metrics/counter-add", 0, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            counter.add();
+        }
+    });
+
+    runner.run("metrics/histogram-observe", 0, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            histogram.observe((i * 7919) % 2000000);
+        }
+    });
+
+    size_t exposedSize = Metrics::expose().size();
+    runner.run("metrics/expose", exposedSize, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            Metrics::expose();
+        }
+    });
+
+    runner.run("latency/histogram-record", 0, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            latency.record((i * 7919) % 2000000);
+        }
+    });
+
+    runner.run("latency/trace-command", 0, [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            uint64_t nowNs = ThreadUtils::monotonicNs();
+            CommandTrace::begin(nowNs, nowNs);
+            CommandTrace::mark(TraceStage::IoSet);
+            CommandTrace::mark(TraceStage::PwmStart);
+            CommandTrace::mark(TraceStage::PwmEnd);
+            CommandTrace::end();
+        }
+    });
+    CommandTrace::reset();
+}
+
+void runPipelineBenchmarks(BenchRunner& runner) {
+    runUpload(runner);
+    runTelemetry(runner);
+    runAssets(runner);
+    runHls(runner);
+    runSupervisor(runner);
+    runMetrics(runner);
+}
@@ -0,0 +1,294 @@
+#include "Bench.h"
+#include "WebSystem.h"
+#include "BinaryProtocol.h"
+#include "Commands.h"
+#include "ThreadUtils.h"
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! WebSystem only needs a service routine to be instantiated
+class BenchSystem : public WebSystem {
+protected:
+    void service() override {}
+};
+
+/**
+ * Drives the broadcast and command paths of WebSystem without an lws context.
+ * Sessions are constructed as LWS_CALLBACK_ESTABLISHED would and drained the
+ * way the writable callback pops them, minus the socket write.
+ */
+class WebSystemBench {
+public:
+    static void run(BenchRunner& runner);
+
+private:
+    typedef WebSystem::Session          Session;
+    typedef WebSystem::SessionSet       SessionSet;
+    typedef WebSystem::OutboundMessage  OutboundMessage;
+    typedef WebSystem::ControlParams_t  ControlParams_t;
+
+    static void openSessions(bool binary, size_t count);
+    static void closeSessions(bool binary);
+
+    //! Pop every queued message of every session of a protocol
+    static size_t drain(bool binary);
+
+    static void runBroadcast(BenchRunner& runner, BenchSystem& system);
+    static void runCommands(BenchRunner& runner);
+    static void runCommandRoundTrip(BenchRunner& runner);
+
+    static WebSystem::SessionSet& sessionSet(bool binary) {
+        return binary ? WebSystem::m_binarySessions : WebSystem::m_textSessions;
+    }
+
+    //! Id of the first open session of a protocol
+    static uint32_t firstSessionId(bool binary) {
+        return sessionSet(binary).sessions.front()->id;
+    }
+
+    inline static volatile uint32_t s_sink = 0;      //! Keeps the handlers from being optimized out
+};
+
+void WebSystemBench::openSessions(bool binary, size_t count) {
+    SessionSet& sessions = sessionSet(binary);
+    std::unique_lock<std::shared_mutex> lck(WebSystem::m_sessionsMutex);
+    for (size_t i = 0; i < count; i++) {
+        Session* pSession = new Session(nullptr, WebSystem::m_queueDepth);
+        pSession->id = WebSystem::m_nextSessionId++;
+        pSession->connectedNs = ThreadUtils::monotonicNs();
+        sessions.sessions.push_back(pSession);
+    }
+    sessions.count.store(sessions.sessions.size(), std::memory_order_relaxed);
+}
+
+void WebSystemBench::closeSessions(bool binary) {
+    SessionSet& sessions = sessionSet(binary);
+    std::unique_lock<std::shared_mutex> lck(WebSystem::m_sessionsMutex);
+    for (Session* pSession : sessions.sessions) {
+        delete pSession;
+    }
+    sessions.sessions.clear();
+    sessions.count.store(0, std::memory_order_relaxed);
+}
+
+size_t WebSystemBench::drain(bool binary) {
+    SessionSet& sessions = sessionSet(binary);
+    size_t popped = 0;
+    std::shared_lock<std::shared_mutex> lck(WebSystem::m_sessionsMutex);
+    for (Session* pSession : sessions.sessions) {
+        std::lock_guard<std::mutex> sessionLck(pSession->mutex);
+        OutboundMessage message;
+        while (pSession->outbound.pop(message)) {
+            pSession->sent++;
+            pSession->sentBytes += message->size();
+            popped++;
+        }
+    }
+    return popped;
+}
+
+/**
+ * sendTextData() and sendData<T>() to 1 to 64 clients. One operation queues
+ * a message to every client and drains it again.
+ */
+void WebSystemBench::runBroadcast(BenchRunner& runner, BenchSystem& system) {
+    WebSystem& web = system;
+    const std::string text = "{\"type\":\"io-state\",\"io\":7,\"setPoint\":1,\"value\":3.3,"
+        "\"changedNs\":1234567890123,\"pinName\":\"PWM1\",\"seq\":42}";
+    const std::vector<uint16_t> samples(512, 0x5A5A);
+
+    for (size_t clients : { 1, 8, 64 }) {
+        std::string name = "websocket/send-text/clients:" + std::to_string(clients);
+        if (runner.selected(name)) {
+            openSessions(false, clients);
+            runner.run(name, text.size(), [&](BenchState& state) {
+                for (uint64_t i = 0; i < state.iterations; i++) {
+                    web.sendTextData(text);
+                    drain(false);
+                }
+            });
+            closeSessions(false);
+        }
+
+        name = "websocket/send-data-u16x512/clients:" + std::to_string(clients);
+        if (runner.selected(name)) {
+            openSessions(true, clients);
+            runner.run(name, samples.size() * sizeof(uint16_t), [&](BenchState& state) {
+                for (uint64_t i = 0; i < state.iterations; i++) {
+                    web.sendData(samples);
+                    drain(true);
+                }
+            });
+            closeSessions(true);
+        }
+    }
+
+    // Zero-copy producer, e.g. telemetry, writing straight into the packet
+    const std::string name = "websocket/acquire-send-packet/clients:8";
+    if (runner.selected(name)) {
+        openSessions(true, 8);
+        runner.run(name, samples.size() * sizeof(uint16_t), [&](BenchState& state) {
+            for (uint64_t i = 0; i < state.iterations; i++) {
+                uint16_t* pData;
+                PacketPtr packet = system.acquireData<uint16_t>(samples.size(), pData);
+                memcpy(pData, samples.data(), samples.size() * sizeof(uint16_t));
+                web.sendPacket(std::move(packet), true);
+                drain(true);
+            }
+        });
+        closeSessions(true);
+    }
+}
+
+/**
+ * Receive-side decode into the command queue and the control thread's
+ * dispatch, in one thread: enqueueCommand() or enqueueBinaryCommand(), then
+ * runCommand() and the acknowledgement. The DOM variant parses with
+ * nlohmann::json and dispatches directly, as commands were handled before
+ * the streaming decoder.
+ */
+void WebSystemBench::runCommands(BenchRunner& runner) {
+    using namespace BinaryProtocol;
+
+    struct JsonCase {
+        const char* name;
+        std::string message;
+    };
+    const JsonCase jsonCases[] = {
+        { "pwm-control", "{\"command\":\"pwm-control\",\"index\":1,\"seq\":7}" },
+        { "io-batch-4", "{\"command\":\"io-batch\",\"seq\":7,\"updates\":[{\"io\":1,\"index\":1},"
+            "{\"io\":2,\"index\":0},{\"io\":3,\"index\":1},{\"io\":4,\"index\":2}]}" },
+    };
+
+    // CommandHeader followed by the little endian payload of Commands.h
+    auto binaryMessage = [](uint8_t opcode, const std::vector<uint8_t>& payload) {
+        CommandHeader header = {};
+        header.magic = FrameMagic;
+        header.type = (uint8_t)FrameType::Command;
+        header.opcode = opcode;
+        header.sequence = 7;
+        std::vector<uint8_t> message(sizeof(header));
+        memcpy(message.data(), &header, sizeof(header));
+        message.insert(message.end(), payload.begin(), payload.end());
+        return message;
+    };
+    struct BinaryCase {
+        const char* name;
+        std::vector<uint8_t> message;
+    };
+    const BinaryCase binaryCases[] = {
+        { "pwm-control", binaryMessage(PwmControlCommand::BinaryOpcode, { 1, 0, 0, 0 }) },
+        { "io-batch-4", binaryMessage(IoBatchCommand::BinaryOpcode,
+            { 4, 1, 0, 1, 0, 2, 0, 0, 0, 3, 0, 1, 0, 4, 0, 2, 0 }) },
+    };
+
+    for (const JsonCase& jsonCase : jsonCases) {
+        std::string name = std::string("commands/json/") + jsonCase.name;
+        Session* pSession = sessionSet(false).sessions.front();
+        runner.run(name, jsonCase.message.size(), [&](BenchState& state) {
+            for (uint64_t i = 0; i < state.iterations; i++) {
+                WebSystem::enqueueCommand(nullptr, pSession, jsonCase.message.data(), jsonCase.message.size());
+                QueuedCommand* pCommand = WebSystem::m_commandQueue.wait(0);
+                if (pCommand) {
+                    WebSystem::runCommand(pCommand);
+                    WebSystem::m_commandQueue.release(pCommand);
+                }
+                drain(false);
+            }
+        });
+
+        name = std::string("commands/json-dom/") + jsonCase.name;
+        runner.run(name, jsonCase.message.size(), [&](BenchState& state) {
+            for (uint64_t i = 0; i < state.iterations; i++) {
+                nlohmann::json message = nlohmann::json::parse(jsonCase.message, nullptr, false);
+                WebSystem::m_commands.dispatch(message);
+            }
+        });
+    }
+
+    for (const BinaryCase& binaryCase : binaryCases) {
+        std::string name = std::string("commands/binary/") + binaryCase.name;
+        uint32_t sessionId = firstSessionId(true);
+        runner.run(name, binaryCase.message.size(), [&](BenchState& state) {
+            for (uint64_t i = 0; i < state.iterations; i++) {
+                WebSystem::enqueueBinaryCommand(sessionId, binaryCase.message.data(), binaryCase.message.size());
+                QueuedCommand* pCommand = WebSystem::m_commandQueue.wait(0);
+                if (pCommand) {
+                    WebSystem::runCommand(pCommand);
+                    WebSystem::m_commandQueue.release(pCommand);
+                }
+                drain(true);
+            }
+        });
+    }
+}
+
+/**
+ * Round trip through the real control thread: a JSON command is queued on
+ * the calling thread, which then spins until the acknowledgement lands in
+ * the session's outbound queue.
+ */
+void WebSystemBench::runCommandRoundTrip(BenchRunner& runner) {
+    const std::string name = "commands/json-round-trip/pwm-control";
+    if (!runner.selected(name)) {
+        return;
+    }
+
+    ControlParams_t params;
+    std::vector<unsigned> cores;
+    for (unsigned core = 0; core < std::thread::hardware_concurrency(); core++) {
+        cores.push_back(core);
+    }
+    pthread_t thread = ThreadUtils::startThread("BenchControl", WebSystem::controlThread, &params, cores,
+        false, true, 0, SCHED_OTHER);
+    if (thread == INVALID_PTHREAD) {
+        runner.skip(name, "control thread could not be started");
+        return;
+    }
+
+    const std::string message = "{\"command\":\"pwm-control\",\"index\":1,\"seq\":7}";
+    Session* pSession = sessionSet(false).sessions.front();
+    runner.run(name, message.size(), [&](BenchState& state) {
+        for (uint64_t i = 0; i < state.iterations; i++) {
+            WebSystem::enqueueCommand(nullptr, pSession, message.data(), message.size());
+            while (drain(false) == 0) {
+            }
+        }
+    });
+
+    params.exit = true;
+    while (!params.exited) {
+        WebSystem::m_commandQueue.wake();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void WebSystemBench::run(BenchRunner& runner) {
+    BenchSystem system;
+
+    runBroadcast(runner, system);
+
+    WebSystem::registerCommand<PwmControlCommand>("pwm-control", [](const PwmControlCommand& command) {
+        s_sink = s_sink + command.index;
+    });
+    WebSystem::registerCommand<IoBatchCommand>("io-batch", [](const IoBatchCommand& command) {
+        s_sink = s_sink + command.count;
+    });
+
+    // Acknowledgements are queued to the sender, one client of each protocol
+    openSessions(false, 1);
+    openSessions(true, 1);
+    runCommands(runner);
+    runCommandRoundTrip(runner);
+    closeSessions(false);
+    closeSessions(true);
+
+    WebSystem::clearCommandCallbacks();
+}
+
+void runWebSystemBenchmarks(BenchRunner& runner) {
+    WebSystemBench::run(runner);
+}
@@ -0,0 +1,134 @@
+#include "LoadGenerator.h"
+#include "Commands.h"
+#include <signal.h>
+#include <sys/resource.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+static void usage(const char* program) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --host address        server address, default 127.0.0.1\n"
+        "  --port n              server port, default 7800\n"
+        "  --connections n       concurrent websocket clients, default 1\n"
+        "  --protocol text|binary  ws-protocol-text or ws-protocol-binary, default text\n"
+        "  --command pwm-control|io-batch  command sent, default pwm-control\n"
+        "  --ios 1,2,3,4         IO numbers of an io-batch\n"
+        "  --set-points n        setpoint indices cycled through, default 2\n"
+        "  --rate n              commands per second over all clients, 0 for closed loop, default 100\n"
+        "  --inflight n          closed loop: unacknowledged commands per client, default 1\n"
+        "  --connect-rate n      new connections per second, default 200\n"
+        "  --duration-ms n       length of the load phase, default 10000\n"
+        "  --drain-ms n          time allowed for the last acks, default 1000\n"
+        "  --server-pid n        server process for the CPU figure, default: find jetson-embeddedUI\n"
+        "  --out file            write the JSON report to file instead of stdout\n",
+        program);
+}
+
+//! Parse "1,2,3" into IO numbers, false on anything else
+static bool parseIos(const char* pText, std::vector<uint16_t>& ios) {
+    ios.clear();
+    while (*pText) {
+        char* pEnd;
+        unsigned long io = strtoul(pText, &pEnd, 10);
+        if (pEnd == pText || io > UINT16_MAX || (*pEnd != ',' && *pEnd != '\0')) {
+            return false;
+        }
+        ios.push_back((uint16_t)io);
+        pText = *pEnd ? pEnd + 1 : pEnd;
+    }
+    return !ios.empty() && ios.size() <= IoBatchCommand::MaxUpdates;
+}
+
+int main(int argc, char** argv) {
+    LoadGenerator::Options options;
+    std::string outPath;
+
+    for (int i = 1; i < argc; i++) {
+        const char* pArg = argv[i];
+        const char* pValue = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!pValue) {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+        if (!strcmp(pArg, "--host")) {
+            options.host = pValue;
+        } else if (!strcmp(pArg, "--port")) {
+            options.port = atoi(pValue);
+        } else if (!strcmp(pArg, "--connections")) {
+            options.connections = (unsigned)strtoul(pValue, nullptr, 10);
+        } else if (!strcmp(pArg, "--protocol") && (!strcmp(pValue, "text") || !strcmp(pValue, "binary"))) {
+            options.binary = !strcmp(pValue, "binary");
+        } else if (!strcmp(pArg, "--command") && !strcmp(pValue, "pwm-control")) {
+            options.command = LoadGenerator::CommandKind::PwmControl;
+        } else if (!strcmp(pArg, "--command") && !strcmp(pValue, "io-batch")) {
+            options.command = LoadGenerator::CommandKind::IoBatch;
+        } else if (!strcmp(pArg, "--ios")) {
+            if (!parseIos(pValue, options.ios)) {
+                usage(argv[0]);
+                return 2;
+            }
+        } else if (!strcmp(pArg, "--set-points")) {
+            options.setPoints = (unsigned)strtoul(pValue, nullptr, 10);
+        } else if (!strcmp(pArg, "--rate")) {
+            options.rate = strtod(pValue, nullptr);
+        } else if (!strcmp(pArg, "--inflight")) {
+            options.inflight = (unsigned)strtoul(pValue, nullptr, 10);
+        } else if (!strcmp(pArg, "--connect-rate")) {
+            options.connectRate = (unsigned)strtoul(pValue, nullptr, 10);
+        } else if (!strcmp(pArg, "--duration-ms")) {
+            options.durationMs = (unsigned)strtoul(pValue, nullptr, 10);
+        } else if (!strcmp(pArg, "--drain-ms")) {
+            options.drainMs = (unsigned)strtoul(pValue, nullptr, 10);
+        } else if (!strcmp(pArg, "--server-pid")) {
+            options.serverPid = (pid_t)atoi(pValue);
+        } else if (!strcmp(pArg, "--out")) {
+            outPath = pValue;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (options.connections == 0 || options.inflight == 0 || options.durationMs == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Every client is a socket; take the hard limit rather than fail at 1024
+    rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < options.connections + 64) {
+        fprintf(stderr, "Open file limit %llu is too low for %u connections\n",
+            (unsigned long long)files.rlim_cur, options.connections);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::string report;
+    {
+        LoadGenerator generator(options);
+        if (!generator.run()) {
+            return 1;
+        }
+        std::cerr << generator.reportText();
+        report = generator.reportJson();
+    }
+
+    FILE* pReport = outPath.empty() ? stdout : fopen(outPath.c_str(), "w");
+    if (!pReport) {
+        perror("Failed to open the report");
+        return 1;
+    }
+    fwrite(report.data(), 1, report.size(), pReport);
+    if (pReport != stdout) {
+        fclose(pReport);
+    }
+    return 0;
+}
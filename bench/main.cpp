@@ -0,0 +1,73 @@
+#include "Bench.h"
+#include "Logger.h"
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void usage(const char* program) {
+    fprintf(stderr,
+        "usage: %s [--filter text] [--min-time-ms n] [--out file]\n"
+        "  --filter text     only run benchmarks whose name contains text\n"
+        "  --min-time-ms n   shortest run reported per benchmark, default 200\n"
+        "  --out file        write the JSON report to file instead of stdout\n",
+        program);
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+    std::string outPath;
+    unsigned minTimeMs = 200;
+    int status = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (!strcmp(argv[i], "--min-time-ms") && i + 1 < argc) {
+            minTimeMs = (unsigned)strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+            outPath = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    // The classes under test print to stdout; keep it for the report only
+    FILE* pReport = outPath.empty() ? fdopen(dup(STDOUT_FILENO), "w") : fopen(outPath.c_str(), "w");
+    if (!pReport) {
+        perror("Failed to open the report");
+        return 1;
+    }
+    fflush(stdout);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    std::vector<unsigned> cores;
+    for (unsigned core = 0; core < std::thread::hardware_concurrency(); core++) {
+        cores.push_back(core);
+    }
+    Logger::setLevel(Logger::Level::Warn);
+    Logger::start(cores);
+
+    // A failing group is reported and the others still run
+    BenchRunner runner(minTimeMs, filter);
+    for (auto group : { runWebSystemBenchmarks, runHardwareBenchmarks, runPipelineBenchmarks }) {
+        try {
+            group(runner);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "Benchmark failed: %s\n", e.what());
+            status = 1;
+        }
+    }
+
+    Logger::stop();
+
+    std::string report = runner.reportJson();
+    fwrite(report.data(), 1, report.size(), pReport);
+    fclose(pReport);
+    return status;
+}
@@ -14,7 +14,7 @@ apt-get update ; apt full-upgrade -y;
 apt autoremove -y
 
 echo "Installing tools and dependencies."
-apt-get install build-essential cmake libwebsockets-dev -y
+apt-get install build-essential cmake libwebsockets-dev zlib1g-dev libbrotli-dev -y
 
 echo "Building JSON library."
 wget https://github.com/nlohmann/json/archive/refs/tags/v3.11.3.tar.gz
@@ -0,0 +1,485 @@
+#include "AssetCache.h"
+#include "Crc32.h"
+#include "Logger.h"
+#include "ThreadUtils.h"
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <poll.h>
+#include <sched.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+namespace fs = std::filesystem;
+
+//! Events that mean the served files changed
+static const uint32_t WatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+//! Immutable for a year; the name changes whenever the content does
+static const char* const HashedCacheControl = "public, max-age=31536000, immutable";
+//! May be cached, but revalidated with the ETag on every use
+static const char* const DefaultCacheControl = "no-cache";
+
+struct MimeType {
+    const char* extension;
+    const char* type;
+    bool        compressible;
+};
+
+static const MimeType MimeTypes[] = {
+    { ".html",  "text/html",                true },
+    { ".htm",   "text/html",                true },
+    { ".js",    "application/javascript",   true },
+    { ".mjs",   "application/javascript",   true },
+    { ".css",   "text/css",                 true },
+    { ".json",  "application/json",         true },
+    { ".map",   "application/json",         true },
+    { ".txt",   "text/plain",               true },
+    { ".svg",   "image/svg+xml",            true },
+    { ".wasm",  "application/wasm",         true },
+    { ".ttf",   "font/ttf",                 true },
+    { ".ico",   "image/x-icon",             true },
+    { ".m3u8",  "application/x-mpegURL",    true },
+    { ".woff",  "font/woff",                false },
+    { ".woff2", "font/woff2",               false },
+    { ".png",   "image/png",                false },
+    { ".jpg",   "image/jpeg",               false },
+    { ".jpeg",  "image/jpeg",               false },
+    { ".gif",   "image/gif",                false },
+    { ".webp",  "image/webp",               false },
+    { ".mp4",   "video/mp4",                false },
+    { ".ts",    "video/mp2t",               false },
+};
+
+static const MimeType DefaultMimeType = { "", "application/octet-stream", false };
+
+static const MimeType& mimeTypeOf(const std::string& path) {
+    size_t dot = path.rfind('.');
+    if (dot != std::string::npos) {
+        for (const MimeType& mime : MimeTypes) {
+            if (strcasecmp(path.c_str() + dot, mime.extension) == 0) {
+                return mime;
+            }
+        }
+    }
+    return DefaultMimeType;
+}
+
+/**
+ * Recognizes bundler output such as "main.3f2a9c1b.js" or "index-BX7k2pQz.js":
+ * the last segment of the stem is 8 or more letters and digits with at least
+ * one digit.
+ */
+static bool isHashedName(const std::string& path) {
+    size_t slash = path.rfind('/');
+    std::string_view name(path);
+    name.remove_prefix(slash == std::string::npos ? 0 : slash + 1);
+
+    size_t dot = name.rfind('.');
+    if (dot == std::string_view::npos) {
+        return false;
+    }
+    std::string_view stem = name.substr(0, dot);
+    size_t separator = stem.find_last_of(".-_");
+    if (separator == std::string_view::npos) {
+        return false;
+    }
+
+    std::string_view hash = stem.substr(separator + 1);
+    if (hash.size() < 8 || hash.size() > 64) {
+        return false;
+    }
+    bool digit = false;
+    for (char c : hash) {
+        if (!isalnum((unsigned char)c)) {
+            return false;
+        }
+        digit |= (isdigit((unsigned char)c) != 0);
+    }
+    return digit;
+}
+
+static bool gzipCompress(const std::string& in, std::string& out) {
+    z_stream stream = {};
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    out.resize(deflateBound(&stream, in.size()));
+    stream.next_in = (Bytef*)in.data();
+    stream.avail_in = (uInt)in.size();
+    stream.next_out = (Bytef*)&out[0];
+    stream.avail_out = (uInt)out.size();
+    int ret = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END;
+}
+
+static bool brotliCompress(const std::string& in, std::string& out) {
+#ifdef HAVE_BROTLI
+    size_t len = BrotliEncoderMaxCompressedSize(in.size());
+    if (len == 0) {
+        return false;
+    }
+    out.resize(len);
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC,
+            in.size(), (const uint8_t*)in.data(), &len, (uint8_t*)&out[0])) {
+        return false;
+    }
+    out.resize(len);
+    return true;
+#else
+    (void)in;
+    (void)out;
+    return false;
+#endif
+}
+
+AssetCache::AssetCache() :
+    m_snapshot(std::make_shared<Snapshot>()),
+    m_inotifyFd(-1),
+    m_thread(INVALID_PTHREAD)
+{
+}
+
+AssetCache::~AssetCache() {
+    stop();
+}
+
+/**
+ * Loads every file below root, then watches the directories for changes.
+ * The cache still serves if watching fails, it just is not refreshed.
+ *
+ * @param root Directory to serve.
+ * @param cores CPU cores the watch thread, which also recompresses, may run on.
+ * @return bool True if the files were loaded.
+ */
+bool AssetCache::start(const std::string& root, std::vector<unsigned> cores) {
+    std::error_code ec;
+    if (!fs::is_directory(root, ec)) {
+        LOG_ERROR("AssetCache: %s is not a directory", root.c_str());
+        return false;
+    }
+
+    m_root = fs::path(root).lexically_normal().string();
+    while (m_root.size() > 1 && m_root.back() == '/') {
+        m_root.pop_back();
+    }
+
+    std::shared_ptr<const Snapshot> pSnapshot = build(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_snapshot = pSnapshot;
+    }
+    LOG_INFO("AssetCache: %llu files from %s, %llu bytes held for %llu bytes on disk, %llu ms",
+        (unsigned long long)m_stats.files.load(), m_root.c_str(),
+        (unsigned long long)m_stats.storedBytes.load(), (unsigned long long)m_stats.bytes.load(),
+        (unsigned long long)(m_stats.loadNs.load() / 1000000));
+
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotifyFd < 0) {
+        LOG_WARN("AssetCache: inotify_init1 failed: %s, changes will not be picked up", strerror(errno));
+        return true;
+    }
+    watchDirectories();
+
+    m_exit.store(false);
+    m_exited.store(false);
+    m_thread = ThreadUtils::startThread("AssetWatch", watchThread, this,
+        cores, false, false, 0, SCHED_OTHER);
+
+    if (m_thread == INVALID_PTHREAD) {
+        m_exited.store(true);
+        LOG_WARN("AssetCache: Failed to start watch thread, changes will not be picked up");
+    }
+    return true;
+}
+
+void AssetCache::stop() {
+    if (!m_exited.load()) {
+        m_exit.store(true);
+        while (!m_exited.load()) {
+            usleep(1000);
+        }
+    }
+
+    if (m_inotifyFd >= 0) {
+        close(m_inotifyFd);
+        m_inotifyFd = -1;
+    }
+}
+
+std::shared_ptr<const AssetCache::Snapshot> AssetCache::snapshot() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_snapshot;
+}
+
+/**
+ * Picks the smallest kept variant whose coding the client accepts. Codings
+ * listed with q=0 are refused.
+ *
+ * @param asset Requested file.
+ * @param acceptEncoding Value of the Accept-Encoding header, empty if absent.
+ * @return AssetEncoding Variant to send.
+ */
+AssetEncoding AssetCache::negotiate(const Asset& asset, std::string_view acceptEncoding) {
+    bool accepted[AssetEncodingCount] = { true, false, false };
+
+    while (!acceptEncoding.empty()) {
+        size_t comma = acceptEncoding.find(',');
+        std::string_view item = acceptEncoding.substr(0, comma);
+        acceptEncoding.remove_prefix(comma == std::string_view::npos ? acceptEncoding.size() : comma + 1);
+
+        size_t semicolon = item.find(';');
+        std::string_view coding = item.substr(0, semicolon);
+        while (!coding.empty() && isspace((unsigned char)coding.front())) {
+            coding.remove_prefix(1);
+        }
+        while (!coding.empty() && isspace((unsigned char)coding.back())) {
+            coding.remove_suffix(1);
+        }
+
+        bool refused = false;
+        if (semicolon != std::string_view::npos) {
+            std::string_view params = item.substr(semicolon + 1);
+            size_t q = params.find("q=");
+            if (q != std::string_view::npos) {
+                refused = strtod(std::string(params.substr(q + 2)).c_str(), nullptr) <= 0.0;
+            }
+        }
+
+        if (coding == "br") {
+            accepted[(size_t)AssetEncoding::Brotli] = !refused;
+        } else if (coding == "gzip") {
+            accepted[(size_t)AssetEncoding::Gzip] = !refused;
+        }
+    }
+
+    AssetEncoding best = AssetEncoding::Identity;
+    size_t bestSize = asset.bodies[0].size();
+    for (size_t encoding = 1; encoding < AssetEncodingCount; encoding++) {
+        if (accepted[encoding] && !asset.bodies[encoding].empty() && asset.bodies[encoding].size() < bestSize) {
+            best = (AssetEncoding)encoding;
+            bestSize = asset.bodies[encoding].size();
+        }
+    }
+    return best;
+}
+
+const char* AssetCache::encodingName(AssetEncoding encoding) {
+    switch (encoding) {
+    case AssetEncoding::Gzip:   return "gzip";
+    case AssetEncoding::Brotli: return "br";
+    default:                    return nullptr;
+    }
+}
+
+void* AssetCache::watchThread(void* arg) {
+    static_cast<AssetCache*>(arg)->run();
+    return 0;
+}
+
+/**
+ * Watch loop. Changes are collected until the files have been quiet for
+ * ReloadDelayMs, so copying a whole new UI build causes one rebuild.
+ */
+void AssetCache::run() {
+    LOG_INFO("AssetCache: watching %s", m_root.c_str());
+
+    alignas(struct inotify_event) char events[4096];
+    bool pending = false;
+    uint64_t changedNs = 0;
+
+    while (!m_exit.load()) {
+        struct pollfd pfd = { m_inotifyFd, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) > 0) {
+            while (read(m_inotifyFd, events, sizeof(events)) > 0) {
+            }
+            pending = true;
+            changedNs = ThreadUtils::monotonicNs();
+        }
+
+        if (!pending || ThreadUtils::monotonicNs() - changedNs < (uint64_t)ReloadDelayMs * 1000000ull) {
+            continue;
+        }
+        pending = false;
+
+        watchDirectories();
+        std::shared_ptr<const Snapshot> pPrevious = snapshot();
+        std::shared_ptr<const Snapshot> pSnapshot = build(pPrevious.get());
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_snapshot = pSnapshot;
+        }
+        m_stats.reloads.fetch_add(1, std::memory_order_relaxed);
+        LOG_INFO("AssetCache: reloaded %llu files in %llu ms",
+            (unsigned long long)m_stats.files.load(), (unsigned long long)(m_stats.loadNs.load() / 1000000));
+    }
+
+    m_exited.store(true);
+    LOG_INFO("AssetCache: watch thread exiting");
+}
+
+/**
+ * Watches the root and every directory below it. Adding an existing watch
+ * is harmless, so this is repeated to pick up new directories.
+ */
+void AssetCache::watchDirectories() {
+    if (inotify_add_watch(m_inotifyFd, m_root.c_str(), WatchMask) < 0) {
+        LOG_WARN("AssetCache: inotify_add_watch %s failed: %s", m_root.c_str(), strerror(errno));
+    }
+
+    std::error_code ec;
+    fs::recursive_directory_iterator it(m_root, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (!it->is_directory(ec)) {
+            continue;
+        }
+        if (it->path().filename().string()[0] == '.') {
+            it.disable_recursion_pending();
+            continue;
+        }
+        inotify_add_watch(m_inotifyFd, it->path().c_str(), WatchMask);
+    }
+}
+
+/**
+ * Reads the files below the root into a new snapshot. Hidden files and
+ * directories, such as the password files, are never served.
+ *
+ * @param pPrevious Snapshot to reuse unchanged files from, nullptr for none.
+ * @return std::shared_ptr<const Snapshot> The new contents.
+ */
+std::shared_ptr<const AssetCache::Snapshot> AssetCache::build(const Snapshot* pPrevious) {
+    uint64_t startNs = ThreadUtils::monotonicNs();
+    std::shared_ptr<Snapshot> pSnapshot = std::make_shared<Snapshot>();
+    uint64_t bytes = 0;
+    uint64_t storedBytes = 0;
+
+    std::error_code ec;
+    fs::recursive_directory_iterator it(m_root, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        std::string path = it->path().string();
+        if (it->path().filename().string()[0] == '.') {
+            if (it->is_directory(ec)) {
+                it.disable_recursion_pending();
+            }
+            continue;
+        }
+
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        std::string relative = path.substr(m_root.size() + 1);
+
+        std::shared_ptr<const Asset> pAsset;
+        if (pPrevious) {
+            auto previous = pPrevious->find(relative);
+            if (previous != pPrevious->end() && previous->second->size == (uint64_t)st.st_size &&
+                previous->second->modified.tv_sec == st.st_mtim.tv_sec &&
+                previous->second->modified.tv_nsec == st.st_mtim.tv_nsec) {
+                pAsset = previous->second;
+            }
+        }
+
+        if (!pAsset) {
+            std::shared_ptr<Asset> pLoaded = std::make_shared<Asset>();
+            pLoaded->path = path;
+            pLoaded->size = st.st_size;
+            pLoaded->modified = st.st_mtim;
+            loadAsset(*pLoaded);
+            pAsset = pLoaded;
+        }
+
+        bytes += pAsset->size;
+        for (const std::string& body : pAsset->bodies) {
+            storedBytes += body.size();
+        }
+        pSnapshot->emplace(std::move(relative), std::move(pAsset));
+    }
+
+    if (ec) {
+        LOG_WARN("AssetCache: listing %s failed: %s", m_root.c_str(), ec.message().c_str());
+    }
+
+    m_stats.files.store(pSnapshot->size(), std::memory_order_relaxed);
+    m_stats.bytes.store(bytes, std::memory_order_relaxed);
+    m_stats.storedBytes.store(storedBytes, std::memory_order_relaxed);
+    m_stats.loadNs.store(ThreadUtils::monotonicNs() - startNs, std::memory_order_relaxed);
+    return pSnapshot;
+}
+
+/**
+ * Reads one file and prepares its headers and compressed variants. A
+ * variant is only kept if it is meaningfully smaller than the file.
+ *
+ * @param asset Asset with path, size and modification time set.
+ */
+void AssetCache::loadAsset(Asset& asset) {
+    const MimeType& mime = mimeTypeOf(asset.path);
+    asset.mimeType = mime.type;
+    asset.cacheControl = isHashedName(asset.path) ? HashedCacheControl : DefaultCacheControl;
+
+    char etag[48];
+    snprintf(etag, sizeof(etag), "\"%llx-%lx\"", (unsigned long long)asset.size,
+        (long)(asset.modified.tv_sec ^ asset.modified.tv_nsec));
+    asset.etags[(size_t)AssetEncoding::Identity] = etag;
+
+    if (asset.size > MaxCachedFileSize) {
+        asset.cached = false;
+        return;
+    }
+
+    int fd = open(asset.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_WARN("AssetCache: open %s failed: %s", asset.path.c_str(), strerror(errno));
+        return;
+    }
+
+    std::string& body = asset.bodies[(size_t)AssetEncoding::Identity];
+    body.resize(asset.size);
+    size_t done = 0;
+    while (done < body.size()) {
+        ssize_t n = read(fd, &body[done], body.size() - done);
+        if (n <= 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    close(fd);
+    body.resize(done);
+    asset.cached = true;
+
+    // Tag the content, not the time it was copied
+    snprintf(etag, sizeof(etag), "\"%08x-%zx\"", Crc32::compute(body.data(), body.size()), body.size());
+    asset.etags[(size_t)AssetEncoding::Identity] = etag;
+
+    if (!mime.compressible || body.size() < MinCompressSize) {
+        return;
+    }
+
+    std::string& gzip = asset.bodies[(size_t)AssetEncoding::Gzip];
+    if (!gzipCompress(body, gzip) || gzip.size() > body.size() * 9 / 10) {
+        gzip.clear();
+    }
+
+    std::string& brotli = asset.bodies[(size_t)AssetEncoding::Brotli];
+    if (!brotliCompress(body, brotli) || brotli.size() > body.size() * 9 / 10) {
+        brotli.clear();
+    }
+
+    // Each coding is a different representation and needs its own tag
+    std::string base = asset.etags[(size_t)AssetEncoding::Identity];
+    base.pop_back();
+    asset.etags[(size_t)AssetEncoding::Gzip] = base + "-gz\"";
+    asset.etags[(size_t)AssetEncoding::Brotli] = base + "-br\"";
+}
@@ -0,0 +1,99 @@
+/**
+* In-memory cache of the static web files. Every file below the root is read
+* once, with gzip and brotli variants compressed ahead of time, so requests
+* are answered from memory in the smallest encoding the client accepts.
+* Each file carries an ETag for conditional requests, and files whose name
+* contains a content hash are marked immutable. An inotify watch rebuilds
+* the cache when the files change; unchanged files are not recompressed.
+*/
+
+#pragma once
+
+#include <pthread.h>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+//! Content coding of a cached body
+enum class AssetEncoding : uint8_t {
+    Identity    = 0,
+    Gzip        = 1,
+    Brotli      = 2
+};
+
+static constexpr size_t AssetEncodingCount = 3;
+
+//! One file below the root
+struct Asset {
+    std::string path;                           //! File on disk
+    std::string mimeType;
+    std::string cacheControl;                   //! Cache-Control header value
+    std::string etags[AssetEncodingCount];      //! Quoted ETag of each variant
+    std::string bodies[AssetEncodingCount];     //! Bodies by AssetEncoding, empty if that variant is not kept
+    bool        cached = false;                 //! False if too large to hold, served from disk instead
+    uint64_t    size = 0;                       //! Size of the file
+    timespec    modified = {};                  //! Modification time when loaded
+};
+
+//! Cache contents and rebuild counters
+struct AssetCacheStats {
+    std::atomic<uint64_t> files{0};             //! Files in the cache
+    std::atomic<uint64_t> bytes{0};             //! Size of the files
+    std::atomic<uint64_t> storedBytes{0};       //! Memory held by all variants
+    std::atomic<uint64_t> reloads{0};           //! Rebuilds after a change
+    std::atomic<uint64_t> loadNs{0};            //! Duration of the last build
+};
+
+class AssetCache {
+public:
+    //! Files by path relative to the root, '/' separated without a leading '/'
+    typedef std::unordered_map<std::string, std::shared_ptr<const Asset>> Snapshot;
+
+    static constexpr uint64_t MaxCachedFileSize = 4 * 1024 * 1024;  //! Larger files are served from disk
+    static constexpr size_t MinCompressSize = 256;                  //! Smaller files are not compressed
+    static constexpr int ReloadDelayMs = 250;                       //! Quiet time after a change before rebuilding
+
+    AssetCache();
+    ~AssetCache();
+
+    //! Load the files below root and start watching them
+    bool start(const std::string& root, std::vector<unsigned> cores);
+    void stop();
+
+    //! Current contents. The snapshot stays valid while it is held, even
+    //! across a rebuild.
+    std::shared_ptr<const Snapshot> snapshot() const;
+
+    //! Choose the smallest variant of an asset allowed by an Accept-Encoding value
+    static AssetEncoding negotiate(const Asset& asset, std::string_view acceptEncoding);
+
+    //! Content-Encoding header value, nullptr for the identity body
+    static const char* encodingName(AssetEncoding encoding);
+
+    const AssetCacheStats& getStats() const { return m_stats; }
+
+private:
+    static void* watchThread(void* arg);
+    void run();
+
+    //! Build a new snapshot, reusing the variants of files that did not change
+    std::shared_ptr<const Snapshot> build(const Snapshot* pPrevious);
+    static void loadAsset(Asset& asset);
+    void watchDirectories();
+
+    std::string                     m_root;                 //! Directory served
+    mutable std::mutex              m_mutex;                //! Guards m_snapshot
+    std::shared_ptr<const Snapshot> m_snapshot;             //! Current contents
+
+    int                             m_inotifyFd;            //! Watches every directory below the root
+    pthread_t                       m_thread;               //! Watch thread
+    std::atomic<bool>               m_exit{false};          //! Signal thread to exit
+    std::atomic<bool>               m_exited{true};         //! Thread indicates it has exited
+    AssetCacheStats                 m_stats;
+};
@@ -0,0 +1,159 @@
+/**
+* Frame formats of ws-protocol-binary: chunked uploads, commands and IO
+* telemetry.
+*
+* Uploads:
+* Every frame is one websocket message starting with a FrameHeader, followed
+* by length payload bytes. All fields are little endian.
+*
+*   client                                  server
+*   Begin  {UploadBegin + name}      ->
+*                                    <-     Ack Ok, offset = bytes already stored
+*   Chunk  {offset, data}            ->     (repeated, in order)
+*                                    <-     Ack Ok, offset = next expected byte
+*   Commit                           ->
+*                                    <-     Ack Complete
+*
+* A Begin for a file whose earlier upload was interrupted resumes it: the Ack
+* reports how much is already on disk and the client continues from there.
+* Any error Ack also carries the offset the client should continue from.
+*
+* Commands: a CommandHeader followed by the payload layout of the opcode, see
+* Commands.h. They go through the same registry and queue as JSON commands on
+* ws-protocol-text. Failures are always answered with a CommandAck; success is
+* acknowledged only when the sequence is not 0, so a high rate client can send
+* without acks.
+*
+* Telemetry (server to client): a TelemetryHeader followed by struct-of-arrays
+* sections, each section starting on a boundary suitable for a JS typed array:
+*
+*   uint64_t changedNs[timestampCount]   time of each IO's last setpoint change
+*   float    value[valueCount]           raw value read from each IO
+*   uint16_t ioNumber[rows]              IO number, from its "IO<n>" key
+*   uint16_t setPoint[setPointCount]     current setpoint index
+*   uint8_t  fields[rows]                TelemetryField bits present for each row
+*
+* Rows are IOs with at least one changed field. A row contributes an entry to
+* a section only if its fields byte has that bit; entries are in row order.
+* Keyframes carry every field of every IO.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace BinaryProtocol
+{
+    static constexpr uint16_t FrameMagic = 0xB17E;
+
+    enum class FrameType : uint8_t {
+        Begin   = 1,        //! Start or resume a transfer, payload is UploadBegin + name
+        Chunk   = 2,        //! File data at offset
+        Commit  = 3,        //! All data sent, verify and move into place
+        Abort   = 4,        //! Discard the transfer and its partial file
+        Command = 0x10,     //! Command, CommandHeader + opcode payload
+        Ack     = 0x81,     //! Server reply, status and next expected offset
+        CommandAck = 0x82,  //! Server reply to a command, CommandAck
+        Telemetry = 0x90    //! IO state, TelemetryHeader
+    };
+
+    enum class AckStatus : uint8_t {
+        Ok              = 0,    //! Data stored, continue at offset
+        Complete        = 1,    //! File verified and committed
+        CrcError        = 2,    //! Chunk or file checksum mismatch, resend from offset
+        OffsetMismatch  = 3,    //! Chunk not at the expected offset, resend from offset
+        Busy            = 4,    //! Server queue full, resend from offset later
+        IoError         = 5,    //! Writing the file failed
+        Invalid         = 6,    //! Malformed frame or request
+        UnknownTransfer = 7,    //! No Begin for this transfer id
+        TooLarge        = 8     //! File exceeds the configured limit
+    };
+
+    //! Kind of upload, selects the destination subdirectory
+    enum class UploadKind : uint8_t {
+        Firmware    = 0,
+        Map         = 1,
+        Config      = 2
+    };
+
+#pragma pack(push, 1)
+    struct FrameHeader {
+        uint16_t magic;         //! FrameMagic
+        uint8_t  type;          //! FrameType
+        uint8_t  status;        //! AckStatus in acks, 0 otherwise
+        uint32_t transferId;    //! Chosen by the client, unique per connection
+        uint64_t offset;        //! File offset of the chunk, or next expected offset in acks
+        uint32_t length;        //! Payload bytes following the header
+        uint32_t crc32;         //! CRC-32 of the payload, 0 if there is none
+    };
+
+    struct UploadBegin {
+        uint64_t totalSize;     //! Size of the complete file
+        uint32_t fileCrc32;     //! CRC-32 of the complete file, 0 to skip the check
+        uint8_t  kind;          //! UploadKind
+        uint8_t  nameLength;    //! Bytes of file name following this struct
+        uint16_t reserved;
+    };
+#pragma pack(pop)
+
+    //! Fields of one IO in a telemetry frame
+    enum TelemetryField : uint8_t {
+        FieldTimestamp  = 0x01,
+        FieldValue      = 0x02,
+        FieldSetPoint   = 0x04,
+        FieldAll        = 0x07
+    };
+
+    static constexpr uint8_t TelemetryKeyframe = 0x01;     //! TelemetryHeader flag
+
+#pragma pack(push, 1)
+    struct TelemetryHeader {
+        uint16_t magic;             //! FrameMagic
+        uint8_t  type;              //! FrameType::Telemetry
+        uint8_t  flags;             //! TelemetryKeyframe
+        uint32_t sequence;          //! Frame counter, gaps mean lost frames
+        uint64_t timestampNs;       //! Monotonic sampling time
+        uint16_t rows;              //! IOs in this frame
+        uint16_t timestampCount;    //! Entries in the changedNs section
+        uint16_t valueCount;        //! Entries in the value section
+        uint16_t setPointCount;     //! Entries in the setPoint section
+    };
+#pragma pack(pop)
+
+    enum class CommandStatus : uint8_t {
+        Ok      = 0,        //! Handler ran
+        Busy    = 1,        //! Command queue full, resend later
+        Invalid = 2,        //! Payload does not match the opcode
+        Unknown = 3         //! No command registered for the opcode
+    };
+
+#pragma pack(push, 1)
+    struct CommandHeader {
+        uint16_t magic;             //! FrameMagic
+        uint8_t  type;              //! FrameType::Command
+        uint8_t  opcode;            //! BinaryOpcode of the command
+        uint32_t sequence;          //! Echoed in the ack, 0 to only ack failures
+    };
+
+    struct CommandAck {
+        uint16_t magic;             //! FrameMagic
+        uint8_t  type;              //! FrameType::CommandAck
+        uint8_t  status;            //! CommandStatus
+        uint32_t sequence;          //! Sequence of the command
+        uint8_t  opcode;            //! Opcode of the command
+        uint8_t  reserved[3];
+        uint32_t queueUs;           //! Time the command waited for the control thread
+    };
+#pragma pack(pop)
+
+    static_assert(sizeof(CommandHeader) == 8, "CommandHeader layout is part of the protocol");
+    static_assert(sizeof(CommandAck) == 16, "CommandAck layout is part of the protocol");
+    static_assert(sizeof(TelemetryHeader) == 24, "TelemetryHeader layout is part of the protocol");
+    static_assert(sizeof(FrameHeader) == 24, "FrameHeader layout is part of the protocol");
+    static_assert(sizeof(UploadBegin) == 16, "UploadBegin layout is part of the protocol");
+
+    //! Largest frame accepted, sized to fit one 64 KiB pooled packet
+    static constexpr size_t MaxFrameLen = 65536;
+    static constexpr size_t MaxChunkLen = MaxFrameLen - sizeof(FrameHeader);
+}
@@ -0,0 +1,146 @@
+/**
+* Fixed capacity single producer / single consumer byte ring. Used for the
+* serial receive buffers: the reactor thread fills free space directly with
+* readv() and the consumer reads contiguous slices in place, so neither side
+* allocates or copies through an intermediate buffer. The transmit buffers
+* use it the other way round, drained by the reactor with writev().
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <sys/uio.h>
+
+class ByteRing {
+public:
+    //! Capacity is rounded up to a power of two
+    explicit ByteRing(size_t capacity = 4096)
+    {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_capacity = size;
+        m_buffer.reset(new char[size]);
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+    //! Bytes readable by the consumer
+    size_t size() const
+    {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+    //! Bytes writable by the producer
+    size_t space() const { return m_capacity - size(); }
+
+    // --- Consumer side ---
+
+    //! Oldest readable bytes up to the wrap point. Call again after consume()
+    //! to see the bytes past the wrap.
+    std::string_view peek() const
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t offset = tail & (m_capacity - 1);
+        size_t length = std::min(head - tail, m_capacity - offset);
+        return std::string_view(m_buffer.get() + offset, length);
+    }
+
+    //! Release bytes returned by peek()
+    void consume(size_t count)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t available = m_head.load(std::memory_order_acquire) - tail;
+        m_tail.store(tail + std::min(count, available), std::memory_order_seq_cst);
+    }
+
+    //! Describe the readable bytes as up to two iovecs for writev().
+    //! Returns the number of iovecs filled, 0 if the ring is empty.
+    int readable(struct iovec (&iov)[2]) const
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t used = m_head.load(std::memory_order_acquire) - tail;
+        if (used == 0) {
+            return 0;
+        }
+
+        size_t offset = tail & (m_capacity - 1);
+        size_t first = std::min(used, m_capacity - offset);
+        iov[0].iov_base = m_buffer.get() + offset;
+        iov[0].iov_len = first;
+        if (first == used) {
+            return 1;
+        }
+        iov[1].iov_base = m_buffer.get();
+        iov[1].iov_len = used - first;
+        return 2;
+    }
+
+    // --- Producer side ---
+
+    //! Describe the free space as up to two iovecs for readv().
+    //! Returns the number of iovecs filled, 0 if the ring is full.
+    int writable(struct iovec (&iov)[2]) const
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t free = m_capacity - (head - m_tail.load(std::memory_order_seq_cst));
+        if (free == 0) {
+            return 0;
+        }
+
+        size_t offset = head & (m_capacity - 1);
+        size_t first = std::min(free, m_capacity - offset);
+        iov[0].iov_base = m_buffer.get() + offset;
+        iov[0].iov_len = first;
+        if (first == free) {
+            return 1;
+        }
+        iov[1].iov_base = m_buffer.get();
+        iov[1].iov_len = free - first;
+        return 2;
+    }
+
+    //! Publish bytes written into the space returned by writable()
+    void commit(size_t count)
+    {
+        m_head.store(m_head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    //! Copy bytes into the ring. Returns false, copying nothing, if they do not fit.
+    bool push(const void* data, size_t size)
+    {
+        if (size == 0) {
+            return true;
+        }
+
+        struct iovec iov[2];
+        int count = writable(iov);
+        size_t free = (count > 0 ? iov[0].iov_len : 0) + (count > 1 ? iov[1].iov_len : 0);
+        if (size > free) {
+            return false;
+        }
+
+        const char* pBytes = static_cast<const char*>(data);
+        size_t first = std::min(size, iov[0].iov_len);
+        std::memcpy(iov[0].iov_base, pBytes, first);
+        if (size > first) {
+            std::memcpy(iov[1].iov_base, pBytes + first, size - first);
+        }
+        commit(size);
+        return true;
+    }
+
+private:
+    size_t                   m_capacity;
+    std::unique_ptr<char[]>  m_buffer;
+    alignas(64) std::atomic<size_t> m_head{0};     //! Written by the producer
+    alignas(64) std::atomic<size_t> m_tail{0};     //! Written by the consumer
+};
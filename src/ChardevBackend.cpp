@@ -0,0 +1,392 @@
+#include "ChardevBackend.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "ThreadUtils.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/gpio.h>
+
+//! Duration of the GPIO line value ioctls
+static Histogram& s_gpioWriteTime = Metrics::histogram("gpio_write_seconds",
+    "Duration of GPIO line set-values ioctls");
+
+static constexpr const char* GPIO_CONSUMER = "jetson-embeddedUI";
+
+/**
+ * One /dev/gpiochipN and the line request holding every line opened on it.
+ * Line i of the request is bit i of the values ioctls.
+ */
+class GpioChip {
+public:
+    GpioChip(const std::string& path, size_t slot);
+    ~GpioChip();
+
+    // Add a line to the request and return its bit
+    uint64_t addLine(unsigned offset, bool output);
+
+    void setValues(uint64_t mask, uint64_t bits);
+    uint64_t getValues(uint64_t mask);
+
+    uint64_t getLineMask() const { return lineMask; }
+    const std::string& getPath() const { return path; }
+
+    const size_t slot;                  // Index in the batch state
+
+private:
+    std::string path;
+    int chipFd;
+    int requestFd;                      // Line request, -1 before the first line
+    std::vector<unsigned> offsets;      // Line offsets, in request order
+    uint64_t lineMask;                  // Bits of all requested lines
+    uint64_t outputMask;                // Bits of the outputs
+    std::atomic<uint64_t> outputBits;   // Last values written to the outputs
+
+    void request();
+};
+
+/**
+ * @brief Opens a GPIO chip
+ *
+ * @param path Device path, e.g. /dev/gpiochip0
+ * @param slot Index of the chip in the backend
+ * @throws std::runtime_error if the device cannot be opened
+ */
+GpioChip::GpioChip(const std::string& path, size_t slot)
+    : slot(slot),
+      path(path),
+      chipFd(-1),
+      requestFd(-1),
+      lineMask(0),
+      outputMask(0),
+      outputBits(0) {
+    chipFd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (chipFd < 0) {
+        throw std::runtime_error("Failed to open " + path + ": " + strerror(errno));
+    }
+}
+
+/**
+ * @brief Releases the lines and closes the chip
+ */
+GpioChip::~GpioChip() {
+    if (requestFd >= 0) {
+        close(requestFd);
+    }
+    close(chipFd);
+}
+
+/**
+ * @brief Adds a line to the chip's request
+ *
+ * The kernel cannot add lines to a request, so the request is released and
+ * made again with all lines; outputs are requested with the values last
+ * written, so they keep their level. Lines are added while the IOs are
+ * created, before any of them is used.
+ *
+ * @param offset Line offset on the chip
+ * @param output True for an output
+ * @return uint64_t Bit of the line in the values ioctls
+ * @throws std::runtime_error if the line is already requested with the other
+ * direction, the request is full or the kernel refuses it
+ */
+uint64_t GpioChip::addLine(unsigned offset, bool output) {
+    for (size_t i = 0; i < offsets.size(); i++) {
+        if (offsets[i] == offset) {
+            uint64_t bit = 1ull << i;
+            if (((outputMask & bit) != 0) != output) {
+                throw std::runtime_error("Line " + std::to_string(offset) + " of " + path +
+                                         " is already used with the other direction");
+            }
+            return bit;
+        }
+    }
+    if (offsets.size() == GPIO_V2_LINES_MAX) {
+        throw std::runtime_error("More than " + std::to_string(GPIO_V2_LINES_MAX) + " lines used on " + path);
+    }
+
+    uint64_t bit = 1ull << offsets.size();
+    offsets.push_back(offset);
+    lineMask |= bit;
+    if (output) {
+        outputMask |= bit;
+    }
+
+    try {
+        request();
+    } catch (const std::exception&) {
+        offsets.pop_back();
+        lineMask &= ~bit;
+        outputMask &= ~bit;
+        if (!offsets.empty()) {
+            request();
+        }
+        throw;
+    }
+    return bit;
+}
+
+/**
+ * @brief Requests all lines of the chip with GPIO_V2_GET_LINE_IOCTL
+ * @throws std::runtime_error if the kernel refuses the request
+ */
+void GpioChip::request() {
+    if (requestFd >= 0) {
+        close(requestFd);
+        requestFd = -1;
+    }
+
+    gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+    for (size_t i = 0; i < offsets.size(); i++) {
+        req.offsets[i] = offsets[i];
+    }
+    req.num_lines = offsets.size();
+    strncpy(req.consumer, GPIO_CONSUMER, sizeof(req.consumer) - 1);
+
+    // Inputs by default, the outputs and their initial values as attributes
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+    if (outputMask != 0) {
+        req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+        req.config.attrs[0].attr.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+        req.config.attrs[0].mask = outputMask;
+        req.config.attrs[1].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+        req.config.attrs[1].attr.values = outputBits.load(std::memory_order_relaxed);
+        req.config.attrs[1].mask = outputMask;
+        req.config.num_attrs = 2;
+    }
+
+    if (ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+        throw std::runtime_error("Failed to request " + std::to_string(offsets.size()) + " lines of " + path +
+                                 ": " + strerror(errno));
+    }
+    requestFd = req.fd;
+}
+
+/**
+ * @brief Sets outputs of the chip with one ioctl
+ *
+ * @param mask Bits of the lines to set
+ * @param bits New values
+ * @throws std::runtime_error if the ioctl fails
+ */
+void GpioChip::setValues(uint64_t mask, uint64_t bits) {
+    gpio_v2_line_values values;
+    values.mask = mask;
+    values.bits = bits;
+
+    uint64_t startNs = ThreadUtils::monotonicNs();
+    int result = ioctl(requestFd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+    s_gpioWriteTime.observe(ThreadUtils::monotonicNs() - startNs);
+    if (result < 0) {
+        throw std::runtime_error("Failed to set lines of " + path + ": " + strerror(errno));
+    }
+
+    uint64_t last = outputBits.load(std::memory_order_relaxed);
+    outputBits.store((last & ~mask) | (bits & mask), std::memory_order_relaxed);
+}
+
+/**
+ * @brief Reads lines of the chip with one ioctl
+ *
+ * @param mask Bits of the lines to read
+ * @return uint64_t Values of the lines in mask
+ * @throws std::runtime_error if the ioctl fails
+ */
+uint64_t GpioChip::getValues(uint64_t mask) {
+    gpio_v2_line_values values;
+    values.mask = mask;
+    values.bits = 0;
+    if (ioctl(requestFd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+        throw std::runtime_error("Failed to read lines of " + path + ": " + strerror(errno));
+    }
+    return values.bits & mask;
+}
+
+// Writes and reads collected by beginBatch() on this thread
+struct GpioBatch {
+    const ChardevBackend* owner = nullptr;  // nullptr outside a batch
+    uint64_t setMask[ChardevBackend::MAX_CHIPS];
+    uint64_t setBits[ChardevBackend::MAX_CHIPS];
+    uint64_t sampledMask[ChardevBackend::MAX_CHIPS];    // Lines read in this batch
+    uint64_t sampledBits[ChardevBackend::MAX_CHIPS];
+};
+
+static thread_local GpioBatch t_batch;
+
+// A line of a GpioChip's request
+class ChardevGpioLine : public GpioLine {
+public:
+    ChardevGpioLine(const ChardevBackend& backend, GpioChip& chip, uint64_t bit)
+        : backend(backend), chip(chip), bit(bit) {}
+
+    void setValue(bool value) override;
+    bool getValue() override;
+
+private:
+    const ChardevBackend& backend;
+    GpioChip& chip;
+    uint64_t bit;
+};
+
+void ChardevGpioLine::setValue(bool value) {
+    if (t_batch.owner == &backend) {
+        t_batch.setMask[chip.slot] |= bit;
+        t_batch.setBits[chip.slot] = value ? (t_batch.setBits[chip.slot] | bit) : (t_batch.setBits[chip.slot] & ~bit);
+        return;
+    }
+    chip.setValues(bit, value ? bit : 0);
+}
+
+bool ChardevGpioLine::getValue() {
+    if (t_batch.owner == &backend) {
+        // The first read of a chip in the batch reads all of its lines
+        if ((t_batch.sampledMask[chip.slot] & bit) == 0) {
+            t_batch.sampledBits[chip.slot] = chip.getValues(chip.getLineMask());
+            t_batch.sampledMask[chip.slot] = chip.getLineMask();
+        }
+        return (t_batch.sampledBits[chip.slot] & bit) != 0;
+    }
+    return (chip.getValues(bit) & bit) != 0;
+}
+
+/**
+ * @brief Constructs a GPIO character device backend
+ *
+ * @param pwmBaseDir The sysfs PWM class directory, PWM_BASE_DIR on hardware
+ * @param gpioDevDir The directory of the gpiochip devices, GPIO_DEV_DIR on hardware
+ */
+ChardevBackend::ChardevBackend(const std::string& pwmBaseDir, const std::string& gpioDevDir)
+    : SysfsBackend(pwmBaseDir),
+      gpioDevDir(gpioDevDir) {
+}
+
+ChardevBackend::~ChardevBackend() = default;
+
+/**
+ * @brief Opens a GPIO line and adds it to the request of its chip
+ *
+ * @param port "gpiochipN" with pinNumber as the line offset, or a line name
+ * @param pinNumber Line offset when port is a chip, unused otherwise
+ * @param output True for an output, which starts low
+ * @return std::unique_ptr<GpioLine> The line
+ * @throws std::runtime_error if the line is not found or cannot be requested
+ */
+std::unique_ptr<GpioLine> ChardevBackend::openGpio(const std::string& port, unsigned pinNumber, bool output) {
+    std::string chipPath = gpioDevDir + "/" + port;
+    unsigned offset = pinNumber;
+    if (port.compare(0, 8, "gpiochip") != 0 || !std::filesystem::exists(chipPath)) {
+        if (!findLine(port, chipPath, offset)) {
+            throw std::runtime_error("GPIO line " + port + " not found in " + gpioDevDir);
+        }
+    }
+
+    std::lock_guard<std::mutex> lck(mutex);
+    GpioChip& chip = getChip(chipPath);
+    uint64_t bit = chip.addLine(offset, output);
+    LOG_INFO("GPIO %s is line %u of %s", port.c_str(), offset, chipPath.c_str());
+    return std::make_unique<ChardevGpioLine>(*this, chip, bit);
+}
+
+/**
+ * @brief Starts collecting the GPIO writes and reads of the calling thread
+ */
+void ChardevBackend::beginBatch() {
+    size_t count = std::min(chips.size(), MAX_CHIPS);
+    for (size_t i = 0; i < count; i++) {
+        t_batch.setMask[i] = 0;
+        t_batch.setBits[i] = 0;
+        t_batch.sampledMask[i] = 0;
+    }
+    t_batch.owner = this;
+}
+
+/**
+ * @brief Writes the collected values, one GPIO_V2_LINE_SET_VALUES per chip
+ * @throws std::runtime_error if a chip could not be written; the other chips
+ * are still written
+ */
+void ChardevBackend::commitBatch() {
+    if (t_batch.owner != this) {
+        return;
+    }
+    t_batch.owner = nullptr;
+
+    std::string error;
+    for (size_t i = 0; i < chips.size(); i++) {
+        if (t_batch.setMask[i] == 0) {
+            continue;
+        }
+        try {
+            chips[i]->setValues(t_batch.setMask[i], t_batch.setBits[i]);
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+    }
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
+/**
+ * @brief Gets an opened chip by its path, opening it the first time
+ * @throws std::runtime_error if the chip cannot be opened or MAX_CHIPS are in use
+ */
+GpioChip& ChardevBackend::getChip(const std::string& path) {
+    for (auto& chip : chips) {
+        if (chip->getPath() == path) {
+            return *chip;
+        }
+    }
+    if (chips.size() == MAX_CHIPS) {
+        throw std::runtime_error("More than " + std::to_string(MAX_CHIPS) + " GPIO chips in use");
+    }
+    chips.push_back(std::make_unique<GpioChip>(path, chips.size()));
+    return *chips.back();
+}
+
+/**
+ * @brief Finds a GPIO line by its name on all chips
+ *
+ * @param lineName Name of the line, e.g. "PCC.07"
+ * @param chipPath Set to the device of the chip with the line
+ * @param offset Set to the offset of the line on its chip
+ * @return bool False if no chip has a line of that name
+ */
+bool ChardevBackend::findLine(const std::string& lineName, std::string& chipPath, unsigned& offset) const {
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(gpioDevDir, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, 8, "gpiochip") != 0) {
+            continue;
+        }
+        int fd = open(entry.path().c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+
+        gpiochip_info chipInfo;
+        memset(&chipInfo, 0, sizeof(chipInfo));
+        if (ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &chipInfo) == 0) {
+            for (unsigned line = 0; line < chipInfo.lines; line++) {
+                gpio_v2_line_info lineInfo;
+                memset(&lineInfo, 0, sizeof(lineInfo));
+                lineInfo.offset = line;
+                if (ioctl(fd, GPIO_V2_GET_LINEINFO_IOCTL, &lineInfo) == 0 &&
+                    strncmp(lineInfo.name, lineName.c_str(), sizeof(lineInfo.name)) == 0) {
+                    close(fd);
+                    chipPath = entry.path().string();
+                    offset = line;
+                    return true;
+                }
+            }
+        }
+        close(fd);
+    }
+    return false;
+}
@@ -0,0 +1,48 @@
+/**
+* Hardware backend with GPIOs on the GPIO character device (/dev/gpiochipN,
+* uAPI v2) and PWM on sysfs, which has no character device.
+*
+* All lines opened on a chip share one line request, so the outputs of a
+* chip are set with a single GPIO_V2_LINE_SET_VALUES ioctl and its inputs
+* read with a single GPIO_V2_LINE_GET_VALUES. Between beginBatch() and
+* commitBatch() the writes of the calling thread are collected per chip and
+* each chip is read once.
+*
+* An IO's port is either a chip ("gpiochip1", pinNumber is the line offset)
+* or a line name such as the Jetson's "PCC.07", looked up on every chip.
+* The kernel's gpio-sim module provides chips with named lines for testing.
+*/
+
+#ifndef CHARDEVBACKEND_H
+#define CHARDEVBACKEND_H
+
+#include <mutex>
+#include <vector>
+#include "SysfsBackend.h"
+
+class GpioChip;
+
+class ChardevBackend : public SysfsBackend {
+public:
+    ChardevBackend(const std::string& pwmBaseDir = PWM_BASE_DIR, const std::string& gpioDevDir = GPIO_DEV_DIR);
+    ~ChardevBackend() override;
+
+    std::unique_ptr<GpioLine> openGpio(const std::string& port, unsigned pinNumber, bool output) override;
+    const char* name() const override { return "chardev"; }
+
+    void beginBatch() override;
+    void commitBatch() override;
+
+    static constexpr const char* GPIO_DEV_DIR = "/dev";
+    static constexpr size_t MAX_CHIPS = 16;     // Chips with requested lines
+
+private:
+    std::string gpioDevDir;                     // Directory of the gpiochip devices
+    std::mutex mutex;                           // Guards chips, taken when opening lines only
+    std::vector<std::unique_ptr<GpioChip>> chips;   // Index is the chip's slot in a batch
+
+    GpioChip& getChip(const std::string& path);
+    bool findLine(const std::string& lineName, std::string& chipPath, unsigned& offset) const;
+};
+
+#endif // CHARDEVBACKEND_H
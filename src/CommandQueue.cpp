@@ -0,0 +1,169 @@
+#include "CommandQueue.h"
+#include "ThreadUtils.h"
+#include <time.h>
+
+CommandQueue::CommandQueue() :
+    m_slots(new Slot[Capacity])
+{
+    for (size_t i = 0; i < Capacity; i++) {
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    sem_init(&m_ready, 0, 0);
+}
+
+CommandQueue::~CommandQueue() {
+    sem_destroy(&m_ready);
+    delete[] m_slots;
+}
+
+/**
+ * Claims the next free slot. Lock free; fails instead of waiting when the
+ * consumer has fallen behind.
+ *
+ * @return QueuedCommand* Slot to fill, nullptr if the queue is full.
+ */
+QueuedCommand* CommandQueue::claim() {
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+
+    while (true) {
+        Slot& slot = m_slots[pos & (Capacity - 1)];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.position = pos;
+                slot.valid = true;
+                return &slot.command;
+            }
+        } else if (diff < 0) {
+            m_stats.rejected.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        } else {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Hands a filled slot to the consumer and updates the depth statistics.
+ *
+ * @param pCommand Slot returned by claim().
+ */
+void CommandQueue::publish(QueuedCommand* pCommand) {
+    Slot* pSlot = reinterpret_cast<Slot*>(reinterpret_cast<uint8_t*>(pCommand) - offsetof(Slot, command));
+
+    // Once published the slot may be consumed, released and claimed again,
+    // so nothing in it is read after the store
+    bool valid = pSlot->valid;
+    pSlot->sequence.store(pSlot->position + 1, std::memory_order_release);
+
+    if (valid) {
+        m_stats.enqueued.fetch_add(1, std::memory_order_relaxed);
+        uint64_t currentDepth = depth();
+        uint64_t maxDepth = m_stats.maxDepth.load(std::memory_order_relaxed);
+        while (currentDepth > maxDepth &&
+               !m_stats.maxDepth.compare_exchange_weak(maxDepth, currentDepth, std::memory_order_relaxed)) {
+        }
+    }
+
+    sem_post(&m_ready);
+}
+
+/**
+ * Returns a claimed slot unused. The slot is still published so the ring
+ * order is kept; the consumer skips it.
+ *
+ * @param pCommand Slot returned by claim().
+ */
+void CommandQueue::abandon(QueuedCommand* pCommand) {
+    Slot* pSlot = reinterpret_cast<Slot*>(reinterpret_cast<uint8_t*>(pCommand) - offsetof(Slot, command));
+    pSlot->valid = false;
+    publish(pCommand);
+}
+
+/**
+ * Waits for the next published command.
+ *
+ * @param timeoutMs Maximum time to wait.
+ * @return QueuedCommand* Oldest command, nullptr on timeout or wake().
+ */
+QueuedCommand* CommandQueue::wait(int timeoutMs) {
+    while (true) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        if (sem_clockwait(&m_ready, CLOCK_MONOTONIC, &deadline) != 0) {
+            return nullptr;
+        }
+
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        Slot& slot = m_slots[pos & (Capacity - 1)];
+
+        // The head may be claimed by a producer that has not published yet
+        // while a later slot is already published. The producer may have
+        // been preempted on this core, and sched_yield() never runs a lower
+        // priority thread under SCHED_FIFO, so sleep until it publishes.
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != pos + 1) {
+            if (m_enqueuePos.load(std::memory_order_relaxed) == pos) {
+                return nullptr;     // Woken by wake(), nothing queued
+            }
+            const struct timespec pause = { 0, PublishWaitNs };
+            while (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+                clock_nanosleep(CLOCK_MONOTONIC, 0, &pause, nullptr);
+            }
+        }
+
+        if (!slot.valid) {
+            release(&slot.command);
+            continue;
+        }
+
+        uint64_t delayNs = ThreadUtils::monotonicNs() - slot.command.receivedNs;
+        m_stats.executed.fetch_add(1, std::memory_order_relaxed);
+        m_stats.totalDelayNs.fetch_add(delayNs, std::memory_order_relaxed);
+        uint64_t maxDelayNs = m_stats.maxDelayNs.load(std::memory_order_relaxed);
+        while (delayNs > maxDelayNs &&
+               !m_stats.maxDelayNs.compare_exchange_weak(maxDelayNs, delayNs, std::memory_order_relaxed)) {
+        }
+
+        return &slot.command;
+    }
+}
+
+/**
+ * Frees the slot of a command returned by wait().
+ *
+ * @param pCommand Command returned by wait().
+ */
+void CommandQueue::release(QueuedCommand* pCommand) {
+    Slot* pSlot = reinterpret_cast<Slot*>(reinterpret_cast<uint8_t*>(pCommand) - offsetof(Slot, command));
+    size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+    pSlot->sequence.store(pos + Capacity, std::memory_order_release);
+    m_dequeuePos.store(pos + 1, std::memory_order_relaxed);
+}
+
+/**
+ * Wakes the consumer, e.g. to let it observe an exit request.
+ */
+void CommandQueue::wake() {
+    sem_post(&m_ready);
+}
+
+/**
+ * Number of commands claimed but not yet released by the consumer.
+ *
+ * @return size_t Current queue depth.
+ */
+size_t CommandQueue::depth() const {
+    size_t dequeued = m_dequeuePos.load(std::memory_order_relaxed);
+    size_t enqueued = m_enqueuePos.load(std::memory_order_relaxed);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
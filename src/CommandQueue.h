@@ -0,0 +1,78 @@
+/**
+* Bounded multi-producer, single-consumer queue of decoded commands. The
+* websocket service threads only validate and enqueue; the control thread
+* dequeues and runs the handlers, so blocking hardware writes never stall
+* websocket I/O. Producers never block: a full queue rejects the command.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <semaphore.h>
+#include "CommandRegistry.h"
+
+//! One decoded command waiting for the control thread
+struct QueuedCommand {
+    CommandId      id;                      //! Registered command
+    uint32_t       sessionId;               //! Session that sent the command, 0 if none
+    uint32_t       sequence;                //! Client sequence number echoed in the ack
+    bool           binary;                  //! Received on ws-protocol-binary, acked in binary
+    uint64_t       receivedNs;              //! Monotonic time the frame was received
+    uint64_t       decodedNs;               //! Monotonic time the payload was decoded
+    CommandPayload payload;                 //! Decoded typed payload
+};
+
+//! Queue depth and queueing delay, readable from any thread
+struct CommandQueueStats {
+    std::atomic<uint64_t> enqueued{0};      //! Commands accepted
+    std::atomic<uint64_t> rejected{0};      //! Commands refused because the queue was full
+    std::atomic<uint64_t> executed{0};      //! Commands dequeued by the consumer
+    std::atomic<uint64_t> maxDepth{0};      //! Deepest the queue has been
+    std::atomic<uint64_t> totalDelayNs{0};  //! Sum of receive-to-dequeue delays
+    std::atomic<uint64_t> maxDelayNs{0};    //! Worst receive-to-dequeue delay
+};
+
+class CommandQueue {
+public:
+    static constexpr size_t Capacity = 256;     //! Slots, power of two
+    static constexpr long PublishWaitNs = 20000; //! Sleep while the head slot is claimed but unpublished
+
+    CommandQueue();
+    ~CommandQueue();
+
+    //! Claim a slot to decode a command into. Returns nullptr if the queue is full.
+    QueuedCommand* claim();
+
+    //! Publish a claimed slot to the consumer
+    void publish(QueuedCommand* pCommand);
+
+    //! Give a claimed slot back without publishing it, e.g. when decoding fails
+    void abandon(QueuedCommand* pCommand);
+
+    //! Wait up to timeoutMs for a command. The returned slot stays owned by
+    //! the consumer until release() is called.
+    QueuedCommand* wait(int timeoutMs);
+    void release(QueuedCommand* pCommand);
+
+    //! Wake a consumer blocked in wait()
+    void wake();
+
+    size_t depth() const;
+    const CommandQueueStats& stats() const { return m_stats; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;       //! Ring slot sequence number
+        size_t              position;       //! Ring position claimed by the producer
+        bool                valid;          //! False if the producer abandoned the slot
+        QueuedCommand       command;
+    };
+
+    Slot*               m_slots;            //! Ring storage
+    std::atomic<size_t> m_enqueuePos{0};    //! Next position for producers
+    std::atomic<size_t> m_dequeuePos{0};    //! Next position for the consumer
+    sem_t               m_ready;            //! Counts published slots
+    CommandQueueStats   m_stats;
+};
@@ -0,0 +1,175 @@
+#include "CommandRegistry.h"
+#include "Logger.h"
+
+using json = nlohmann::json;
+
+/**
+ * Adds a command, replacing the handler if the name is already registered.
+ *
+ * @param entry Command name, decoder and handler.
+ * @return CommandId Id of the command.
+ */
+CommandId CommandRegistry::addEntry(Entry&& entry) {
+    CommandId id;
+    auto it = m_ids.find(entry.name);
+    if (it != m_ids.end()) {
+        id = it->second;
+        if (m_entries[id].opcode != NoOpcode) {
+            m_opcodes[m_entries[id].opcode] = InvalidCommandId;
+        }
+        m_entries[id] = std::move(entry);
+    } else {
+        id = (CommandId)m_entries.size();
+        m_ids.emplace(entry.name, id);
+        m_entries.push_back(std::move(entry));
+    }
+
+    uint16_t opcode = m_entries[id].opcode;
+    if (opcode != NoOpcode) {
+        if (m_opcodes[opcode] != InvalidCommandId && m_opcodes[opcode] != id) {
+            LOG_WARN("CommandRegistry: opcode 0x%02x of %s replaces %s", opcode,
+                m_entries[id].name.c_str(), m_entries[m_opcodes[opcode]].name.c_str());
+            m_entries[m_opcodes[opcode]].opcode = NoOpcode;
+            m_entries[m_opcodes[opcode]].decodeBinary = nullptr;
+        }
+        m_opcodes[opcode] = id;
+    }
+    return id;
+}
+
+/**
+ * Resolves a command name to its id.
+ *
+ * @param name Command name from the message.
+ * @return CommandId Id of the command, InvalidCommandId if unknown.
+ */
+CommandId CommandRegistry::resolve(std::string_view name) const {
+    auto it = m_ids.find(name);
+    return (it != m_ids.end()) ? it->second : InvalidCommandId;
+}
+
+/**
+ * Decodes a message into the typed payload of a command.
+ *
+ * @param id Command id.
+ * @param message Parsed message.
+ * @param payload Storage receiving the typed payload.
+ * @return bool False if the message does not match the payload.
+ */
+bool CommandRegistry::decode(CommandId id, const json& message, CommandPayload& payload) const {
+    if (id >= m_entries.size()) {
+        return false;
+    }
+
+    try {
+        m_entries[id].decode(message, payload);
+    } catch (const std::exception& e) {
+        LOG_WARN("CommandRegistry: invalid %s payload: %s", m_entries[id].name.c_str(), e.what());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Decodes a command from the JSON text of its message.
+ *
+ * @param id Command id.
+ * @param pData Message text, not necessarily terminated.
+ * @param size Length of the text.
+ * @param payload Storage receiving the typed payload.
+ * @return bool False if the message does not match the payload.
+ */
+bool CommandRegistry::decode(CommandId id, const char* pData, size_t size, CommandPayload& payload) const {
+    if (id >= m_entries.size()) {
+        return false;
+    }
+
+    const Entry& entry = m_entries[id];
+    if (entry.decodeField) {
+        uint64_t found = 0;
+        entry.initFields(payload);
+        JsonExtract result = extractJson(pData, size, [&](const JsonPath& path, const JsonScalar& value) {
+            return entry.decodeField(path, value, payload, found);
+        });
+
+        if (result != JsonExtract::Done || !entry.doneFields(payload, found)) {
+            LOG_WARN("CommandRegistry: invalid %s payload", entry.name.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    json message = json::parse(pData, pData + size, nullptr, false);
+    return !message.is_discarded() && decode(id, message, payload);
+}
+
+/**
+ * Decodes a binary message body into the typed payload of a command.
+ *
+ * @param id Command id.
+ * @param pData Payload bytes following the command header.
+ * @param size Number of payload bytes.
+ * @param payload Storage receiving the typed payload.
+ * @return bool False if the command has no binary encoding or the data does not match it.
+ */
+bool CommandRegistry::decode(CommandId id, const uint8_t* pData, size_t size, CommandPayload& payload) const {
+    if (id >= m_entries.size() || !m_entries[id].decodeBinary) {
+        return false;
+    }
+
+    return m_entries[id].decodeBinary(pData, size, payload);
+}
+
+/**
+ * Runs the handler of a command.
+ *
+ * @param id Command id.
+ * @param payload Payload produced by decode().
+ */
+void CommandRegistry::invoke(CommandId id, const CommandPayload& payload) const {
+    if (id < m_entries.size() && m_entries[id].invoke) {
+        m_entries[id].invoke(payload);
+    }
+}
+
+/**
+ * Resolves the command named by a message.
+ *
+ * @param message Parsed message with a "command" string field.
+ * @return CommandId Id of the command, InvalidCommandId if missing or unknown.
+ */
+CommandId CommandRegistry::identify(const json& message) const {
+    auto it = message.find("command");
+    if (it == message.end() || !it->is_string()) {
+        return InvalidCommandId;
+    }
+
+    return resolve(it->get_ref<const std::string&>());
+}
+
+/**
+ * Resolves, decodes and runs the command named by a message.
+ *
+ * @param message Parsed message with a "command" string field.
+ * @return CommandId Dispatched command, InvalidCommandId if none.
+ */
+CommandId CommandRegistry::dispatch(const json& message) const {
+    CommandId id = identify(message);
+    if (id == InvalidCommandId) {
+        return InvalidCommandId;
+    }
+
+    CommandPayload payload;
+    if (!decode(id, message, payload)) {
+        return InvalidCommandId;
+    }
+
+    invoke(id, payload);
+    return id;
+}
+
+void CommandRegistry::clear() {
+    m_entries.clear();
+    m_ids.clear();
+    m_opcodes = makeOpcodeTable();
+}
@@ -0,0 +1,234 @@
+/**
+* Registry of websocket commands. Command names are resolved to integer ids
+* once at registration; each command decodes its message into its own typed
+* payload, which is passed to the handler as an argument. Payloads live in
+* fixed inline storage so decoding and dispatch do not allocate.
+*
+* Payload types that provide from_json_field() are decoded while the message
+* is parsed, without building a DOM (see JsonExtractor); others fall back to
+* nlohmann's from_json on a parsed message.
+*
+* Payload types with a BinaryOpcode are also reachable through that opcode
+* and decoded with their from_binary() from a compact binary message.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "JsonExtractor.h"
+
+typedef uint16_t CommandId;
+static constexpr CommandId InvalidCommandId = 0xFFFF;
+
+//! Inline storage for one decoded command payload
+struct CommandPayload {
+    static constexpr size_t Capacity = 128;
+
+    template <class T>
+    T& as() { return *std::launder(reinterpret_cast<T*>(bytes)); }
+
+    template <class T>
+    const T& as() const { return *std::launder(reinterpret_cast<const T*>(bytes)); }
+
+    alignas(8) uint8_t bytes[Capacity];
+};
+
+//! True for payload types that declare a BinaryOpcode
+template <class T, class = void>
+struct HasBinaryOpcode : std::false_type {};
+
+template <class T>
+struct HasBinaryOpcode<T, std::void_t<decltype(T::BinaryOpcode)>> : std::true_type {};
+
+//! True for payload types decoded field by field while parsing:
+//! bool from_json_field(const JsonPath&, const JsonScalar&, T&, uint64_t& found) stores one field
+//! and sets its bit in found, bool from_json_done(const T&, uint64_t found) checks the result.
+template <class T, class = void>
+struct HasJsonFields : std::false_type {};
+
+template <class T>
+struct HasJsonFields<T, std::void_t<decltype(from_json_field(std::declval<const JsonPath&>(),
+    std::declval<const JsonScalar&>(), std::declval<T&>(), std::declval<uint64_t&>()))>> : std::true_type {};
+
+class CommandRegistry {
+public:
+    static constexpr uint16_t NoOpcode = 0xFFFF;
+
+    //! Register a handler for a command. T is decoded from the message with
+    //! nlohmann's from_json and must be trivially copyable so it fits the
+    //! inline payload storage. If T declares a BinaryOpcode it is also
+    //! decoded from binary messages with from_binary(pData, size, T&).
+    template <class T>
+    CommandId add(const std::string& name, std::function<void(const T&)> handler)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Command payloads must be trivially copyable");
+        static_assert(sizeof(T) <= CommandPayload::Capacity, "Command payload too large");
+        static_assert(alignof(T) <= 8, "Command payload over-aligned");
+
+        Entry entry;
+        entry.name = name;
+        entry.decode = [](const nlohmann::json& message, CommandPayload& payload) {
+            T* pValue = new (payload.bytes) T();
+            message.get_to(*pValue);
+        };
+
+        if constexpr (HasJsonFields<T>::value) {
+            entry.initFields = [](CommandPayload& payload) {
+                new (payload.bytes) T();
+            };
+            entry.decodeField = [](const JsonPath& path, const JsonScalar& value, CommandPayload& payload,
+                uint64_t& found) {
+                return from_json_field(path, value, payload.as<T>(), found);
+            };
+            entry.doneFields = [](const CommandPayload& payload, uint64_t found) {
+                return from_json_done(payload.as<T>(), found);
+            };
+        }
+
+        entry.invoke = [handler = std::move(handler)](const CommandPayload& payload) {
+            handler(payload.as<T>());
+        };
+
+        if constexpr (HasBinaryOpcode<T>::value) {
+            entry.opcode = T::BinaryOpcode;
+            entry.decodeBinary = [](const uint8_t* pData, size_t size, CommandPayload& payload) {
+                T* pValue = new (payload.bytes) T();
+                return from_binary(pData, size, *pValue);
+            };
+        }
+
+        return addEntry(std::move(entry));
+    }
+
+    //! Resolve a command name to its id, InvalidCommandId if unknown
+    CommandId resolve(std::string_view name) const;
+
+    //! Resolve a binary opcode to its command id, InvalidCommandId if unknown
+    CommandId resolveOpcode(uint8_t opcode) const { return m_opcodes[opcode]; }
+
+    //! Name of a registered command
+    const std::string& name(CommandId id) const { return m_entries[id].name; }
+
+    //! Binary opcode of a registered command, NoOpcode if it has none
+    uint16_t opcode(CommandId id) const { return m_entries[id].opcode; }
+
+    //! Decode a message into the typed payload of a command.
+    //! Returns false if the message does not match the payload.
+    bool decode(CommandId id, const nlohmann::json& message, CommandPayload& payload) const;
+
+    //! Decode a command from its JSON text. Streams the fields if the payload
+    //! supports it, otherwise parses the message and uses from_json.
+    //! Returns false if the message does not match the payload.
+    bool decode(CommandId id, const char* pData, size_t size, CommandPayload& payload) const;
+
+    //! Outcome of decodeMessage()
+    enum class DecodeStatus {
+        Ok,             //! Payload decoded
+        Unknown,        //! No "command" field or no such command
+        Invalid,        //! The message does not match the payload of the command
+        Malformed       //! Not valid JSON
+    };
+
+    //! Resolve the "command" field of JSON text and decode its payload while
+    //! the text is parsed. When "command" comes first this is a single pass;
+    //! fields before it cost a second pass. other(path, value) sees every
+    //! scalar, e.g. to pick up a sequence number. id receives the command, if known.
+    template <class Other>
+    DecodeStatus decodeMessage(const char* pData, size_t size, CommandPayload& payload, CommandId& id,
+        Other&& other) const
+    {
+        const Entry* pEntry = nullptr;
+        uint64_t found = 0;
+        bool invalidField = false;
+        bool missedFields = false;      // Fields came before the payload type was known
+
+        id = InvalidCommandId;
+        JsonExtract result = extractJson(pData, size, [&](const JsonPath& path, const JsonScalar& value) {
+            other(path, value);
+            if (path.is("command")) {
+                if (id == InvalidCommandId && value.type == JsonScalar::Type::String) {
+                    id = resolve(value.string);
+                    if (id != InvalidCommandId && m_entries[id].decodeField) {
+                        pEntry = &m_entries[id];
+                        pEntry->initFields(payload);
+                    }
+                }
+                return true;
+            }
+            if (!pEntry) {
+                missedFields = true;
+                return true;
+            }
+            if (!pEntry->decodeField(path, value, payload, found)) {
+                invalidField = true;
+                return false;
+            }
+            return true;
+        });
+
+        if (result == JsonExtract::Invalid) {
+            return DecodeStatus::Malformed;
+        }
+        if (id == InvalidCommandId) {
+            return DecodeStatus::Unknown;
+        }
+        if (!invalidField && pEntry && !missedFields && pEntry->doneFields(payload, found)) {
+            return DecodeStatus::Ok;
+        }
+        if (!invalidField && decode(id, pData, size, payload)) {
+            return DecodeStatus::Ok;
+        }
+        return DecodeStatus::Invalid;
+    }
+
+    //! Decode the binary payload of a command. Returns false if the command
+    //! has no binary encoding or the data does not match it.
+    bool decode(CommandId id, const uint8_t* pData, size_t size, CommandPayload& payload) const;
+
+    //! Run the handler of a command with an already decoded payload
+    void invoke(CommandId id, const CommandPayload& payload) const;
+
+    //! Resolve the "command" field of a message, InvalidCommandId if missing or unknown
+    CommandId identify(const nlohmann::json& message) const;
+
+    //! Resolve the "command" field of a message, decode it and run its handler.
+    //! Returns the command id, or InvalidCommandId if nothing was dispatched.
+    CommandId dispatch(const nlohmann::json& message) const;
+
+    void clear();
+
+private:
+    struct Entry {
+        std::string name;
+        void (*decode)(const nlohmann::json& message, CommandPayload& payload);
+        void (*initFields)(CommandPayload& payload) = nullptr;
+        bool (*decodeField)(const JsonPath& path, const JsonScalar& value, CommandPayload& payload,
+            uint64_t& found) = nullptr;
+        bool (*doneFields)(const CommandPayload& payload, uint64_t found) = nullptr;
+        bool (*decodeBinary)(const uint8_t* pData, size_t size, CommandPayload& payload) = nullptr;
+        uint16_t opcode = NoOpcode;
+        std::function<void(const CommandPayload&)> invoke;
+    };
+
+    CommandId addEntry(Entry&& entry);
+
+    std::vector<Entry>                             m_entries;   //! Indexed by CommandId
+    std::map<std::string, CommandId, std::less<>>  m_ids;       //! Name lookup without temporaries
+    std::array<CommandId, 256>                     m_opcodes = makeOpcodeTable(); //! Indexed by binary opcode
+
+    static std::array<CommandId, 256> makeOpcodeTable() {
+        std::array<CommandId, 256> table;
+        table.fill(InvalidCommandId);
+        return table;
+    }
+};
@@ -0,0 +1,116 @@
+#include "CommandTrace.h"
+#include <cstdio>
+
+using namespace std;
+
+//! Percentiles reported for every stage
+static const double ReportedPercentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+/**
+ * Records the time between each reached stage and the one before it. Stages
+ * the command did not reach, such as the PWM stages of an io-query, are
+ * skipped rather than recorded as zero.
+ */
+void CommandTrace::end() {
+    Trace& trace = m_current;
+    if (!trace.active) {
+        return;
+    }
+    trace.stamps[(size_t)TraceStage::Completed] = ThreadUtils::monotonicNs();
+    trace.active = false;
+
+    uint64_t previousNs = trace.stamps[(size_t)TraceStage::Received];
+    for (size_t i = 1; i < StageCount; i++) {
+        uint64_t stampNs = trace.stamps[i];
+        if (stampNs == 0) {
+            continue;
+        }
+        m_stages[i].record(stampNs >= previousNs ? stampNs - previousNs : 0);
+        previousNs = stampNs;
+    }
+    m_total.record(trace.stamps[(size_t)TraceStage::Completed] - trace.stamps[(size_t)TraceStage::Received]);
+}
+
+const char* CommandTrace::intervalName(TraceStage stage) {
+    switch (stage) {
+    case TraceStage::Received:      return "receive";
+    case TraceStage::Decoded:       return "decode";
+    case TraceStage::Dispatched:    return "queue";
+    case TraceStage::IoSet:         return "handler";
+    case TraceStage::PwmStart:      return "io";
+    case TraceStage::PwmEnd:        return "pwm-write";
+    case TraceStage::Completed:     return "complete";
+    case TraceStage::Count:         break;
+    }
+    return "";
+}
+
+/**
+ * Formats one histogram as a JSON object with microsecond values.
+ *
+ * @param out String receiving the object.
+ * @param histogram Histogram to format.
+ */
+static void appendJson(string& out, const LatencyHistogram& histogram) {
+    char buffer[192];
+    snprintf(buffer, sizeof(buffer), "{\"count\":%llu,\"meanUs\":%.1f,\"p50Us\":%.1f,\"p90Us\":%.1f,"
+        "\"p99Us\":%.1f,\"p999Us\":%.1f,\"maxUs\":%.1f}",
+        (unsigned long long)histogram.count(), histogram.mean() / 1000.0,
+        histogram.percentile(ReportedPercentiles[0]) / 1000.0, histogram.percentile(ReportedPercentiles[1]) / 1000.0,
+        histogram.percentile(ReportedPercentiles[2]) / 1000.0, histogram.percentile(ReportedPercentiles[3]) / 1000.0,
+        histogram.max() / 1000.0);
+    out += buffer;
+}
+
+/**
+ * Reports every stage, named after the interval it ends, e.g. "queue" is the
+ * time from Decoded to Dispatched.
+ *
+ * @return std::string {"latency": {"decode": {...}, ..., "total": {...}}}
+ */
+string CommandTrace::reportJson() {
+    string out = "{\"latency\":{";
+    for (size_t i = 1; i < StageCount; i++) {
+        out += '"';
+        out += intervalName((TraceStage)i);
+        out += "\":";
+        appendJson(out, m_stages[i]);
+        out += ',';
+    }
+    out += "\"total\":";
+    appendJson(out, m_total);
+    out += "}}";
+    return out;
+}
+
+string CommandTrace::reportText() {
+    char line[160];
+    string out;
+    snprintf(line, sizeof(line), "%-10s %10s %10s %10s %10s %10s %10s %10s\n",
+        "stage (us)", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    out += line;
+
+    auto appendLine = [&out, &line](const char* name, const LatencyHistogram& histogram) {
+        snprintf(line, sizeof(line), "%-10s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            name, (unsigned long long)histogram.count(), histogram.mean() / 1000.0,
+            histogram.percentile(ReportedPercentiles[0]) / 1000.0,
+            histogram.percentile(ReportedPercentiles[1]) / 1000.0,
+            histogram.percentile(ReportedPercentiles[2]) / 1000.0,
+            histogram.percentile(ReportedPercentiles[3]) / 1000.0,
+            histogram.max() / 1000.0);
+        out += line;
+    };
+
+    for (size_t i = 1; i < StageCount; i++) {
+        appendLine(intervalName((TraceStage)i), m_stages[i]);
+    }
+    appendLine("total", m_total);
+    return out;
+}
+
+void CommandTrace::reset() {
+    for (LatencyHistogram& histogram : m_stages) {
+        histogram.reset();
+    }
+    m_total.reset();
+}
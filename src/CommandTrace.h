@@ -0,0 +1,86 @@
+/**
+* End-to-end latency tracing of websocket commands. Every command carries
+* monotonic timestamps of the stages it passes, from the lws receive callback
+* to the duty cycle landing in sysfs. The control thread opens a trace before
+* running a command's handler, the IO and PWM layers stamp their stages into
+* it through a thread local, and the time between consecutive stages is
+* recorded in one LatencyHistogram per stage.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "LatencyHistogram.h"
+#include "ThreadUtils.h"
+
+//! Stages of a command, in the order they are reached
+enum class TraceStage : uint8_t {
+    Received    = 0,        //! lws receive callback
+    Decoded     = 1,        //! Payload parsed into its queue slot
+    Dispatched  = 2,        //! Control thread starts the handler
+    IoSet       = 3,        //! IO::setPoint() entered
+    PwmStart    = 4,        //! PWM::setDutyCycle() entered
+    PwmEnd      = 5,        //! Duty cycle written to sysfs
+    Completed   = 6,        //! Handler returned
+    Count       = 7
+};
+
+class CommandTrace {
+public:
+    static constexpr size_t StageCount = (size_t)TraceStage::Count;
+
+    //! Open a trace on the calling thread for a command received and decoded
+    //! at the given times; stamps Dispatched
+    static void begin(uint64_t receivedNs, uint64_t decodedNs) {
+        Trace& trace = m_current;
+        for (uint64_t& stamp : trace.stamps) {
+            stamp = 0;
+        }
+        trace.stamps[(size_t)TraceStage::Received] = receivedNs;
+        trace.stamps[(size_t)TraceStage::Decoded] = decodedNs;
+        trace.stamps[(size_t)TraceStage::Dispatched] = ThreadUtils::monotonicNs();
+        trace.active = true;
+    }
+
+    //! Stamp a stage of the command running on the calling thread. Only the
+    //! first stamp of a stage counts, e.g. the first IO of a batch. Does
+    //! nothing outside a command, such as IO changes at startup.
+    static void mark(TraceStage stage) {
+        Trace& trace = m_current;
+        if (trace.active && trace.stamps[(size_t)stage] == 0) {
+            trace.stamps[(size_t)stage] = ThreadUtils::monotonicNs();
+        }
+    }
+
+    //! Stamp Completed, close the trace and record its stage latencies
+    static void end();
+
+    //! Time from the previous stage the command reached to stage
+    static const LatencyHistogram& stageLatency(TraceStage stage) { return m_stages[(size_t)stage]; }
+    //! Time from Received to Completed
+    static const LatencyHistogram& totalLatency() { return m_total; }
+
+    //! Name of the interval ending at stage, e.g. "queue" for Decoded to Dispatched
+    static const char* intervalName(TraceStage stage);
+
+    //! Percentiles of every stage in microseconds, as a JSON object
+    static std::string reportJson();
+    //! Percentiles of every stage in microseconds, as a table for the console
+    static std::string reportText();
+
+    //! Forget the recorded latencies
+    static void reset();
+
+private:
+    //! Zero initialized, as a thread local
+    struct Trace {
+        bool     active;                            //! A command is running
+        uint64_t stamps[StageCount];                //! 0 where the stage was not reached
+    };
+
+    inline static thread_local Trace m_current;     //! Command running on this thread
+    inline static LatencyHistogram   m_stages[StageCount];  //! Indexed by the stage ending the interval
+    inline static LatencyHistogram   m_total;
+};
@@ -0,0 +1,210 @@
+/**
+* Typed payloads of the websocket commands. Each payload is decoded from its
+* message by the CommandRegistry and handed to the command handler.
+*
+* from_json_field() stores one field as the message is parsed and marks it in
+* a found mask; from_json_done() checks that the required fields arrived.
+*
+* A payload with a BinaryOpcode can also be sent on ws-protocol-binary as a
+* BinaryProtocol::CommandHeader followed by the little endian layout listed
+* with it; from_binary() decodes that layout and returns false if the size
+* does not match.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <nlohmann/json.hpp>
+#include "JsonExtractor.h"
+
+//! {"command": "pwm-control", "index": n}
+//! Binary: uint32_t index
+struct PwmControlCommand {
+    static constexpr uint8_t BinaryOpcode = 0x01;
+
+    uint32_t index;     //! Index into the setPoints of the PWM IO
+};
+
+inline void from_json(const nlohmann::json& j, PwmControlCommand& command) {
+    j.at("index").get_to(command.index);
+}
+
+inline bool from_json_field(const JsonPath& path, const JsonScalar& value, PwmControlCommand& command,
+    uint64_t& found) {
+    if (path.is("index")) {
+        found |= 1;
+        return value.get(command.index);
+    }
+    return true;
+}
+
+inline bool from_json_done(const PwmControlCommand&, uint64_t found) {
+    return found == 1;
+}
+
+inline bool from_binary(const uint8_t* pData, size_t size, PwmControlCommand& command) {
+    if (size != sizeof(uint32_t)) {
+        return false;
+    }
+    memcpy(&command.index, pData, sizeof(uint32_t));
+    return true;
+}
+
+//! {"command": "io-set", "io": n, "index": k}
+//! Binary: uint16_t io, uint16_t index
+struct IoSetCommand {
+    static constexpr uint8_t BinaryOpcode = 0x02;
+
+    uint16_t io;        //! IO number
+    uint16_t index;     //! Index into the setPoints of the IO
+};
+
+inline void from_json(const nlohmann::json& j, IoSetCommand& command) {
+    j.at("io").get_to(command.io);
+    j.at("index").get_to(command.index);
+}
+
+inline bool from_json_field(const JsonPath& path, const JsonScalar& value, IoSetCommand& command,
+    uint64_t& found) {
+    if (path.is("io")) {
+        found |= 1;
+        return value.get(command.io);
+    }
+    if (path.is("index")) {
+        found |= 2;
+        return value.get(command.index);
+    }
+    return true;
+}
+
+inline bool from_json_done(const IoSetCommand&, uint64_t found) {
+    return found == 3;
+}
+
+inline bool from_binary(const uint8_t* pData, size_t size, IoSetCommand& command) {
+    if (size != 2 * sizeof(uint16_t)) {
+        return false;
+    }
+    memcpy(&command.io, pData, sizeof(uint16_t));
+    memcpy(&command.index, pData + sizeof(uint16_t), sizeof(uint16_t));
+    return true;
+}
+
+//! {"command": "io-batch", "updates": [{"io": n, "index": k}, ...]}
+//! io is the number n of the "IO<n>" configuration key.
+//! Binary: uint8_t count, then count times {uint16_t io, uint16_t index}
+struct IoBatchCommand {
+    static constexpr uint8_t BinaryOpcode = 0x03;
+    static constexpr size_t MaxUpdates = 24;
+
+    struct Update {
+        uint16_t io;        //! IO number
+        uint16_t index;     //! Index into the setPoints of the IO
+    };
+
+    uint32_t count;
+    Update   updates[MaxUpdates];
+};
+
+inline void from_json(const nlohmann::json& j, IoBatchCommand& command) {
+    const auto& updates = j.at("updates");
+    if (!updates.is_array() || updates.size() > IoBatchCommand::MaxUpdates) {
+        throw std::length_error("io-batch holds at most 24 updates");
+    }
+
+    command.count = 0;
+    for (const auto& update : updates) {
+        update.at("io").get_to(command.updates[command.count].io);
+        update.at("index").get_to(command.updates[command.count].index);
+        command.count++;
+    }
+}
+
+//! Bits 2n and 2n+1 of found mark the io and index of update n
+inline bool from_json_field(const JsonPath& path, const JsonScalar& value, IoBatchCommand& command,
+    uint64_t& found) {
+    size_t n;
+    if (path.is("updates", n, "io")) {
+        if (n >= IoBatchCommand::MaxUpdates) {
+            return false;
+        }
+        found |= 1ull << (2 * n);
+        command.count = std::max(command.count, (uint32_t)n + 1);
+        return value.get(command.updates[n].io);
+    }
+    if (path.is("updates", n, "index")) {
+        if (n >= IoBatchCommand::MaxUpdates) {
+            return false;
+        }
+        found |= 2ull << (2 * n);
+        command.count = std::max(command.count, (uint32_t)n + 1);
+        return value.get(command.updates[n].index);
+    }
+    return true;
+}
+
+inline bool from_json_done(const IoBatchCommand& command, uint64_t found) {
+    return found == (1ull << (2 * command.count)) - 1;
+}
+
+inline bool from_binary(const uint8_t* pData, size_t size, IoBatchCommand& command) {
+    if (size < 1 || pData[0] > IoBatchCommand::MaxUpdates || size != 1 + (size_t)pData[0] * 4) {
+        return false;
+    }
+
+    command.count = pData[0];
+    const uint8_t* pUpdate = pData + 1;
+    for (uint32_t i = 0; i < command.count; i++, pUpdate += 4) {
+        memcpy(&command.updates[i].io, pUpdate, sizeof(uint16_t));
+        memcpy(&command.updates[i].index, pUpdate + sizeof(uint16_t), sizeof(uint16_t));
+    }
+    return true;
+}
+
+//! {"command": "io-query"}
+//! Binary: no payload. The next telemetry frame carries the state of every IO.
+struct IoQueryCommand {
+    static constexpr uint8_t BinaryOpcode = 0x04;
+};
+
+inline void from_json(const nlohmann::json&, IoQueryCommand&) {
+}
+
+inline bool from_json_field(const JsonPath&, const JsonScalar&, IoQueryCommand&, uint64_t&) {
+    return true;
+}
+
+inline bool from_json_done(const IoQueryCommand&, uint64_t) {
+    return true;
+}
+
+inline bool from_binary(const uint8_t*, size_t size, IoQueryCommand&) {
+    return size == 0;
+}
+
+//! {"command": "latency-report", "reset": false}
+//! Replies with CommandTrace::reportJson() to the sender; "reset" then clears
+//! the recorded latencies. JSON only.
+struct LatencyReportCommand {
+    bool reset;         //! Clear the latencies after reporting
+};
+
+inline void from_json(const nlohmann::json& j, LatencyReportCommand& command) {
+    command.reset = j.value("reset", false);
+}
+
+inline bool from_json_field(const JsonPath& path, const JsonScalar& value, LatencyReportCommand& command,
+    uint64_t&) {
+    if (path.is("reset")) {
+        return value.get(command.reset);
+    }
+    return true;
+}
+
+inline bool from_json_done(const LatencyReportCommand&, uint64_t) {
+    return true;
+}
@@ -0,0 +1,67 @@
+/**
+* CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320), the same checksum as
+* zlib's crc32() and most browser libraries, so clients can use any of them.
+* Table driven, slicing by 4 bytes.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace Crc32
+{
+    namespace Detail
+    {
+        typedef std::array<std::array<uint32_t, 256>, 4> Tables;
+
+        constexpr Tables makeTables()
+        {
+            Tables tables{};
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : (crc >> 1);
+                }
+                tables[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; i++) {
+                for (size_t t = 1; t < 4; t++) {
+                    uint32_t previous = tables[t - 1][i];
+                    tables[t][i] = (previous >> 8) ^ tables[0][previous & 0xFF];
+                }
+            }
+            return tables;
+        }
+
+        inline constexpr Tables tables = makeTables();
+    }
+
+    //! Continue a CRC over more data; start with crc = 0
+    inline uint32_t update(uint32_t crc, const void* data, size_t size)
+    {
+        const uint8_t* pBytes = static_cast<const uint8_t*>(data);
+        const auto& t = Detail::tables;
+        crc = ~crc;
+
+        while (size >= 4) {
+            crc ^= (uint32_t)pBytes[0] | ((uint32_t)pBytes[1] << 8) |
+                   ((uint32_t)pBytes[2] << 16) | ((uint32_t)pBytes[3] << 24);
+            crc = t[3][crc & 0xFF] ^ t[2][(crc >> 8) & 0xFF] ^
+                  t[1][(crc >> 16) & 0xFF] ^ t[0][crc >> 24];
+            pBytes += 4;
+            size -= 4;
+        }
+        while (size-- > 0) {
+            crc = (crc >> 8) ^ t[0][(crc ^ *pBytes++) & 0xFF];
+        }
+
+        return ~crc;
+    }
+
+    inline uint32_t compute(const void* data, size_t size)
+    {
+        return update(0, data, size);
+    }
+}
@@ -0,0 +1,25 @@
+#include "HardwareBackend.h"
+#include "SysfsBackend.h"
+#include "ChardevBackend.h"
+#include "SimulatedBackend.h"
+#include <stdexcept>
+
+/**
+ * @brief Creates the backend selected in the settings
+ *
+ * @param settings Hardware section of settings.json
+ * @return std::unique_ptr<HardwareBackend> The backend
+ * @throws std::runtime_error if the backend name is unknown
+ */
+std::unique_ptr<HardwareBackend> HardwareBackend::create(const Settings::Hardware& settings) {
+    if (settings.backend == "chardev") {
+        return std::make_unique<ChardevBackend>(settings.pwmBaseDir, settings.gpioDevDir);
+    }
+    if (settings.backend == "sysfs") {
+        return std::make_unique<SysfsBackend>(settings.pwmBaseDir, settings.gpioBaseDir);
+    }
+    if (settings.backend == "simulated") {
+        return std::make_unique<SimulatedBackend>();
+    }
+    throw std::runtime_error("Unknown hardware backend: " + settings.backend);
+}
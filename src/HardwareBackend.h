@@ -0,0 +1,57 @@
+/**
+* Hardware backends under PWM and GPIIO. A backend opens the PWM channels and
+* GPIO lines of the IOs; SysfsBackend drives the Linux sysfs interfaces of the
+* Jetson and SimulatedBackend keeps the outputs in memory, so the control path
+* can be run and measured on any Linux machine. ChardevBackend drives the
+* GPIOs through the GPIO character device instead of sysfs. The backend is selected by
+* the "Hardware" section of settings.json.
+*/
+
+#ifndef HARDWAREBACKEND_H
+#define HARDWAREBACKEND_H
+
+#include <memory>
+#include <string>
+#include "configuration.hpp"
+
+// One PWM output, configured with its period, duty cycle 0 and disabled when opened
+class PwmChannel {
+public:
+    virtual ~PwmChannel() = default;
+
+    virtual void setDutyCycle(long dutyNs) = 0;     // Throws std::runtime_error on failure
+    virtual void setEnabled(bool enabled) = 0;      // Throws std::runtime_error on failure
+};
+
+// One GPIO line; an output starts low
+class GpioLine {
+public:
+    virtual ~GpioLine() = default;
+
+    virtual void setValue(bool value) = 0;          // Throws std::runtime_error on failure
+    virtual bool getValue() = 0;                    // Throws std::runtime_error on failure
+};
+
+class HardwareBackend {
+public:
+    virtual ~HardwareBackend() = default;
+
+    // Open PWM channel chan of PWM chip chip. Throws std::runtime_error on failure.
+    virtual std::unique_ptr<PwmChannel> openPwm(int chip, int chan, int periodNs) = 0;
+
+    // Open the GPIO of an IO by its port and pin number. Throws std::runtime_error on failure.
+    virtual std::unique_ptr<GpioLine> openGpio(const std::string& port, unsigned pinNumber, bool output) = 0;
+
+    virtual const char* name() const = 0;
+
+    // Group the GPIO writes and reads of the calling thread until commitBatch().
+    // A backend may defer the writes and read each chip at most once meanwhile.
+    virtual void beginBatch() {}
+
+    // Apply the deferred writes. Throws std::runtime_error on failure.
+    virtual void commitBatch() {}
+
+    static std::unique_ptr<HardwareBackend> create(const Settings::Hardware& settings);
+};
+
+#endif // HARDWAREBACKEND_H
@@ -0,0 +1,380 @@
+#include "HlsSegmentStore.h"
+#include "ThreadUtils.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+static constexpr uint64_t TimeMask = (1ull << 33) - 1;     //! PTS wrap, 33 bits of 90 kHz
+
+//! Stream types carrying video, segments are cut at their keyframes
+static bool isVideoStreamType(uint8_t type) {
+    switch (type) {
+    case 0x01:      // MPEG-1
+    case 0x02:      // MPEG-2
+    case 0x10:      // MPEG-4 part 2
+    case 0x1B:      // H.264
+    case 0x24:      // H.265
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Reads the PTS of a PES packet starting at pPayload.
+ *
+ * @param pPayload Start of the PES packet.
+ * @param len Bytes available.
+ * @param pts Receives the 90 kHz PTS.
+ * @return bool True if the header carries a PTS.
+ */
+static bool parsePts(const uint8_t* pPayload, size_t len, uint64_t& pts) {
+    if (len < 14 || pPayload[0] != 0 || pPayload[1] != 0 || pPayload[2] != 1 || !(pPayload[7] & 0x80)) {
+        return false;
+    }
+    const uint8_t* p = pPayload + 9;
+    pts = ((uint64_t)((p[0] >> 1) & 0x07) << 30) | ((uint64_t)p[1] << 22) | ((uint64_t)(p[2] >> 1) << 15) |
+        ((uint64_t)p[3] << 7) | (uint64_t)(p[4] >> 1);
+    return true;
+}
+
+HlsSegmentStore::HlsSegmentStore(unsigned targetDurationMs, size_t playlistLength) :
+    m_targetDurationMs(targetDurationMs),
+    m_playlistLength(std::max<size_t>(playlistLength, 1))
+{
+    m_playlist = buildPlaylist();
+}
+
+/**
+ * Splits the input into 188 byte packets, resynchronizing on the 0x47
+ * sync byte after garbage.
+ *
+ * @param pData MPEG-TS bytes, nullptr at the end of the stream.
+ * @param len Number of bytes.
+ */
+void HlsSegmentStore::write(const uint8_t* pData, size_t len) {
+    if (!pData) {
+        endOfStream();
+        return;
+    }
+
+    while (len > 0) {
+        if (m_partialLen == 0) {
+            const uint8_t* pSync = static_cast<const uint8_t*>(memchr(pData, 0x47, len));
+            size_t skipped = pSync ? (size_t)(pSync - pData) : len;
+            m_stats.droppedBytes += skipped;
+            pData += skipped;
+            len -= skipped;
+
+            // Whole packets straight from the input
+            while (len >= TsPacketLen && pData[0] == 0x47) {
+                packet(pData);
+                pData += TsPacketLen;
+                len -= TsPacketLen;
+            }
+            if (len == 0 || pData[0] != 0x47 || len >= TsPacketLen) {
+                continue;
+            }
+        }
+
+        size_t copy = std::min(len, TsPacketLen - m_partialLen);
+        memcpy(m_partial + m_partialLen, pData, copy);
+        m_partialLen += copy;
+        pData += copy;
+        len -= copy;
+        if (m_partialLen == TsPacketLen) {
+            packet(m_partial);
+            m_partialLen = 0;
+        }
+    }
+}
+
+/**
+ * Handles one packet: tracks PAT and PMT, cuts a segment at a video
+ * keyframe once the target duration is reached, and appends the packet to
+ * the open segment.
+ *
+ * @param p Packet.
+ */
+void HlsSegmentStore::packet(const uint8_t* p) {
+    bool unitStart = (p[1] & 0x40) != 0;
+    uint16_t pid = (uint16_t)(((p[1] & 0x1F) << 8) | p[2]);
+    uint8_t adaptation = (p[3] >> 4) & 0x03;
+
+    size_t payload = 4;
+    bool randomAccess = false;
+    if (adaptation & 0x02) {
+        uint8_t adaptationLen = p[4];
+        randomAccess = adaptationLen > 0 && (p[5] & 0x40);
+        payload += 1 + adaptationLen;
+    }
+    bool hasPayload = (adaptation & 0x01) && payload < TsPacketLen;
+
+    if (pid == 0 && unitStart && hasPayload) {
+        memcpy(m_pat, p, TsPacketLen);
+        m_havePat = true;
+        parsePat(p + payload, TsPacketLen - payload);
+    } else if (pid == m_pmtPid && unitStart && hasPayload) {
+        memcpy(m_pmt, p, TsPacketLen);
+        m_havePmt = true;
+        parsePmt(p + payload, TsPacketLen - payload);
+    }
+
+    // Audio only streams are cut at any random access point
+    bool isCutStream = (m_videoPid != 0xFFFF) ? (pid == m_videoPid) : (pid != 0 && pid != m_pmtPid);
+    if (m_havePat && m_havePmt && isCutStream && unitStart && hasPayload) {
+        uint64_t time;
+        if (!parsePts(p + payload, TsPacketLen - payload, time)) {
+            time = ThreadUtils::monotonicNs() * 9 / 100000;
+        }
+        time &= TimeMask;
+        m_lastTime = time;
+
+        if (randomAccess && !m_open) {
+            openSegment(time);
+        } else if (randomAccess && ((time - m_startTime) & TimeMask) * 1000 / 90000 >= m_targetDurationMs) {
+            closeSegment(time);
+            openSegment(time);
+        }
+    }
+
+    if (!m_open) {
+        m_stats.droppedBytes += TsPacketLen;
+        return;
+    }
+
+    if (m_building.size() + TsPacketLen > MaxSegmentLen) {
+        LOG_WARN("HLS: no keyframe within %zu bytes, dropping segment", MaxSegmentLen);
+        m_stats.overflows++;
+        m_stats.droppedBytes += m_building.size();
+        m_building.clear();
+        m_open = false;
+        return;
+    }
+    m_building.append((const char*)p, TsPacketLen);
+}
+
+/**
+ * Finds the PMT of the first program in a PAT that fits one packet.
+ *
+ * @param pPayload Packet payload.
+ * @param len Payload length.
+ */
+void HlsSegmentStore::parsePat(const uint8_t* pPayload, size_t len) {
+    size_t offset = 1 + pPayload[0];
+    if (offset + 8 > len || pPayload[offset] != 0x00) {
+        return;
+    }
+    const uint8_t* t = pPayload + offset;
+    size_t sectionLen = ((t[1] & 0x0F) << 8) | t[2];
+    if (sectionLen < 9) {
+        return;
+    }
+    size_t end = std::min(len - offset, 3 + sectionLen) - 4;        // Excludes the CRC
+
+    for (size_t i = 8; i + 4 <= end; i += 4) {
+        uint16_t program = (uint16_t)((t[i] << 8) | t[i + 1]);
+        if (program != 0) {
+            m_pmtPid = (uint16_t)(((t[i + 2] & 0x1F) << 8) | t[i + 3]);
+            return;
+        }
+    }
+}
+
+/**
+ * Finds the video stream in a PMT that fits one packet.
+ *
+ * @param pPayload Packet payload.
+ * @param len Payload length.
+ */
+void HlsSegmentStore::parsePmt(const uint8_t* pPayload, size_t len) {
+    size_t offset = 1 + pPayload[0];
+    if (offset + 12 > len || pPayload[offset] != 0x02) {
+        return;
+    }
+    const uint8_t* t = pPayload + offset;
+    size_t sectionLen = ((t[1] & 0x0F) << 8) | t[2];
+    if (sectionLen < 13) {
+        return;
+    }
+    size_t end = std::min(len - offset, 3 + sectionLen) - 4;
+    size_t programInfoLen = ((t[10] & 0x0F) << 8) | t[11];
+
+    m_videoPid = 0xFFFF;
+    for (size_t i = 12 + programInfoLen; i + 5 <= end; i += 5 + (((t[i + 3] & 0x0F) << 8) | t[i + 4])) {
+        if (isVideoStreamType(t[i])) {
+            m_videoPid = (uint16_t)(((t[i + 1] & 0x1F) << 8) | t[i + 2]);
+            return;
+        }
+    }
+}
+
+/**
+ * Starts a segment with the latest PAT and PMT, so it can be decoded
+ * without the segments before it.
+ *
+ * @param time90k Time of the keyframe starting the segment.
+ */
+void HlsSegmentStore::openSegment(uint64_t time90k) {
+    m_building.append((const char*)m_pat, TsPacketLen);
+    m_building.append((const char*)m_pmt, TsPacketLen);
+    m_startTime = time90k;
+    m_open = true;
+}
+
+/**
+ * Completes the open segment and publishes it.
+ *
+ * @param time90k Time of the keyframe ending the segment.
+ */
+void HlsSegmentStore::closeSegment(uint64_t time90k) {
+    auto pSegment = std::make_shared<HlsSegment>();
+    pSegment->sequence = m_nextSequence++;
+    pSegment->durationMs = (uint32_t)(((time90k - m_startTime) & TimeMask) * 1000 / 90000);
+    pSegment->discontinuity = m_discontinuity;
+    pSegment->readyNs = ThreadUtils::monotonicNs();
+
+    // Hand over the buffer and start the next one at the same capacity
+    size_t capacity = m_building.capacity();
+    pSegment->data.swap(m_building);
+    m_building.reserve(capacity);
+
+    m_discontinuity = false;
+    m_open = false;
+    m_stats.segments++;
+    m_stats.bytes += pSegment->data.size();
+    publish(std::move(pSegment));
+}
+
+/**
+ * The encoder exited: completes the open segment and prepares for a new
+ * stream, whose PIDs and timestamps may differ.
+ */
+void HlsSegmentStore::endOfStream() {
+    if (m_open) {
+        closeSegment(m_lastTime);
+    }
+    m_partialLen = 0;
+    m_havePat = false;
+    m_havePmt = false;
+    m_pmtPid = 0xFFFF;
+    m_videoPid = 0xFFFF;
+    m_discontinuity = m_nextSequence > 0;
+}
+
+/**
+ * Adds a segment to the ring, dropping the oldest, and rebuilds the
+ * playlist.
+ *
+ * @param pSegment Completed segment.
+ */
+void HlsSegmentStore::publish(std::shared_ptr<const HlsSegment> pSegment) {
+    std::shared_ptr<const HlsSegment> pReleased;
+    std::lock_guard<std::mutex> lck(m_mutex);
+
+    m_segments.push_back(std::move(pSegment));
+    if (m_segments.size() > m_playlistLength) {
+        // Segment that just left the playlist
+        if (m_segments[m_segments.size() - m_playlistLength - 1]->discontinuity) {
+            m_discontinuitySequence++;
+        }
+    }
+    if (m_segments.size() > m_playlistLength + RetainedExtra) {
+        pReleased = std::move(m_segments.front());
+        m_segments.pop_front();
+    }
+    m_playlist = buildPlaylist();
+}
+
+/**
+ * Builds the live playlist from the newest segments. Called with m_mutex
+ * held.
+ *
+ * @return std::shared_ptr<const std::string> Playlist text.
+ */
+std::shared_ptr<const std::string> HlsSegmentStore::buildPlaylist() const {
+    size_t first = m_segments.size() > m_playlistLength ? m_segments.size() - m_playlistLength : 0;
+
+    uint32_t maxDurationMs = m_targetDurationMs;
+    for (size_t i = first; i < m_segments.size(); i++) {
+        maxDurationMs = std::max(maxDurationMs, m_segments[i]->durationMs);
+    }
+
+    auto pPlaylist = std::make_shared<std::string>();
+    pPlaylist->reserve(128 + 48 * m_playlistLength);
+
+    char line[96];
+    snprintf(line, sizeof(line), "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%u\n",
+        (maxDurationMs + 999) / 1000);
+    pPlaylist->append(line);
+    snprintf(line, sizeof(line), "#EXT-X-MEDIA-SEQUENCE:%llu\n#EXT-X-DISCONTINUITY-SEQUENCE:%llu\n",
+        (unsigned long long)(first < m_segments.size() ? m_segments[first]->sequence : m_nextSequence),
+        (unsigned long long)m_discontinuitySequence);
+    pPlaylist->append(line);
+
+    for (size_t i = first; i < m_segments.size(); i++) {
+        const HlsSegment& segment = *m_segments[i];
+        if (segment.discontinuity) {
+            pPlaylist->append("#EXT-X-DISCONTINUITY\n");
+        }
+        snprintf(line, sizeof(line), "#EXTINF:%u.%03u,\nsegment-%llu.ts\n",
+            segment.durationMs / 1000, segment.durationMs % 1000, (unsigned long long)segment.sequence);
+        pPlaylist->append(line);
+    }
+    return pPlaylist;
+}
+
+std::shared_ptr<const std::string> HlsSegmentStore::playlist() const {
+    std::lock_guard<std::mutex> lck(m_mutex);
+    return m_playlist;
+}
+
+/**
+ * Looks up the playlist or a segment by file name.
+ *
+ * @param name PlaylistName or "segment-<sequence>.ts".
+ * @return std::shared_ptr<const std::string> Body, nullptr if not held.
+ */
+std::shared_ptr<const std::string> HlsSegmentStore::find(std::string_view name) {
+    if (name == PlaylistName) {
+        return playlist();
+    }
+
+    static constexpr std::string_view Prefix = "segment-";
+    static constexpr std::string_view Suffix = ".ts";
+    if (name.size() <= Prefix.size() + Suffix.size() || name.substr(0, Prefix.size()) != Prefix ||
+        name.substr(name.size() - Suffix.size()) != Suffix) {
+        return nullptr;
+    }
+
+    uint64_t sequence = 0;
+    for (char c : name.substr(Prefix.size(), name.size() - Prefix.size() - Suffix.size())) {
+        if (c < '0' || c > '9') {
+            return nullptr;
+        }
+        sequence = sequence * 10 + (uint64_t)(c - '0');
+    }
+
+    std::lock_guard<std::mutex> lck(m_mutex);
+    if (!m_segments.empty() && sequence >= m_segments.front()->sequence) {
+        size_t index = (size_t)(sequence - m_segments.front()->sequence);
+        if (index < m_segments.size()) {
+            m_stats.requests++;
+            const std::shared_ptr<const HlsSegment>& pSegment = m_segments[index];
+            return std::shared_ptr<const std::string>(pSegment, &pSegment->data);
+        }
+    }
+    m_stats.misses++;
+    return nullptr;
+}
+
+void HlsSegmentStore::recordFirstByte(uint64_t ns) {
+    m_stats.ttfbCount.fetch_add(1, std::memory_order_relaxed);
+    m_stats.ttfbTotalNs.fetch_add(ns, std::memory_order_relaxed);
+    m_stats.ttfbLastNs.store(ns, std::memory_order_relaxed);
+
+    uint64_t maxNs = m_stats.ttfbMaxNs.load(std::memory_order_relaxed);
+    while (ns > maxNs && !m_stats.ttfbMaxNs.compare_exchange_weak(maxNs, ns, std::memory_order_relaxed)) {
+    }
+}
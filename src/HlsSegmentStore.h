@@ -0,0 +1,104 @@
+/**
+* In-memory HLS for the camera stream. ffmpeg writes a plain MPEG-TS stream
+* to a pipe; the store cuts it into segments at video keyframes, each one
+* starting with the latest PAT and PMT so it decodes on its own, and keeps
+* a bounded ring of the most recent segments. The live playlist is rebuilt
+* from the ring whenever a segment completes. Nothing touches the flash.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+//! One completed segment
+struct HlsSegment {
+    uint64_t    sequence = 0;                   //! Media sequence number
+    uint32_t    durationMs = 0;
+    bool        discontinuity = false;          //! First segment after the encoder restarted
+    uint64_t    readyNs = 0;                    //! Time the segment completed
+    std::string data;                           //! MPEG-TS packets
+};
+
+//! Store counters
+struct HlsStats {
+    std::atomic<uint64_t> segments{0};          //! Segments completed
+    std::atomic<uint64_t> bytes{0};             //! Bytes of the completed segments
+    std::atomic<uint64_t> droppedBytes{0};      //! Input discarded before the first keyframe or to resync
+    std::atomic<uint64_t> overflows{0};         //! Segments discarded for exceeding MaxSegmentLen
+    std::atomic<uint64_t> requests{0};          //! Segment requests answered
+    std::atomic<uint64_t> misses{0};            //! Requests for segments no longer held
+    std::atomic<uint64_t> ttfbCount{0};         //! Segment responses timed
+    std::atomic<uint64_t> ttfbTotalNs{0};       //! Sum of request-to-first-byte times
+    std::atomic<uint64_t> ttfbMaxNs{0};         //! Worst request-to-first-byte time
+    std::atomic<uint64_t> ttfbLastNs{0};        //! Request-to-first-byte time of the last segment sent
+};
+
+class HlsSegmentStore {
+public:
+    static constexpr size_t TsPacketLen = 188;
+    static constexpr size_t RetainedExtra = 2;              //! Segments kept after leaving the playlist, for slow clients
+    static constexpr size_t MaxSegmentLen = 8 * 1024 * 1024;//! Bound on a segment while waiting for a keyframe
+    static constexpr const char* PlaylistName = "index.m3u8";
+
+    //! \param targetDurationMs Shortest segment, cut at the first keyframe after it
+    //! \param playlistLength Segments listed in the playlist
+    HlsSegmentStore(unsigned targetDurationMs = 1000, size_t playlistLength = 6);
+
+    //! Append MPEG-TS bytes, from one producer thread. pData nullptr marks the
+    //! end of the stream: the open segment is completed and the next one is a
+    //! discontinuity.
+    void write(const uint8_t* pData, size_t len);
+
+    //! Current playlist
+    std::shared_ptr<const std::string> playlist() const;
+
+    //! Body of PlaylistName or "segment-<sequence>.ts", nullptr if not held
+    std::shared_ptr<const std::string> find(std::string_view name);
+
+    //! Account the request-to-first-byte time of a segment response
+    void recordFirstByte(uint64_t ns);
+
+    const HlsStats& getStats() const { return m_stats; }
+
+private:
+    void packet(const uint8_t* p);
+    void parsePat(const uint8_t* pPayload, size_t len);
+    void parsePmt(const uint8_t* pPayload, size_t len);
+    void openSegment(uint64_t time90k);
+    void closeSegment(uint64_t time90k);
+    void endOfStream();
+    void publish(std::shared_ptr<const HlsSegment> pSegment);
+    std::shared_ptr<const std::string> buildPlaylist() const;
+
+    const unsigned              m_targetDurationMs;
+    const size_t                m_playlistLength;
+
+    // Producer thread only
+    uint8_t                     m_partial[TsPacketLen]; //! Packet split across writes
+    size_t                      m_partialLen = 0;
+    uint8_t                     m_pat[TsPacketLen];     //! Latest PAT packet
+    uint8_t                     m_pmt[TsPacketLen];     //! Latest PMT packet
+    bool                        m_havePat = false;
+    bool                        m_havePmt = false;
+    uint16_t                    m_pmtPid = 0xFFFF;
+    uint16_t                    m_videoPid = 0xFFFF;    //! Segments are cut at keyframes of this stream
+    bool                        m_open = false;         //! m_building holds a segment
+    std::string                 m_building;             //! Segment being filled
+    uint64_t                    m_startTime = 0;        //! 90 kHz time of the first keyframe of m_building
+    uint64_t                    m_lastTime = 0;         //! 90 kHz time of the latest frame of the cut stream
+    bool                        m_discontinuity = false;//! The next segment follows a restart
+    uint64_t                    m_nextSequence = 0;
+
+    // Shared with readers
+    mutable std::mutex          m_mutex;                //! Guards the ring and the playlist
+    std::deque<std::shared_ptr<const HlsSegment>> m_segments;   //! Oldest first
+    uint64_t                    m_discontinuitySequence = 0;    //! Discontinuities that left the playlist
+    std::shared_ptr<const std::string> m_playlist;
+    HlsStats                    m_stats;
+};
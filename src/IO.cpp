@@ -1,4 +1,7 @@
 #include "IO.h"
+#include "ThreadUtils.h"
+#include "CommandTrace.h"
+#include "Logger.h"
 #include <iostream>
 
 /**
@@ -20,8 +23,10 @@ IO::IO(const std::string& name, const Config& config)
  * @note Derived classes must implement the actual hardware setting
  */
 void IO::setPoint(size_t index) {
+    CommandTrace::mark(TraceStage::IoSet);
     if (index < config.setPoints.size()) {
         currentSetPoint = index;
+        changedNs = ThreadUtils::monotonicNs();
         // Derived classes will implement the actual hardware setting
     }
 }
@@ -29,16 +34,17 @@ void IO::setPoint(size_t index) {
 /**
  * @brief Constructs a PWM-specific IO object
  * 
+ * @param backend Hardware backend that opens the PWM channel
  * @param name Unique identifier for this PWM IO
  * @param config Configuration structure containing PWM parameters
  * @throws std::runtime_error if PWM initialization fails
  */
-PWMIO::PWMIO(const std::string& name, const Config& config)
+PWMIO::PWMIO(HardwareBackend& backend, const std::string& name, const Config& config)
     : IO(name, config) {
     if (config.isEnabled) {
         try {
             int chipNum = std::stoi(config.port.substr(7));  // Extract from "pwmchip0"
-            pwm = std::make_unique<PWM>(config.port, chipNum, 0, PWM_FREQUENCY_HZ);
+            pwm = std::make_unique<PWM>(backend, config.port, chipNum, 0, PWM_FREQUENCY_HZ);
         } catch (const std::exception& e) {
             std::cerr << "Failed to create PWM: " << e.what() << std::endl;
             throw;
@@ -74,21 +80,33 @@ void PWMIO::stop() {
 /**
  * @brief Reads the current PWM value
  * 
- * @return float Current setpoint value
+ * @return float Current setpoint value, 0 if the IO has no setpoints
  * @note Currently returns the setpoint value; hardware feedback could be implemented here
  */
 float PWMIO::read() const {
     // Implement PWM feedback reading if hardware supports it
-    return config.setPoints[currentSetPoint];
+    size_t index = currentSetPoint;
+    if (index >= config.setPoints.size()) {
+        return 0.0f;
+    }
+    return config.setPoints[index];
 }
 
 /**
  * @brief Initializes all IO devices from configuration settings
  * 
- * Creates and starts all enabled IO devices based on their configuration
+ * Creates and starts all enabled IO devices based on their configuration.
+ * IOs of an earlier initialize() are destroyed first.
  * @param ioSettings Map of IO configurations from settings file
+ * @param hardwareBackend Backend the IOs drive, see HardwareBackend::create()
  */
-void IOManager::initialize(const std::map<std::string, Settings::IO>& ioSettings) {
+void IOManager::initialize(const std::map<std::string, Settings::IO>& ioSettings,
+                           std::unique_ptr<HardwareBackend> hardwareBackend) {
+    iosByNumber.clear();
+    ios.clear();
+    backend = std::move(hardwareBackend);
+    std::cout << "IOManager: using the " << backend->name() << " hardware backend" << std::endl;
+
     for (const auto& [name, settings] : ioSettings) {
         // Skip IO11 as it's managed by SgcuManager
         if (name == "IO11") continue;
@@ -98,6 +116,16 @@ void IOManager::initialize(const std::map<std::string, Settings::IO>& ioSettings
             try {
                 ios[name] = std::move(io);
                 auto* ptr = ios[name].get();
+
+                // Index by number so commands can address IOs without a string lookup
+                if (name.size() > 2 && name.compare(0, 2, "IO") == 0) {
+                    unsigned number = std::stoul(name.substr(2));
+                    if (number >= iosByNumber.size()) {
+                        iosByNumber.resize(number + 1, nullptr);
+                    }
+                    iosByNumber[number] = ptr;
+                }
+
                 if (ptr && ptr->isEnabled()) {
                     ptr->start();
                 }
@@ -123,6 +151,7 @@ std::unique_ptr<IO> IOManager::createIO(const std::string& name, const Settings:
     config.pinNumber = static_cast<int>(settings.pinNumber);
     config.port = settings.port;
     config.type = (settings.pinFunction == "PWM") ? IO::Type::PWM : IO::Type::GPIO;
+    config.direction = (settings.direction == "INPUT") ? IO::Direction::INPUT : IO::Direction::OUTPUT;
     config.name = settings.pinName;
     config.isEnabled = settings.isEnabled;
     config.setPoints.assign(settings.setPoints.begin(), settings.setPoints.end());
@@ -130,14 +159,14 @@ std::unique_ptr<IO> IOManager::createIO(const std::string& name, const Settings:
 
     if (config.type == IO::Type::PWM) {
         try {
-            return std::make_unique<PWMIO>(name, config);
+            return std::make_unique<PWMIO>(*backend, name, config);
         } catch (const std::exception& e) {
             std::cerr << "Failed to create PWM IO: " << e.what() << std::endl;
             return nullptr;
         }
     } else {
         try {
-            return std::make_unique<GPIIO>(name, config);
+            return std::make_unique<GPIIO>(*backend, name, config);
         } catch (const std::exception& e) {
             std::cerr << "Failed to create GPIO IO: " << e.what() << std::endl;
             return nullptr;
@@ -156,28 +185,161 @@ IO* IOManager::getIO(const std::string& name) {
     return (it != ios.end()) ? it->second.get() : nullptr;
 }
 
-// Add GPIIO constructor implementation
-GPIIO::GPIIO(const std::string& name, const Config& config)
+/**
+ * @brief Gets an IO by the number of its "IO<n>" configuration key
+ * 
+ * @param ioNumber Number n of the IO
+ * @return IO* The IO, nullptr if there is none
+ */
+IO* IOManager::getIO(unsigned ioNumber) {
+    return (ioNumber < iosByNumber.size()) ? iosByNumber[ioNumber] : nullptr;
+}
+
+/**
+ * @brief Stages a setpoint update, replacing any earlier update to the same IO
+ * 
+ * @param ioNumber Number n of the "IO<n>" to update
+ * @param setPointIndex Index into the setPoints of the IO
+ * @return bool False if the batch is full
+ */
+bool IOManager::Transaction::set(unsigned ioNumber, size_t setPointIndex) {
+    for (size_t i = 0; i < count; i++) {
+        if (updates[i].ioNumber == ioNumber) {
+            updates[i].setPointIndex = setPointIndex;
+            return true;
+        }
+    }
+
+    if (count == MaxUpdates) {
+        return false;
+    }
+
+    updates[count++] = { ioNumber, setPointIndex };
+    return true;
+}
+
+/**
+ * @brief Applies the staged updates back to back and clears the batch
+ * 
+ * Unknown IOs are skipped. A failing hardware write is logged and does not
+ * prevent the remaining updates from being applied. The updates form one
+ * hardware batch, so GPIOs on the same chip are written together. A backend
+ * may only write the GPIOs when the batch is committed, so they count as
+ * updated only if that succeeds.
+ * 
+ * @return size_t Number of IOs updated
+ */
+size_t IOManager::Transaction::commit() {
+    size_t applied = 0;
+    size_t batched = 0;     // GPIO updates written by commitBatch()
+    HardwareBackend* backend = manager.getBackend();
+    if (backend) {
+        backend->beginBatch();
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        IO* io = manager.getIO(updates[i].ioNumber);
+        if (!io || !io->isEnabled()) {
+            continue;
+        }
+
+        try {
+            io->setPoint(updates[i].setPointIndex);
+            if (io->getType() == IO::Type::GPIO) {
+                batched++;
+            } else {
+                applied++;
+            }
+        } catch (const std::exception& e) {
+            LOG_ERROR("Failed to update IO%u: %s", updates[i].ioNumber, e.what());
+        }
+    }
+
+    if (backend) {
+        try {
+            backend->commitBatch();
+            applied += batched;
+        } catch (const std::exception& e) {
+            LOG_ERROR("Failed to apply IO batch: %s", e.what());
+        }
+    } else {
+        applied += batched;
+    }
+
+    count = 0;
+    return applied;
+}
+
+/**
+ * @brief Constructs a GPIO-specific IO object
+ * 
+ * @param backend Hardware backend that opens the GPIO line
+ * @param name Unique identifier for this GPIO IO
+ * @param config Configuration structure containing GPIO parameters
+ * @throws std::runtime_error if the GPIO cannot be opened
+ */
+GPIIO::GPIIO(HardwareBackend& backend, const std::string& name, const Config& config)
     : IO(name, config) {
-    // TODO: Initialize GPIO hardware
+    if (config.isEnabled) {
+        line = backend.openGpio(config.port, config.pinNumber, config.direction == Direction::OUTPUT);
+    }
 }
 
+/**
+ * @brief Drives an output to its current setpoint
+ * @throws std::runtime_error if the GPIO write fails
+ */
 void GPIIO::start() {
-    // TODO: Implement GPIO start logic
+    if (config.isEnabled && line && config.direction == Direction::OUTPUT) {
+        setPoint(currentSetPoint);
+    }
 }
 
+/**
+ * @brief Leaves the GPIO in its last state
+ */
 void GPIIO::stop() {
-    // TODO: mplement GPIO stop logic
 }
 
+/**
+ * @brief Sets the IO to a setpoint and drives an output accordingly
+ * 
+ * @param index Index into the setPoints vector
+ * @throws std::runtime_error if the GPIO write fails
+ */
+void GPIIO::setPoint(size_t index) {
+    CommandTrace::mark(TraceStage::IoSet);
+    if (index < config.setPoints.size()) {
+        currentSetPoint = index;
+        changedNs = ThreadUtils::monotonicNs();
+        if (config.isEnabled && line && config.direction == Direction::OUTPUT) {
+            line->setValue(config.setPoints[index] != 0);
+        }
+    }
+}
+
+/**
+ * @brief Reads the GPIO level
+ * 
+ * @return float 1 if the line is high, 0 if it is low; an output reports its setpoint
+ */
 float GPIIO::read() const {
-    // TODO: Implement GPIO read logic
-    return 0.0f;  // Placeholder return
+    if (config.direction == Direction::INPUT && line) {
+        try {
+            return line->getValue() ? 1.0f : 0.0f;
+        } catch (const std::exception& e) {
+            LOG_ERROR("Failed to read %s: %s", name.c_str(), e.what());
+            return 0.0f;
+        }
+    }
+    return (currentSetPoint < config.setPoints.size() && config.setPoints[currentSetPoint] != 0) ? 1.0f : 0.0f;
 }
 
 void PWMIO::setPoint(size_t index) {
+    CommandTrace::mark(TraceStage::IoSet);
     if (index < config.setPoints.size()) {
         currentSetPoint = index;
+        changedNs = ThreadUtils::monotonicNs();
         if (config.isEnabled && pwm) {
             // Convert setpoint from microseconds to nanoseconds (multiply by 1000)
             float valueNs = config.setPoints[index] * 1000;
@@ -5,10 +5,13 @@
 #ifndef IO_H
 #define IO_H
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
 #include "pwm.h"
+#include "HardwareBackend.h"
 #include "configuration.hpp"
 
 class IO {
@@ -46,6 +49,7 @@ public:
     const std::string& getName() const { return name; }
     bool isEnabled() const { return config.isEnabled; }
     size_t getCurrentSetPoint() const { return currentSetPoint; }
+    uint64_t getChangedNs() const { return changedNs; }   // Monotonic time of the last setpoint change
     size_t getSetPointCount() const { return config.setPoints.size(); }
     Type getType() const { return config.type; }
     Direction getDirection() const { return config.direction; }
@@ -53,13 +57,14 @@ public:
 protected:
     std::string name;
     Config config;
-    size_t currentSetPoint;
+    std::atomic<size_t> currentSetPoint;    // Written by the control thread, sampled by telemetry
+    std::atomic<uint64_t> changedNs{0};
 };
 
 // PWM-specific implementation
 class PWMIO : public IO {
 public:
-    PWMIO(const std::string& name, const Config& config);
+    PWMIO(HardwareBackend& backend, const std::string& name, const Config& config);
     
     void start() override;
     void stop() override;
@@ -74,27 +79,64 @@ private:
 // GPIO-specific implementation
 class GPIIO : public IO {
 public:
-    GPIIO(const std::string& name, const Config& config);
+    GPIIO(HardwareBackend& backend, const std::string& name, const Config& config);
     
     void start() override;
     void stop() override;
-    float read() const override;
+    void setPoint(size_t index) override;  // Drives an output high for a non-zero setpoint
+    float read() const override;           // 0 or 1
 
 private:
-    // GPIO specific members
+    std::unique_ptr<GpioLine> line;
 };
 
 // Factory class to manage IOs
 class IOManager {
 public:
+    //! Batch of setpoint updates applied back to back by commit().
+    //! Fixed capacity, no allocation; a later update to the same IO replaces
+    //! the earlier one (last writer wins).
+    class Transaction {
+    public:
+        static constexpr size_t MaxUpdates = 32;
+
+        explicit Transaction(IOManager& manager) : manager(manager) {}
+
+        //! Stage a setpoint for IO number ioNumber. Returns false if the batch is full.
+        bool set(unsigned ioNumber, size_t setPointIndex);
+
+        //! Apply all staged updates and clear the batch. Returns the number applied.
+        size_t commit();
+
+        size_t size() const { return count; }
+
+    private:
+        struct Update {
+            unsigned ioNumber;
+            size_t setPointIndex;
+        };
+
+        IOManager& manager;
+        Update updates[MaxUpdates];
+        size_t count = 0;
+    };
+
     static IOManager& getInstance();
-    void initialize(const std::map<std::string, Settings::IO>& ioSettings);
+    void initialize(const std::map<std::string, Settings::IO>& ioSettings,
+                    std::unique_ptr<HardwareBackend> hardwareBackend);
+    HardwareBackend* getBackend() { return backend.get(); }
     IO* getIO(const std::string& name);
+    IO* getIO(unsigned ioNumber);        // IO by the number in its "IO<n>" key
     std::vector<IO*> getIOsByType(IO::Type type);
+    const std::vector<IO*>& getIOsByNumber() const { return iosByNumber; }   // nullptr where unused
+
+    Transaction beginTransaction() { return Transaction(*this); }
 
 private:
     IOManager() = default;
+    std::unique_ptr<HardwareBackend> backend;   // Declared first, so the IOs are destroyed before it
     std::map<std::string, std::unique_ptr<IO>> ios;
+    std::vector<IO*> iosByNumber;        // Indexed by IO number, nullptr if unused
     
     std::unique_ptr<IO> createIO(const std::string& name, const Settings::IO& settings);
 };
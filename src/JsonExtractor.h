@@ -0,0 +1,262 @@
+/**
+* Streaming field extraction from JSON text, built on nlohmann's sax_parse.
+* The parser walks the receive buffer in place and reports every scalar with
+* its path, so a command can pick out the fields it declares without a DOM
+* being built or the message being copied. Only keys and the current path are
+* kept, in fixed storage.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <nlohmann/json.hpp>
+
+//! One scalar value reached by the parser. Strings point into parser storage
+//! that is only valid during the callback.
+struct JsonScalar {
+    enum class Type : uint8_t { Null, Bool, Integer, Unsigned, Float, String };
+
+    Type             type = Type::Null;
+    bool             boolean = false;
+    int64_t          integer = 0;
+    uint64_t         unsignedInteger = 0;
+    double           number = 0.0;
+    std::string_view string;
+
+    //! Convert to an integral or floating point field.
+    //! Returns false if the type does not match or the value is out of range.
+    template <class T>
+    bool get(T& out) const
+    {
+        if constexpr (std::is_same<T, bool>::value) {
+            if (type != Type::Bool) {
+                return false;
+            }
+            out = boolean;
+            return true;
+        } else if constexpr (std::is_floating_point<T>::value) {
+            switch (type) {
+            case Type::Integer:     out = (T)integer; return true;
+            case Type::Unsigned:    out = (T)unsignedInteger; return true;
+            case Type::Float:       out = (T)number; return true;
+            default:                return false;
+            }
+        } else {
+            static_assert(std::is_integral<T>::value, "JsonScalar converts to numbers and bool only");
+            if (type == Type::Unsigned) {
+                if (unsignedInteger > (uint64_t)std::numeric_limits<T>::max()) {
+                    return false;
+                }
+                out = (T)unsignedInteger;
+                return true;
+            }
+            if (type == Type::Integer) {
+                if (integer < (int64_t)std::numeric_limits<T>::min() ||
+                    (integer > 0 && (uint64_t)integer > (uint64_t)std::numeric_limits<T>::max())) {
+                    return false;
+                }
+                out = (T)integer;
+                return true;
+            }
+            return false;
+        }
+    }
+};
+
+//! Location of a scalar: object keys and array indexes from the root
+class JsonPath {
+public:
+    static constexpr size_t MaxDepth = 4;       //! Deeper messages are rejected
+    static constexpr size_t MaxKeyLen = 31;     //! Longer keys never match
+
+    //! Levels below the root, 1 for a member of the top-level object
+    size_t depth() const { return m_depth; }
+
+    //! True for the top-level member key
+    bool is(std::string_view key) const {
+        return m_depth == 1 && !m_levels[0].isArray && keyIs(0, key);
+    }
+
+    //! True for member field of an object in the top-level array key; index
+    //! receives the position of the object in the array
+    bool is(std::string_view key, size_t& index, std::string_view field) const {
+        if (m_depth != 3 || m_levels[0].isArray || !m_levels[1].isArray || m_levels[2].isArray ||
+            !keyIs(0, key) || !keyIs(2, field)) {
+            return false;
+        }
+        index = m_levels[1].index;
+        return true;
+    }
+
+private:
+    template <class Visitor>
+    friend class JsonExtractor;
+
+    struct Level {
+        bool     isArray = false;
+        size_t   index = 0;                     //! Position of the current element of an array
+        uint8_t  keyLen = 0;                    //! Current member key of an object
+        bool     keyTooLong = false;
+        char     key[MaxKeyLen];
+    };
+
+    bool keyIs(size_t level, std::string_view key) const {
+        const Level& l = m_levels[level];
+        return !l.keyTooLong && std::string_view(l.key, l.keyLen) == key;
+    }
+
+    Level  m_levels[MaxDepth];
+    size_t m_depth = 0;
+};
+
+//! Outcome of an extraction
+enum class JsonExtract {
+    Done,           //! Whole message parsed
+    Stopped,        //! The visitor asked to stop
+    Invalid         //! Malformed or too deeply nested
+};
+
+//! SAX handler forwarding scalars to a visitor
+//! bool visitor(const JsonPath& path, const JsonScalar& value), false stops parsing.
+template <class Visitor>
+class JsonExtractor {
+public:
+    explicit JsonExtractor(Visitor& visitor) : m_visitor(visitor) {}
+
+    //! Parse text and call the visitor for every scalar
+    static JsonExtract extract(const char* pData, size_t size, Visitor& visitor) {
+        JsonExtractor extractor(visitor);
+        if (nlohmann::json::sax_parse(pData, pData + size, &extractor)) {
+            return JsonExtract::Done;
+        }
+        return extractor.m_stopped ? JsonExtract::Stopped : JsonExtract::Invalid;
+    }
+
+    // nlohmann::json SAX interface
+    bool null() {
+        JsonScalar value;
+        return scalar(value);
+    }
+
+    bool boolean(bool b) {
+        JsonScalar value;
+        value.type = JsonScalar::Type::Bool;
+        value.boolean = b;
+        return scalar(value);
+    }
+
+    bool number_integer(int64_t i) {
+        JsonScalar value;
+        value.type = JsonScalar::Type::Integer;
+        value.integer = i;
+        return scalar(value);
+    }
+
+    bool number_unsigned(uint64_t u) {
+        JsonScalar value;
+        value.type = JsonScalar::Type::Unsigned;
+        value.unsignedInteger = u;
+        return scalar(value);
+    }
+
+    bool number_float(double d, const std::string&) {
+        JsonScalar value;
+        value.type = JsonScalar::Type::Float;
+        value.number = d;
+        return scalar(value);
+    }
+
+    bool string(std::string& s) {
+        JsonScalar value;
+        value.type = JsonScalar::Type::String;
+        value.string = s;
+        return scalar(value);
+    }
+
+    template <class Binary>
+    bool binary(Binary&) {
+        return false;
+    }
+
+    bool start_object(size_t) {
+        return push(false);
+    }
+
+    bool key(std::string& k) {
+        JsonPath::Level& level = m_path.m_levels[m_path.m_depth - 1];
+        level.keyTooLong = k.size() > JsonPath::MaxKeyLen;
+        if (!level.keyTooLong) {
+            memcpy(level.key, k.data(), k.size());
+            level.keyLen = (uint8_t)k.size();
+        }
+        return true;
+    }
+
+    bool end_object() {
+        return pop();
+    }
+
+    bool start_array(size_t) {
+        return push(true);
+    }
+
+    bool end_array() {
+        return pop();
+    }
+
+    template <class Exception>
+    bool parse_error(size_t, const std::string&, const Exception&) {
+        return false;
+    }
+
+private:
+    bool scalar(const JsonScalar& value) {
+        if (!m_visitor(m_path, value)) {
+            m_stopped = true;
+            return false;
+        }
+        nextElement();
+        return true;
+    }
+
+    bool push(bool isArray) {
+        if (m_path.m_depth == JsonPath::MaxDepth) {
+            return false;
+        }
+        JsonPath::Level& level = m_path.m_levels[m_path.m_depth++];
+        level.isArray = isArray;
+        level.index = 0;
+        level.keyLen = 0;
+        level.keyTooLong = false;
+        return true;
+    }
+
+    bool pop() {
+        m_path.m_depth--;
+        nextElement();
+        return true;
+    }
+
+    //! A value of the enclosing array is complete
+    void nextElement() {
+        if (m_path.m_depth > 0 && m_path.m_levels[m_path.m_depth - 1].isArray) {
+            m_path.m_levels[m_path.m_depth - 1].index++;
+        }
+    }
+
+    Visitor& m_visitor;
+    JsonPath m_path;
+    bool     m_stopped = false;
+};
+
+//! Parse text and call visitor(path, value) for every scalar
+template <class Visitor>
+JsonExtract extractJson(const char* pData, size_t size, Visitor&& visitor) {
+    return JsonExtractor<std::remove_reference_t<Visitor>>::extract(pData, size, visitor);
+}
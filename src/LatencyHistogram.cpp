@@ -0,0 +1,55 @@
+#include "LatencyHistogram.h"
+#include <cmath>
+
+uint64_t LatencyHistogram::mean() const {
+    uint64_t count = m_count.load(std::memory_order_relaxed);
+    return count ? m_sum.load(std::memory_order_relaxed) / count : 0;
+}
+
+/**
+ * Walks the buckets until the cumulative count reaches the requested rank.
+ * The result never exceeds the largest recorded value.
+ *
+ * @param fraction Percentile as a fraction, e.g. 0.99.
+ * @return uint64_t The value at the percentile.
+ */
+uint64_t LatencyHistogram::percentile(double fraction) const {
+    uint64_t count = m_count.load(std::memory_order_relaxed);
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)std::ceil(fraction * count);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < BucketCount; i++) {
+        cumulative += m_buckets[i].load(std::memory_order_relaxed);
+        if (cumulative >= rank) {
+            uint64_t highest = highestOf(i);
+            uint64_t max = m_max.load(std::memory_order_relaxed);
+            return highest < max ? highest : max;
+        }
+    }
+    return m_max.load(std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset() {
+    for (auto& bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::highestOf(size_t index) {
+    if (index < (2u << SubBucketBits)) {
+        return index;
+    }
+    unsigned shift = (unsigned)(index >> SubBucketBits) - 1;
+    uint64_t mantissa = index - ((size_t)shift << SubBucketBits);
+    return ((mantissa + 1) << shift) - 1;
+}
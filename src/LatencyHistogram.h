@@ -0,0 +1,63 @@
+/**
+* Lock-free latency histogram in the style of HdrHistogram. Each power of two
+* is split into 32 linear sub-buckets, so any recorded value is resolved to
+* within about 3% from a few nanoseconds up to minutes, in fixed memory.
+* Recording is a handful of relaxed atomic operations; percentiles are
+* computed by the reader by walking the buckets.
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class LatencyHistogram {
+public:
+    static constexpr unsigned SubBucketBits = 5;    //! 32 sub-buckets per power of two
+    static constexpr unsigned MaxValueBits = 40;    //! Values from 2^40 ns, about 18 minutes, are clamped
+    static constexpr size_t BucketCount = (size_t)(MaxValueBits + 1 - SubBucketBits) << SubBucketBits;
+    static constexpr uint64_t MaxValue = (1ull << MaxValueBits) - 1;
+
+    void record(uint64_t value) {
+        if (value > MaxValue) {
+            value = MaxValue;
+        }
+        m_buckets[indexOf(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+    uint64_t mean() const;
+
+    //! Smallest value that at least fraction (0..1] of the recorded values
+    //! do not exceed, rounded up to its bucket; 0 if nothing was recorded
+    uint64_t percentile(double fraction) const;
+
+    //! Forget all recorded values. Values recorded concurrently may be lost.
+    void reset();
+
+    //! Bucket holding value: values below 64 exactly, larger ones by their
+    //! top SubBucketBits + 1 bits
+    static size_t indexOf(uint64_t value) {
+        unsigned msb = 63 - __builtin_clzll(value | 1);
+        unsigned shift = msb > SubBucketBits ? msb - SubBucketBits : 0;
+        return ((size_t)shift << SubBucketBits) + (size_t)(value >> shift);
+    }
+
+    //! Largest value that falls in bucket index
+    static uint64_t highestOf(size_t index);
+
+private:
+    std::array<std::atomic<uint64_t>, BucketCount> m_buckets{};
+    std::atomic<uint64_t>   m_count{0};
+    std::atomic<uint64_t>   m_sum{0};
+    std::atomic<uint64_t>   m_max{0};
+};
@@ -0,0 +1,327 @@
+#include "Logger.h"
+#include "ThreadUtils.h"
+#include <libwebsockets.h>
+#include <cstdio>
+#include <cstring>
+#include <sched.h>
+#include <unistd.h>
+
+Logger::Record Logger::m_ring[Logger::RingSize];
+
+/**
+ * Starts the drain thread.
+ *
+ * @param cores CPU cores the drain thread may run on.
+ * @return bool True if the thread was started.
+ */
+bool Logger::start(std::vector<unsigned> cores) {
+    if (m_running.exchange(true)) {
+        return true;
+    }
+
+    m_exited.store(false);
+    pthread_t thread = ThreadUtils::startThread(
+        "Logger",
+        drainThread,
+        nullptr,
+        cores,
+        false,
+        false,
+        sched_get_priority_min(SCHED_OTHER),
+        SCHED_OTHER
+    );
+
+    if (thread == INVALID_PTHREAD) {
+        m_running.store(false);
+        m_exited.store(true);
+        fprintf(stderr, "Logger: Failed to start drain thread\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Stops the drain thread after it has written all queued records.
+ */
+void Logger::stop() {
+    m_running.store(false);
+    while (!m_exited.load()) {
+        usleep(1000);
+    }
+}
+
+/**
+ * Converts a level name from the settings file.
+ *
+ * @param name "debug", "info", "warn", "error" or "off".
+ * @return Level Matching level, Info if the name is unknown.
+ */
+Logger::Level Logger::levelFromName(const char* name) {
+    if (strcmp(name, "debug") == 0) return Level::Debug;
+    if (strcmp(name, "warn") == 0) return Level::Warn;
+    if (strcmp(name, "error") == 0) return Level::Error;
+    if (strcmp(name, "off") == 0) return Level::Off;
+    return Level::Info;
+}
+
+void Logger::checkFormat(const char*, ...) {
+}
+
+/**
+ * Forwards a libwebsockets log line. lws lines end with a newline, which is
+ * stripped since the drain thread terminates every record itself.
+ *
+ * @param level lws log level bit (LLL_*).
+ * @param line Log line.
+ */
+void Logger::lwsEmit(int level, const char* line) {
+    Level ourLevel = (level & LLL_ERR) ? Level::Error :
+                     (level & LLL_WARN) ? Level::Warn :
+                     (level & (LLL_NOTICE | LLL_USER)) ? Level::Info : Level::Debug;
+    if (!enabled(ourLevel)) {
+        return;
+    }
+
+    size_t len = strlen(line);
+    if (len > 0 && line[len - 1] == '\n') {
+        len--;
+    }
+    char trimmed[StringBytes];
+    if (len >= sizeof(trimmed)) {
+        len = sizeof(trimmed) - 1;
+    }
+    memcpy(trimmed, line, len);
+    trimmed[len] = '\0';
+
+    write(ourLevel, "lws: %s", (const char*)trimmed);
+}
+
+/**
+ * Claims a free ring slot for a producer. Lock free; returns nullptr when
+ * the ring is full instead of waiting.
+ *
+ * @return Record* Slot to fill, or nullptr if the record must be dropped.
+ */
+Logger::Record* Logger::claim() {
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+
+    while (true) {
+        size_t slot = pos & (RingSize - 1);
+        Record& record = m_ring[slot];
+        size_t sequence = record.sequence.load(std::memory_order_acquire) + slot;
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                record.position = pos;
+                record.timestampNs = ThreadUtils::monotonicNs();
+                return &record;
+            }
+        } else if (diff < 0) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        } else {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Hands a filled slot to the drain thread.
+ *
+ * @param pRecord Slot returned by claim().
+ */
+void Logger::publish(Record* pRecord) {
+    size_t slot = pRecord->position & (RingSize - 1);
+    pRecord->sequence.store(pRecord->position + 1 - slot, std::memory_order_release);
+}
+
+/**
+ * Copies a string argument into the record, truncating it if the record's
+ * string area is exhausted.
+ */
+void Logger::encodeString(Record& record, Arg& arg, const char* str) {
+    arg.type = Arg::Type::String;
+    arg.offset = record.stringsUsed;
+
+    if (!str) {
+        str = "(null)";
+    }
+
+    size_t room = StringBytes - record.stringsUsed;
+    if (room == 0) {
+        arg.offset = StringBytes - 1;
+        return;
+    }
+
+    size_t len = strnlen(str, room - 1);
+    memcpy(record.strings + record.stringsUsed, str, len);
+    record.strings[record.stringsUsed + len] = '\0';
+    record.stringsUsed += len + 1;
+}
+
+/**
+ * Formats one record. Walks the printf format string and renders each
+ * conversion with the stored argument, so the formatting cost is paid on
+ * the drain thread instead of the producer.
+ *
+ * @param record Record to format.
+ * @param out Output buffer.
+ * @param outLen Size of the output buffer.
+ * @return size_t Number of characters written, excluding the terminator.
+ */
+size_t Logger::format(const Record& record, char* out, size_t outLen) {
+    static const char levelNames[] = { 'D', 'I', 'W', 'E' };
+    size_t used = snprintf(out, outLen, "[%10.6f] %c ",
+        record.timestampNs / 1e9, levelNames[static_cast<int>(record.level) & 3]);
+
+    const char* p = record.fmt;
+    size_t argIndex = 0;
+
+    while (*p && used + 1 < outLen) {
+        if (*p != '%') {
+            out[used++] = *p++;
+            continue;
+        }
+
+        if (p[1] == '%') {
+            out[used++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // Copy flags, width and precision, drop the length modifiers
+        char spec[32];
+        size_t specLen = 0;
+        spec[specLen++] = *p++;
+        while (*p && strchr("-+ #0123456789.", *p) && specLen < sizeof(spec) - 4) {
+            spec[specLen++] = *p++;
+        }
+        while (*p && strchr("hlLqjzt", *p)) {
+            p++;
+        }
+        char conversion = *p ? *p++ : 's';
+
+        if (argIndex >= record.argCount) {
+            break;
+        }
+        const Arg& arg = record.args[argIndex++];
+
+        int n = 0;
+        switch (arg.type) {
+        case Arg::Type::Int:
+            if (conversion == 'c') {
+                spec[specLen++] = 'c';
+                spec[specLen] = '\0';
+                n = snprintf(out + used, outLen - used, spec, (int)arg.i);
+            } else {
+                spec[specLen++] = 'l';
+                spec[specLen++] = 'l';
+                spec[specLen++] = strchr("ouxX", conversion) ? conversion : 'd';
+                spec[specLen] = '\0';
+                n = snprintf(out + used, outLen - used, spec, (long long)arg.i);
+            }
+            break;
+        case Arg::Type::UInt:
+            spec[specLen++] = 'l';
+            spec[specLen++] = 'l';
+            spec[specLen++] = strchr("ouxX", conversion) ? conversion : 'u';
+            spec[specLen] = '\0';
+            n = snprintf(out + used, outLen - used, spec, (unsigned long long)arg.u);
+            break;
+        case Arg::Type::Double:
+            spec[specLen++] = strchr("eEfFgGaA", conversion) ? conversion : 'f';
+            spec[specLen] = '\0';
+            n = snprintf(out + used, outLen - used, spec, arg.d);
+            break;
+        case Arg::Type::String:
+            spec[specLen++] = 's';
+            spec[specLen] = '\0';
+            n = snprintf(out + used, outLen - used, spec, record.strings + arg.offset);
+            break;
+        case Arg::Type::Pointer:
+            spec[specLen++] = 'p';
+            spec[specLen] = '\0';
+            n = snprintf(out + used, outLen - used, spec, arg.p);
+            break;
+        }
+
+        if (n > 0) {
+            used += (size_t)n < outLen - used ? (size_t)n : outLen - used - 1;
+        }
+    }
+
+    // Strip a trailing newline from printf style messages, one is added on output
+    if (used > 0 && out[used - 1] == '\n') {
+        used--;
+    }
+    out[used] = '\0';
+    return used;
+}
+
+/**
+ * Formats and writes the oldest record, if one is ready.
+ *
+ * @return bool True if a record was written.
+ */
+bool Logger::drainOne(char* line, size_t lineLen) {
+    size_t slot = m_dequeuePos & (RingSize - 1);
+    Record& record = m_ring[slot];
+
+    size_t sequence = record.sequence.load(std::memory_order_acquire) + slot;
+    if (sequence != m_dequeuePos + 1) {
+        return false;
+    }
+
+    size_t len = format(record, line, lineLen - 1);
+    line[len++] = '\n';
+    fwrite(line, 1, len, record.level >= Level::Warn ? stderr : stdout);
+
+    record.sequence.store(m_dequeuePos + RingSize - slot, std::memory_order_release);
+    m_dequeuePos++;
+    return true;
+}
+
+/**
+ * Drain thread. Writes records in batches and sleeps briefly when the ring
+ * is empty; it runs at the lowest priority so it only uses idle time.
+ *
+ * @param arg Unused.
+ * @return void* Always returns 0.
+ */
+void* Logger::drainThread(void* arg) {
+    char line[512];
+    uint64_t reportedDrops = 0;
+
+    while (true) {
+        bool running = m_running.load();
+        size_t written = 0;
+        while (drainOne(line, sizeof(line))) {
+            written++;
+        }
+
+        uint64_t drops = m_dropped.load(std::memory_order_relaxed);
+        if (drops != reportedDrops) {
+            fprintf(stderr, "Logger: %llu messages dropped, ring full\n",
+                (unsigned long long)(drops - reportedDrops));
+            reportedDrops = drops;
+        }
+
+        if (written > 0) {
+            fflush(stdout);
+            fflush(stderr);
+        }
+
+        if (!running) {
+            break;
+        }
+
+        if (written == 0) {
+            usleep(5000);
+        }
+    }
+
+    m_exited.store(true);
+    return 0;
+}
@@ -0,0 +1,163 @@
+/**
+* Asynchronous, level gated logging. Producers copy the format string pointer
+* and the raw arguments into a lock-free ring without blocking or allocating.
+* A low priority thread formats the records and writes them to stdout/stderr,
+* so the websocket and control threads never perform blocking I/O.
+*
+* Messages below LOG_COMPILE_LEVEL are removed at compile time, messages
+* below the runtime level are rejected with a single atomic load.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+//! Compile-time floor: 0 debug, 1 info, 2 warning, 3 error
+#ifndef LOG_COMPILE_LEVEL
+#ifdef ENABLE_LOGS
+#define LOG_COMPILE_LEVEL 0
+#else
+#define LOG_COMPILE_LEVEL 1
+#endif
+#endif
+
+#define LOG_AT(level, ...)                                                          \
+    do {                                                                            \
+        if (static_cast<int>(level) >= LOG_COMPILE_LEVEL && Logger::enabled(level)) { \
+            if (false) Logger::checkFormat(__VA_ARGS__);                           \
+            Logger::write(level, __VA_ARGS__);                                      \
+        }                                                                           \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(Logger::Level::Debug, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(Logger::Level::Info, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(Logger::Level::Warn, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(Logger::Level::Error, __VA_ARGS__)
+
+class Logger {
+public:
+    enum class Level : uint8_t {
+        Debug = 0,
+        Info,
+        Warn,
+        Error,
+        Off
+    };
+
+    //! Start the drain thread on the given cores at the lowest priority
+    static bool start(std::vector<unsigned> cores);
+
+    //! Drain the remaining records and stop the drain thread
+    static void stop();
+
+    static void setLevel(Level level) { m_level.store(level, std::memory_order_relaxed); }
+    static Level level() { return m_level.load(std::memory_order_relaxed); }
+    static bool enabled(Level level) { return level >= m_level.load(std::memory_order_relaxed); }
+
+    //! Parse "debug", "info", "warn", "error" or "off"; unknown names give Info
+    static Level levelFromName(const char* name);
+
+    //! Records lost because the ring was full
+    static uint64_t dropped() { return m_dropped.load(std::memory_order_relaxed); }
+
+    //! Queue a printf style message. Never blocks; drops the message if the ring is full.
+    template <class... Args>
+    static void write(Level level, const char* fmt, const Args&... args)
+    {
+        static_assert(sizeof...(Args) <= MaxArgs, "Too many log arguments");
+
+        Record* pRecord = claim();
+        if (!pRecord) {
+            return;
+        }
+
+        pRecord->level = level;
+        pRecord->fmt = fmt;
+        pRecord->argCount = 0;
+        pRecord->stringsUsed = 0;
+        (encode(*pRecord, args), ...);
+        publish(pRecord);
+    }
+
+    //! Never called; lets the compiler check format strings against their arguments
+    static void checkFormat(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+    //! Forward libwebsockets log lines into the ring
+    static void lwsEmit(int level, const char* line);
+
+private:
+    static constexpr size_t MaxArgs = 8;            //! Arguments stored per record
+    static constexpr size_t StringBytes = 160;      //! Bytes for copied string arguments
+    static constexpr size_t RingSize = 1024;        //! Records in the ring, power of two
+
+    struct Arg {
+        enum class Type : uint8_t { Int, UInt, Double, String, Pointer } type;
+        union {
+            int64_t     i;
+            uint64_t    u;
+            double      d;
+            uint16_t    offset;     //! Offset of the copied string in Record::strings
+            const void* p;
+        };
+    };
+
+    //! Slot sequence numbers are stored relative to the slot index so the
+    //! zero-initialized ring is valid before any constructor has run.
+    struct Record {
+        std::atomic<size_t> sequence;               //! Ring slot sequence number minus slot index
+        size_t              position;               //! Ring position claimed by the producer
+        uint64_t            timestampNs;            //! Monotonic time the record was queued
+        const char*         fmt;                    //! Format string, must be a literal
+        Level               level;
+        uint8_t             argCount;
+        uint16_t            stringsUsed;
+        Arg                 args[MaxArgs];
+        char                strings[StringBytes];
+    };
+
+    static Record* claim();
+    static void publish(Record* pRecord);
+    static void* drainThread(void* arg);
+    static bool drainOne(char* line, size_t lineLen);
+    static size_t format(const Record& record, char* out, size_t outLen);
+
+    template <class T>
+    static void encode(Record& record, const T& value)
+    {
+        Arg& arg = record.args[record.argCount++];
+        if constexpr (std::is_floating_point<T>::value) {
+            arg.type = Arg::Type::Double;
+            arg.d = value;
+        } else if constexpr (std::is_enum<T>::value) {
+            arg.type = Arg::Type::Int;
+            arg.i = static_cast<int64_t>(value);
+        } else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value) {
+            arg.type = Arg::Type::Int;
+            arg.i = value;
+        } else if constexpr (std::is_integral<T>::value) {
+            arg.type = Arg::Type::UInt;
+            arg.u = value;
+        } else if constexpr (std::is_convertible<T, const char*>::value) {
+            encodeString(record, arg, value);
+        } else {
+            static_assert(std::is_pointer<T>::value, "Unsupported log argument type");
+            arg.type = Arg::Type::Pointer;
+            arg.p = value;
+        }
+    }
+
+    static void encodeString(Record& record, Arg& arg, const char* str);
+
+    inline static std::atomic<Level>    m_level{Level::Info};     //! Runtime level
+    inline static std::atomic<uint64_t> m_dropped{0};             //! Records lost to a full ring
+    inline static std::atomic<size_t>   m_enqueuePos{0};          //! Next slot for producers
+    inline static size_t                m_dequeuePos = 0;         //! Next slot for the drain thread
+    inline static std::atomic<bool>     m_running{false};         //! Drain thread should keep running
+    inline static std::atomic<bool>     m_exited{true};           //! Drain thread has exited
+    static Record                       m_ring[RingSize];         //! Record slots
+};
@@ -0,0 +1,71 @@
+/**
+* Fixed capacity ring of discrete messages. Used for the per-session outbound
+* queues of the websocket so a slow client only loses its own data.
+* The ring is not thread safe; the owner guards it with its own mutex.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+//! What to do with a new message when the ring is full
+enum class OverflowPolicy {
+    DropOldest,     //! Evict the oldest queued message to make room
+    Coalesce        //! Replace the newest queued message, the latest state wins
+};
+
+template <class T>
+class MessageRing {
+public:
+    explicit MessageRing(size_t capacity = 1)
+        : m_slots(capacity > 0 ? capacity : 1)
+    {
+    }
+
+    //! Queue a message. Returns false if an older message was discarded to fit it.
+    bool push(T&& message, OverflowPolicy policy)
+    {
+        if (m_count < m_slots.size()) {
+            m_slots[(m_head + m_count) % m_slots.size()] = std::move(message);
+            m_count++;
+            return true;
+        }
+
+        m_dropped++;
+        if (policy == OverflowPolicy::Coalesce) {
+            m_slots[(m_head + m_count - 1) % m_slots.size()] = std::move(message);
+        } else {
+            m_slots[m_head] = std::move(message);
+            m_head = (m_head + 1) % m_slots.size();
+        }
+        return false;
+    }
+
+    //! Move the oldest message out of the ring. Returns false if the ring is empty.
+    bool pop(T& message)
+    {
+        if (m_count == 0) {
+            return false;
+        }
+
+        message = std::move(m_slots[m_head]);
+        m_slots[m_head] = T();
+        m_head = (m_head + 1) % m_slots.size();
+        m_count--;
+        return true;
+    }
+
+    bool empty() const { return m_count == 0; }
+    size_t size() const { return m_count; }
+    size_t capacity() const { return m_slots.size(); }
+    uint64_t dropped() const { return m_dropped; }
+
+private:
+    std::vector<T> m_slots;         //! Preallocated message slots
+    size_t         m_head = 0;      //! Index of the oldest message
+    size_t         m_count = 0;     //! Number of queued messages
+    uint64_t       m_dropped = 0;   //! Messages discarded due to overflow
+};
@@ -0,0 +1,262 @@
+#include "Metrics.h"
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+enum class MetricType : uint8_t { Counter, Gauge, Histogram };
+
+//! One labelled series of a family; exactly one of the members is set
+struct Series {
+    string                  labels;         //! Formatted label set without braces, empty if none
+    unique_ptr<Counter>     pCounter;
+    unique_ptr<Gauge>       pGauge;
+    unique_ptr<Histogram>   pHistogram;
+    Metrics::Sampler        sampler;
+};
+
+//! Series sharing a name, exported under one HELP and TYPE
+struct Family {
+    string                      name;
+    string                      help;
+    MetricType                  type;
+    vector<unique_ptr<Series>>  series;
+};
+
+struct Registry {
+    mutex                       guard;      //! Guards registration and scrapes, never taken to record
+    vector<unique_ptr<Family>>  families;   //! In registration order
+};
+
+//! Function local so metrics can be registered from static initializers
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+const char* typeName(MetricType type) {
+    switch (type) {
+    case MetricType::Counter:   return "counter";
+    case MetricType::Gauge:     return "gauge";
+    case MetricType::Histogram: return "histogram";
+    }
+    return "untyped";
+}
+
+//! Escape a label value or, with quotes false, a HELP text
+string escape(const string& text, bool quotes) {
+    string escaped;
+    escaped.reserve(text.size());
+    for (char c : text) {
+        if (c == '\\') {
+            escaped += "\\\\";
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else if (c == '"' && quotes) {
+            escaped += "\\\"";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+string formatLabels(const Metrics::Labels& labels) {
+    string formatted;
+    for (const auto& label : labels) {
+        if (!formatted.empty()) {
+            formatted += ',';
+        }
+        formatted += label.first + "=\"" + escape(label.second, true) + '"';
+    }
+    return formatted;
+}
+
+/**
+ * Finds or creates a series. Must be called with the registry locked.
+ *
+ * @param name Metric name without Metrics::Prefix.
+ * @param help Description, used when the family is created.
+ * @param type Type of the family.
+ * @param labels Labels of the series.
+ * @return Series& The existing or new series.
+ * @throws std::invalid_argument if name is registered with another type.
+ */
+Series& findSeries(const string& name, const string& help, MetricType type, const Metrics::Labels& labels) {
+    Registry& reg = registry();
+    Family* pFamily = nullptr;
+    for (auto& family : reg.families) {
+        if (family->name == name) {
+            pFamily = family.get();
+            break;
+        }
+    }
+
+    if (!pFamily) {
+        reg.families.push_back(make_unique<Family>());
+        pFamily = reg.families.back().get();
+        pFamily->name = name;
+        pFamily->help = help;
+        pFamily->type = type;
+    } else if (pFamily->type != type) {
+        throw invalid_argument("Metric " + name + " is already registered as a " + typeName(pFamily->type));
+    }
+
+    string formatted = formatLabels(labels);
+    for (auto& series : pFamily->series) {
+        if (series->labels == formatted) {
+            return *series;
+        }
+    }
+
+    pFamily->series.push_back(make_unique<Series>());
+    pFamily->series.back()->labels = std::move(formatted);
+    return *pFamily->series.back();
+}
+
+//! Append one sample line
+void appendSample(string& out, const string& name, const char* suffix, const string& labels,
+    const char* extraLabel, const char* value) {
+    out += Metrics::Prefix;
+    out += name;
+    out += suffix;
+    if (!labels.empty() || extraLabel) {
+        out += '{';
+        out += labels;
+        if (extraLabel) {
+            if (!labels.empty()) {
+                out += ',';
+            }
+            out += extraLabel;
+        }
+        out += '}';
+    }
+    out += ' ';
+    out += value;
+    out += '\n';
+}
+
+} // namespace
+
+/**
+ * Constructor
+ *
+ * @param bounds Inclusive upper bounds in recording units, ascending. Bounds
+ * beyond MaxBuckets are ignored.
+ * @param scale Exported value of one recording unit.
+ */
+Histogram::Histogram(const vector<uint64_t>& bounds, double scale) :
+    m_boundCount(std::min(bounds.size(), MaxBuckets)),
+    m_scale(scale)
+{
+    std::copy(bounds.begin(), bounds.begin() + m_boundCount, m_bounds.begin());
+}
+
+const vector<uint64_t>& Histogram::latencyBoundsNs() {
+    static const vector<uint64_t> bounds = {
+        1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+        1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000, 250000000, 500000000,
+        1000000000
+    };
+    return bounds;
+}
+
+Counter& Metrics::counter(const string& name, const string& help, const Labels& labels) {
+    lock_guard<mutex> lck(registry().guard);
+    Series& series = findSeries(name, help, MetricType::Counter, labels);
+    if (!series.pCounter) {
+        series.pCounter = make_unique<Counter>();
+    }
+    return *series.pCounter;
+}
+
+Gauge& Metrics::gauge(const string& name, const string& help, const Labels& labels) {
+    lock_guard<mutex> lck(registry().guard);
+    Series& series = findSeries(name, help, MetricType::Gauge, labels);
+    if (!series.pGauge) {
+        series.pGauge = make_unique<Gauge>();
+    }
+    return *series.pGauge;
+}
+
+Histogram& Metrics::histogram(const string& name, const string& help, const Labels& labels,
+    const vector<uint64_t>& bounds, double scale) {
+    lock_guard<mutex> lck(registry().guard);
+    Series& series = findSeries(name, help, MetricType::Histogram, labels);
+    if (!series.pHistogram) {
+        series.pHistogram = make_unique<Histogram>(bounds, scale);
+    }
+    return *series.pHistogram;
+}
+
+void Metrics::counterFunction(const string& name, const string& help, const Labels& labels, Sampler sampler) {
+    lock_guard<mutex> lck(registry().guard);
+    findSeries(name, help, MetricType::Counter, labels).sampler = std::move(sampler);
+}
+
+void Metrics::gaugeFunction(const string& name, const string& help, const Labels& labels, Sampler sampler) {
+    lock_guard<mutex> lck(registry().guard);
+    findSeries(name, help, MetricType::Gauge, labels).sampler = std::move(sampler);
+}
+
+/**
+ * Formats every registered metric. Histogram buckets are read one by one
+ * while they may still be recorded, so a scrape can be off by the
+ * observations made during it; the next scrape catches up.
+ *
+ * @return std::string The text exposition.
+ */
+string Metrics::expose() {
+    Registry& reg = registry();
+    lock_guard<mutex> lck(reg.guard);
+
+    string out;
+    out.reserve(16384);
+    char value[64];
+    char le[64];
+
+    for (const auto& pFamily : reg.families) {
+        out += "# HELP ";
+        out += Prefix + pFamily->name + ' ' + escape(pFamily->help, false) + '\n';
+        out += "# TYPE ";
+        out += Prefix + pFamily->name + ' ' + typeName(pFamily->type) + '\n';
+
+        for (const auto& pSeries : pFamily->series) {
+            const string& labels = pSeries->labels;
+            if (pSeries->sampler) {
+                snprintf(value, sizeof(value), "%.17g", pSeries->sampler());
+                appendSample(out, pFamily->name, "", labels, nullptr, value);
+            } else if (pSeries->pCounter) {
+                snprintf(value, sizeof(value), "%" PRIu64, pSeries->pCounter->value());
+                appendSample(out, pFamily->name, "", labels, nullptr, value);
+            } else if (pSeries->pGauge) {
+                snprintf(value, sizeof(value), "%" PRId64, pSeries->pGauge->value());
+                appendSample(out, pFamily->name, "", labels, nullptr, value);
+            } else if (pSeries->pHistogram) {
+                const Histogram& histogram = *pSeries->pHistogram;
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i <= histogram.boundCount(); i++) {
+                    cumulative += histogram.bucket(i);
+                    if (i < histogram.boundCount()) {
+                        snprintf(le, sizeof(le), "le=\"%.9g\"", histogram.bound(i) * histogram.scale());
+                    } else {
+                        snprintf(le, sizeof(le), "le=\"+Inf\"");
+                    }
+                    snprintf(value, sizeof(value), "%" PRIu64, cumulative);
+                    appendSample(out, pFamily->name, "_bucket", labels, le, value);
+                }
+                snprintf(value, sizeof(value), "%.17g", histogram.sum() * histogram.scale());
+                appendSample(out, pFamily->name, "_sum", labels, nullptr, value);
+                snprintf(value, sizeof(value), "%" PRIu64, cumulative);
+                appendSample(out, pFamily->name, "_count", labels, nullptr, value);
+            }
+        }
+    }
+
+    return out;
+}
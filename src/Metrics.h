@@ -0,0 +1,105 @@
+/**
+* Process wide metrics registry, exported in the Prometheus text format on
+* /metrics. Counters, gauges and fixed-bucket histograms are registered once,
+* usually at startup, and then recorded with relaxed atomics only, so a hot
+* path pays a few nanoseconds and never takes a lock. Values a subsystem
+* already keeps in its own statistics are exported through samplers read at
+* scrape time instead of being counted twice.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+//! Monotonic count, on its own cache line so threads recording different
+//! metrics do not contend
+class alignas(64) Counter {
+public:
+    void add(uint64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value{0};
+};
+
+//! Value that goes up and down
+class alignas(64) Gauge {
+public:
+    void set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+    void add(int64_t n) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    int64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> m_value{0};
+};
+
+//! Distribution over fixed buckets. Values are recorded in integer units,
+//! e.g. nanoseconds, and scaled to the exported unit at scrape time.
+class Histogram {
+public:
+    static constexpr size_t MaxBuckets = 24;        //! Finite buckets, +Inf is implicit
+
+    //! \param bounds Inclusive upper bounds in recording units, ascending, at most MaxBuckets
+    //! \param scale Exported value of one recording unit, 1e-9 to export nanoseconds as seconds
+    Histogram(const std::vector<uint64_t>& bounds, double scale);
+
+    void observe(uint64_t value) {
+        size_t bucket = std::lower_bound(m_bounds.begin(), m_bounds.begin() + m_boundCount, value) -
+            m_bounds.begin();
+        m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    size_t boundCount() const { return m_boundCount; }
+    uint64_t bound(size_t i) const { return m_bounds[i]; }
+    //! Observations of bucket i alone, i == boundCount() for +Inf
+    uint64_t bucket(size_t i) const { return m_buckets[i].load(std::memory_order_relaxed); }
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+    double scale() const { return m_scale; }
+
+    //! 1 us to 1 s in 1-2.5-5 steps, for latencies recorded in nanoseconds
+    static const std::vector<uint64_t>& latencyBoundsNs();
+
+private:
+    std::array<uint64_t, MaxBuckets>                    m_bounds{};
+    size_t                                              m_boundCount;
+    double                                              m_scale;
+    std::array<std::atomic<uint64_t>, MaxBuckets + 1>   m_buckets{};    //! Last one is +Inf
+    std::atomic<uint64_t>                               m_sum{0};
+};
+
+class Metrics {
+public:
+    //! Label names and values of one series
+    typedef std::vector<std::pair<std::string, std::string>> Labels;
+    //! Reads a value kept elsewhere, runs on the service thread answering the scrape
+    typedef std::function<double()> Sampler;
+
+    static constexpr const char* Prefix = "embeddedui_";    //! Prepended to every exported name
+    static constexpr const char* ContentType = "text/plain; version=0.0.4; charset=utf-8";
+
+    //! Get or create a series. The returned metric lives until the process
+    //! exits, so callers keep the reference instead of looking it up again.
+    //! A name registered with another type throws std::invalid_argument.
+    static Counter& counter(const std::string& name, const std::string& help, const Labels& labels = {});
+    static Gauge& gauge(const std::string& name, const std::string& help, const Labels& labels = {});
+    static Histogram& histogram(const std::string& name, const std::string& help, const Labels& labels = {},
+        const std::vector<uint64_t>& bounds = Histogram::latencyBoundsNs(), double scale = 1e-9);
+
+    //! Export a value sampled at every scrape. Registering the same series
+    //! again replaces its sampler.
+    static void counterFunction(const std::string& name, const std::string& help, const Labels& labels,
+        Sampler sampler);
+    static void gaugeFunction(const std::string& name, const std::string& help, const Labels& labels,
+        Sampler sampler);
+
+    //! Every metric in the Prometheus text exposition format
+    static std::string expose();
+};
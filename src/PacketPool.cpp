@@ -0,0 +1,83 @@
+#include "PacketPool.h"
+
+/**
+ * Allocates the buffer of a packet with LWS_PRE bytes of headroom.
+ *
+ * @param capacity Payload capacity in bytes.
+ * @param sizeClass Pool free list the packet returns to, -1 if not pooled.
+ */
+Packet::Packet(size_t capacity, int sizeClass) :
+    m_buffer(new uint8_t[LWS_PRE + capacity]),
+    m_capacity(capacity),
+    m_sizeClass(sizeClass)
+{
+}
+
+Packet::~Packet() {
+    delete[] m_buffer;
+}
+
+/**
+ * Drops this reference. The last reference returns the packet to the pool.
+ */
+void PacketPtr::release() {
+    if (m_pPacket && m_pPacket->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        PacketPool::recycle(m_pPacket);
+    }
+    m_pPacket = nullptr;
+}
+
+/**
+ * Gets a packet from the smallest size class able to hold the payload.
+ *
+ * @param payloadLen Number of payload bytes the caller will write.
+ * @return PacketPtr Packet sized to payloadLen.
+ */
+PacketPtr PacketPool::acquire(size_t payloadLen) {
+    Packet* pPacket = nullptr;
+
+    for (size_t i = 0; i < NumSizeClasses; i++) {
+        if (payloadLen > SizeClasses[i]) {
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lck(m_mutex);
+            if (!m_freeLists[i].empty()) {
+                pPacket = m_freeLists[i].back();
+                m_freeLists[i].pop_back();
+            }
+        }
+
+        if (!pPacket) {
+            pPacket = new Packet(SizeClasses[i], (int)i);
+        }
+        break;
+    }
+
+    // Oversized payloads get a dedicated buffer
+    if (!pPacket) {
+        pPacket = new Packet(payloadLen, -1);
+    }
+
+    pPacket->m_size = payloadLen;
+    return PacketPtr(pPacket);
+}
+
+/**
+ * Returns a packet to its free list, or frees it if the list is full.
+ *
+ * @param pPacket Packet whose last reference was released.
+ */
+void PacketPool::recycle(Packet* pPacket) {
+    if (pPacket->m_sizeClass >= 0) {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        auto& freeList = m_freeLists[pPacket->m_sizeClass];
+        if (freeList.size() < MaxFreePerClass) {
+            freeList.push_back(pPacket);
+            return;
+        }
+    }
+
+    delete pPacket;
+}
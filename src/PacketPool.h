@@ -0,0 +1,110 @@
+/**
+* Pooled, reference counted buffers for outbound websocket frames.
+* Every packet reserves LWS_PRE bytes of headroom in front of its payload so
+* producers can write in place and the buffer can be handed to lws_write()
+* without another copy. One packet may be queued to several clients; it
+* returns to the pool when the last reference is released.
+*/
+
+#pragma once
+
+#include <libwebsockets.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+class PacketPool;
+
+class Packet {
+public:
+    //! Writable payload, LWS_PRE bytes after the start of the buffer
+    uint8_t* payload() { return m_buffer + LWS_PRE; }
+    const uint8_t* payload() const { return m_buffer + LWS_PRE; }
+
+    //! View the payload as an array of T
+    template <class T>
+    T* as() { return reinterpret_cast<T*>(payload()); }
+
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_capacity; }
+
+    //! Shrink or grow the payload length within the capacity
+    void resize(size_t size) { m_size = size < m_capacity ? size : m_capacity; }
+
+private:
+    friend class PacketPool;
+    friend class PacketPtr;
+
+    Packet(size_t capacity, int sizeClass);
+    ~Packet();
+    Packet(const Packet&) = delete;
+    Packet& operator=(const Packet&) = delete;
+
+    uint8_t*              m_buffer;         //! LWS_PRE headroom followed by the payload
+    size_t                m_capacity;       //! Payload capacity in bytes
+    size_t                m_size = 0;       //! Payload length in bytes
+    int                   m_sizeClass;      //! Pool free list the packet returns to, -1 if not pooled
+    std::atomic<uint32_t> m_refs{0};        //! Number of PacketPtr owning the packet
+};
+
+//! Intrusive reference to a pooled packet
+class PacketPtr {
+public:
+    PacketPtr() = default;
+    explicit PacketPtr(Packet* pPacket) : m_pPacket(pPacket) { retain(); }
+    PacketPtr(const PacketPtr& other) : m_pPacket(other.m_pPacket) { retain(); }
+    PacketPtr(PacketPtr&& other) noexcept : m_pPacket(std::exchange(other.m_pPacket, nullptr)) {}
+    ~PacketPtr() { release(); }
+
+    PacketPtr& operator=(const PacketPtr& other)
+    {
+        PacketPtr copy(other);
+        std::swap(m_pPacket, copy.m_pPacket);
+        return *this;
+    }
+
+    PacketPtr& operator=(PacketPtr&& other) noexcept
+    {
+        PacketPtr moved(std::move(other));
+        std::swap(m_pPacket, moved.m_pPacket);
+        return *this;
+    }
+
+    Packet* operator->() const { return m_pPacket; }
+    Packet& operator*() const { return *m_pPacket; }
+    explicit operator bool() const { return m_pPacket != nullptr; }
+
+private:
+    void retain()
+    {
+        if (m_pPacket) {
+            m_pPacket->m_refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void release();
+
+    Packet* m_pPacket = nullptr;
+};
+
+class PacketPool {
+public:
+    //! Get a packet able to hold payloadLen bytes, sized to payloadLen
+    static PacketPtr acquire(size_t payloadLen);
+
+private:
+    friend class PacketPtr;
+
+    static void recycle(Packet* pPacket);
+
+    //! Payload capacity of each size class, larger packets are not pooled
+    static constexpr size_t SizeClasses[] = { 256, 1024, 4096, 16384, 65536, 262144 };
+    static constexpr size_t NumSizeClasses = sizeof(SizeClasses) / sizeof(SizeClasses[0]);
+    static constexpr size_t MaxFreePerClass = 64;   //! Packets kept per size class
+
+    inline static std::mutex          m_mutex;                          //! Guards the free lists
+    inline static std::vector<Packet*> m_freeLists[NumSizeClasses];     //! Recycled packets per size class
+};
@@ -0,0 +1,563 @@
+#include "ProcessSupervisor.h"
+#include "ThreadUtils.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+/**
+ * Opens a pidfd for a child, readable once the child exits.
+ *
+ * @param pid Child process.
+ * @return int pidfd, -1 on kernels without pidfd_open (before 5.3).
+ */
+static int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static uint64_t msToNs(int ms) {
+    return (uint64_t)ms * 1000000ull;
+}
+
+ProcessSupervisor::ProcessSupervisor(std::string name) :
+    m_name(std::move(name)),
+    m_epollFd(epoll_create1(EPOLL_CLOEXEC)),
+    m_wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    m_thread(INVALID_PTHREAD)
+{
+    m_line.reserve(MaxLineLen);
+
+    if (m_epollFd < 0 || m_wakeFd < 0) {
+        LOG_ERROR("%s: Failed to create epoll/eventfd: %s", m_name.c_str(), strerror(errno));
+        return;
+    }
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = m_wakeFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &event);
+}
+
+ProcessSupervisor::~ProcessSupervisor() {
+    stop();
+    if (m_wakeFd >= 0) {
+        close(m_wakeFd);
+    }
+    if (m_epollFd >= 0) {
+        close(m_epollFd);
+    }
+}
+
+/**
+ * Starts the supervisor thread. The child inherits the thread's CPU
+ * affinity, so cores also bounds where the child runs.
+ *
+ * @param cores CPU cores the thread and its child may run on.
+ * @return bool True if the thread is running.
+ */
+bool ProcessSupervisor::start(std::vector<unsigned> cores) {
+    if (m_epollFd < 0 || m_wakeFd < 0) {
+        return false;
+    }
+    if (m_thread != INVALID_PTHREAD && !m_exited.load()) {
+        return true;
+    }
+
+    m_exit.store(false);
+    m_exited.store(false);
+    m_thread = ThreadUtils::startThread("Supervisor", supervisorThread, this,
+        cores, false, false, 0, SCHED_OTHER);
+
+    if (m_thread == INVALID_PTHREAD) {
+        m_exited.store(true);
+        LOG_ERROR("%s: Failed to start supervisor thread", m_name.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Stops the child as halt() does and waits for the supervisor thread to
+ * exit, which takes up to StopTimeoutMs if the child ignores SIGTERM.
+ */
+void ProcessSupervisor::stop() {
+    if (m_exited.load()) {
+        return;
+    }
+
+    halt();
+    m_exit.store(true);
+    wake();
+
+    while (!m_exited.load()) {
+        usleep(1000);
+    }
+}
+
+/**
+ * Requests the child to run. Returns immediately; the supervisor thread
+ * spawns it.
+ *
+ * @param argv Program and arguments.
+ */
+void ProcessSupervisor::launch(std::vector<std::string> argv) {
+    if (argv.empty()) {
+        LOG_ERROR("%s: launch without a program", m_name.c_str());
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        m_argv = std::move(argv);
+        if (!m_wanted) {
+            m_wanted = true;
+            m_launchNs = ThreadUtils::monotonicNs();
+        }
+    }
+    wake();
+}
+
+/**
+ * Requests the child to stop. Returns immediately; the supervisor thread
+ * sends SIGTERM and reaps it.
+ */
+void ProcessSupervisor::halt() {
+    {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        if (m_wanted) {
+            m_wanted = false;
+            m_haltNs = ThreadUtils::monotonicNs();
+        }
+    }
+    wake();
+}
+
+void ProcessSupervisor::wake() {
+    uint64_t one = 1;
+    ssize_t ignored = ::write(m_wakeFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void* ProcessSupervisor::supervisorThread(void* arg) {
+    static_cast<ProcessSupervisor*>(arg)->run();
+    return 0;
+}
+
+/**
+ * Supervisor loop. Blocks in epoll_wait() until the child exits, writes to
+ * stderr, a request arrives or a stop/restart deadline passes. Exits once
+ * stop() was called and the child is gone.
+ */
+void ProcessSupervisor::run() {
+    struct epoll_event events[4];
+    LOG_INFO("%s: supervisor thread started", m_name.c_str());
+
+    while (true) {
+        uint64_t nowNs = ThreadUtils::monotonicNs();
+        reconcile(nowNs);
+        if (m_exit.load() && m_pid < 0) {
+            break;
+        }
+
+        int n = epoll_wait(m_epollFd, events, 4, timeoutMs(nowNs));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("%s: epoll_wait failed: %s", m_name.c_str(), strerror(errno));
+            break;
+        }
+
+        bool exited = false;
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == m_wakeFd) {
+                uint64_t count;
+                ssize_t ignored = ::read(m_wakeFd, &count, sizeof(count));
+                (void)ignored;
+            } else if (fd == m_stderrFd) {
+                readStderr();
+            } else if (fd == m_stdoutFd) {
+                readStdout();
+            } else if (fd == m_pidFd) {
+                exited = true;
+            }
+        }
+
+        // Without a pidfd the exit is polled every PollMs
+        if (m_pid > 0 && (exited || m_pidFd < 0)) {
+            reap(ThreadUtils::monotonicNs());
+        }
+    }
+
+    // Only reached with a child on an epoll failure
+    if (m_pid > 0) {
+        kill(m_pid, SIGKILL);
+        waitpid(m_pid, nullptr, 0);
+        m_pid = -1;
+        m_pidPublic.store(-1);
+    }
+    m_state.store(ProcessState::Stopped);
+    m_exited.store(true);
+    LOG_INFO("%s: supervisor thread exiting", m_name.c_str());
+}
+
+/**
+ * Starts, signals or kills the child as needed to match the requested
+ * state.
+ *
+ * @param nowNs Current monotonic time.
+ */
+void ProcessSupervisor::reconcile(uint64_t nowNs) {
+    bool wanted;
+    {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        wanted = m_wanted && !m_exit.load();
+    }
+
+    if (m_pid > 0) {
+        if (!wanted && m_termNs == 0) {
+            terminate(nowNs);
+        } else if (m_termNs != 0 && !m_killed && nowNs - m_termNs >= msToNs(StopTimeoutMs)) {
+            LOG_WARN("%s: pid %d ignored SIGTERM for %d ms, killing it", m_name.c_str(), m_pid, StopTimeoutMs);
+            kill(m_pid, SIGKILL);
+            m_killed = true;
+            m_stats.kills++;
+        }
+        return;
+    }
+
+    if (!wanted) {
+        m_state.store(ProcessState::Stopped);
+        m_backoffMs = MinBackoffMs;
+        return;
+    }
+
+    if (m_state.load() == ProcessState::Backoff && nowNs < m_restartNs) {
+        return;
+    }
+    spawn(nowNs);
+}
+
+/**
+ * Spawns the child with stdin on /dev/null and stderr on a pipe. stdout
+ * goes to a pipe if there is an output handler, else to /dev/null.
+ * posix_spawn reports exec failures, such as a missing program, directly.
+ *
+ * @param nowNs Current monotonic time.
+ * @return bool True if the child is running.
+ */
+bool ProcessSupervisor::spawn(uint64_t nowNs) {
+    std::vector<std::string> argv;
+    uint64_t launchNs;
+    {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        argv = m_argv;
+        launchNs = m_launchNs;
+    }
+
+    std::vector<char*> args;
+    for (std::string& arg : argv) {
+        args.push_back(&arg[0]);
+    }
+    args.push_back(nullptr);
+
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+        LOG_ERROR("%s: Failed to create stderr pipe: %s", m_name.c_str(), strerror(errno));
+        pipeFds[0] = pipeFds[1] = -1;
+    } else {
+        fcntl(pipeFds[0], F_SETFL, O_NONBLOCK);
+    }
+
+    int outFds[2] = { -1, -1 };
+    if (m_outputHandler) {
+        if (pipe2(outFds, O_CLOEXEC) != 0) {
+            LOG_ERROR("%s: Failed to create stdout pipe: %s", m_name.c_str(), strerror(errno));
+            outFds[0] = outFds[1] = -1;
+        } else {
+            fcntl(outFds[0], F_SETFL, O_NONBLOCK);
+        }
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    if (outFds[1] >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, outFds[1], STDOUT_FILENO);
+    } else {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+    if (pipeFds[1] >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, pipeFds[1], STDERR_FILENO);
+    }
+
+    // Undo signal state the server sets up for itself, such as an ignored SIGPIPE
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    for (int sig : { SIGPIPE, SIGTERM, SIGINT, SIGHUP }) {
+        sigaddset(&defaults, sig);
+    }
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid = -1;
+    int err = posix_spawnp(&pid, args[0], &actions, &attr, args.data(), environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    for (int fd : { pipeFds[1], outFds[1] }) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    if (err != 0) {
+        for (int fd : { pipeFds[0], outFds[0] }) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        m_stats.failures++;
+        m_restartNs = nowNs + msToNs(m_backoffMs);
+        LOG_ERROR("%s: Failed to start %s: %s, retrying in %d ms", m_name.c_str(), args[0], strerror(err), m_backoffMs);
+        m_backoffMs = std::min(m_backoffMs * 2, MaxBackoffMs);
+        m_state.store(ProcessState::Backoff);
+        return false;
+    }
+
+    m_pid = pid;
+    m_spawnNs = ThreadUtils::monotonicNs();
+    m_termNs = 0;
+    m_killed = false;
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    m_pidFd = pidfdOpen(pid);
+    if (m_pidFd >= 0) {
+        event.data.fd = m_pidFd;
+        epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_pidFd, &event);
+    }
+    m_stderrFd = pipeFds[0];
+    if (m_stderrFd >= 0) {
+        event.data.fd = m_stderrFd;
+        epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_stderrFd, &event);
+    }
+    m_stdoutFd = outFds[0];
+    if (m_stdoutFd >= 0) {
+        event.data.fd = m_stdoutFd;
+        epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_stdoutFd, &event);
+    }
+
+    // The first start after launch() is timed, later ones are restarts
+    m_stats.starts++;
+    if (launchNs != m_startedLaunchNs) {
+        m_startedLaunchNs = launchNs;
+        m_stats.startUs.store((m_spawnNs - launchNs) / 1000);
+    } else {
+        m_stats.restarts++;
+    }
+
+    m_pidPublic.store(pid);
+    m_state.store(ProcessState::Running);
+    LOG_INFO("%s: started %s, pid %d", m_name.c_str(), args[0], pid);
+    return true;
+}
+
+/**
+ * Sends SIGTERM to the child.
+ *
+ * @param nowNs Current monotonic time.
+ */
+void ProcessSupervisor::terminate(uint64_t nowNs) {
+    LOG_INFO("%s: stopping pid %d", m_name.c_str(), m_pid);
+    kill(m_pid, SIGTERM);
+    m_termNs = nowNs;
+    m_state.store(ProcessState::Stopping);
+}
+
+/**
+ * Collects the child if it has exited and decides whether to restart it.
+ *
+ * @param nowNs Current monotonic time.
+ */
+void ProcessSupervisor::reap(uint64_t nowNs) {
+    int status = 0;
+    pid_t result = waitpid(m_pid, &status, WNOHANG);
+    if (result == 0 || (result < 0 && errno == EINTR)) {
+        return;
+    }
+
+    // ECHILD if SIGCHLD is ignored and the kernel already reaped it
+    int exitStatus = 0;
+    if (result > 0) {
+        exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : WIFSIGNALED(status) ? -WTERMSIG(status) : 0;
+    }
+    m_stats.lastExitStatus.store(exitStatus);
+
+    readStderr();
+    if (!m_line.empty()) {
+        emitLine();
+    }
+    if (m_stderrFd >= 0) {
+        close(m_stderrFd);
+        m_stderrFd = -1;
+    }
+    readStdout();
+    if (m_stdoutFd >= 0) {
+        close(m_stdoutFd);
+        m_stdoutFd = -1;
+    }
+    if (m_outputHandler) {
+        m_outputHandler(nullptr, 0);
+    }
+    if (m_pidFd >= 0) {
+        close(m_pidFd);
+        m_pidFd = -1;
+    }
+
+    pid_t pid = m_pid;
+    m_pid = -1;
+    m_pidPublic.store(-1);
+
+    bool wanted;
+    uint64_t haltNs;
+    {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        wanted = m_wanted && !m_exit.load();
+        haltNs = m_haltNs;
+    }
+
+    if (m_termNs != 0 || !wanted) {
+        uint64_t requestNs = (haltNs != 0 && haltNs <= nowNs) ? haltNs : m_termNs;
+        m_stats.stopUs.store(requestNs != 0 ? (nowNs - requestNs) / 1000 : 0);
+        LOG_INFO("%s: pid %d stopped with status %d", m_name.c_str(), pid, exitStatus);
+        m_termNs = 0;
+        m_backoffMs = MinBackoffMs;
+        m_state.store(ProcessState::Stopped);
+        return;
+    }
+
+    // A long run means the last failure was transient, restart quickly
+    if (nowNs - m_spawnNs >= msToNs(StableRunMs)) {
+        m_backoffMs = MinBackoffMs;
+    }
+    m_stats.failures++;
+    m_restartNs = nowNs + msToNs(m_backoffMs);
+    LOG_WARN("%s: pid %d exited with status %d after %llu ms, restarting in %d ms", m_name.c_str(), pid,
+        exitStatus, (unsigned long long)((nowNs - m_spawnNs) / 1000000), m_backoffMs);
+    m_backoffMs = std::min(m_backoffMs * 2, MaxBackoffMs);
+    m_state.store(ProcessState::Backoff);
+}
+
+/**
+ * Reads the child's stderr until the pipe is empty and logs every complete
+ * line. '\r' also ends a line, ffmpeg uses it for progress updates.
+ */
+void ProcessSupervisor::readStderr() {
+    char buffer[1024];
+
+    while (m_stderrFd >= 0) {
+        ssize_t n = ::read(m_stderrFd, buffer, sizeof(buffer));
+        if (n > 0) {
+            for (ssize_t i = 0; i < n; i++) {
+                char c = buffer[i];
+                if (c == '\n' || c == '\r') {
+                    if (!m_line.empty()) {
+                        emitLine();
+                    }
+                } else if (m_line.size() < MaxLineLen) {
+                    m_line.push_back(c);
+                }
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            break;
+        }
+
+        // The child closed stderr; closing the fd also removes it from epoll
+        close(m_stderrFd);
+        m_stderrFd = -1;
+    }
+}
+
+/**
+ * Passes everything in the child's stdout pipe to the output handler.
+ */
+void ProcessSupervisor::readStdout() {
+    uint8_t buffer[16384];
+
+    while (m_stdoutFd >= 0) {
+        ssize_t n = ::read(m_stdoutFd, buffer, sizeof(buffer));
+        if (n > 0) {
+            m_stats.stdoutBytes += n;
+            m_outputHandler(buffer, (size_t)n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            break;
+        }
+
+        close(m_stdoutFd);
+        m_stdoutFd = -1;
+    }
+}
+
+void ProcessSupervisor::emitLine() {
+    LOG_INFO("%s: %s", m_name.c_str(), m_line.c_str());
+    m_stats.stderrLines++;
+    m_line.clear();
+}
+
+/**
+ * Time until the next deadline the loop must act on.
+ *
+ * @param nowNs Current monotonic time.
+ * @return int epoll_wait() timeout in ms, -1 to wait for events only.
+ */
+int ProcessSupervisor::timeoutMs(uint64_t nowNs) const {
+    uint64_t deadlineNs = 0;
+    if (m_pid > 0) {
+        if (m_termNs != 0 && !m_killed) {
+            deadlineNs = m_termNs + msToNs(StopTimeoutMs);
+        }
+        if (m_pidFd < 0 && (deadlineNs == 0 || deadlineNs > nowNs + msToNs(PollMs))) {
+            deadlineNs = nowNs + msToNs(PollMs);
+        }
+    } else if (m_state.load() == ProcessState::Backoff) {
+        deadlineNs = m_restartNs;
+    }
+
+    if (deadlineNs == 0) {
+        return -1;
+    }
+    return deadlineNs <= nowNs ? 0 : (int)((deadlineNs - nowNs + 999999) / 1000000);
+}
@@ -0,0 +1,124 @@
+/**
+* Supervises one long running child process, such as the ffmpeg HLS encoder.
+* The child is started with posix_spawn and tracked through a pidfd on the
+* supervisor's epoll loop, so no thread blocks on it. Its stderr is read line
+* by line into the log, its stdout optionally to a consumer. A child that exits on its own is restarted with an
+* exponential backoff; halt() asks it to exit with SIGTERM and only kills it
+* if it ignores that.
+*/
+
+#pragma once
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//! Lifecycle of the supervised process
+enum class ProcessState : uint8_t {
+    Stopped     = 0,        //! Not running and not wanted
+    Running     = 1,
+    Backoff     = 2,        //! Exited on its own, waiting to restart
+    Stopping    = 3         //! SIGTERM sent, waiting for it to exit
+};
+
+//! Supervisor counters
+struct ProcessStats {
+    std::atomic<uint64_t> starts{0};            //! Successful spawns, restarts included
+    std::atomic<uint64_t> restarts{0};          //! Spawns after an unexpected exit
+    std::atomic<uint64_t> failures{0};          //! Exits that were not requested, and failed spawns
+    std::atomic<uint64_t> kills{0};             //! Children that needed SIGKILL
+    std::atomic<uint64_t> stderrLines{0};       //! Lines logged from stderr
+    std::atomic<uint64_t> stdoutBytes{0};       //! Bytes passed to the output handler
+    std::atomic<int>      lastExitStatus{0};    //! Exit code, or -signal if killed by a signal
+    std::atomic<uint64_t> startUs{0};           //! launch() to the child running, last start
+    std::atomic<uint64_t> stopUs{0};            //! halt() to the child reaped, last stop
+};
+
+class ProcessSupervisor {
+public:
+    //! Receives the child's stdout on the supervisor thread; (nullptr, 0)
+    //! marks the end of the output of one run of the child
+    typedef std::function<void(const uint8_t* pData, size_t len)> OutputHandler;
+
+    static constexpr int StopTimeoutMs = 3000;      //! SIGTERM grace period before SIGKILL
+    static constexpr int MinBackoffMs = 500;        //! First restart delay
+    static constexpr int MaxBackoffMs = 30000;      //! Restart delay ceiling
+    static constexpr int StableRunMs = 10000;       //! A run this long resets the backoff
+    static constexpr int PollMs = 100;              //! Exit polling without pidfd support
+    static constexpr size_t MaxLineLen = 120;       //! Longer stderr lines are truncated
+
+    //! \param name Prefix of the log lines
+    explicit ProcessSupervisor(std::string name);
+    ~ProcessSupervisor();
+
+    //! Pipe the child's stdout to handler instead of /dev/null, call before start()
+    void setOutputHandler(OutputHandler handler) { m_outputHandler = std::move(handler); }
+
+    //! Start the supervisor thread
+    bool start(std::vector<unsigned> cores);
+
+    //! Stop the child gracefully, then the supervisor thread
+    void stop();
+
+    //! Run argv until halt(), restarting it whenever it exits. argv[0] is
+    //! looked up in PATH. New arguments take effect on the next start.
+    void launch(std::vector<std::string> argv);
+
+    //! Ask the child to exit, SIGKILL after StopTimeoutMs
+    void halt();
+
+    ProcessState state() const { return m_state.load(std::memory_order_relaxed); }
+    pid_t pid() const { return m_pidPublic.load(std::memory_order_relaxed); }
+    const ProcessStats& getStats() const { return m_stats; }
+
+private:
+    static void* supervisorThread(void* arg);
+    void run();
+
+    //! Bring the child in line with the requested state
+    void reconcile(uint64_t nowNs);
+    bool spawn(uint64_t nowNs);
+    void terminate(uint64_t nowNs);
+    void reap(uint64_t nowNs);
+    void readStderr();
+    void readStdout();
+    void emitLine();
+    int timeoutMs(uint64_t nowNs) const;
+    void wake();
+
+    std::string                 m_name;
+    int                         m_epollFd;              //! Waits on the wake eventfd, pidfd and stderr
+    int                         m_wakeFd;               //! eventfd signaled by launch(), halt() and stop()
+    pthread_t                   m_thread;               //! Supervisor thread
+    std::atomic<bool>           m_exit{false};          //! Signal thread to exit
+    std::atomic<bool>           m_exited{true};         //! Thread indicates it has exited
+
+    std::mutex                  m_mutex;                //! Guards the requested state below
+    std::vector<std::string>    m_argv;                 //! Command line of the next start
+    bool                        m_wanted = false;       //! The child should be running
+    uint64_t                    m_launchNs = 0;         //! Time of the last launch()
+    uint64_t                    m_haltNs = 0;           //! Time of the last halt()
+
+    // Owned by the supervisor thread
+    pid_t                       m_pid = -1;             //! Child, -1 if none
+    int                         m_pidFd = -1;           //! Readable when the child exits, -1 if unsupported
+    int                         m_stderrFd = -1;        //! Read end of the child's stderr
+    int                         m_stdoutFd = -1;        //! Read end of the child's stdout, with an output handler
+    OutputHandler               m_outputHandler;        //! Consumer of the child's stdout
+    std::string                 m_line;                 //! Partial stderr line
+    uint64_t                    m_spawnNs = 0;          //! Time the child started
+    uint64_t                    m_termNs = 0;           //! Time SIGTERM was sent, 0 if not
+    bool                        m_killed = false;       //! SIGKILL sent after the grace period
+    uint64_t                    m_restartNs = 0;        //! Time of the next restart while in Backoff
+    int                         m_backoffMs = MinBackoffMs;
+    uint64_t                    m_startedLaunchNs = 0;  //! launch() the last spawn belonged to
+
+    std::atomic<ProcessState>   m_state{ProcessState::Stopped};
+    std::atomic<pid_t>          m_pidPublic{-1};
+    ProcessStats                m_stats;
+};
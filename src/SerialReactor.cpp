@@ -0,0 +1,200 @@
+#include "SerialReactor.h"
+#include "serial.h"
+#include "ThreadUtils.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+SerialReactor::SerialReactor() :
+    m_epollFd(epoll_create1(EPOLL_CLOEXEC)),
+    m_wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    m_thread(INVALID_PTHREAD)
+{
+    if (m_epollFd < 0 || m_wakeFd < 0) {
+        LOG_ERROR("SerialReactor: Failed to create epoll/eventfd: %s", strerror(errno));
+        return;
+    }
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;   // nullptr marks the wake eventfd
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &event);
+}
+
+SerialReactor::~SerialReactor() {
+    stop();
+    if (m_wakeFd >= 0) {
+        close(m_wakeFd);
+    }
+    if (m_epollFd >= 0) {
+        close(m_epollFd);
+    }
+}
+
+/**
+ * Starts the reactor thread.
+ *
+ * @param cores CPU cores the thread may run on.
+ * @param priority Scheduling priority.
+ * @param policy Scheduling policy.
+ * @return bool True if the thread is running.
+ */
+bool SerialReactor::start(std::vector<unsigned> cores, int priority, int policy) {
+    if (m_thread != INVALID_PTHREAD && !m_exited.load()) {
+        return true;
+    }
+
+    m_exit.store(false);
+    m_exited.store(false);
+    m_thread = ThreadUtils::startThread("SerialReactor", reactorThread, this,
+        cores, false, false, priority, policy);
+
+    if (m_thread == INVALID_PTHREAD) {
+        m_exited.store(true);
+        LOG_ERROR("SerialReactor: Failed to start reactor thread");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Stops the reactor thread and waits for it to exit.
+ */
+void SerialReactor::stop() {
+    if (m_exited.load()) {
+        return;
+    }
+
+    m_exit.store(true);
+    wake();
+
+    while (!m_exited.load()) {
+        usleep(1000);
+    }
+}
+
+/**
+ * Registers a port with the reactor. Edge triggered: the port drains its fd
+ * until EAGAIN or until its ring is full.
+ *
+ * @param pSerial Port to register.
+ * @return bool True on success.
+ */
+bool SerialReactor::add(Serial* pSerial) {
+    std::lock_guard<std::mutex> lck(m_mutex);
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = pSerial;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, pSerial->fileDescriptor(), &event) != 0) {
+        LOG_ERROR("SerialReactor: Failed to add fd %d: %s", pSerial->fileDescriptor(), strerror(errno));
+        return false;
+    }
+
+    m_ports.push_back(pSerial);
+    return true;
+}
+
+/**
+ * Unregisters a port. Dispatch runs under the same mutex, so once this
+ * returns the reactor no longer touches the port.
+ *
+ * @param pSerial Port to unregister.
+ */
+void SerialReactor::remove(Serial* pSerial) {
+    std::lock_guard<std::mutex> lck(m_mutex);
+
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, pSerial->fileDescriptor(), nullptr);
+    m_ports.erase(std::remove(m_ports.begin(), m_ports.end(), pSerial), m_ports.end());
+}
+
+/**
+ * Wakes the reactor thread. With edge triggered events a port that stopped
+ * reading because its ring was full gets no new event for data already
+ * pending in the kernel, so the consumer wakes the reactor after draining it.
+ */
+void SerialReactor::wake() {
+    uint64_t one = 1;
+    ssize_t ignored = ::write(m_wakeFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+/**
+ * Updates the events a port waits for. Safe to call from any thread.
+ *
+ * @param pSerial Port to update.
+ * @param wantWrite True to also wait for EPOLLOUT.
+ */
+void SerialReactor::modify(Serial* pSerial, bool wantWrite) {
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLET;
+    if (wantWrite) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.ptr = pSerial;
+    epoll_ctl(m_epollFd, EPOLL_CTL_MOD, pSerial->fileDescriptor(), &event);
+}
+
+bool SerialReactor::isAttached(Serial* pSerial) const {
+    return std::find(m_ports.begin(), m_ports.end(), pSerial) != m_ports.end();
+}
+
+void* SerialReactor::reactorThread(void* arg) {
+    static_cast<SerialReactor*>(arg)->run();
+    return 0;
+}
+
+/**
+ * Reactor loop. Blocks in epoll_wait() until a port is readable or
+ * writable, or until the wake eventfd is signaled.
+ */
+void SerialReactor::run() {
+    struct epoll_event events[32];
+    LOG_INFO("SerialReactor: reactor thread started");
+
+    while (!m_exit.load()) {
+        int n = epoll_wait(m_epollFd, events, 32, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("SerialReactor: epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        std::lock_guard<std::mutex> lck(m_mutex);
+        bool woken = false;
+
+        for (int i = 0; i < n; i++) {
+            Serial* pSerial = static_cast<Serial*>(events[i].data.ptr);
+
+            if (pSerial == nullptr) {
+                uint64_t count;
+                ssize_t ignored = ::read(m_wakeFd, &count, sizeof(count));
+                (void)ignored;
+                woken = true;
+                continue;
+            }
+
+            // The port may have been removed after epoll_wait() returned
+            if (isAttached(pSerial)) {
+                pSerial->handleEvents(events[i].events);
+            }
+        }
+
+        if (woken) {
+            for (Serial* pSerial : m_ports) {
+                if (pSerial->receiveStalled()) {
+                    pSerial->handleEvents(EPOLLIN);
+                }
+            }
+        }
+    }
+
+    m_exited.store(true);
+    LOG_INFO("SerialReactor: reactor thread exiting");
+}
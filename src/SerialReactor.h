@@ -0,0 +1,56 @@
+/**
+* Single thread epoll reactor for serial ports. Every attached Serial fd is
+* multiplexed on one epoll instance; readable ports are drained straight into
+* their fixed size receive rings, so consumers never busy-poll the fds.
+*/
+
+#ifndef SERIALREACTOR_H
+#define SERIALREACTOR_H
+
+#include <pthread.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+class Serial;
+
+class SerialReactor {
+public:
+    SerialReactor();
+    ~SerialReactor();
+
+    //! Start the reactor thread on the given cores
+    bool start(std::vector<unsigned> cores, int priority, int policy);
+
+    //! Stop the reactor thread and wait for it to exit
+    void stop();
+
+    //! Register a port. The port must stay alive until remove() returns.
+    bool add(Serial* pSerial);
+
+    //! Unregister a port. No callback for it runs once this returns.
+    void remove(Serial* pSerial);
+
+    //! Wake the reactor so it services ports whose receive ring was full.
+    //! Lock free, so consumers may call it from a receive callback.
+    void wake();
+
+    //! Update the events a port waits for; EPOLLOUT while it has queued bytes
+    void modify(Serial* pSerial, bool wantWrite);
+
+private:
+    static void* reactorThread(void* arg);
+    void run();
+    bool isAttached(Serial* pSerial) const;
+
+    int                   m_epollFd;            //! epoll instance for all ports
+    int                   m_wakeFd;             //! eventfd used to wake the thread
+    pthread_t             m_thread;             //! Reactor thread
+    std::atomic<bool>     m_exit{false};        //! Signal thread to exit
+    std::atomic<bool>     m_exited{true};       //! Thread indicates it has exited
+
+    std::mutex            m_mutex;              //! Guards m_ports and event dispatch
+    std::vector<Serial*>  m_ports;              //! Attached ports
+};
+
+#endif // SERIALREACTOR_H
@@ -0,0 +1,104 @@
+#include "SimulatedBackend.h"
+#include "ThreadUtils.h"
+
+// Simulated PWM channel, a write is a log entry
+class SimulatedPwmChannel : public PwmChannel {
+public:
+    explicit SimulatedPwmChannel(std::shared_ptr<SimulatedBackend::Pin> pin) : pin(std::move(pin)) {}
+
+    void setDutyCycle(long dutyNs) override { pin->record(dutyNs); }
+    void setEnabled(bool enabled) override { pin->setEnabled(enabled); }
+
+private:
+    std::shared_ptr<SimulatedBackend::Pin> pin;
+};
+
+// Simulated GPIO line; an input reads whatever was last recorded on its pin
+class SimulatedGpioLine : public GpioLine {
+public:
+    explicit SimulatedGpioLine(std::shared_ptr<SimulatedBackend::Pin> pin) : pin(std::move(pin)) {}
+
+    void setValue(bool value) override { pin->record(value ? 1 : 0); }
+    bool getValue() override { return pin->getValue() != 0; }
+
+private:
+    std::shared_ptr<SimulatedBackend::Pin> pin;
+};
+
+/**
+ * @brief Logs a write and updates the current value
+ *
+ * @param value Value written
+ */
+void SimulatedBackend::Pin::record(long value) {
+    uint64_t index = writeCount.load(std::memory_order_relaxed);
+    log[index % LOG_CAPACITY] = { ThreadUtils::monotonicNs(), value };
+    this->value.store(value, std::memory_order_relaxed);
+    writeCount.store(index + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Copies the logged writes
+ *
+ * @return std::vector<Write> Up to LOG_CAPACITY most recent writes, oldest first
+ */
+std::vector<SimulatedBackend::Write> SimulatedBackend::Pin::getWrites() const {
+    uint64_t count = getWriteCount();
+    uint64_t first = count > LOG_CAPACITY ? count - LOG_CAPACITY : 0;
+    std::vector<Write> writes;
+    writes.reserve(count - first);
+    for (uint64_t i = first; i < count; i++) {
+        writes.push_back(log[i % LOG_CAPACITY]);
+    }
+    return writes;
+}
+
+/**
+ * @brief Opens a simulated PWM channel, duty cycle 0 and disabled
+ *
+ * Opening a channel again continues its log.
+ */
+std::unique_ptr<PwmChannel> SimulatedBackend::openPwm(int chip, int chan, int periodNs) {
+    (void)periodNs;
+    std::shared_ptr<Pin> pin = openPin("pwmchip" + std::to_string(chip) + "/pwm" + std::to_string(chan));
+    pin->setEnabled(false);
+    pin->record(0);
+    return std::make_unique<SimulatedPwmChannel>(pin);
+}
+
+/**
+ * @brief Opens a simulated GPIO; an output starts low
+ *
+ * Opening a GPIO again continues its log.
+ */
+std::unique_ptr<GpioLine> SimulatedBackend::openGpio(const std::string& port, unsigned pinNumber, bool output) {
+    (void)port;
+    std::shared_ptr<Pin> pin = openPin("gpio" + std::to_string(pinNumber));
+    if (output) {
+        pin->record(0);
+    }
+    return std::make_unique<SimulatedGpioLine>(pin);
+}
+
+std::shared_ptr<SimulatedBackend::Pin> SimulatedBackend::getPwmPin(int chip, int chan) const {
+    return findPin("pwmchip" + std::to_string(chip) + "/pwm" + std::to_string(chan));
+}
+
+std::shared_ptr<SimulatedBackend::Pin> SimulatedBackend::getGpioPin(unsigned pinNumber) const {
+    return findPin("gpio" + std::to_string(pinNumber));
+}
+
+std::shared_ptr<SimulatedBackend::Pin> SimulatedBackend::findPin(const std::string& key) const {
+    std::lock_guard<std::mutex> lck(mutex);
+    auto it = pins.find(key);
+    return (it != pins.end()) ? it->second : nullptr;
+}
+
+std::shared_ptr<SimulatedBackend::Pin> SimulatedBackend::openPin(const std::string& key) {
+    std::lock_guard<std::mutex> lck(mutex);
+    std::shared_ptr<Pin>& pin = pins[key];
+    if (!pin) {
+        pin = std::make_shared<Pin>();
+    }
+    return pin;
+}
@@ -0,0 +1,68 @@
+/**
+* In-memory hardware backend. Every PWM channel and GPIO line is a Pin that
+* holds the last value written and logs each write with its monotonic time,
+* so the control path can be driven at kHz rates on a machine without the
+* Jetson's PWM and GPIO hardware, and its output timing checked afterwards.
+*/
+
+#ifndef SIMULATEDBACKEND_H
+#define SIMULATEDBACKEND_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "HardwareBackend.h"
+
+class SimulatedBackend : public HardwareBackend {
+public:
+    struct Write {
+        uint64_t timestampNs;   // ThreadUtils::monotonicNs() of the write
+        long value;             // Duty cycle in ns, or 0/1 for a GPIO
+    };
+
+    // State and write log of one PWM channel or GPIO line. Written by one
+    // thread at a time; record() is lock and allocation free.
+    class Pin {
+    public:
+        static constexpr size_t LOG_CAPACITY = 4096;   // Most recent writes kept
+
+        // Log a write and make value the current value. Also drives inputs.
+        void record(long value);
+        void setEnabled(bool enabled) { this->enabled = enabled; }
+
+        long getValue() const { return value.load(std::memory_order_relaxed); }
+        bool isEnabled() const { return enabled; }
+        uint64_t getWriteCount() const { return writeCount.load(std::memory_order_acquire); }
+
+        // The logged writes, oldest first. Exact only while nothing records.
+        std::vector<Write> getWrites() const;
+
+    private:
+        std::array<Write, LOG_CAPACITY> log{};
+        std::atomic<uint64_t> writeCount{0};
+        std::atomic<long> value{0};
+        std::atomic<bool> enabled{false};
+    };
+
+    std::unique_ptr<PwmChannel> openPwm(int chip, int chan, int periodNs) override;
+    std::unique_ptr<GpioLine> openGpio(const std::string& port, unsigned pinNumber, bool output) override;
+    const char* name() const override { return "simulated"; }
+
+    // Pin of PWM channel chan of chip, nullptr if it was never opened
+    std::shared_ptr<Pin> getPwmPin(int chip, int chan) const;
+
+    // Pin of a GPIO by its pin number, nullptr if it was never opened
+    std::shared_ptr<Pin> getGpioPin(unsigned pinNumber) const;
+
+private:
+    mutable std::mutex mutex;                           // Guards pins, not taken by record()
+    std::map<std::string, std::shared_ptr<Pin>> pins;   // By "pwmchip<n>/pwm<m>" or "gpio<n>"
+
+    std::shared_ptr<Pin> findPin(const std::string& key) const;
+    std::shared_ptr<Pin> openPin(const std::string& key);
+};
+
+#endif // SIMULATEDBACKEND_H
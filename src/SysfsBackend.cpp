@@ -0,0 +1,288 @@
+#include "SysfsBackend.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "ThreadUtils.h"
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <chrono>
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+//! Duration of the sysfs attribute writes of every PWM channel
+static Histogram& s_writeTime = Metrics::histogram("pwm_write_seconds", "Duration of PWM sysfs attribute writes");
+
+/**
+ * @brief Writes a value to a sysfs file in the Linux filesystem
+ *
+ * @param path Full path to the sysfs file to write to
+ * @param value String value to write to the file
+ * @throws std::runtime_error if unable to open or write to the sysfs file
+ */
+static void writeSysfs(const std::string& path, const std::string& value) {
+    LOG_DEBUG("Writing to %s: %s", path.c_str(), value.c_str());
+    std::ofstream fs(path);
+    if (!fs.is_open()) {
+        throw std::runtime_error("Failed to open sysfs file: " + path);
+    }
+    fs << value;
+    fs.close();
+
+    if (!fs) {
+        throw std::runtime_error("Failed to write to sysfs file: " + path);
+    }
+}
+
+/**
+ * @brief Writes an integer to an open sysfs attribute
+ *
+ * Formats the value into a stack buffer and writes it with a single pwrite()
+ * at offset 0, with no allocation or open/close.
+ *
+ * @param fd Open attribute descriptor
+ * @param value Value to write
+ * @param dir Directory of the attribute, for error messages
+ * @param name Attribute name, for error messages
+ * @param pWriteTime Histogram of the write duration, nullptr for none
+ * @throws std::runtime_error if the write fails
+ */
+static void writeAttribute(int fd, long value, const std::string& dir, const char* name, Histogram* pWriteTime) {
+    char buf[24];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    size_t len = result.ptr - buf;
+
+    uint64_t startNs = ThreadUtils::monotonicNs();
+    ssize_t written = pwrite(fd, buf, len, 0);
+    if (pWriteTime) {
+        pWriteTime->observe(ThreadUtils::monotonicNs() - startNs);
+    }
+    if (written != static_cast<ssize_t>(len)) {
+        throw std::runtime_error("Failed to write " + dir + "/" + name + ": " +
+                                 (written < 0 ? strerror(errno) : "short write"));
+    }
+}
+
+/**
+ * @brief Opens a sysfs attribute
+ *
+ * @param path Attribute path
+ * @param flags open() flags
+ * @return int Open descriptor
+ * @throws std::runtime_error if the attribute cannot be opened
+ */
+static int openAttribute(const std::string& path, int flags) {
+    int fd = open(path.c_str(), flags | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + path + ": " + strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * @brief Exports a PWM channel or GPIO and waits for its attribute
+ *
+ * The kernel creates the directory during the write to export, but udev may
+ * change the attribute permissions shortly after. The attribute is polled
+ * every millisecond until it is writable, for at most EXPORT_TIMEOUT_MS.
+ *
+ * @param exportPath The export file of the chip or class
+ * @param value Channel or GPIO number to export
+ * @param attributePath Attribute that must become writable
+ * @throws std::runtime_error if the export fails or times out
+ */
+static void exportAndWait(const std::string& exportPath, const std::string& value,
+                          const std::string& attributePath) {
+    writeSysfs(exportPath, value);
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(SysfsBackend::EXPORT_TIMEOUT_MS);
+    while (access(attributePath.c_str(), W_OK) != 0) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            throw std::runtime_error("Export did not create a writable " + attributePath);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// PWM channel under /sys/class/pwm/pwmchipX/pwmY
+class SysfsPwmChannel : public PwmChannel {
+public:
+    SysfsPwmChannel(const std::string& baseDir, int chip, int chan, int periodNs);
+    ~SysfsPwmChannel() override;
+
+    void setDutyCycle(long dutyNs) override;
+    void setEnabled(bool enabled) override;
+
+private:
+    std::string chipDir;
+    std::string pwmDir;
+    int channel;
+    int dutyFd;           // Open duty_cycle attribute
+    int enableFd;         // Open enable attribute
+
+    void closeAttributes();
+};
+
+/**
+ * @brief Exports and configures a PWM channel and opens its attributes
+ *
+ * @param baseDir The sysfs PWM class directory
+ * @param chip The PWM chip number
+ * @param chan The PWM channel on the chip
+ * @param periodNs The PWM period in nanoseconds
+ * @throws std::runtime_error if the export or any attribute write fails
+ */
+SysfsPwmChannel::SysfsPwmChannel(const std::string& baseDir, int chip, int chan, int periodNs)
+    : chipDir(baseDir + "/pwmchip" + std::to_string(chip)),
+      pwmDir(chipDir + "/pwm" + std::to_string(chan)),
+      channel(chan),
+      dutyFd(-1),
+      enableFd(-1) {
+
+    if (!std::filesystem::exists(pwmDir)) {
+        exportAndWait(chipDir + "/export", std::to_string(channel), pwmDir + "/period");
+    }
+
+    // Configure the period first (required before duty cycle)
+    writeSysfs(pwmDir + "/period", std::to_string(periodNs));
+    writeSysfs(pwmDir + "/duty_cycle", "0");
+    writeSysfs(pwmDir + "/enable", "0");
+
+    try {
+        dutyFd = openAttribute(pwmDir + "/duty_cycle", O_WRONLY);
+        enableFd = openAttribute(pwmDir + "/enable", O_WRONLY);
+    } catch (const std::exception&) {
+        closeAttributes();
+        throw;
+    }
+}
+
+/**
+ * @brief Closes the attributes and unexports the channel
+ */
+SysfsPwmChannel::~SysfsPwmChannel() {
+    closeAttributes();
+    try {
+        writeSysfs(chipDir + "/unexport", std::to_string(channel));
+    } catch (const std::exception& e) {
+        std::cerr << "Error unexporting PWM: " << e.what() << std::endl;
+    }
+}
+
+void SysfsPwmChannel::setDutyCycle(long dutyNs) {
+    writeAttribute(dutyFd, dutyNs, pwmDir, "duty_cycle", &s_writeTime);
+}
+
+void SysfsPwmChannel::setEnabled(bool enabled) {
+    writeAttribute(enableFd, enabled ? 1 : 0, pwmDir, "enable", &s_writeTime);
+}
+
+void SysfsPwmChannel::closeAttributes() {
+    if (dutyFd >= 0) {
+        close(dutyFd);
+        dutyFd = -1;
+    }
+    if (enableFd >= 0) {
+        close(enableFd);
+        enableFd = -1;
+    }
+}
+
+// GPIO under /sys/class/gpio/gpioN
+class SysfsGpioLine : public GpioLine {
+public:
+    SysfsGpioLine(const std::string& baseDir, unsigned pinNumber, bool output);
+    ~SysfsGpioLine() override;
+
+    void setValue(bool value) override;
+    bool getValue() override;
+
+private:
+    std::string baseDir;
+    std::string gpioDir;
+    unsigned pinNumber;
+    int valueFd;          // Open value attribute
+};
+
+/**
+ * @brief Exports a GPIO, sets its direction and opens its value
+ *
+ * Outputs are configured with "low" so they never glitch high.
+ *
+ * @param baseDir The sysfs GPIO class directory
+ * @param pinNumber The sysfs GPIO number
+ * @param output True for an output
+ * @throws std::runtime_error if the export or any attribute write fails
+ */
+SysfsGpioLine::SysfsGpioLine(const std::string& baseDir, unsigned pinNumber, bool output)
+    : baseDir(baseDir),
+      gpioDir(baseDir + "/gpio" + std::to_string(pinNumber)),
+      pinNumber(pinNumber),
+      valueFd(-1) {
+
+    if (!std::filesystem::exists(gpioDir)) {
+        exportAndWait(baseDir + "/export", std::to_string(pinNumber), gpioDir + "/direction");
+    }
+    writeSysfs(gpioDir + "/direction", output ? "low" : "in");
+    valueFd = openAttribute(gpioDir + "/value", output ? O_RDWR : O_RDONLY);
+}
+
+/**
+ * @brief Closes the value attribute and unexports the GPIO
+ */
+SysfsGpioLine::~SysfsGpioLine() {
+    if (valueFd >= 0) {
+        close(valueFd);
+    }
+    try {
+        writeSysfs(baseDir + "/unexport", std::to_string(pinNumber));
+    } catch (const std::exception& e) {
+        std::cerr << "Error unexporting GPIO: " << e.what() << std::endl;
+    }
+}
+
+void SysfsGpioLine::setValue(bool value) {
+    writeAttribute(valueFd, value ? 1 : 0, gpioDir, "value", nullptr);
+}
+
+bool SysfsGpioLine::getValue() {
+    char buf[2];
+    ssize_t n = pread(valueFd, buf, sizeof(buf), 0);
+    if (n < 1) {
+        throw std::runtime_error("Failed to read " + gpioDir + "/value: " +
+                                 (n < 0 ? strerror(errno) : "empty read"));
+    }
+    return buf[0] == '1';
+}
+
+/**
+ * @brief Constructs a sysfs backend
+ *
+ * @param pwmBaseDir The sysfs PWM class directory, PWM_BASE_DIR on hardware
+ * @param gpioBaseDir The sysfs GPIO class directory, GPIO_BASE_DIR on hardware
+ */
+SysfsBackend::SysfsBackend(const std::string& pwmBaseDir, const std::string& gpioBaseDir)
+    : pwmBaseDir(pwmBaseDir),
+      gpioBaseDir(gpioBaseDir) {
+}
+
+std::unique_ptr<PwmChannel> SysfsBackend::openPwm(int chip, int chan, int periodNs) {
+    return std::make_unique<SysfsPwmChannel>(pwmBaseDir, chip, chan, periodNs);
+}
+
+/**
+ * @brief Opens a GPIO by its sysfs number
+ *
+ * @param port Unused, sysfs addresses GPIOs by number
+ * @param pinNumber The sysfs GPIO number
+ * @param output True for an output
+ */
+std::unique_ptr<GpioLine> SysfsBackend::openGpio(const std::string& port, unsigned pinNumber, bool output) {
+    (void)port;
+    return std::make_unique<SysfsGpioLine>(gpioBaseDir, pinNumber, output);
+}
@@ -0,0 +1,32 @@
+/**
+* Hardware backend on the Linux sysfs PWM and GPIO interfaces.
+*
+* Channels and lines are exported if needed and their attributes stay open
+* for the lifetime of the object, so an update is a single pwrite() of a
+* stack formatted integer. After an export the attributes are polled until
+* udev has made them writable instead of waiting a fixed time.
+*/
+
+#ifndef SYSFSBACKEND_H
+#define SYSFSBACKEND_H
+
+#include "HardwareBackend.h"
+
+class SysfsBackend : public HardwareBackend {
+public:
+    SysfsBackend(const std::string& pwmBaseDir = PWM_BASE_DIR, const std::string& gpioBaseDir = GPIO_BASE_DIR);
+
+    std::unique_ptr<PwmChannel> openPwm(int chip, int chan, int periodNs) override;
+    std::unique_ptr<GpioLine> openGpio(const std::string& port, unsigned pinNumber, bool output) override;
+    const char* name() const override { return "sysfs"; }
+
+    static constexpr const char* PWM_BASE_DIR = "/sys/class/pwm";
+    static constexpr const char* GPIO_BASE_DIR = "/sys/class/gpio";
+    static constexpr int EXPORT_TIMEOUT_MS = 1000;  // Longest wait for an exported attribute
+
+private:
+    std::string pwmBaseDir;   // sysfs PWM class directory
+    std::string gpioBaseDir;  // sysfs GPIO class directory
+};
+
+#endif // SYSFSBACKEND_H
@@ -0,0 +1,286 @@
+#include "TelemetryPublisher.h"
+#include "BinaryProtocol.h"
+#include "IO.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "ThreadUtils.h"
+#include <algorithm>
+#include <cstring>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace BinaryProtocol;
+
+TelemetryPublisher::TelemetryPublisher(IOManager& ioManager) :
+    m_ioManager(ioManager),
+    m_thread(INVALID_PTHREAD)
+{
+}
+
+TelemetryPublisher::~TelemetryPublisher() {
+    stop();
+}
+
+/**
+ * Starts the publisher thread.
+ *
+ * @param rateHz Frames per second.
+ * @param keyframeIntervalMs Time between frames carrying the full state.
+ * @param cores CPU cores the thread may run on.
+ * @param publish Hands each frame to the socket layer.
+ * @return bool True if the thread is running.
+ */
+bool TelemetryPublisher::start(unsigned rateHz, unsigned keyframeIntervalMs, std::vector<unsigned> cores,
+    PublishFunction publish) {
+    m_rateHz = rateHz > 0 ? rateHz : 1;
+    m_keyframeIntervalMs = keyframeIntervalMs;
+    m_publish = std::move(publish);
+
+    // Size the scratch buffers once, encoding must not allocate
+    size_t count = m_ioManager.getIOsByNumber().size();
+    m_last.assign(count, Sample());
+    m_current.assign(count, Sample());
+    m_rows.reserve(count);
+
+    m_exit.store(false);
+    m_exited.store(false);
+    m_thread = ThreadUtils::startThread("Telemetry", publisherThread, this,
+        cores, false, false, 0, SCHED_OTHER);
+
+    if (m_thread == INVALID_PTHREAD) {
+        m_exited.store(true);
+        LOG_ERROR("TelemetryPublisher: Failed to start publisher thread");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Exports the publishing statistics on /metrics. They are sampled when
+ * scraped, so the publisher thread only keeps updating its atomics.
+ */
+void TelemetryPublisher::registerMetrics() {
+    auto sample = [](const std::atomic<uint64_t>& value, double scale) {
+        return [&value, scale]() { return (double)value.load(std::memory_order_relaxed) * scale; };
+    };
+
+    Metrics::counterFunction("telemetry_frames_total", "Telemetry frames published", {},
+        sample(m_stats.frames, 1.0));
+    Metrics::counterFunction("telemetry_skipped_ticks_total", "Telemetry ticks with no IO change to send", {},
+        sample(m_stats.skipped, 1.0));
+    Metrics::counterFunction("telemetry_bytes_total", "Telemetry payload bytes published", {},
+        sample(m_stats.bytes, 1.0));
+    Metrics::gaugeFunction("telemetry_bytes_per_second", "Telemetry payload rate over the last second", {},
+        sample(m_stats.bytesPerSecond, 1.0));
+    Metrics::counterFunction("telemetry_encode_seconds_total", "Time spent encoding telemetry frames", {},
+        sample(m_stats.encodeTotalNs, 1e-9));
+    Metrics::gaugeFunction("telemetry_encode_max_seconds", "Longest telemetry frame encode", {},
+        sample(m_stats.encodeMaxNs, 1e-9));
+    Metrics::counterFunction("telemetry_overruns_total", "Telemetry ticks missed because the thread ran late", {},
+        sample(m_stats.overruns, 1.0));
+}
+
+void TelemetryPublisher::stop() {
+    if (m_exited.load()) {
+        return;
+    }
+
+    m_exit.store(true);
+    while (!m_exited.load()) {
+        usleep(1000);
+    }
+}
+
+/**
+ * Samples every IO and encodes the fields that changed since the last frame
+ * straight into a pooled packet.
+ *
+ * @param nowNs Monotonic sampling time.
+ * @param keyframe True to include every field of every IO.
+ * @return PacketPtr Encoded frame, empty if there is nothing to send.
+ */
+PacketPtr TelemetryPublisher::encode(uint64_t nowNs, bool keyframe) {
+    const std::vector<IO*>& ios = m_ioManager.getIOsByNumber();
+    size_t count = std::min(ios.size(), m_last.size());
+    size_t timestampCount = 0;
+    size_t valueCount = 0;
+    size_t setPointCount = 0;
+
+    // One batch, so the GPIO inputs are read with one ioctl per chip
+    HardwareBackend* pBackend = m_ioManager.getBackend();
+    if (pBackend) {
+        pBackend->beginBatch();
+    }
+
+    m_rows.clear();
+    for (size_t number = 0; number < count; number++) {
+        IO* pIO = ios[number];
+        if (!pIO || !pIO->isEnabled()) {
+            continue;
+        }
+
+        Sample& sample = m_current[number];
+        const Sample& last = m_last[number];
+        sample.setPoint = (uint16_t)pIO->getCurrentSetPoint();
+        sample.value = pIO->read();
+        sample.changedNs = pIO->getChangedNs();
+
+        uint8_t fields = FieldAll;
+        if (!keyframe && last.sent) {
+            fields = 0;
+            if (sample.changedNs != last.changedNs) {
+                fields |= FieldTimestamp;
+            }
+            if (memcmp(&sample.value, &last.value, sizeof(float)) != 0) {
+                fields |= FieldValue;
+            }
+            if (sample.setPoint != last.setPoint) {
+                fields |= FieldSetPoint;
+            }
+        }
+
+        if (fields != 0) {
+            m_rows.push_back({(uint16_t)number, fields});
+            timestampCount += (fields & FieldTimestamp) ? 1 : 0;
+            valueCount += (fields & FieldValue) ? 1 : 0;
+            setPointCount += (fields & FieldSetPoint) ? 1 : 0;
+        }
+    }
+
+    // Only reads were batched, ending the batch writes nothing
+    if (pBackend) {
+        pBackend->commitBatch();
+    }
+
+    if (m_rows.empty()) {
+        return PacketPtr();
+    }
+
+    size_t rows = m_rows.size();
+    size_t len = sizeof(TelemetryHeader) + timestampCount * sizeof(uint64_t) + valueCount * sizeof(float) +
+        rows * sizeof(uint16_t) + setPointCount * sizeof(uint16_t) + rows * sizeof(uint8_t);
+    PacketPtr frame = PacketPool::acquire(len);
+
+    TelemetryHeader header;
+    header.magic = FrameMagic;
+    header.type = (uint8_t)FrameType::Telemetry;
+    header.flags = keyframe ? TelemetryKeyframe : 0;
+    header.sequence = m_sequence++;
+    header.timestampNs = nowNs;
+    header.rows = (uint16_t)rows;
+    header.timestampCount = (uint16_t)timestampCount;
+    header.valueCount = (uint16_t)valueCount;
+    header.setPointCount = (uint16_t)setPointCount;
+
+    // Sections in descending alignment so each starts aligned for its type
+    uint8_t* pOut = frame->payload();
+    memcpy(pOut, &header, sizeof(header));
+    uint8_t* pTimestamps = pOut + sizeof(header);
+    uint8_t* pValues = pTimestamps + timestampCount * sizeof(uint64_t);
+    uint8_t* pNumbers = pValues + valueCount * sizeof(float);
+    uint8_t* pSetPoints = pNumbers + rows * sizeof(uint16_t);
+    uint8_t* pFields = pSetPoints + setPointCount * sizeof(uint16_t);
+
+    for (const Row& row : m_rows) {
+        Sample& sample = m_current[row.ioNumber];
+        if (row.fields & FieldTimestamp) {
+            memcpy(pTimestamps, &sample.changedNs, sizeof(uint64_t));
+            pTimestamps += sizeof(uint64_t);
+        }
+        if (row.fields & FieldValue) {
+            memcpy(pValues, &sample.value, sizeof(float));
+            pValues += sizeof(float);
+        }
+        memcpy(pNumbers, &row.ioNumber, sizeof(uint16_t));
+        pNumbers += sizeof(uint16_t);
+        if (row.fields & FieldSetPoint) {
+            memcpy(pSetPoints, &sample.setPoint, sizeof(uint16_t));
+            pSetPoints += sizeof(uint16_t);
+        }
+        *pFields++ = row.fields;
+
+        sample.sent = true;
+        m_last[row.ioNumber] = sample;
+    }
+
+    return frame;
+}
+
+void* TelemetryPublisher::publisherThread(void* arg) {
+    static_cast<TelemetryPublisher*>(arg)->run();
+    return 0;
+}
+
+/**
+ * Publisher loop. Ticks on absolute deadlines so the rate does not drift
+ * with the encode time; ticks missed while running late are skipped.
+ */
+void TelemetryPublisher::run() {
+    LOG_INFO("TelemetryPublisher: publishing at %u Hz", m_rateHz);
+
+    const uint64_t periodNs = 1000000000ull / m_rateHz;
+    const uint64_t keyframeNs = (uint64_t)m_keyframeIntervalMs * 1000000ull;
+    uint64_t nextNs = ThreadUtils::monotonicNs();
+    uint64_t lastKeyframeNs = 0;
+    uint64_t windowStartNs = nextNs;
+    uint64_t windowBytes = 0;
+
+    while (!m_exit.load()) {
+        struct timespec deadline;
+        deadline.tv_sec = (time_t)(nextNs / 1000000000ull);
+        deadline.tv_nsec = (long)(nextNs % 1000000000ull);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+
+        uint64_t nowNs = ThreadUtils::monotonicNs();
+        bool requested = m_keyframeRequested.exchange(false, std::memory_order_relaxed);
+        bool keyframe = requested || (lastKeyframeNs == 0) || (nowNs - lastKeyframeNs >= keyframeNs);
+
+        PacketPtr frame = encode(nowNs, keyframe);
+        uint64_t encodeNs = ThreadUtils::monotonicNs() - nowNs;
+
+        if (frame) {
+            size_t len = frame->size();
+            if (m_publish) {
+                m_publish(std::move(frame));
+            }
+            if (keyframe) {
+                lastKeyframeNs = nowNs;
+            }
+
+            m_stats.frames.fetch_add(1, std::memory_order_relaxed);
+            m_stats.bytes.fetch_add(len, std::memory_order_relaxed);
+            m_stats.encodeTotalNs.fetch_add(encodeNs, std::memory_order_relaxed);
+            if (encodeNs > m_stats.encodeMaxNs.load(std::memory_order_relaxed)) {
+                m_stats.encodeMaxNs.store(encodeNs, std::memory_order_relaxed);
+            }
+            windowBytes += len;
+        } else {
+            m_stats.skipped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (nowNs - windowStartNs >= 1000000000ull) {
+            uint64_t rate = windowBytes * 1000000000ull / (nowNs - windowStartNs);
+            m_stats.bytesPerSecond.store(rate, std::memory_order_relaxed);
+
+            uint64_t frames = m_stats.frames.load(std::memory_order_relaxed);
+            LOG_DEBUG("TelemetryPublisher: %llu B/s, mean encode %llu ns, max %llu ns",
+                (unsigned long long)rate,
+                (unsigned long long)(frames ? m_stats.encodeTotalNs.load() / frames : 0),
+                (unsigned long long)m_stats.encodeMaxNs.load());
+
+            windowStartNs = nowNs;
+            windowBytes = 0;
+        }
+
+        nextNs += periodNs;
+        if (nextNs <= nowNs) {
+            uint64_t missed = (nowNs - nextNs) / periodNs + 1;
+            m_stats.overruns.fetch_add(missed, std::memory_order_relaxed);
+            nextNs += missed * periodNs;
+        }
+    }
+
+    m_exited.store(true);
+    LOG_INFO("TelemetryPublisher: publisher thread exiting");
+}
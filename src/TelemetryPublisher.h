@@ -0,0 +1,87 @@
+/**
+* Periodic IO telemetry for the UI. Samples every IO at a fixed rate and
+* publishes a compact struct-of-arrays binary frame (BinaryProtocol) on
+* ws-protocol-binary. Only fields that changed since the previous frame are
+* sent, with a full keyframe at a fixed interval so newly connected clients
+* catch up; an idle system sends nothing between keyframes.
+*/
+
+#pragma once
+
+#include <pthread.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "PacketPool.h"
+
+class IOManager;
+
+//! Publisher counters, for sizing the rate against the link
+struct TelemetryStats {
+    std::atomic<uint64_t> frames{0};            //! Frames published
+    std::atomic<uint64_t> skipped{0};           //! Ticks with nothing changed
+    std::atomic<uint64_t> bytes{0};             //! Payload bytes published
+    std::atomic<uint64_t> bytesPerSecond{0};    //! Payload rate over the last second
+    std::atomic<uint64_t> encodeTotalNs{0};     //! Sum of encode times
+    std::atomic<uint64_t> encodeMaxNs{0};       //! Worst encode time
+    std::atomic<uint64_t> overruns{0};          //! Ticks missed because the thread ran late
+};
+
+class TelemetryPublisher {
+public:
+    //! Hands a finished frame to the socket layer
+    typedef std::function<void(PacketPtr&& frame)> PublishFunction;
+
+    explicit TelemetryPublisher(IOManager& ioManager);
+    ~TelemetryPublisher();
+
+    //! Start publishing
+    //! \param rateHz Frames per second
+    //! \param keyframeIntervalMs Time between frames carrying the full state
+    bool start(unsigned rateHz, unsigned keyframeIntervalMs, std::vector<unsigned> cores, PublishFunction publish);
+    void stop();
+
+    //! Make the next frame a keyframe, safe from any thread
+    void requestKeyframe() { m_keyframeRequested.store(true, std::memory_order_relaxed); }
+
+    //! Sample the IOs and encode one frame; empty if nothing changed and keyframe is false
+    PacketPtr encode(uint64_t nowNs, bool keyframe);
+
+    const TelemetryStats& getStats() const { return m_stats; }
+
+    //! Export the statistics on /metrics; the publisher must then live until the process exits
+    void registerMetrics();
+
+private:
+    struct Sample {
+        uint16_t setPoint = 0;
+        float    value = 0.0f;
+        uint64_t changedNs = 0;
+        bool     sent = false;              //! Included in a frame at least once
+    };
+
+    struct Row {
+        uint16_t ioNumber;
+        uint8_t  fields;
+    };
+
+    static void* publisherThread(void* arg);
+    void run();
+
+    IOManager&              m_ioManager;
+    PublishFunction         m_publish;
+    unsigned                m_rateHz = 10;
+    unsigned                m_keyframeIntervalMs = 1000;
+    uint32_t                m_sequence = 0;             //! Sequence of the next frame
+
+    std::vector<Sample>     m_last;                     //! Last published state, indexed by IO number
+    std::vector<Sample>     m_current;                  //! Scratch for the current sample
+    std::vector<Row>        m_rows;                     //! Scratch for the rows of a frame
+
+    pthread_t               m_thread;                   //! Publisher thread
+    std::atomic<bool>       m_exit{false};              //! Signal thread to exit
+    std::atomic<bool>       m_exited{true};             //! Thread indicates it has exited
+    std::atomic<bool>       m_keyframeRequested{false}; //! Set by requestKeyframe()
+    TelemetryStats          m_stats;
+};
@@ -9,6 +9,8 @@
 
 #include <limits.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <time.h>
 #include <string>
 #include <vector>
 
@@ -29,4 +31,12 @@ namespace ThreadUtils
         int                    priority,
         int                    policy
     );
+
+    //! Monotonic clock in nanoseconds, for latency stamps shared across threads
+    inline uint64_t monotonicNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    }
 }
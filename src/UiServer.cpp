@@ -1,4 +1,7 @@
 #include "UiServer.h"
+#include "Logger.h"
+#include "Commands.h"
+#include "CommandTrace.h"
 #include <cstring>
 #include <iostream>
 #include <nlohmann/json.hpp>
@@ -40,30 +43,39 @@ static const struct lws_protocol_vhost_options nvo_mime_wasm = {
     "application/wasm"
 };
 
+//! Request to first body byte time of HLS segments
+static Histogram& s_hlsFirstByteTime = Metrics::histogram("hls_first_byte_seconds",
+    "Time from an HLS segment request to its first body byte");
+
+/**
+ * @brief Builds a mount serving the web files, with every other field zeroed.
+ * 
+ * @param pNext Next mount in the list, nullptr for the last.
+ * @param mountpoint URL prefix.
+ * @param def File served for the mountpoint itself.
+ * @return lws_http_mount The mount.
+ */
+static lws_http_mount makeMount(const lws_http_mount* pNext, const char* mountpoint, const char* def) {
+    lws_http_mount mount;
+    memset(&mount, 0, sizeof(mount));
+    mount.mount_next = pNext;
+    mount.mountpoint = mountpoint;
+    mount.mountpoint_len = (unsigned char)strlen(mountpoint);
+    mount.def = def;
+    mount.extra_mimetypes = &nvo_mime_wasm;
+    return mount;
+}
+
 UiServer::UiServer() :
     WebSystem(),
     context(nullptr),
-    m_mount{
-        &m_superMount, "/", MOUNT_PATH, "index.html", 
-        NULL, &nvo_mime_wasm, 
-        0, 0, 
-        0, 0, 0, 
-        LWSMPRO_FILE, 1,
-    },
-    m_superMount{
-        &m_manufacturingMount, "/superuser", MOUNT_PATH, "integration.html", 
-        NULL, &nvo_mime_wasm,
-        0, 0, 
-        0, 0, 0, 
-        LWSMPRO_FILE, 10,
-    },
-    m_manufacturingMount{
-        NULL, "/manufacturing", MOUNT_PATH, "manufacturing.html",
-        NULL, &nvo_mime_wasm,
-        0, 0, 
-        0, 0, 0, 
-        LWSMPRO_FILE, 14,
-    }
+    m_mount(makeMount(&m_superMount, "/", "index.html")),
+    m_superMount(makeMount(&m_manufacturingMount, "/superuser", "integration.html")),
+    m_manufacturingMount(makeMount(&m_hlsMount, "/manufacturing", "manufacturing.html")),
+    m_hlsMount(makeMount(&m_metricsMount, "/hls", HlsSegmentStore::PlaylistName)),
+    m_metricsMount(makeMount(nullptr, "/metrics", "metrics")),
+    m_stream("ffmpeg"),
+    m_hls(500, 10)
 {
     std::cout << "UiServer constructor: MOUNT_PATH = " << MOUNT_PATH << std::endl;
     
@@ -72,6 +84,9 @@ UiServer::UiServer() :
 }
 
 UiServer::~UiServer() {
+    setBinaryHandlers(nullptr, nullptr);
+    m_uploads.stop();
+    m_stream.stop();
     if (context) {
         lws_context_destroy(context);
     }
@@ -81,15 +96,50 @@ UiServer::~UiServer() {
  * @brief Initializes the UiServer.
  * 
  * @param port Port number
+ * @param serviceCores CPU cores of the websocket service threads, one thread per core
+ * @param controlCore CPU core of the thread running command handlers
  * @return true if initialization is successful, false otherwise.
  */
-bool UiServer::initialize(int port) {
+bool UiServer::initialize(int port, std::vector<unsigned> serviceCores, unsigned controlCore) {
     std::cout << "UiServer::initialize: Starting initialization on port " << port << std::endl;
     
     // Register command callbacks before initializing WebSystem
     registerCommandCallbacks();
+
+    // Serve the web files from the asset cache if it is loaded, else straight from disk
+    for (lws_http_mount* pMount : { &m_mount, &m_superMount, &m_manufacturingMount }) {
+        pMount->origin = m_assetCacheEnabled ? "http" : MOUNT_PATH;
+        pMount->origin_protocol = m_assetCacheEnabled ? LWSMPRO_CALLBACK : LWSMPRO_FILE;
+    }
+
+    // The stream is only ever in memory, served by the route below
+    m_hlsMount.origin = "http";
+    m_hlsMount.origin_protocol = LWSMPRO_CALLBACK;
+    addHttpRoute(m_hlsMount.mountpoint, [this](std::string_view path, HttpContent& content) {
+        content.body = m_hls.find(path);
+        if (path != HlsSegmentStore::PlaylistName) {
+            content.firstByte = [this](uint64_t ns) {
+                m_hls.recordFirstByte(ns);
+                s_hlsFirstByteTime.observe(ns);
+            };
+        }
+        return content.body != nullptr;
+    });
+
+    // Metrics are formatted on every scrape
+    m_metricsMount.origin = "http";
+    m_metricsMount.origin_protocol = LWSMPRO_CALLBACK;
+    addHttpRoute(m_metricsMount.mountpoint, [this](std::string_view path, HttpContent& content) {
+        if (path != m_metricsMount.def) {
+            return false;
+        }
+        content.body = std::make_shared<const std::string>(Metrics::expose());
+        content.mimeType = Metrics::ContentType;
+        return true;
+    });
+    registerMetrics();
     
-    int result = WebSystem::initialize("webapp", port, 0, &m_mount);
+    int result = WebSystem::initialize("webapp", port, std::move(serviceCores), controlCore, &m_mount);
     if (result != 0) {
         std::cerr << "UiServer::initialize: WebSystem::initialize failed with error code " << result << std::endl;
         return false;
@@ -104,80 +154,211 @@ bool UiServer::initialize(int port) {
  * This method sets up the command callbacks for handling user-generated commands.
  */
 void UiServer::registerCommandCallbacks() {
-    setCommandCallback("pwm-control", [this]() {
-        std::cout << "PWM control command received" << std::endl;
-        const auto& data = this->getCommandData();
-        if (m_pwmControlCallback && data.contains("index")) {
-            size_t index = data["index"].get<std::size_t>();
-            std::cout << "Setting PWM to position " << index << std::endl;
-            m_pwmControlCallback(index);
+    registerCommand<PwmControlCommand>("pwm-control", [this](const PwmControlCommand& command) {
+        if (m_pwmControlCallback) {
+            LOG_DEBUG("Setting PWM to position %u", command.index);
+            m_pwmControlCallback(command.index);
+        }
+    });
+
+    registerCommand<IoBatchCommand>("io-batch", [this](const IoBatchCommand& command) {
+        if (m_ioBatchCallback) {
+            LOG_DEBUG("Applying batch of %u IO updates", command.count);
+            m_ioBatchCallback(command);
+        }
+    });
+
+    registerCommand<IoSetCommand>("io-set", [this](const IoSetCommand& command) {
+        if (m_ioBatchCallback) {
+            IoBatchCommand batch;
+            batch.count = 1;
+            batch.updates[0] = {command.io, command.index};
+            m_ioBatchCallback(batch);
+        }
+    });
+
+    registerCommand<IoQueryCommand>("io-query", [this](const IoQueryCommand&) {
+        if (m_ioQueryCallback) {
+            m_ioQueryCallback();
+        }
+    });
+
+    registerCommand<LatencyReportCommand>("latency-report", [](const LatencyReportCommand& command) {
+        std::string report = CommandTrace::reportJson();
+        sendTextTo(commandSessionId(), report.data(), report.size());
+        if (command.reset) {
+            CommandTrace::reset();
         }
     });
 }
 
+/**
+ * @brief Exports the statistics the subsystems already keep on /metrics.
+ * 
+ * The values are sampled when scraped, so nothing is added to their hot paths.
+ */
+void UiServer::registerMetrics() {
+    auto sample = [](const std::atomic<uint64_t>& value) {
+        return [&value]() { return (double)value.load(std::memory_order_relaxed); };
+    };
+
+    const AssetCacheStats& assets = getAssetCacheStats();
+    Metrics::gaugeFunction("asset_cache_files", "Web files held in memory", {}, sample(assets.files));
+    Metrics::gaugeFunction("asset_cache_stored_bytes",
+        "Memory held by the cached web files and their compressed copies", {}, sample(assets.storedBytes));
+    Metrics::counterFunction("asset_cache_reloads_total", "Asset cache rebuilds after a change", {},
+        sample(assets.reloads));
+
+    const UploadStats& uploads = m_uploads.getStats();
+    Metrics::counterFunction("upload_written_bytes_total", "Uploaded bytes written to disk", {},
+        sample(uploads.bytesWritten));
+    Metrics::counterFunction("upload_completed_total", "Uploaded files committed", {}, sample(uploads.completed));
+    Metrics::counterFunction("upload_rejected_frames_total", "Upload frames refused because the queue was full", {},
+        sample(uploads.rejected));
+    Metrics::counterFunction("upload_pauses_total", "Times an uploading client was paused for backpressure", {},
+        sample(uploads.pauses));
+
+    const ProcessStats& stream = m_stream.getStats();
+    Metrics::gaugeFunction("stream_encoder_running", "1 while the ffmpeg encoder runs", {},
+        [this]() { return m_stream.state() == ProcessState::Running ? 1.0 : 0.0; });
+    Metrics::counterFunction("stream_encoder_restarts_total", "ffmpeg restarts after an unexpected exit", {},
+        sample(stream.restarts));
+    Metrics::counterFunction("stream_encoder_output_bytes_total", "MPEG-TS bytes read from ffmpeg", {},
+        sample(stream.stdoutBytes));
+
+    const HlsStats& hls = m_hls.getStats();
+    Metrics::counterFunction("hls_segments_total", "HLS segments completed", {}, sample(hls.segments));
+    Metrics::counterFunction("hls_dropped_bytes_total", "Stream bytes discarded before a keyframe or to resync", {},
+        sample(hls.droppedBytes));
+    Metrics::counterFunction("hls_segment_requests_total", "HLS segment requests answered", {}, sample(hls.requests));
+    Metrics::counterFunction("hls_segment_misses_total", "Requests for HLS segments no longer held", {},
+        sample(hls.misses));
+}
+
 /**
  * @brief Services and processes outgoing data.
  */
 void UiServer::service() {
-    std::cout << "UiServer::service() called" << std::endl;
+    // Report how long producers waited for a service thread to pick up writes
+    const auto& wake = getWakeStats();
+    uint64_t wakeCount = wake.count.load();
+    if (wakeCount > 0) {
+        LOG_DEBUG("UiServer: service wakeups %llu, mean latency %llu us, max %llu us",
+            (unsigned long long)wakeCount,
+            (unsigned long long)(wake.totalNs.load() / wakeCount / 1000),
+            (unsigned long long)(wake.maxNs.load() / 1000));
+    }
+}
 
-    Reader commandReader;
-    const auto& command = commandReader.Commands();
+/**
+ * @brief Starts the supervisor of the HLS encoder and the encoder itself.
+ * The encoder's MPEG-TS output is segmented in memory and served below /hls.
+ * 
+ * @param input ffmpeg input URL of the camera stream.
+ * @param cores CPU cores the supervisor thread and ffmpeg may run on.
+ * @return true if the supervisor is running.
+ */
+bool UiServer::enableStream(const std::string& input, std::vector<unsigned> cores) {
+    m_stream.setOutputHandler([this](const uint8_t* pData, size_t len) { m_hls.write(pData, len); });
+    if (!m_stream.start(cores)) {
+        std::cerr << "UiServer::enableStream: Failed to start the stream supervisor" << std::endl;
+        return false;
+    }
+    m_streamInput = input;
+    startProcess();
+    return true;
 }
 
 /**
- * @brief Starts a process to handle HLS streaming using ffmpeg.
+ * @brief Starts ffmpeg to handle HLS streaming. Returns immediately; the
+ * supervisor spawns it and restarts it if it exits. ffmpeg only remuxes the
+ * stream to MPEG-TS on stdout, m_hls cuts the segments.
  */
 void UiServer::startProcess() {
-    // example starting a hls process
-    std::string cmd = std::string("ffmpeg -hide_banner -loglevel quiet -i udp://192.168.10.10:1234 ") +
-         "-vcodec copy -f hls -hls_segment_type mpegts -hls_time 0.5 -hls_wrap 10 -hls_list_size 10 /var/www/master.m3u8";
-    system(cmd.c_str());
-
-    m_processStarted = true;
+    m_stream.launch({
+        "ffmpeg", "-hide_banner", "-nostdin", "-loglevel", "warning", "-i", m_streamInput,
+        "-vcodec", "copy", "-f", "mpegts", "-flush_packets", "1", "pipe:1"
+    });
 }
 
 /**
- * @brief Stops the HLS streaming process by killing the ffmpeg process.
+ * @brief Stops the HLS streaming process with SIGTERM, SIGKILL if it does
+ * not exit in time.
  */
 void UiServer::stopProcess() {
-    // Get the pid of ffmpeg process and kill it
-    char line[10];
-    FILE *cmd = popen("pidof ffmpeg", "r");
+    m_stream.halt();
+}
 
-    fgets(line, 10, cmd);
-    pid_t pid = strtoul(line, NULL, 10);
+/**
+ * @brief Loads the web files into memory with precompressed variants.
+ * 
+ * Must be called before initialize(); without it the files are served
+ * from disk.
+ * 
+ * @param cores CPU cores the thread watching the files for changes may run on.
+ * @return true if the files are served from memory.
+ */
+bool UiServer::enableAssetCache(std::vector<unsigned> cores) {
+    m_assetCacheEnabled = startAssetCache(MOUNT_PATH, cores);
+    if (!m_assetCacheEnabled) {
+        std::cerr << "UiServer::enableAssetCache: Failed to load " << MOUNT_PATH << std::endl;
+    }
+    return m_assetCacheEnabled;
+}
+
+/**
+ * @brief Starts the upload writer and routes binary messages to it.
+ * 
+ * @param directory Root of the upload directories.
+ * @param maxFileSize Largest file accepted, in bytes.
+ * @param cores CPU cores the writer thread may run on.
+ * @return true if uploads are enabled.
+ */
+bool UiServer::enableUploads(const std::string& directory, uint64_t maxFileSize, std::vector<unsigned> cores) {
+    static_assert(BinaryProtocol::MaxFrameLen <= MaxBinaryFrameLen, "Upload frames must fit a binary message");
 
-    pclose(cmd);
+    m_uploads.setTransport(
+        [](uint32_t sessionId, const uint8_t* pData, size_t len) { sendBinaryTo(sessionId, pData, len); },
+        [](uint32_t sessionId) { resumeBinaryReceive(sessionId); });
+
+    if (!m_uploads.start(directory, maxFileSize, cores)) {
+        std::cerr << "UiServer::enableUploads: Failed to start uploads in " << directory << std::endl;
+        return false;
+    }
 
-    // Kill the ffmpeg process
-    kill(pid, 9);
-    m_processStarted = false;
+    setBinaryHandlers(
+        [this](uint32_t sessionId, PacketPtr&& frame) { return processBinaryFrame(sessionId, std::move(frame)); },
+        [this](uint32_t sessionId) { m_uploads.sessionClosed(sessionId); });
+    return true;
 }
 
 /**
- * @brief Processes incoming binary data.
+ * @brief Processes a complete binary message on the websocket service thread.
+ * 
+ * Upload frames are queued for the writer thread; the return value pauses
+ * the client while the writer is behind.
+ * 
+ * @param sessionId Session that sent the message.
+ * @param frame The message.
+ * @return false if the client should stop sending until resumed.
  */
-void UiServer::processBinaryData() {
-    // RAII, grabs binary data, clears buffer after use
-    BinaryReader binaryReader;
-    const auto& binaryData = binaryReader.Data();
-
-    // File transfers can be chunked. Find the sync header,
-    // mark the inProgress and receive the rest of the data.
-    if(binaryData.size() > 0) {
-        // Handle binary data here...
-    }
+bool UiServer::processBinaryFrame(uint32_t sessionId, PacketPtr&& frame) {
+    return m_uploads.submit(sessionId, std::move(frame));
 }
 
 /**
  * @brief Sends an example binary data buffer.
+ * 
+ * The samples are written straight into a pooled packet, which is then
+ * shared by every binary client without further copies.
  */
 void UiServer::sendBinaryExample() {
     // Example send data
-    static std::vector<int16_t> dataBuffer;
-    if(dataBuffer.capacity() == 0) dataBuffer.reserve(0);
-    sendData(dataBuffer);
-    dataBuffer.clear();
+    const size_t sampleCount = 0;
+    int16_t* pSamples = nullptr;
+    PacketPtr packet = acquireData(sampleCount, pSamples);
+    for (size_t i = 0; i < sampleCount; i++) {
+        pSamples[i] = 0;
+    }
+    sendPacket(std::move(packet), true);
 }
-
@@ -9,6 +9,10 @@
 #include <libwebsockets.h>
 #include <functional> 
 #include "WebSystem.h"
+#include "Commands.h"
+#include "UploadManager.h"
+#include "ProcessSupervisor.h"
+#include "HlsSegmentStore.h"
 
 class UiServer : public WebSystem { 
 public:
@@ -17,13 +21,40 @@ public:
     UiServer(); 
     ~UiServer(); 
 
-    bool initialize(int port);
+    bool initialize(int port, std::vector<unsigned> serviceCores, unsigned controlCore);
     void service() override;
 
+    //! Serve the web files from memory, call before initialize()
+    bool enableAssetCache(std::vector<unsigned> cores);
+
+    //! Accept chunked file uploads on ws-protocol-binary, stored below directory
+    bool enableUploads(const std::string& directory, uint64_t maxFileSize, std::vector<unsigned> cores);
+
+    const UploadStats& getUploadStats() const { return m_uploads.getStats(); }
+
+    //! Run the ffmpeg HLS encoder for the camera stream at input
+    bool enableStream(const std::string& input, std::vector<unsigned> cores);
+
+    const ProcessStats& getStreamStats() const { return m_stream.getStats(); }
+    const HlsStats& getHlsStats() const { return m_hls.getStats(); }
+
+    //! Queue a telemetry frame to every binary client, safe from any thread
+    void publishTelemetry(PacketPtr&& frame) { sendPacket(std::move(frame), true); }
+
+    //! The callbacks run on the control thread, set them before initialize()
     void setPwmControlCallback(std::function<void(size_t)> callback) {
         m_pwmControlCallback = callback;
     }
 
+    void setIoBatchCallback(std::function<void(const IoBatchCommand&)> callback) {
+        m_ioBatchCallback = callback;
+    }
+
+    //! Called for "io-query", e.g. to send the full IO state on the next telemetry frame
+    void setIoQueryCallback(std::function<void()> callback) {
+        m_ioQueryCallback = callback;
+    }
+
 private:
     struct lws_context *context;
     struct lws_protocols protocol;
@@ -33,20 +64,30 @@ private:
     static const char* MOUNT_PATH;
     static const char* PASSWORD_PATH;
     static const char* PASSWORD_MA_PATH;
-    bool m_processStarted = false;
+    bool m_assetCacheEnabled = false;         //! Mounts are answered from the asset cache
 
     lws_http_mount m_mount;                   //! Mount location for the web files
     lws_http_mount m_superMount;              //! Super mount location
     lws_http_mount m_manufacturingMount;      //! Super mount location
+    lws_http_mount m_hlsMount;                //! HLS playlist and segments from m_hls
+    lws_http_mount m_metricsMount;            //! Prometheus metrics
 
 
-    void processBinaryData();
+    bool processBinaryFrame(uint32_t sessionId, PacketPtr&& frame);
     void sendBinaryExample();
     void startProcess();
     void stopProcess();
     void registerCommandCallbacks();
+    void registerMetrics();
 
     std::function<void(size_t)> m_pwmControlCallback;
+    std::function<void(const IoBatchCommand&)> m_ioBatchCallback;
+    std::function<void()> m_ioQueryCallback;
+
+    UploadManager m_uploads;                  //! Writes uploaded files on its own thread
+    ProcessSupervisor m_stream;               //! Runs and restarts the ffmpeg HLS encoder
+    std::string m_streamInput;                //! ffmpeg input URL
+    HlsSegmentStore m_hls;                    //! Recent segments of the stream, in memory
 };
 
 #endif //UISERVER_H
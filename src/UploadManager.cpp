@@ -0,0 +1,531 @@
+#include "UploadManager.h"
+#include "Crc32.h"
+#include "Logger.h"
+#include "ThreadUtils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace BinaryProtocol;
+
+//! Destination subdirectory of each UploadKind
+static const char* const KindDirectories[] = { "firmware", "maps", "config" };
+
+UploadManager::UploadManager() :
+    m_thread(INVALID_PTHREAD)
+{
+}
+
+UploadManager::~UploadManager() {
+    stop();
+}
+
+/**
+ * Creates the upload directories and starts the writer thread.
+ *
+ * @param directory Root of the upload directories.
+ * @param maxFileSize Largest file accepted, in bytes.
+ * @param cores CPU cores the writer thread may run on.
+ * @return bool True if the thread is running.
+ */
+bool UploadManager::start(const std::string& directory, uint64_t maxFileSize, std::vector<unsigned> cores) {
+    m_directory = directory;
+    m_maxFileSize = maxFileSize;
+
+    for (const char* kind : KindDirectories) {
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(directory) / kind, ec);
+        if (ec) {
+            LOG_ERROR("UploadManager: Failed to create %s/%s: %s", directory.c_str(), kind, ec.message().c_str());
+            return false;
+        }
+    }
+
+    m_exit.store(false);
+    m_exited.store(false);
+    m_thread = ThreadUtils::startThread("UploadWriter", writerThread, this,
+        cores, false, false, 0, SCHED_OTHER);
+
+    if (m_thread == INVALID_PTHREAD) {
+        m_exited.store(true);
+        LOG_ERROR("UploadManager: Failed to start writer thread");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Stops the writer thread. Open transfers are closed and stay resumable.
+ */
+void UploadManager::stop() {
+    if (m_exited.load()) {
+        return;
+    }
+
+    m_exit.store(true);
+    m_ready.notify_all();
+    while (!m_exited.load()) {
+        usleep(1000);
+    }
+}
+
+void UploadManager::setTransport(ReplyFunction reply, ResumeFunction resume) {
+    m_reply = std::move(reply);
+    m_resume = std::move(resume);
+}
+
+/**
+ * Queues a received frame for the writer thread. Runs on the websocket
+ * service thread, so it only queues; checksums and disk writes happen on
+ * the writer thread.
+ *
+ * @param sessionId Session that sent the frame.
+ * @param frame Complete frame.
+ * @return bool False if the sender should pause until it is resumed.
+ */
+bool UploadManager::submit(uint32_t sessionId, PacketPtr&& frame) {
+    std::unique_lock<std::mutex> lck(m_mutex);
+
+    if (m_queue.size() >= QueueCapacity) {
+        // The sender is paused as well, so it must be resumed once the queue drains
+        pauseSession(sessionId);
+        lck.unlock();
+        m_stats.rejected.fetch_add(1, std::memory_order_relaxed);
+
+        FrameHeader header = {};
+        if (frame->size() >= sizeof(header)) {
+            memcpy(&header, frame->payload(), sizeof(header));
+        }
+        ack(sessionId, header.transferId, AckStatus::Busy, header.offset);
+        return false;
+    }
+
+    Item item;
+    item.sessionId = sessionId;
+    item.frame = std::move(frame);
+    m_queue.push(std::move(item), OverflowPolicy::DropOldest);
+    m_pushed++;
+
+    uint64_t depth = m_queue.size();
+    if (depth > m_stats.maxQueued.load(std::memory_order_relaxed)) {
+        m_stats.maxQueued.store(depth, std::memory_order_relaxed);
+    }
+
+    bool accept = true;
+    if (depth >= PauseDepth) {
+        pauseSession(sessionId);
+        accept = false;
+    }
+
+    lck.unlock();
+    m_ready.notify_one();
+    return accept;
+}
+
+/**
+ * Adds a session to the senders resumed once the queue has drained.
+ * Called with m_mutex held.
+ *
+ * @param sessionId Session that is paused.
+ */
+void UploadManager::pauseSession(uint32_t sessionId) {
+    if (std::find(m_paused.begin(), m_paused.end(), sessionId) == m_paused.end()) {
+        m_paused.push_back(sessionId);
+        m_stats.pauses.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Notes that a client disconnected. Its files are closed by the writer
+ * thread after the frames it already queued.
+ *
+ * @param sessionId Closed session.
+ */
+void UploadManager::sessionClosed(uint32_t sessionId) {
+    {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        m_closed.emplace_back(sessionId, m_pushed);
+        m_paused.erase(std::remove(m_paused.begin(), m_paused.end(), sessionId), m_paused.end());
+    }
+    m_ready.notify_one();
+}
+
+void* UploadManager::writerThread(void* arg) {
+    static_cast<UploadManager*>(arg)->run();
+    return 0;
+}
+
+/**
+ * Writer loop. Processes queued frames in arrival order and resumes paused
+ * senders once the queue has drained below ResumeDepth.
+ */
+void UploadManager::run() {
+    LOG_INFO("UploadManager: writer thread started");
+
+    while (!m_exit.load()) {
+        Item item;
+        std::vector<uint32_t> closed;
+        std::vector<uint32_t> resumed;
+
+        {
+            std::unique_lock<std::mutex> lck(m_mutex);
+            m_ready.wait(lck, [this] { return m_exit.load() || !m_queue.empty() || !m_closed.empty(); });
+
+            // A close takes effect after the frames queued before it and
+            // before any frame queued after it, e.g. a resuming Begin
+            uint64_t position = m_queue.pop(item) ? m_popped++ : m_pushed;
+            for (auto it = m_closed.begin(); it != m_closed.end(); ) {
+                if (it->second <= position) {
+                    closed.push_back(it->first);
+                    it = m_closed.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            if (m_queue.size() <= ResumeDepth) {
+                resumed.swap(m_paused);
+            }
+        }
+
+        for (uint32_t sessionId : closed) {
+            for (auto it = m_transfers.begin(); it != m_transfers.end(); ) {
+                if (it->second.sessionId == sessionId) {
+                    LOG_INFO("UploadManager: %s interrupted at %llu of %llu bytes",
+                        it->second.path.c_str(), (unsigned long long)it->second.offset,
+                        (unsigned long long)it->second.totalSize);
+                    closeTransfer(it->second);
+                    it = m_transfers.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        if (item.frame) {
+            process(item.sessionId, item.frame);
+        }
+
+        if (m_resume) {
+            for (uint32_t sessionId : resumed) {
+                m_resume(sessionId);
+            }
+        }
+    }
+
+    for (auto& entry : m_transfers) {
+        closeTransfer(entry.second);
+    }
+    m_transfers.clear();
+
+    m_exited.store(true);
+    LOG_INFO("UploadManager: writer thread exiting");
+}
+
+/**
+ * Validates the header of a frame and runs its request.
+ *
+ * @param sessionId Session that sent the frame.
+ * @param frame Complete frame.
+ */
+void UploadManager::process(uint32_t sessionId, const PacketPtr& frame) {
+    FrameHeader header;
+    if (frame->size() < sizeof(header)) {
+        LOG_WARN("UploadManager: frame of %zu bytes is shorter than its header", frame->size());
+        ack(sessionId, 0, AckStatus::Invalid, 0);
+        return;
+    }
+
+    memcpy(&header, frame->payload(), sizeof(header));
+    if (header.magic != FrameMagic || header.length != frame->size() - sizeof(header)) {
+        LOG_WARN("UploadManager: malformed frame for transfer %u", header.transferId);
+        ack(sessionId, header.transferId, AckStatus::Invalid, 0);
+        return;
+    }
+
+    const uint8_t* pPayload = frame->payload() + sizeof(header);
+    switch ((FrameType)header.type) {
+    case FrameType::Begin:
+        begin(sessionId, header, pPayload);
+        break;
+    case FrameType::Chunk:
+        chunk(sessionId, header, pPayload);
+        break;
+    case FrameType::Commit:
+        commit(sessionId, header);
+        break;
+    case FrameType::Abort:
+        abort(sessionId, header);
+        break;
+    default:
+        ack(sessionId, header.transferId, AckStatus::Invalid, 0);
+        break;
+    }
+}
+
+/**
+ * Starts a transfer, or resumes it if a partial file of the same name
+ * exists. The CRC of the data already stored is recomputed so the final
+ * file check covers the resumed part as well.
+ *
+ * @param sessionId Session that sent the frame.
+ * @param header Frame header.
+ * @param pPayload UploadBegin followed by the file name.
+ */
+void UploadManager::begin(uint32_t sessionId, const FrameHeader& header, const uint8_t* pPayload) {
+    UploadBegin request;
+    if (header.length < sizeof(request)) {
+        ack(sessionId, header.transferId, AckStatus::Invalid, 0);
+        return;
+    }
+    memcpy(&request, pPayload, sizeof(request));
+
+    std::string name(reinterpret_cast<const char*>(pPayload + sizeof(request)),
+        std::min<size_t>(request.nameLength, header.length - sizeof(request)));
+
+    // Plain file names only, nothing that could leave the upload directory
+    bool validName = !name.empty() && name[0] != '.' && name.find('/') == std::string::npos &&
+        name.find('\0') == std::string::npos && request.nameLength == name.size();
+    if (!validName || request.kind >= sizeof(KindDirectories) / sizeof(KindDirectories[0])) {
+        LOG_WARN("UploadManager: rejecting upload of \"%s\"", name.c_str());
+        ack(sessionId, header.transferId, AckStatus::Invalid, 0);
+        return;
+    }
+
+    if (request.totalSize > m_maxFileSize) {
+        LOG_WARN("UploadManager: %s is %llu bytes, limit is %llu", name.c_str(),
+            (unsigned long long)request.totalSize, (unsigned long long)m_maxFileSize);
+        ack(sessionId, header.transferId, AckStatus::TooLarge, 0);
+        return;
+    }
+
+    Transfer transfer;
+    transfer.sessionId = sessionId;
+    transfer.path = m_directory + "/" + KindDirectories[request.kind] + "/" + name;
+    transfer.partPath = transfer.path + ".part";
+    transfer.totalSize = request.totalSize;
+    transfer.fileCrc32 = request.fileCrc32;
+    transfer.runningCrc32 = 0;
+    transfer.offset = 0;
+
+    // A restarted Begin replaces the session's transfer; another session
+    // uploading the same file keeps it.
+    auto existing = m_transfers.find(key(sessionId, header.transferId));
+    if (existing != m_transfers.end()) {
+        closeTransfer(existing->second);
+        m_transfers.erase(existing);
+    }
+    for (const auto& entry : m_transfers) {
+        if (entry.second.partPath == transfer.partPath) {
+            ack(sessionId, header.transferId, AckStatus::Busy, 0);
+            return;
+        }
+    }
+
+    transfer.fd = open(transfer.partPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (transfer.fd < 0) {
+        LOG_ERROR("UploadManager: Failed to open %s: %s", transfer.partPath.c_str(), strerror(errno));
+        ack(sessionId, header.transferId, AckStatus::IoError, 0);
+        return;
+    }
+
+    struct stat info;
+    uint64_t existingSize = (fstat(transfer.fd, &info) == 0) ? (uint64_t)info.st_size : 0;
+    if (existingSize > transfer.totalSize) {
+        existingSize = 0;
+    }
+    if (ftruncate(transfer.fd, (off_t)existingSize) != 0) {
+        existingSize = 0;
+    }
+
+    // Rebuild the checksum of the resumed part
+    uint8_t buffer[16384];
+    while (transfer.offset < existingSize) {
+        ssize_t n = pread(transfer.fd, buffer, std::min<uint64_t>(sizeof(buffer), existingSize - transfer.offset),
+            (off_t)transfer.offset);
+        if (n <= 0) {
+            break;
+        }
+        transfer.runningCrc32 = Crc32::update(transfer.runningCrc32, buffer, (size_t)n);
+        transfer.offset += (uint64_t)n;
+    }
+    if (transfer.offset < existingSize && ftruncate(transfer.fd, (off_t)transfer.offset) != 0) {
+        LOG_WARN("UploadManager: Failed to trim %s: %s", transfer.partPath.c_str(), strerror(errno));
+    }
+
+    if (transfer.offset > 0) {
+        LOG_INFO("UploadManager: resuming %s at %llu of %llu bytes", transfer.path.c_str(),
+            (unsigned long long)transfer.offset, (unsigned long long)transfer.totalSize);
+    } else {
+        LOG_INFO("UploadManager: receiving %s, %llu bytes", transfer.path.c_str(),
+            (unsigned long long)transfer.totalSize);
+    }
+
+    uint64_t offset = transfer.offset;
+    m_transfers.emplace(key(sessionId, header.transferId), std::move(transfer));
+    ack(sessionId, header.transferId, AckStatus::Ok, offset);
+}
+
+/**
+ * Verifies a chunk and appends it to the partial file.
+ *
+ * @param sessionId Session that sent the frame.
+ * @param header Frame header.
+ * @param pPayload Chunk data.
+ */
+void UploadManager::chunk(uint32_t sessionId, const FrameHeader& header, const uint8_t* pPayload) {
+    auto it = m_transfers.find(key(sessionId, header.transferId));
+    if (it == m_transfers.end()) {
+        ack(sessionId, header.transferId, AckStatus::UnknownTransfer, 0);
+        return;
+    }
+    Transfer& transfer = it->second;
+
+    if (header.offset != transfer.offset) {
+        ack(sessionId, header.transferId, AckStatus::OffsetMismatch, transfer.offset);
+        return;
+    }
+    if (transfer.offset + header.length > transfer.totalSize) {
+        ack(sessionId, header.transferId, AckStatus::Invalid, transfer.offset);
+        return;
+    }
+    if (Crc32::compute(pPayload, header.length) != header.crc32) {
+        m_stats.crcErrors.fetch_add(1, std::memory_order_relaxed);
+        ack(sessionId, header.transferId, AckStatus::CrcError, transfer.offset);
+        return;
+    }
+
+    uint64_t startNs = ThreadUtils::monotonicNs();
+    size_t written = 0;
+    while (written < header.length) {
+        ssize_t n = pwrite(transfer.fd, pPayload + written, header.length - written,
+            (off_t)(transfer.offset + written));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            LOG_ERROR("UploadManager: Failed to write %s: %s", transfer.partPath.c_str(), strerror(errno));
+            ack(sessionId, header.transferId, AckStatus::IoError, transfer.offset);
+            return;
+        }
+        written += (size_t)n;
+    }
+    m_stats.writeNs.fetch_add(ThreadUtils::monotonicNs() - startNs, std::memory_order_relaxed);
+    m_stats.bytesWritten.fetch_add(header.length, std::memory_order_relaxed);
+    m_stats.chunks.fetch_add(1, std::memory_order_relaxed);
+
+    transfer.runningCrc32 = Crc32::update(transfer.runningCrc32, pPayload, header.length);
+    transfer.offset += header.length;
+    ack(sessionId, header.transferId, AckStatus::Ok, transfer.offset);
+}
+
+/**
+ * Verifies the complete file, flushes it and renames it into place. A file
+ * failing the checksum is discarded so the retry starts from scratch.
+ *
+ * @param sessionId Session that sent the frame.
+ * @param header Frame header.
+ */
+void UploadManager::commit(uint32_t sessionId, const FrameHeader& header) {
+    auto it = m_transfers.find(key(sessionId, header.transferId));
+    if (it == m_transfers.end()) {
+        ack(sessionId, header.transferId, AckStatus::UnknownTransfer, 0);
+        return;
+    }
+    Transfer& transfer = it->second;
+
+    if (transfer.offset != transfer.totalSize) {
+        ack(sessionId, header.transferId, AckStatus::OffsetMismatch, transfer.offset);
+        return;
+    }
+
+    if (transfer.fileCrc32 != 0 && transfer.runningCrc32 != transfer.fileCrc32) {
+        LOG_WARN("UploadManager: %s failed its checksum, discarding", transfer.path.c_str());
+        m_stats.crcErrors.fetch_add(1, std::memory_order_relaxed);
+        if (ftruncate(transfer.fd, 0) == 0) {
+            transfer.offset = 0;
+            transfer.runningCrc32 = 0;
+        }
+        ack(sessionId, header.transferId, AckStatus::CrcError, transfer.offset);
+        return;
+    }
+
+    bool stored = (fsync(transfer.fd) == 0);
+    close(transfer.fd);
+    transfer.fd = -1;
+    stored = stored && (rename(transfer.partPath.c_str(), transfer.path.c_str()) == 0);
+
+    if (!stored) {
+        LOG_ERROR("UploadManager: Failed to store %s: %s", transfer.path.c_str(), strerror(errno));
+        ack(sessionId, header.transferId, AckStatus::IoError, transfer.offset);
+        m_transfers.erase(it);
+        return;
+    }
+
+    // Make the rename itself durable
+    std::string directory = std::filesystem::path(transfer.path).parent_path().string();
+    int dirFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+
+    LOG_INFO("UploadManager: stored %s, %llu bytes", transfer.path.c_str(), (unsigned long long)transfer.totalSize);
+    m_stats.completed.fetch_add(1, std::memory_order_relaxed);
+    ack(sessionId, header.transferId, AckStatus::Complete, transfer.totalSize);
+    m_transfers.erase(it);
+}
+
+/**
+ * Discards a transfer and its partial file.
+ *
+ * @param sessionId Session that sent the frame.
+ * @param header Frame header.
+ */
+void UploadManager::abort(uint32_t sessionId, const FrameHeader& header) {
+    auto it = m_transfers.find(key(sessionId, header.transferId));
+    if (it == m_transfers.end()) {
+        ack(sessionId, header.transferId, AckStatus::UnknownTransfer, 0);
+        return;
+    }
+
+    LOG_INFO("UploadManager: %s aborted", it->second.path.c_str());
+    closeTransfer(it->second);
+    unlink(it->second.partPath.c_str());
+    m_transfers.erase(it);
+    ack(sessionId, header.transferId, AckStatus::Ok, 0);
+}
+
+void UploadManager::closeTransfer(Transfer& transfer) {
+    if (transfer.fd >= 0) {
+        close(transfer.fd);
+        transfer.fd = -1;
+    }
+}
+
+/**
+ * Sends an Ack frame to a client.
+ *
+ * @param sessionId Target session.
+ * @param transferId Transfer the ack refers to.
+ * @param status Result of the request.
+ * @param offset Offset the client should continue from.
+ */
+void UploadManager::ack(uint32_t sessionId, uint32_t transferId, AckStatus status, uint64_t offset) {
+    if (!m_reply) {
+        return;
+    }
+
+    FrameHeader header = {};
+    header.magic = FrameMagic;
+    header.type = (uint8_t)FrameType::Ack;
+    header.status = (uint8_t)status;
+    header.transferId = transferId;
+    header.offset = offset;
+    m_reply(sessionId, reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+}
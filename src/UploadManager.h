@@ -0,0 +1,119 @@
+/**
+* Receives chunked file uploads (firmware, maps, configuration) framed with
+* BinaryProtocol and streams them to disk on a dedicated writer thread.
+* Chunks wait in a bounded queue, so memory stays fixed however large the
+* file; when the queue fills the sending client is paused until the writer
+* catches up. Data is written to "<name>.part" and renamed into place once
+* the whole file is verified, so an interrupted upload can be resumed.
+*/
+
+#pragma once
+
+#include <pthread.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "BinaryProtocol.h"
+#include "MessageRing.h"
+#include "PacketPool.h"
+
+//! Upload counters, for throughput and backpressure monitoring
+struct UploadStats {
+    std::atomic<uint64_t> bytesWritten{0};      //! File bytes written to disk
+    std::atomic<uint64_t> chunks{0};            //! Chunks written
+    std::atomic<uint64_t> writeNs{0};           //! Time spent in pwrite()
+    std::atomic<uint64_t> completed{0};         //! Files committed
+    std::atomic<uint64_t> crcErrors{0};         //! Chunks or files failing the checksum
+    std::atomic<uint64_t> pauses{0};            //! Times a client was paused for backpressure
+    std::atomic<uint64_t> rejected{0};          //! Frames refused because the queue was full
+    std::atomic<uint64_t> maxQueued{0};         //! Deepest the chunk queue has been
+};
+
+class UploadManager {
+public:
+    //! Sends a reply frame to one client
+    typedef std::function<void(uint32_t sessionId, const uint8_t* pData, size_t len)> ReplyFunction;
+    //! Lets a paused client send again
+    typedef std::function<void(uint32_t sessionId)> ResumeFunction;
+
+    static constexpr size_t QueueCapacity = 32;     //! Frames waiting for the writer, 2 MiB at most
+    static constexpr size_t PauseDepth = 24;        //! Pause the sender once this many are queued
+    static constexpr size_t ResumeDepth = 8;        //! Resume paused senders below this depth
+
+    UploadManager();
+    ~UploadManager();
+
+    //! Start the writer thread
+    //! \param directory Root of the upload directories, one subdirectory per UploadKind
+    //! \param maxFileSize Largest file accepted, in bytes
+    bool start(const std::string& directory, uint64_t maxFileSize, std::vector<unsigned> cores);
+    void stop();
+
+    void setTransport(ReplyFunction reply, ResumeFunction resume);
+
+    //! Queue a received frame. Returns false if the sender should pause until resumed.
+    bool submit(uint32_t sessionId, PacketPtr&& frame);
+
+    //! Close the open files of a disconnected client, keeping them resumable
+    void sessionClosed(uint32_t sessionId);
+
+    const UploadStats& getStats() const { return m_stats; }
+
+private:
+    struct Item {
+        uint32_t  sessionId = 0;
+        PacketPtr frame;
+    };
+
+    struct Transfer {
+        uint32_t    sessionId;
+        int         fd;
+        std::string path;               //! Final file name
+        std::string partPath;           //! File receiving the data
+        uint64_t    totalSize;
+        uint64_t    offset;             //! Bytes stored so far, the next expected offset
+        uint32_t    fileCrc32;          //! Expected CRC-32 of the file, 0 to skip
+        uint32_t    runningCrc32;       //! CRC-32 of the bytes stored so far
+    };
+
+    static void* writerThread(void* arg);
+    void run();
+    void process(uint32_t sessionId, const PacketPtr& frame);
+    void begin(uint32_t sessionId, const BinaryProtocol::FrameHeader& header, const uint8_t* pPayload);
+    void chunk(uint32_t sessionId, const BinaryProtocol::FrameHeader& header, const uint8_t* pPayload);
+    void commit(uint32_t sessionId, const BinaryProtocol::FrameHeader& header);
+    void abort(uint32_t sessionId, const BinaryProtocol::FrameHeader& header);
+    void closeTransfer(Transfer& transfer);
+    void pauseSession(uint32_t sessionId);
+    void ack(uint32_t sessionId, uint32_t transferId, BinaryProtocol::AckStatus status, uint64_t offset);
+
+    static uint64_t key(uint32_t sessionId, uint32_t transferId) {
+        return ((uint64_t)sessionId << 32) | transferId;
+    }
+
+    std::string             m_directory;                //! Root of the upload directories
+    uint64_t                m_maxFileSize = 0;          //! Largest file accepted
+    ReplyFunction           m_reply;                    //! Sends acks
+    ResumeFunction          m_resume;                   //! Resumes paused senders
+
+    std::mutex              m_mutex;                    //! Guards the queue and the lists below
+    std::condition_variable m_ready;                    //! Signaled when work is queued
+    MessageRing<Item>       m_queue{QueueCapacity};     //! Frames waiting for the writer
+    std::vector<uint32_t>   m_paused;                   //! Sessions paused for backpressure
+    std::vector<std::pair<uint32_t, uint64_t>> m_closed; //! Closed sessions and the frame count at closing
+    uint64_t                m_pushed = 0;               //! Frames queued so far
+    uint64_t                m_popped = 0;               //! Frames taken by the writer so far
+
+    std::unordered_map<uint64_t, Transfer> m_transfers; //! Open transfers, writer thread only
+
+    pthread_t               m_thread;                   //! Writer thread
+    std::atomic<bool>       m_exit{false};              //! Signal thread to exit
+    std::atomic<bool>       m_exited{true};             //! Thread indicates it has exited
+    UploadStats             m_stats;
+};
@@ -3,14 +3,20 @@
 #include <type_traits>
 #include <unistd.h>
 #include <functional>
+#include <algorithm>
+#include <new>
 #include "WebSystem.h"
 #include "ThreadUtils.h"
+#include "Logger.h"
+#include "CommandTrace.h"
 #include <nlohmann/json.hpp>
 
 using namespace std;
 using json = nlohmann::json;
 
-std::atomic<bool> WebSystem::m_webSocketEnabled{false};     //! Atomic boolean to check if websocket is enabled
+//! Command handler run time, recorded on the control thread
+static Histogram& s_commandHandlerTime = Metrics::histogram("command_handler_seconds",
+    "Time spent running command handlers on the control thread");
 
 
 /**
@@ -18,12 +24,13 @@ std::atomic<bool> WebSystem::m_webSocketEnabled{false};     //! Atomic boolean t
  * Initializes the WebSystem with default values.
 */
 WebSystem::WebSystem() :
-    m_serviceThread(INVALID_PTHREAD),
+    m_context(nullptr),
+    m_controlThread(INVALID_PTHREAD),
     m_protocols{
-        { "http", WebSystem::callbackHttp, 0, 0, 0, NULL}, 
-        { "ws-protocol-text", WebSystem::callbackWsProtocolText, sizeof(int),
+        { "http", WebSystem::callbackHttp, sizeof(HttpSession), 0, 0, NULL}, 
+        { "ws-protocol-text", WebSystem::callbackWsProtocolText, sizeof(Session),
             WebSystem::MaxPacketByteLen, 0, NULL}, 
-        { "ws-protocol-binary", WebSystem::callbackWsProtocolBinary, sizeof(int),
+        { "ws-protocol-binary", WebSystem::callbackWsProtocolBinary, sizeof(Session),
             WebSystem::MaxPacketByteLen, 0, NULL}, 
         { NULL, NULL, 0, 0, 0, NULL}, 
     }
@@ -33,63 +40,136 @@ WebSystem::WebSystem() :
         cerr << "chdir() to /var/www/webFiles failed" << endl;
     }
 
-    // Write buffer space for LWS
-    m_writeBufferText.resize(LWS_PRE);
-    m_writeBufferBinary.resize(LWS_PRE);
-
-    m_webSocketEnabled.store(false);
+}
 
+/**
+ * Constructor
+ * Registers the traffic metrics of a protocol, labelled with its name.
+ *
+ * @param protocol Protocol name.
+ */
+WebSystem::SessionSet::SessionSet(const char* protocol) :
+    protocol(protocol),
+    messagesIn(Metrics::counter("websocket_received_messages_total", "Websocket messages received",
+        {{"protocol", protocol}})),
+    bytesIn(Metrics::counter("websocket_received_bytes_total", "Websocket payload bytes received",
+        {{"protocol", protocol}})),
+    messagesOut(Metrics::counter("websocket_sent_messages_total", "Websocket messages sent",
+        {{"protocol", protocol}})),
+    bytesOut(Metrics::counter("websocket_sent_bytes_total", "Websocket payload bytes sent",
+        {{"protocol", protocol}})),
+    dropped(Metrics::counter("websocket_dropped_messages_total",
+        "Outbound websocket messages discarded because a client's queue was full", {{"protocol", protocol}}))
+{
+    Metrics::gaugeFunction("websocket_sessions", "Connected websocket clients", {{"protocol", protocol}},
+        [this]() { return (double)count.load(memory_order_relaxed); });
+
+    // Sampled under the session locks, only when scraped
+    Metrics::gaugeFunction("websocket_queued_messages", "Outbound websocket messages waiting to be sent",
+        {{"protocol", protocol}}, [this]() {
+            size_t queued = 0;
+            shared_lock<shared_mutex> lck(m_sessionsMutex);
+            for (Session* pSession : sessions) {
+                lock_guard<mutex> sessionLck(pSession->mutex);
+                queued += pSession->outbound.size();
+            }
+            return (double)queued;
+        });
 }
 
 /**
  * Destructor
- * Cleans up resources, ensures the service thread is terminated properly, and destroys the LWS context.
+ * Cleans up resources, ensures the service threads are terminated properly, and destroys the LWS context.
 */
 WebSystem::~WebSystem() {
-    if ( (m_serviceThread != INVALID_PTHREAD) && !m_serviceParams.exited )
+    if (!m_serviceThreads.empty())
     {   
-        // Wait here for the thread to die
+        // Signal the threads and wake every one of them out of its poll wait
+        for (size_t i = 0; i < m_serviceThreads.size(); i++) {
+            m_serviceParams[i].exit = true;
+        }
+        lws_cancel_service(m_context);
+
+        // Wait here for the threads to die
+        for (size_t i = 0; i < m_serviceThreads.size(); i++) {
+            while (!m_serviceParams[i].exited) {
+                usleep(1000);
+            }
+        }
     }   
 
-    if (m_serviceParams.context) {
-        lws_context_destroy(m_serviceParams.context);
+    if ( (m_controlThread != INVALID_PTHREAD) && !m_controlParams.exited )
+    {
+        m_controlParams.exit = true;
+        m_commandQueue.wake();
+        while (!m_controlParams.exited) {
+            usleep(1000);
+        }
+    }
+
+    if (m_context) {
+        lws_context_destroy(m_context);
     }   
 }
 
 /**
-* Initialize the service thread tied to a core
+* Initialize the service threads, each tied to a core
+* 
+* lws runs one service loop per entry of serviceCores and hands each new
+* connection to the loop with the fewest connections; the connection stays
+* on that thread until it closes.
 * 
 * @param name The name of the application.
 * @param port The port number for the binary and text websocket services.
-* @param core The CPU core number to which the low priority service thread is tied.
+* @param serviceCores CPU cores of the low priority service threads, one thread per core.
+* @param controlCore The CPU core number to which the command control thread is tied.
 * @param pMount The mount location for serving HTTP files.
 * @param wsi Pointer to the websocket instance.
 * @return int Returns 0 on success, -1 on failure.
 */
-int WebSystem::initialize(string name, int port, unsigned core, const lws_http_mount* pMount) {
+int WebSystem::initialize(string name, int port, vector<unsigned> serviceCores, unsigned controlCore,
+    const lws_http_mount* pMount) {
     m_applicationName = name;
+    if (serviceCores.empty()) {
+        serviceCores.push_back(0);
+    }
 
     cout << "WebSystem: Starting initialization for " << name << " on port " << port << endl;
 
 
-#ifdef TEST_MODE 
+#ifdef ENABLE_LOGS 
     int logs = LLL_ERR | LLL_WARN | LLL_NOTICE | LLL_INFO | LLL_DEBUG | LLL_HEADER | LLL_EXT | LLL_CLIENT | LLL_LATENCY | LLL_USER; // | LLL_PARSER;
 #else
     int logs = 0; // Disable logs
 #endif
 
-    lws_set_log_level(logs, NULL);
+    // Route lws logs through the asynchronous logger
+    lws_set_log_level(logs, Logger::lwsEmit);
+
+    // Mounts handled by callbackHttp are answered by their route handler or the asset cache
+    m_staticRoutes.clear();
+    for (const lws_http_mount* pRoute = pMount; pRoute; pRoute = pRoute->mount_next) {
+        if (pRoute->origin_protocol == LWSMPRO_CALLBACK) {
+            auto handler = m_httpHandlers.find(pRoute->mountpoint);
+            m_staticRoutes.push_back({pRoute->mountpoint, pRoute->def ? pRoute->def : "index.html",
+                handler != m_httpHandlers.end() ? handler->second : HttpRouteHandler(), pRoute->extra_mimetypes});
+        }
+    }
+    std::sort(m_staticRoutes.begin(), m_staticRoutes.end(), [](const StaticRoute& a, const StaticRoute& b) {
+        return a.mountpoint.size() > b.mountpoint.size();
+    });
 
     struct lws_context_creation_info info;
     memset(&info, 0, sizeof(info));
     info.port = port;
     info.mounts = pMount;
     info.protocols = m_protocols;
+    info.count_threads = serviceCores.size();
 
     if (info.protocols != nullptr) {
         cout << "WebSystem: Protocols initialized successfully" << endl;
 
-#ifdef TEST_MODE
+#ifdef ENABLE_LOGS
         for (int i = 0; m_protocols[i].name != nullptr; ++i) {
             cout << "Protocol " << i << ": " << m_protocols[i].name << endl;
         }
@@ -101,47 +181,102 @@ int WebSystem::initialize(string name, int port, unsigned core, const lws_http_m
     info.options = LWS_SERVER_OPTION_EXPLICIT_VHOSTS;
 
     cout << "WebSystem: Creating lws context" << endl;
-    m_serviceParams.context = lws_create_context(&info);
-    if (!m_serviceParams.context) {
+    m_context = lws_create_context(&info);
+    if (!m_context) {
         cerr << "WebSystem: Failed to create lws_context" << endl;
         return -1;
     }
 
     cout << "WebSystem: lws context created successfully" << endl;
+    m_pServiceContext = m_context;
+
+    // lws built with a lower LWS_MAX_SMP runs fewer service loops than asked for
+    size_t threadCount = lws_get_count_threads(m_context);
+    if (threadCount < serviceCores.size()) {
+        cerr << "WebSystem: lws supports " << threadCount << " service threads, " << serviceCores.size()
+             << " requested" << endl;
+    }
 
     cout << "WebSystem: Creating vhost" << endl;
     info.vhost_name = name.c_str();
-    auto* pVhost = lws_create_vhost(m_serviceParams.context, &info);
+    auto* pVhost = lws_create_vhost(m_context, &info);
     if (!pVhost) {
         cerr << "WebSystem: Failed to create vhost" << endl;
         return -1;
     }
 
     cout << "WebSystem: vhost created successfully" << endl;
-    
-    // Start the service thread
-    m_serviceParams.exit = false;
-    m_serviceParams.exited = false;
-
-    cout << "WebSystem: Starting service thread" << endl;
-    vector<unsigned> cores = { core };
-    m_serviceThread = ThreadUtils::startThread(
-        "WebSystem",
-        serviceThread,
-        &m_serviceParams,
-        cores,
+
+    // Statistics the queues keep themselves are sampled when scraped
+    Metrics::gaugeFunction("command_queue_depth", "Commands waiting for the control thread", {},
+        []() { return (double)m_commandQueue.depth(); });
+    Metrics::counterFunction("command_queue_rejected_total", "Commands refused because the queue was full", {},
+        []() { return (double)m_commandQueue.stats().rejected.load(memory_order_relaxed); });
+    Metrics::counterFunction("service_wakeups_total", "Service thread wakeups requested by producers", {},
+        []() { return (double)m_wakeStats.count.load(memory_order_relaxed); });
+    Metrics::counterFunction("service_wake_latency_seconds_total",
+        "Sum of the delays between a wakeup request and a service thread handling it", {},
+        []() { return m_wakeStats.totalNs.load(memory_order_relaxed) * 1e-9; });
+    Metrics::counterFunction("log_dropped_records_total", "Log records lost to a full log ring", {},
+        []() { return (double)Logger::dropped(); });
+
+    // Start the control thread before the first command can arrive
+    m_controlParams.exit = false;
+    m_controlParams.exited = false;
+
+    cout << "WebSystem: Starting control thread" << endl;
+    vector<unsigned> controlCores = { controlCore };
+    m_controlThread = ThreadUtils::startThread(
+        "WebControl",
+        controlThread,
+        &m_controlParams,
+        controlCores,
         false,
         false,
-        sched_get_priority_min(SCHED_FIFO) + 1,
+        sched_get_priority_min(SCHED_FIFO) + 2,
         SCHED_FIFO
     );
 
-    if (m_serviceThread == INVALID_PTHREAD) {
-        cerr << "WebSystem: Failed to start service thread" << endl;
+    if (m_controlThread == INVALID_PTHREAD) {
+        cerr << "WebSystem: Failed to start control thread" << endl;
         return -1;
     }
+    
+    // Start one service thread per lws service loop. The parameters are
+    // sized once up front, the threads keep pointers into them.
+    m_serviceParams.resize(threadCount);
+    for (size_t tsi = 0; tsi < threadCount; tsi++) {
+        ServiceParams_t& params = m_serviceParams[tsi];
+        params.exit = false;
+        params.exited = false;
+        params.context = m_context;
+        params.tsi = (int)tsi;
+        params.pIterationTime = &Metrics::histogram("lws_service_iteration_seconds",
+            "Duration of one lws service loop iteration, including the poll wait",
+            {{"thread", to_string(tsi)}});
+
+        cout << "WebSystem: Starting service thread " << tsi << " on core " << serviceCores[tsi] << endl;
+        string threadName = "WebSystem" + to_string(tsi);
+        vector<unsigned> cores = { serviceCores[tsi] };
+        pthread_t thread = ThreadUtils::startThread(
+            threadName.c_str(),
+            serviceThread,
+            &params,
+            cores,
+            false,
+            false,
+            sched_get_priority_min(SCHED_FIFO) + 1,
+            SCHED_FIFO
+        );
+
+        if (thread == INVALID_PTHREAD) {
+            cerr << "WebSystem: Failed to start service thread " << tsi << endl;
+            return -1;
+        }
+        m_serviceThreads.push_back(thread);
+    }
 
-    cout << "WebSystem: Service thread started successfully" << endl;
+    cout << "WebSystem: Service threads started successfully" << endl;
     cout << "WebSystem: Initialization completed successfully" << endl;
 
     return 0;
@@ -149,69 +284,304 @@ int WebSystem::initialize(string name, int port, unsigned core, const lws_http_m
 
 /**
  * Service thread function
- * Handles the lifecycle of the service thread, processing websocket activity.
+ * Handles the lifecycle of one service thread, processing the websocket
+ * activity of the connections lws assigned to its thread service index.
+ * The thread blocks in lws_service_tsi() until there is socket activity, a
+ * scheduled lws timer expires, or a producer calls requestService().
  * 
  * @param arg Pointer to ServiceParams_t structure containing thread and context information.
  * @return void* Always returns 0.
  */
 void* WebSystem::serviceThread(void* arg) {
     ServiceParams_t* pParams = (ServiceParams_t*)(arg);
-    printf("serviceThread: ServiceThread started\n");
+    LOG_INFO("serviceThread: ServiceThread %d started", pParams->tsi);
     
     while (!pParams->exit && pParams->context) {
-        printf("serviceThread: Calling lws_service\n");
-        
-        // Service any pending websocket activity
-        int n = lws_service(pParams->context, 0);
-        printf("serviceThread: lws_service returned: %d\n", n);
+        // Sleep on the poll wait; producers wake us with lws_cancel_service()
+        uint64_t startNs = ThreadUtils::monotonicNs();
+        int n = lws_service_tsi(pParams->context, 0, pParams->tsi);
+        pParams->pIterationTime->observe(ThreadUtils::monotonicNs() - startNs);
 
         if (n < 0) {
-            cerr << "WebSystem::serviceThread lws_service error" << endl;
+            LOG_ERROR("WebSystem::serviceThread %d lws_service_tsi error %d", pParams->tsi, n);
             break;
         }
-        usleep(25000); // 25ms response
     }
     pParams->exited = true;
-    printf("WebSystem: serviceThread exiting\n");
+    LOG_INFO("WebSystem: serviceThread %d exiting", pParams->tsi);
     return 0;
 }
 
 /**
- * Sends text data over the websocket.
+ * Control thread function
+ * Runs the handlers of queued commands in arrival order and acknowledges
+ * each one to the client that sent it. Blocking hardware writes happen
+ * here instead of on the lws service thread.
  * 
- * @param str The string data to send.
+ * @param arg Pointer to ControlParams_t structure.
+ * @return void* Always returns 0.
  */
-void WebSystem::sendTextData(const string& str) {
-    lock_guard<mutex> lck(m_writeBufferTextMutex);
+void* WebSystem::controlThread(void* arg) {
+    ControlParams_t* pParams = (ControlParams_t*)(arg);
+    LOG_INFO("controlThread: ControlThread started");
+
+    while (!pParams->exit) {
+        QueuedCommand* pCommand = m_commandQueue.wait(100);
+        if (!pCommand) {
+            continue;
+        }
+
+        runCommand(pCommand);
+        m_commandQueue.release(pCommand);
+    }
+
+    pParams->exited = true;
+    LOG_INFO("WebSystem: controlThread exiting");
+    return 0;
+}
+
+/**
+ * Runs the handler of a queued command and acknowledges it.
+ * The IO and PWM layers stamp their stages into the trace as the handler runs.
+ * 
+ * @param pCommand Command taken from the queue, released by the caller.
+ */
+void WebSystem::runCommand(const QueuedCommand* pCommand) {
+    uint64_t startNs = ThreadUtils::monotonicNs();
+    uint64_t queueNs = startNs - pCommand->receivedNs;
+    m_commandSessionId = pCommand->sessionId;
+    CommandTrace::begin(pCommand->receivedNs, pCommand->decodedNs);
+    m_commands.invoke(pCommand->id, pCommand->payload);
+    CommandTrace::end();
+    s_commandHandlerTime.observe(ThreadUtils::monotonicNs() - startNs);
+    if (!pCommand->binary) {
+        sendAck(pCommand->sessionId, m_commands.name(pCommand->id).c_str(), pCommand->sequence, "ok", queueNs);
+    } else if (pCommand->sequence != 0) {
+        sendBinaryAck(pCommand->sessionId, (uint8_t)m_commands.opcode(pCommand->id), pCommand->sequence,
+            BinaryProtocol::CommandStatus::Ok, queueNs);
+    }
+}
+
+/**
+ * Validates a received text command and queues it for the control thread.
+ * Runs on the session's service thread; only parses and decodes, never executes. The
+ * message is streamed from the receive buffer, no JSON document is built.
+ * 
+ * @param wsi Pointer to the websocket instance.
+ * @param user Per-session user area holding the Session.
+ * @param pData Received frame.
+ * @param size Size of the received frame.
+ */
+void WebSystem::enqueueCommand(lws* wsi, void* user, const char* pData, size_t size) {
+    uint64_t receivedNs = ThreadUtils::monotonicNs();
+    uint32_t sessionId = static_cast<Session*>(user)->id;
+
+    uint32_t sequence = 0;
+    auto findSequence = [&sequence](const JsonPath& path, const JsonScalar& value) {
+        if (path.is("seq")) {
+            value.get(sequence);
+        }
+    };
+
+    QueuedCommand* pCommand = m_commandQueue.claim();
+    if (!pCommand) {
+        // Decode aside only to name the rejected command in the ack
+        CommandPayload payload;
+        CommandId id;
+        if (m_commands.decodeMessage(pData, size, payload, id, findSequence) !=
+            CommandRegistry::DecodeStatus::Malformed) {
+            const char* name = (id != InvalidCommandId) ? m_commands.name(id).c_str() : "";
+            LOG_WARN("WebSystem: command queue full, rejecting %s", name);
+            sendAck(sessionId, name, sequence, "busy", 0);
+        }
+        return;
+    }
+
+    CommandId id;
+    switch (m_commands.decodeMessage(pData, size, pCommand->payload, id, findSequence)) {
+    case CommandRegistry::DecodeStatus::Ok:
+        break;
+    case CommandRegistry::DecodeStatus::Malformed:
+        m_commandQueue.abandon(pCommand);
+        LOG_WARN("Failed to parse JSON command of %zu bytes", size);
+        return;
+    case CommandRegistry::DecodeStatus::Unknown:
+        m_commandQueue.abandon(pCommand);
+        sendAck(sessionId, "", sequence, "unknown", 0);
+        return;
+    case CommandRegistry::DecodeStatus::Invalid:
+        m_commandQueue.abandon(pCommand);
+        sendAck(sessionId, m_commands.name(id).c_str(), sequence, "invalid", 0);
+        return;
+    }
+
+    pCommand->id = id;
+    pCommand->sessionId = sessionId;
+    pCommand->sequence = sequence;
+    pCommand->binary = false;
+    pCommand->receivedNs = receivedNs;
+    pCommand->decodedNs = ThreadUtils::monotonicNs();
+    m_commandQueue.publish(pCommand);
+}
+
+/**
+ * Checks whether a binary message carries a command.
+ * 
+ * @param pData Received message.
+ * @param size Size of the message.
+ * @return bool True for a BinaryProtocol command frame.
+ */
+bool WebSystem::isBinaryCommand(const uint8_t* pData, size_t size) {
+    if (size < sizeof(BinaryProtocol::CommandHeader)) {
+        return false;
+    }
+
+    uint16_t magic;
+    memcpy(&magic, pData, sizeof(magic));
+    return magic == BinaryProtocol::FrameMagic && pData[2] == (uint8_t)BinaryProtocol::FrameType::Command;
+}
+
+/**
+ * Validates a binary command and queues it for the control thread. The
+ * payload is decoded from the receive buffer straight into the queue slot,
+ * without parsing or allocating.
+ * 
+ * @param sessionId Session that sent the command.
+ * @param pData Received message, starting with a CommandHeader.
+ * @param size Size of the message.
+ */
+void WebSystem::enqueueBinaryCommand(uint32_t sessionId, const uint8_t* pData, size_t size) {
+    using namespace BinaryProtocol;
+    uint64_t receivedNs = ThreadUtils::monotonicNs();
+
+    CommandHeader header;
+    memcpy(&header, pData, sizeof(header));
+
+    CommandId id = m_commands.resolveOpcode(header.opcode);
+    if (id == InvalidCommandId) {
+        sendBinaryAck(sessionId, header.opcode, header.sequence, CommandStatus::Unknown, 0);
+        return;
+    }
+
+    QueuedCommand* pCommand = m_commandQueue.claim();
+    if (!pCommand) {
+        LOG_WARN("WebSystem: command queue full, rejecting %s", m_commands.name(id).c_str());
+        sendBinaryAck(sessionId, header.opcode, header.sequence, CommandStatus::Busy, 0);
+        return;
+    }
+
+    if (!m_commands.decode(id, pData + sizeof(header), size - sizeof(header), pCommand->payload)) {
+        m_commandQueue.abandon(pCommand);
+        sendBinaryAck(sessionId, header.opcode, header.sequence, CommandStatus::Invalid, 0);
+        return;
+    }
+
+    pCommand->id = id;
+    pCommand->sessionId = sessionId;
+    pCommand->sequence = header.sequence;
+    pCommand->binary = true;
+    pCommand->receivedNs = receivedNs;
+    pCommand->decodedNs = ThreadUtils::monotonicNs();
+    m_commandQueue.publish(pCommand);
+}
+
+/**
+ * Acknowledges a command to the client that sent it.
+ * 
+ * @param sessionId Session that sent the command.
+ * @param command Command name.
+ * @param sequence Client sequence number, 0 if the client sent none.
+ * @param status "ok", "busy", "invalid" or "unknown".
+ * @param queueNs Time the command waited before its handler ran.
+ */
+void WebSystem::sendAck(uint32_t sessionId, const char* command, uint32_t sequence,
+    const char* status, uint64_t queueNs) {
+    char ack[160];
+    int len = snprintf(ack, sizeof(ack), "{\"ack\":\"%s\",\"seq\":%u,\"status\":\"%s\",\"queueUs\":%llu}",
+        command, sequence, status, (unsigned long long)(queueNs / 1000));
+    if (len > 0 && (size_t)len < sizeof(ack)) {
+        sendTextTo(sessionId, ack, len);
+    }
+}
+
+/**
+ * Acknowledges a binary command to the client that sent it.
+ * 
+ * @param sessionId Session that sent the command.
+ * @param opcode Opcode of the command.
+ * @param sequence Sequence from the CommandHeader.
+ * @param status Outcome of the command.
+ * @param queueNs Time the command waited before its handler ran.
+ */
+void WebSystem::sendBinaryAck(uint32_t sessionId, uint8_t opcode, uint32_t sequence,
+    BinaryProtocol::CommandStatus status, uint64_t queueNs) {
+    BinaryProtocol::CommandAck ack = {};
+    ack.magic = BinaryProtocol::FrameMagic;
+    ack.type = (uint8_t)BinaryProtocol::FrameType::CommandAck;
+    ack.status = (uint8_t)status;
+    ack.sequence = sequence;
+    ack.opcode = opcode;
+    ack.queueUs = (uint32_t)std::min<uint64_t>(queueNs / 1000, UINT32_MAX);
+    sendBinaryTo(sessionId, &ack, sizeof(ack));
+}
 
-    if (m_webSocketEnabled.load() == false) {
-        cerr << "sendTextData: WebSocket is not enabled" << endl;
+/**
+ * Wakes the service threads so they dispatch pending writes.
+ * Safe to call from any thread; lws_cancel_service() is the only lws call
+ * that may be made outside a connection's service thread. It wakes every
+ * service thread, each then handles its own connections.
+ */
+void WebSystem::requestService() {
+    if (!m_pServiceContext) {
         return;
     }
 
-    if (m_webSocketEnabled.load() == true && (m_writeBufferText.size() + str.size()) > MaxPacketByteLen) {
-        cerr << "sendTextData: WebSocket enabled but write buffer is too large, dumping buffer" << endl;
-        cerr << "WebSystem: Current Buffer: " << m_writeBufferText.size() << "Data Buffer: " << str.size() << "Total: " << m_writeBufferText.size() + str.size() << endl;
-        
-        // Dump all data in the buffer
-        m_writeBufferText.clear();
-        m_writeBufferText.resize(LWS_PRE); // Reset buffer to initial size
+    // Keep the oldest outstanding request so the latency covers the full wait
+    uint64_t expected = 0;
+    m_wakeRequestNs.compare_exchange_strong(expected, ThreadUtils::monotonicNs());
+
+    lws_cancel_service(m_pServiceContext);
+}
 
+/**
+ * Records the wake-to-dispatch latency of the service threads.
+ * Called on each service thread when LWS_CALLBACK_EVENT_WAIT_CANCELLED
+ * arrives; the first one to wake accounts the request.
+ * The request stamp is cleared before the write buffers are inspected, so a
+ * producer racing with this call always triggers another wakeup.
+ * 
+ * @param wsi Pointer to the websocket instance (unused here).
+ */
+void WebSystem::onServiceWake(lws* wsi) {
+    uint64_t requestNs = m_wakeRequestNs.exchange(0);
+    if (requestNs == 0) {
         return;
     }
 
-    // Insert new data to the end due to LWS header
-    printf("sendTextData: Adding data to write buffer: %s\n", str.c_str());
-    m_writeBufferText += str;
+    uint64_t latencyNs = ThreadUtils::monotonicNs() - requestNs;
+    m_wakeStats.count.fetch_add(1, memory_order_relaxed);
+    m_wakeStats.totalNs.fetch_add(latencyNs, memory_order_relaxed);
+
+    uint64_t maxNs = m_wakeStats.maxNs.load(memory_order_relaxed);
+    while (latencyNs > maxNs &&
+           !m_wakeStats.maxNs.compare_exchange_weak(maxNs, latencyNs, memory_order_relaxed)) {
+    }
+}
 
-    // Service the writable callback for the text protocol
-     int result = lws_callback_on_writable_all_protocol(m_serviceParams.context, &m_protocols[1]);
-     if (result != 0) {
-         cerr << "Failed to request writable callback, error: " << result << endl;
-     } else {
-         printf("sendTextData: Requested writable callback for protocol: %s\n", m_protocols[1].name);
-     }
+/**
+ * Sends text data over the websocket.
+ * The message is serialized once and shared by every connected text client.
+ * 
+ * @param str The string data to send.
+ */
+void WebSystem::sendTextData(const string& str) {
+    if (sessionCount(false) == 0) {
+        return;
+    }
 
+    PacketPtr packet = acquirePacket(str.size());
+    memcpy(packet->payload(), str.data(), str.size());
+    sendPacket(std::move(packet), false);
 }
 
 /**
@@ -220,49 +590,534 @@ void WebSystem::sendTextData(const string& str) {
  * @param data The binary data to send as a vector of uint8_t.
  */
 void WebSystem::sendBinaryData(const vector<uint8_t>& data) {
-    lock_guard<mutex> lck(m_writeBufferBinaryMutex);
+    sendData(data);
+}
+
+/**
+ * Queues a filled packet to every client of a protocol.
+ * 
+ * @param packet Packet from acquirePacket(), ownership passes to the queues.
+ * @param binary True for ws-protocol-binary, false for ws-protocol-text.
+ */
+void WebSystem::sendPacket(PacketPtr&& packet, bool binary) {
+    if (!packet) {
+        return;
+    }
+
+    SessionSet& sessions = binary ? m_binarySessions : m_textSessions;
+    if (sessions.count.load(memory_order_relaxed) == 0) {
+        return;
+    }
+
+    if (packet->size() > MaxPacketByteLen) {
+        LOG_WARN("sendPacket: message of %zu bytes exceeds %zu, dropping", packet->size(), MaxPacketByteLen);
+        return;
+    }
+
+    enqueueAll(sessions, packet);
+}
+
+/**
+ * Queues text to a single text client.
+ * 
+ * @param sessionId Id of the target session.
+ * @param pData Text to send.
+ * @param len Length of the text.
+ */
+void WebSystem::sendTextTo(uint32_t sessionId, const char* pData, size_t len) {
+    sendTo(m_textSessions, sessionId, pData, len);
+}
+
+/**
+ * Queues binary data to a single binary client.
+ * 
+ * @param sessionId Id of the target session.
+ * @param pData Data to send.
+ * @param len Length of the data.
+ */
+void WebSystem::sendBinaryTo(uint32_t sessionId, const void* pData, size_t len) {
+    sendTo(m_binarySessions, sessionId, pData, len);
+}
+
+/**
+ * Queues a copy of data to one session of a protocol and wakes the service threads.
+ * 
+ * @param sessions Session list of the protocol.
+ * @param sessionId Id of the target session.
+ * @param pData Data to send.
+ * @param len Length of the data.
+ */
+void WebSystem::sendTo(SessionSet& sessions, uint32_t sessionId, const void* pData, size_t len) {
+    PacketPtr packet = acquirePacket(len);
+    memcpy(packet->payload(), pData, len);
+
+    {
+        shared_lock<shared_mutex> lck(m_sessionsMutex);
+        for (Session* pSession : sessions.sessions) {
+            if (pSession->id == sessionId) {
+                lock_guard<mutex> sessionLck(pSession->mutex);
+                if (!pSession->outbound.push(std::move(packet), m_queuePolicy)) {
+                    sessions.dropped.add();
+                }
+                break;
+            }
+        }
+    }
+
+    requestService();
+}
+
+/**
+ * Configures the outbound queue of sessions opened after this call.
+ * 
+ * @param depth Number of messages each session may hold.
+ * @param policy Overflow behavior once a session's queue is full.
+ */
+void WebSystem::setOutboundQueuePolicy(size_t depth, OverflowPolicy policy) {
+    unique_lock<shared_mutex> lck(m_sessionsMutex);
+    m_queueDepth = depth > 0 ? depth : 1;
+    m_queuePolicy = policy;
+}
+
+/**
+ * Returns the outbound queue statistics of every connected client.
+ * 
+ * @return vector<SessionStats> One entry per open session.
+ */
+vector<WebSystem::SessionStats> WebSystem::getSessionStats() {
+    vector<SessionStats> stats;
+    uint64_t nowNs = ThreadUtils::monotonicNs();
+    shared_lock<shared_mutex> lck(m_sessionsMutex);
+
+    for (const SessionSet* pSet : { &m_textSessions, &m_binarySessions }) {
+        for (Session* pSession : pSet->sessions) {
+            lock_guard<mutex> sessionLck(pSession->mutex);
+            stats.push_back({pSet->protocol, pSession->id, pSession->tsi, pSession->outbound.size(), pSession->sent,
+                pSession->sentBytes, pSession->outbound.dropped(), (nowNs - pSession->connectedNs) / 1000000});
+        }
+    }
+
+    return stats;
+}
+
+/**
+ * Queues a message to every session of a protocol and wakes the service threads.
+ * lws_write() builds the frame header in the packet's headroom, so the
+ * sessions of one service thread share a packet and every other service
+ * thread with sessions gets its own copy. Per session only the reference
+ * count changes. Concurrent broadcasts only share-lock the session list.
+ * 
+ * @param sessions Session list of the target protocol.
+ * @param message Packet to share between the sessions.
+ */
+void WebSystem::enqueueAll(SessionSet& sessions, const OutboundMessage& message) {
+    // Packet of each service thread, reused between broadcasts of this thread
+    thread_local vector<OutboundMessage> t_threadPackets;
+    t_threadPackets.resize(max<size_t>(m_serviceParams.size(), 1));
+    bool originalUsed = false;
+
+    {
+        shared_lock<shared_mutex> lck(m_sessionsMutex);
+        for (Session* pSession : sessions.sessions) {
+            size_t tsi = (size_t)pSession->tsi < t_threadPackets.size() ? (size_t)pSession->tsi : 0;
+            OutboundMessage& threadPacket = t_threadPackets[tsi];
+            if (!threadPacket) {
+                if (!originalUsed) {
+                    threadPacket = message;
+                    originalUsed = true;
+                } else {
+                    threadPacket = PacketPool::acquire(message->size());
+                    memcpy(threadPacket->payload(), message->payload(), message->size());
+                }
+            }
+
+            lock_guard<mutex> sessionLck(pSession->mutex);
+            OutboundMessage reference(threadPacket);
+            if (!pSession->outbound.push(std::move(reference), m_queuePolicy)) {
+                sessions.dropped.add();
+                LOG_WARN("WebSystem: outbound queue full, %llu messages dropped for this client",
+                    (unsigned long long)pSession->outbound.dropped());
+            }
+        }
+    }
+
+    for (OutboundMessage& threadPacket : t_threadPackets) {
+        threadPacket = OutboundMessage();
+    }
+
+    // Wake the service threads, each requests the writable callback for its sessions
+    requestService();
+}
+
+/**
+ * Constructs the session in the lws per-session user area and registers it.
+ * 
+ * @param sessions Session list of the protocol.
+ * @param wsi Pointer to the websocket instance.
+ * @param user Per-session user area allocated by lws.
+ */
+void WebSystem::openSession(SessionSet& sessions, lws* wsi, void* user) {
+    unique_lock<shared_mutex> lck(m_sessionsMutex);
+    Session* pSession = new (user) Session(wsi, m_queueDepth);
+    pSession->id = m_nextSessionId++;
+    pSession->tsi = lws_get_tsi(wsi);
+    pSession->connectedNs = ThreadUtils::monotonicNs();
+    sessions.sessions.push_back(pSession);
+    sessions.count.store(sessions.sessions.size(), memory_order_relaxed);
+    LOG_INFO("WebSystem: %s session %u opened on service thread %d, %zu connected", sessions.protocol,
+        pSession->id, pSession->tsi, sessions.sessions.size());
+}
+
+/**
+ * Unregisters the session and destroys it. The user area is freed by lws.
+ * 
+ * @param sessions Session list of the protocol.
+ * @param user Per-session user area allocated by lws.
+ */
+void WebSystem::closeSession(SessionSet& sessions, void* user) {
+    Session* pSession = static_cast<Session*>(user);
+    unique_lock<shared_mutex> lck(m_sessionsMutex);
+
+    for (auto it = sessions.sessions.begin(); it != sessions.sessions.end(); ++it) {
+        if (*it == pSession) {
+            sessions.sessions.erase(it);
+            sessions.count.store(sessions.sessions.size(), memory_order_relaxed);
+            LOG_INFO("WebSystem: %s session %u closed, %zu connected", sessions.protocol, pSession->id,
+                sessions.sessions.size());
+            pSession->~Session();
+            return;
+        }
+    }
+}
+
+/**
+ * Requests the writable callback for every session of one service thread
+ * with queued messages. lws_callback_on_writable() must be called on the
+ * thread owning the connection, so each thread only handles its own.
+ * 
+ * @param sessions Session list of the protocol.
+ * @param tsi Thread service index of the calling service thread.
+ */
+void WebSystem::requestWritable(SessionSet& sessions, int tsi) {
+    shared_lock<shared_mutex> lck(m_sessionsMutex);
+    for (Session* pSession : sessions.sessions) {
+        if (pSession->tsi != tsi) {
+            continue;
+        }
+        lock_guard<mutex> sessionLck(pSession->mutex);
+        if (!pSession->outbound.empty()) {
+            lws_callback_on_writable(pSession->wsi);
+        }
+    }
+}
+
+/**
+ * Writes the oldest queued message of a session as one websocket frame and
+ * asks for another writable callback if more messages are waiting.
+ * 
+ * @param wsi Pointer to the websocket instance.
+ * @param user Per-session user area.
+ * @param type LWS_WRITE_TEXT or LWS_WRITE_BINARY.
+ */
+void WebSystem::writeSession(lws* wsi, void* user, lws_write_protocol type) {
+    Session* pSession = static_cast<Session*>(user);
+    OutboundMessage message;
+    bool more = false;
+
+    {
+        lock_guard<mutex> lck(pSession->mutex);
+        if (!pSession->outbound.pop(message)) {
+            return;
+        }
+        more = !pSession->outbound.empty();
+        pSession->sent++;
+        pSession->sentBytes += message->size();
+    }
 
-    // Insert new data to the end due to LWS header
-    m_writeBufferBinary.insert(m_writeBufferBinary.end(), data.begin(), data.end());
+    // lws builds the frame header in the headroom in front of the payload;
+    // enqueueAll() gives every service thread its own packet for that
+    size_t len = message->size();
+    if (lws_write(wsi, message->payload(), len, type) < (int)len) {
+        LOG_WARN("WebSystem: lws_write failed for %zu bytes", len);
+    }
+
+    SessionSet& sessions = (type == LWS_WRITE_BINARY) ? m_binarySessions : m_textSessions;
+    sessions.messagesOut.add();
+    sessions.bytesOut.add(len);
 
-    // Service the writable callback for the binary protocol
-    lws_callback_on_writable_all_protocol(m_serviceParams.context, &m_protocols[2]);
+    if (more) {
+        lws_callback_on_writable(wsi);
+    }
 }
 
 /**
- * LWS callback for handling HTTP requests.
+ * LWS callback for handling HTTP requests on the callback mounts.
  * 
  * @param wsi Pointer to the websocket instance.
  * @param reason The callback reason or trigger.
- * @param user Pointer to user-defined data (unused here).
- * @param in Pointer to incoming data (unused here).
- * @param len Length of the incoming data (unused here).
- * @return int Always returns 0.
+ * @param user Per-request HttpSession.
+ * @param in URL below the mountpoint.
+ * @param len Length of the URL.
+ * @return int 0 to continue, -1 to close the connection.
  */
 int WebSystem::callbackHttp(lws* wsi, lws_callback_reasons reason, void* user, void* in, size_t len) {
-    const char* file_path = "index.html";
+    HttpSession* pSession = static_cast<HttpSession*>(user);
+
     switch(reason) {
-    case LWS_CALLBACK_HTTP:
-        printf("HTTP request callback triggered\n");
-        printf("Attempting to serve file: %s\n", file_path);
-        if (lws_serve_http_file(wsi, file_path, "text/html", NULL, 0) < 0) {
-            printf("Failed to serve %s\n", file_path);
-        } else {
-            printf("Successfully served %s\n", file_path);
+    case LWS_CALLBACK_HTTP_BIND_PROTOCOL:
+        if (pSession) {
+            new (pSession) HttpSession();
         }
         break;
+    case LWS_CALLBACK_HTTP_DROP_PROTOCOL:
+        if (pSession) {
+            pSession->~HttpSession();
+        }
+        break;
+    case LWS_CALLBACK_HTTP:
+        LOG_DEBUG("HTTP request for %s", std::string((const char*)in, len).c_str());
+        return pSession ? serveAsset(wsi, pSession) : -1;
+    case LWS_CALLBACK_HTTP_WRITEABLE:
+        return pSession ? writeAsset(wsi, pSession) : 0;
     default:
         break;
     }
     return 0;
 }
 
+/**
+ * Ends an HTTP transaction so the connection can be reused.
+ * 
+ * @param wsi Pointer to the websocket instance.
+ * @return int Callback result, -1 to close the connection.
+ */
+static int completeHttp(lws* wsi) {
+    return lws_http_transaction_completed(wsi) ? -1 : 0;
+}
+
+/**
+ * Answers a request for a static file from the asset cache: picks the
+ * smallest variant the client accepts, answers 304 if the client's copy is
+ * current, and otherwise sends the headers and starts writing the body.
+ * Files too large to cache are streamed from disk by lws. Mounts with a
+ * route handler are answered by serveContent() instead.
+ * 
+ * @param wsi Pointer to the websocket instance.
+ * @param pSession Per-request user area.
+ * @return int Callback result, -1 to close the connection.
+ */
+int WebSystem::serveAsset(lws* wsi, HttpSession* pSession) {
+    char uri[512];
+    if (lws_hdr_copy(wsi, uri, sizeof(uri), WSI_TOKEN_GET_URI) <= 0) {
+        lws_return_http_status(wsi, HTTP_STATUS_METHOD_NOT_ALLOWED, NULL);
+        return completeHttp(wsi);
+    }
+
+    // Longest mountpoint that is a whole-segment prefix of the path
+    std::string_view path(uri);
+    const StaticRoute* pRoute = nullptr;
+    for (const StaticRoute& route : m_staticRoutes) {
+        const std::string& mountpoint = route.mountpoint;
+        if (mountpoint == "/" || (path.compare(0, mountpoint.size(), mountpoint) == 0 &&
+            (path.size() == mountpoint.size() || path[mountpoint.size()] == '/'))) {
+            pRoute = &route;
+            break;
+        }
+    }
+
+    pSession->requestNs = ThreadUtils::monotonicNs();
+
+    std::shared_ptr<const AssetCache::Snapshot> pSnapshot = m_assets.snapshot();
+    const Asset* pAsset = nullptr;
+    if (pRoute) {
+        std::string_view relative = path.substr(pRoute->mountpoint == "/" ? 0 : pRoute->mountpoint.size());
+        while (!relative.empty() && relative.front() == '/') {
+            relative.remove_prefix(1);
+        }
+        if (relative.empty()) {
+            relative = pRoute->def;
+        }
+
+        if (pRoute->handler) {
+            return serveContent(wsi, pSession, *pRoute, relative);
+        }
+
+        if (pSnapshot) {
+            auto it = pSnapshot->find(std::string(relative));
+            if (it != pSnapshot->end()) {
+                pAsset = it->second.get();
+            }
+        }
+    }
+
+    if (!pAsset) {
+        LOG_DEBUG("HTTP %s not found", uri);
+        lws_return_http_status(wsi, HTTP_STATUS_NOT_FOUND, NULL);
+        return completeHttp(wsi);
+    }
+
+    if (!pAsset->cached) {
+        int n = lws_serve_http_file(wsi, pAsset->path.c_str(), pAsset->mimeType.c_str(), NULL, 0);
+        if (n < 0) {
+            LOG_WARN("Failed to serve %s", pAsset->path.c_str());
+            return -1;
+        }
+        return (n > 0) ? completeHttp(wsi) : 0;
+    }
+
+    char header[256];
+    AssetEncoding encoding = AssetEncoding::Identity;
+    if (lws_hdr_copy(wsi, header, sizeof(header), WSI_TOKEN_HTTP_ACCEPT_ENCODING) > 0) {
+        encoding = AssetCache::negotiate(*pAsset, header);
+    }
+
+    const std::string& etag = pAsset->etags[(size_t)encoding];
+    const std::string& body = pAsset->bodies[(size_t)encoding];
+    bool notModified = lws_hdr_copy(wsi, header, sizeof(header), WSI_TOKEN_HTTP_IF_NONE_MATCH) > 0 &&
+        (strstr(header, etag.c_str()) != nullptr || strcmp(header, "*") == 0);
+
+    unsigned char buffer[LWS_PRE + 1024];
+    unsigned char* pStart = buffer + LWS_PRE;
+    unsigned char* p = pStart;
+    unsigned char* pEnd = buffer + sizeof(buffer);
+
+    if (lws_add_http_common_headers(wsi, notModified ? HTTP_STATUS_NOT_MODIFIED : HTTP_STATUS_OK,
+            pAsset->mimeType.c_str(), notModified ? 0 : body.size(), &p, pEnd) ||
+        lws_add_http_header_by_name(wsi, (const unsigned char*)"etag:",
+            (const unsigned char*)etag.c_str(), (int)etag.size(), &p, pEnd) ||
+        lws_add_http_header_by_name(wsi, (const unsigned char*)"cache-control:",
+            (const unsigned char*)pAsset->cacheControl.c_str(), (int)pAsset->cacheControl.size(), &p, pEnd)) {
+        return -1;
+    }
+
+    // Caches must key compressed responses on the request's Accept-Encoding
+    if (!pAsset->bodies[(size_t)AssetEncoding::Gzip].empty() || !pAsset->bodies[(size_t)AssetEncoding::Brotli].empty()) {
+        if (lws_add_http_header_by_name(wsi, (const unsigned char*)"vary:",
+                (const unsigned char*)"Accept-Encoding", 15, &p, pEnd)) {
+            return -1;
+        }
+    }
+
+    const char* encodingName = AssetCache::encodingName(encoding);
+    if (encodingName && !notModified) {
+        if (lws_add_http_header_by_name(wsi, (const unsigned char*)"content-encoding:",
+                (const unsigned char*)encodingName, (int)strlen(encodingName), &p, pEnd)) {
+            return -1;
+        }
+    }
+
+    if (lws_finalize_write_http_header(wsi, pStart, &p, pEnd)) {
+        return -1;
+    }
+
+    if (notModified || body.empty()) {
+        return completeHttp(wsi);
+    }
+
+    pSession->owner = std::move(pSnapshot);
+    pSession->pBody = &body;
+    pSession->offset = 0;
+    lws_callback_on_writable(wsi);
+    return 0;
+}
+
+/**
+ * Answers a request on a mount with a route handler. The MIME type, unless
+ * the handler sets one, comes from the mount's extra_mimetypes by suffix.
+ * 
+ * @param wsi Pointer to the websocket instance.
+ * @param pSession Per-request user area.
+ * @param route Mount of the request.
+ * @param path Request path below the mountpoint.
+ * @return int Callback result, -1 to close the connection.
+ */
+int WebSystem::serveContent(lws* wsi, HttpSession* pSession, const StaticRoute& route, std::string_view path) {
+    HttpContent content;
+    if (!route.handler(path, content) || !content.body) {
+        LOG_DEBUG("HTTP %s%s not found", route.mountpoint.c_str(), std::string(path).c_str());
+        lws_return_http_status(wsi, HTTP_STATUS_NOT_FOUND, NULL);
+        return completeHttp(wsi);
+    }
+
+    if (content.mimeType.empty()) {
+        content.mimeType = "application/octet-stream";
+        for (const lws_protocol_vhost_options* pMime = route.pMimeTypes; pMime; pMime = pMime->next) {
+            size_t suffixLen = strlen(pMime->name);
+            if (path.size() >= suffixLen && path.compare(path.size() - suffixLen, suffixLen, pMime->name) == 0) {
+                content.mimeType = pMime->value;
+                break;
+            }
+        }
+    }
+
+    unsigned char buffer[LWS_PRE + 512];
+    unsigned char* pStart = buffer + LWS_PRE;
+    unsigned char* p = pStart;
+    unsigned char* pEnd = buffer + sizeof(buffer);
+
+    if (lws_add_http_common_headers(wsi, HTTP_STATUS_OK, content.mimeType.c_str(), content.body->size(), &p, pEnd) ||
+        lws_add_http_header_by_name(wsi, (const unsigned char*)"cache-control:",
+            (const unsigned char*)content.cacheControl, (int)strlen(content.cacheControl), &p, pEnd) ||
+        lws_finalize_write_http_header(wsi, pStart, &p, pEnd)) {
+        return -1;
+    }
+
+    if (content.body->empty()) {
+        return completeHttp(wsi);
+    }
+
+    pSession->pBody = content.body.get();
+    pSession->owner = std::move(content.body);
+    pSession->offset = 0;
+    pSession->firstByte = std::move(content.firstByte);
+    lws_callback_on_writable(wsi);
+    return 0;
+}
+
+/**
+ * Writes the next chunk of the body selected by serveAsset().
+ * 
+ * @param wsi Pointer to the websocket instance.
+ * @param pSession Per-request user area.
+ * @return int Callback result, -1 to close the connection.
+ */
+int WebSystem::writeAsset(lws* wsi, HttpSession* pSession) {
+    if (!pSession->pBody) {
+        return 0;
+    }
+
+    // lws needs LWS_PRE bytes of headroom it may write into, so copy out of the shared body
+    unsigned char buffer[LWS_PRE + HttpChunkLen];
+    const std::string& body = *pSession->pBody;
+    size_t len = std::min(body.size() - pSession->offset, HttpChunkLen);
+    bool final = (pSession->offset + len == body.size());
+    memcpy(buffer + LWS_PRE, body.data() + pSession->offset, len);
+
+    if (lws_write(wsi, buffer + LWS_PRE, len, final ? LWS_WRITE_HTTP_FINAL : LWS_WRITE_HTTP) != (int)len) {
+        return -1;
+    }
+    if (pSession->offset == 0 && pSession->firstByte) {
+        pSession->firstByte(ThreadUtils::monotonicNs() - pSession->requestNs);
+    }
+    pSession->offset += len;
+
+    if (!final) {
+        lws_callback_on_writable(wsi);
+        return 0;
+    }
+
+    pSession->pBody = nullptr;
+    pSession->owner.reset();
+    pSession->firstByte = nullptr;
+    return completeHttp(wsi);
+}
+
 /**
  * LWS callback for handling text protocol websocket communication.
  * 
  * @param wsi Pointer to the websocket instance.
  * @param reason The callback reason or trigger.
- * @param user Pointer to user-defined data (unused here).
+ * @param user Per-session user area holding the Session.
  * @param pDataIn Pointer to incoming data.
  * @param size Size of the incoming data.
  * @return int Always returns 0.
@@ -271,124 +1126,85 @@ int WebSystem::callbackWsProtocolText(lws* wsi, lws_callback_reasons reason, voi
     
     // Check if wsi is null
     if (wsi == nullptr) {
-        cerr << "Websocket instance is null" << endl;
+        LOG_ERROR("Websocket instance is null");
         return -1; 
     }
 
     // Verify context association
     if (lws_get_context(wsi) == nullptr) {
-        cerr << "Websocket instance is not associated with a valid context" << endl;
+        LOG_ERROR("Websocket instance is not associated with a valid context");
         return -1;
     }
 
     // Check protocol
     const struct lws_protocols* protocol = lws_get_protocol(wsi);
     if (protocol == nullptr || strcmp(protocol->name, "ws-protocol-text") != 0) {
-        cerr << "Websocket instance is using an unexpected protocol" << endl;
+        LOG_ERROR("Websocket instance is using an unexpected protocol");
         return -1; 
     }
 
-    printf("callbackWsProtocolText triggered with reason: %d\n", reason);
-
     switch(reason) {
     case LWS_CALLBACK_PROTOCOL_INIT:
     {
-        printf("LWS_CALLBACK_PROTOCOL_INIT triggered\n");
+        LOG_DEBUG("LWS_CALLBACK_PROTOCOL_INIT triggered");
         break;
     }
     case LWS_CALLBACK_ESTABLISHED:
     {
-        printf("LWS_CALLBACK_ESTABLISHED: Connection established for ws-protocol-text.\n");
-        m_webSocketEnabled.store(true);
-        printf("WebSocket readyState: OPEN\n");
+        openSession(m_textSessions, wsi, user);
         break;
     }
     case LWS_CALLBACK_CLOSED:
     {
-        printf("WebSystem: Connection closed for ws-protocol-text.\n");
-        m_webSocketEnabled.store(false);
-        printf("WebSocket readyState: CLOSED\n");
+        closeSession(m_textSessions, user);
         break;
     }   
     case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
     {
-        printf("LWS_CALLBACK_EVENT_WAIT_CANCELLED triggered\n");
+        onServiceWake(wsi);
+        requestWritable(m_textSessions, lws_get_tsi(wsi));
         break;
     }
     case LWS_CALLBACK_SERVER_WRITEABLE:
     {
-        printf("LWS_CALLBACK_SERVER_WRITEABLE triggered\n");
-        lock_guard<mutex> lck(m_writeBufferTextMutex);
-        size_t len = m_writeBufferText.size() - LWS_PRE;
-
-        printf("Write buffer length: %zu\n", len);
-
-        if(len == 0) {
-            printf("No data to write\n");
-            return 0;
-        }
-
-        if (len <= MaxPacketByteLen) {
-            printf("Writing data to websocket\n");
-            lws_write(wsi, (uint8_t*)m_writeBufferText.data() + LWS_PRE, len, LWS_WRITE_TEXT);
-        } else {
-            printf("WebSystem: write buffer is too large. %d\n", (int)len);
-        }
-
-        m_writeBufferText.clear();
-        m_writeBufferText.resize(LWS_PRE);
-
+        writeSession(wsi, user, LWS_WRITE_TEXT);
         break;
     }
     case LWS_CALLBACK_RECEIVE:
     {
-        printf("WebSystem: LWS_CALLBACK_RECEIVE triggered\n");
-        printf("WebSystem: Received data size: %zu\n", size);
-
         if (size > MaxPacketByteLen) {
-            printf("WebSystem: received message too large\n");
+            LOG_WARN("WebSystem: received message too large, %zu bytes", size);
         }
 
         if(size == 0) {
-            printf("WebSystem: No data received\n");
             return 0;
         }
 
-        lock_guard<mutex> lck(m_readBufferTextMutex);
-
-        uint8_t* pData = static_cast<uint8_t*>(pDataIn);
-        string receivedData(pData, pData + size);
-        m_readBufferText += receivedData;
+        m_textSessions.bytesIn.add(size);
+        if (lws_is_final_fragment(wsi)) {
+            m_textSessions.messagesIn.add();
+        }
 
-        printf("Received data: %s\n", receivedData.c_str());
+        const char* pData = static_cast<const char*>(pDataIn);
+        LOG_DEBUG("WebSystem: Received %zu bytes", size);
 
-        try {
-            m_commandData = json::parse(receivedData);  // Store the parsed JSON
-            if (m_commandData.contains("command")) {
-                string command = m_commandData["command"];
-                auto it = m_commandCallbacks.find(command);
-                if (it != m_commandCallbacks.end()) {
-                    printf("Executing callback for command: %s\n", command.c_str());
-                    it->second();
-                }
-            }
-        } catch (const json::parse_error& e) {
-            cerr << "Failed to parse JSON: " << e.what() << endl;
-        }
+        // Validate and queue only, the control thread runs the handler
+        enqueueCommand(wsi, user, pData, size);
 
 #ifdef TEST_MODE
         // Echo the received message back
         {
-            lock_guard<mutex> lck(m_writeBufferTextMutex);
-            m_writeBufferText += receivedData;
-            printf("Echoing back received message\n");
+            Session* pSession = static_cast<Session*>(user);
+            lock_guard<mutex> sessionLck(pSession->mutex);
+            PacketPtr echo = acquirePacket(size);
+            memcpy(echo->payload(), pData, size);
+            pSession->outbound.push(std::move(echo), m_queuePolicy);
             lws_callback_on_writable(wsi);
         }
 #endif
         break;
     }
     default:
-        printf("Unhandled callback reason: %d\n", reason);
         break;
     }
 
@@ -400,72 +1216,49 @@ int WebSystem::callbackWsProtocolText(lws* wsi, lws_callback_reasons reason, voi
  * 
  * @param wsi Pointer to the websocket instance.
  * @param reason The callback reason or trigger.
- * @param user Pointer to user-defined data (unused here).
+ * @param user Per-session user area holding the Session.
  * @param pDataIn Pointer to incoming data.
  * @param size Size of the incoming data.
  * @return int Always returns 0.
  */
 int WebSystem::callbackWsProtocolBinary(lws* wsi, lws_callback_reasons reason, void* user, void* pDataIn, size_t size) {
-    WebSystem* pWebSystem = static_cast<WebSystem*>(user);
-
-    printf("callbackWsProtocolBinary triggered with reason: %d\n", reason);
-
     switch( reason ) {
     case LWS_CALLBACK_ESTABLISHED:
     {
-        printf("LWS_CALLBACK_ESTABLISHED: Connection established for ws-protocol-binary.\n");
-        m_webSocketEnabled.store(true);
-        printf("WebSocket readyState: OPEN\n");
+        openSession(m_binarySessions, wsi, user);
         break;
     }
     case LWS_CALLBACK_CLOSED:
     {
-        printf("Connection closed for protocol: %s\n", pWebSystem->m_protocols[2].name);
-        pWebSystem->m_webSocketEnabled.store(false);
+        uint32_t sessionId = static_cast<Session*>(user)->id;
+        closeSession(m_binarySessions, user);
+        if (m_binaryCloseHandler) {
+            m_binaryCloseHandler(sessionId);
+        }
         break;
     }   
     case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
     {
-        printf("LWS_CALLBACK_EVENT_WAIT_CANCELLED triggered\n");
+        onServiceWake(wsi);
+        resumePausedSessions(lws_get_tsi(wsi));
+        requestWritable(m_binarySessions, lws_get_tsi(wsi));
         break;
     }
     case LWS_CALLBACK_SERVER_WRITEABLE:
     {
-        lock_guard<mutex> lck(pWebSystem->m_writeBufferBinaryMutex);
-        size_t len = pWebSystem->m_writeBufferBinary.size() - LWS_PRE;
-
-        if(len == 0)
-            return 0;
-
-        if (len <= MaxPacketByteLen)
-        {
-            lws_write(wsi, pWebSystem->m_writeBufferBinary.data() + LWS_PRE, len, LWS_WRITE_BINARY);
-        }
-        else
-        {
-            printf( "WebSystem: write buffer is too large. %d\n", (int)len);
-        }
-
-        pWebSystem->m_writeBufferBinary.clear();
-        pWebSystem->m_writeBufferBinary.resize(LWS_PRE);
-
+        writeSession(wsi, user, LWS_WRITE_BINARY);
         break;
     }
     case LWS_CALLBACK_RECEIVE:
     {
-        if (size > MaxPacketByteLen)
-        {
-            printf( "WebSystem: receive binary too large");
-        }
-
         if(size == 0)
             return 0;
 
-        lock_guard<mutex> lck(pWebSystem->m_readBufferBinaryMutex);
-
-        uint8_t* pData = static_cast<uint8_t*>(pDataIn);
-        pWebSystem->m_readBufferBinary.insert(pWebSystem->m_readBufferBinary.end(), pData, pData+size);
-
+        m_binarySessions.bytesIn.add(size);
+        if (lws_is_final_fragment(wsi)) {
+            m_binarySessions.messagesIn.add();
+        }
+        receiveBinary(wsi, static_cast<Session*>(user), static_cast<const uint8_t*>(pDataIn), size);
         break;
     }
     default:
@@ -475,6 +1268,109 @@ int WebSystem::callbackWsProtocolBinary(lws* wsi, lws_callback_reasons reason, v
     return 0;
 }
 
-WebSystem::ServiceParams_t& WebSystem::getServiceParams() {
+/**
+ * Reassembles a binary message from the fragments lws delivers and hands it
+ * to the frame handler, or to the command queue if it is a command. The message is built in one pooled packet, so
+ * receiving does not allocate and memory per client is bounded by
+ * MaxBinaryFrameLen. If the handler asks for backpressure, lws stops reading
+ * from the socket until the session is resumed.
+ * 
+ * @param wsi Pointer to the websocket instance.
+ * @param pSession Session that received the fragment.
+ * @param pData Received fragment.
+ * @param size Size of the fragment.
+ */
+void WebSystem::receiveBinary(lws* wsi, Session* pSession, const uint8_t* pData, size_t size) {
+    bool first = lws_is_first_fragment(wsi);
+
+    // Commands arrive unfragmented; decode them from the receive buffer
+    if (first && lws_is_final_fragment(wsi) && isBinaryCommand(pData, size)) {
+        enqueueBinaryCommand(pSession->id, pData, size);
+        return;
+    }
+
+    if (first) {
+        pSession->rxFrame = acquirePacket(MaxBinaryFrameLen);
+        pSession->rxFrame->resize(0);
+        pSession->rxOverflow = false;
+    }
+
+    if (!pSession->rxFrame) {
+        return;
+    }
+
+    size_t used = pSession->rxFrame->size();
+    if (!pSession->rxOverflow && used + size <= MaxBinaryFrameLen) {
+        memcpy(pSession->rxFrame->payload() + used, pData, size);
+        pSession->rxFrame->resize(used + size);
+    } else if (!pSession->rxOverflow) {
+        LOG_WARN("WebSystem: binary message exceeds %zu bytes, dropping", MaxBinaryFrameLen);
+        pSession->rxOverflow = true;
+    }
+
+    if (!lws_is_final_fragment(wsi)) {
+        return;
+    }
+
+    PacketPtr frame = std::move(pSession->rxFrame);
+    if (pSession->rxOverflow) {
+        return;
+    }
+
+    if (isBinaryCommand(frame->payload(), frame->size())) {
+        enqueueBinaryCommand(pSession->id, frame->payload(), frame->size());
+        return;
+    }
+
+    if (!m_binaryFrameHandler) {
+        LOG_DEBUG("WebSystem: no binary handler, dropping %zu bytes", frame->size());
+        return;
+    }
+
+    if (!m_binaryFrameHandler(pSession->id, std::move(frame)) && !pSession->rxPaused) {
+        pSession->rxPaused = true;
+        lws_rx_flow_control(wsi, 0);
+    }
+}
+
+/**
+ * Marks a paused binary session for resuming and wakes the service threads;
+ * the one owning the session re-enables receiving. lws_rx_flow_control()
+ * must only be called on that thread.
+ * 
+ * @param sessionId Id of the session to resume.
+ */
+void WebSystem::resumeBinaryReceive(uint32_t sessionId) {
+    {
+        shared_lock<shared_mutex> lck(m_sessionsMutex);
+        for (Session* pSession : m_binarySessions.sessions) {
+            if (pSession->id == sessionId) {
+                pSession->rxResume.store(true);
+                break;
+            }
+        }
+    }
+
+    requestService();
+}
+
+/**
+ * Re-enables receiving for binary sessions resumed since the last wakeup.
+ * Runs on the service thread owning the sessions, after any RECEIVE that
+ * paused them.
+ * 
+ * @param tsi Thread service index of the calling service thread.
+ */
+void WebSystem::resumePausedSessions(int tsi) {
+    shared_lock<shared_mutex> lck(m_sessionsMutex);
+    for (Session* pSession : m_binarySessions.sessions) {
+        if (pSession->tsi == tsi && pSession->rxResume.exchange(false) && pSession->rxPaused) {
+            pSession->rxPaused = false;
+            lws_rx_flow_control(pSession->wsi, 1);
+        }
+    }
+}
+
+vector<WebSystem::ServiceParams_t>& WebSystem::getServiceParams() {
     return m_serviceParams;
 }
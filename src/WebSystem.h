@@ -1,7 +1,8 @@
 /**
-* Low-level server functionality. Initializes server and thread, handles callbacks,
-* sends and receives data via the websocket. All of this is handled in a thread
-* separate from the main application thread.
+* Low-level server functionality. Initializes server and threads, handles callbacks,
+* sends and receives data via the websocket. All of this is handled in service
+* threads separate from the main application thread, one lws service loop per
+* thread, each owning the connections lws assigned to it.
 * 
 */
 
@@ -10,55 +11,55 @@
 #include <libwebsockets.h>
 #include <pthread.h>
 #include <mutex>
+#include <shared_mutex>
 #include <vector>
 #include <string.h>
 #include <functional> 
 #include <atomic>
+#include <memory>
+#include <string_view>
 #include <unordered_map>
 #include <map>
 #include <nlohmann/json.hpp>
+#include "MessageRing.h"
+#include "PacketPool.h"
+#include "CommandRegistry.h"
+#include "BinaryProtocol.h"
+#include "CommandQueue.h"
+#include "AssetCache.h"
+#include "Metrics.h"
 
 using json = nlohmann::json;
 
+//! Wake-to-dispatch latency of the service threads, in nanoseconds.
+//! Measured from the first requestService() until the first service thread
+//! handles LWS_CALLBACK_EVENT_WAIT_CANCELLED.
+struct ServiceWakeStats {
+    std::atomic<uint64_t> count{0};                         //! Number of wakeups serviced
+    std::atomic<uint64_t> totalNs{0};                       //! Sum of wake latencies
+    std::atomic<uint64_t> maxNs{0};                         //! Worst wake latency
+};
+
+//! Response produced by an HTTP route handler
+struct HttpContent {
+    std::shared_ptr<const std::string>  body;               //! Sent as is, kept alive until written
+    std::string                         mimeType;           //! Empty to look it up in the mount's extra_mimetypes
+    const char*                         cacheControl = "no-cache";
+    std::function<void(uint64_t)>       firstByte;          //! Optional, told the request-to-first-body-byte time in ns
+};
+
+//! Answers a request below a mountpoint. path is relative to the mountpoint,
+//! without a leading '/'. Returns false for 404. Runs on a service thread.
+typedef std::function<bool(std::string_view path, HttpContent& content)> HttpRouteHandler;
+
 class WebSystem
 {
 protected:
     //! Child provides a service routine to run in the main loop in the application
     virtual void service() = 0;
 
-    int initialize(std::string name, int port, unsigned core, const lws_http_mount* mount);
-
-    //! RAII process for the service routine to get string commands.
-    //! For use in the service routine to read the commands from the ws.
-    //! Create object in service() routine to lock/read/unlock command buffer.
-    struct Reader {
-        Reader() {
-            m_readBufferTextMutex.lock();
-        }
-        ~Reader() {
-            m_readBufferText.clear();
-            m_readBufferTextMutex.unlock();
-        }
-        const std::string& Commands(void) {
-            return m_readBufferText;
-        }
-    };  
-
-    //! RAII process for the service routine to get binary data.
-    //! For use in the service routine to read the binary data from the ws.
-    //! Create object in service() routine to lock/read/unlock binary buffer.
-    struct BinaryReader {
-        BinaryReader() {
-            m_readBufferBinaryMutex.lock();
-        }
-        ~BinaryReader() {
-            m_readBufferBinary.clear();
-            m_readBufferBinaryMutex.unlock();
-        }
-        const std::vector<uint8_t>& Data(void) {
-            return m_readBufferBinary;
-        }
-    };
+    int initialize(std::string name, int port, std::vector<unsigned> serviceCores, unsigned controlCore,
+        const lws_http_mount* mount);
 
     static int callbackHttp(lws *wsi, lws_callback_reasons reason,
         void* user, void* data, size_t dataLen);
@@ -70,45 +71,225 @@ protected:
         void* user, void* data, size_t dataLen);
 
     //! Stream binary data to web socket
-    //! Allows for any data type to be streamed to the websocket
+    //! Allows for any data type to be streamed to the websocket.
+    //! The data is copied once into a pooled packet shared by all clients.
     template <class T>
     void sendData(const std::vector<T>& data)
     {
-        size_t len = data.size();
-        size_t dataSize = sizeof(T);
-        uint8_t* pData = (uint8_t*)data.data();
+        if (sessionCount(true) == 0) {
+            return;
+        }
+        size_t byteLen = data.size() * sizeof(T);
+        PacketPtr packet = acquirePacket(byteLen);
+        memcpy(packet->payload(), data.data(), byteLen);
+        sendPacket(std::move(packet), true);
+    }
+
+    //! Zero-copy variant of sendData: the producer writes count elements of T
+    //! in place through pData, then hands the packet over with sendPacket().
+    template <class T>
+    PacketPtr acquireData(size_t count, T*& pData)
+    {
+        PacketPtr packet = acquirePacket(count * sizeof(T));
+        pData = packet->as<T>();
+        return packet;
+    }
 
-        std::vector<uint8_t> rawData(pData, pData + len * dataSize);
-        sendBinaryData(rawData);
+    //! Get a pooled packet with LWS_PRE headroom for payloadLen bytes
+    static PacketPtr acquirePacket(size_t payloadLen) { return PacketPool::acquire(payloadLen); }
+
+    //! Queue a filled packet to every client of the binary or text protocol.
+    //! Ownership passes to the socket layer; the payload is not copied.
+    void sendPacket(PacketPtr&& packet, bool binary);
+
+    //! Clients connected to the binary or text protocol, without locking.
+    //! Producers can skip building a message nobody would receive.
+    static size_t sessionCount(bool binary) {
+        return (binary ? m_binarySessions : m_textSessions).count.load(std::memory_order_relaxed);
     }
 
     void sendBinaryData(const std::vector<uint8_t>& data);
     void sendTextData(const std::string& str);
 
-    static const size_t            MaxPacketByteLen = 200000;      //! Max size of packet supported
-    static std::atomic<bool>       m_webSocketEnabled;             //! Atomic boolean to check if websocket is enabled
+    //! Queue text to a single client, e.g. a command acknowledgement
+    static void sendTextTo(uint32_t sessionId, const char* pData, size_t len);
+
+    //! Session that sent the command whose handler is running. Only valid in
+    //! a command handler, which runs on the control thread.
+    static uint32_t commandSessionId() { return m_commandSessionId; }
 
-    // Generic command callback map
-    inline static std::unordered_map<std::string, std::function<void()>> m_commandCallbacks;
+    //! Queue binary data to a single client, e.g. an upload acknowledgement
+    static void sendBinaryTo(uint32_t sessionId, const void* pData, size_t len);
 
-    static void registerCommandCallback(const std::string& command, std::function<void()> callback) {
-        m_commandCallbacks[command] = std::move(callback);
+    //! Receives each complete ws-protocol-binary message on the service thread of the session.
+    //! Returning false pauses receiving from that client until resumeBinaryReceive().
+    typedef std::function<bool(uint32_t sessionId, PacketPtr&& frame)> BinaryFrameHandler;
+    //! Told when a ws-protocol-binary client disconnects
+    typedef std::function<void(uint32_t sessionId)> BinaryCloseHandler;
+
+    static void setBinaryHandlers(BinaryFrameHandler frameHandler, BinaryCloseHandler closeHandler) {
+        m_binaryFrameHandler = std::move(frameHandler);
+        m_binaryCloseHandler = std::move(closeHandler);
     }
 
-    static void clearCommandCallbacks() {
-        m_commandCallbacks.clear();
+    //! Let a paused binary client send again. Safe to call from any thread.
+    static void resumeBinaryReceive(uint32_t sessionId);
+
+    //! Wake the service threads from any thread so pending writes are dispatched
+    static void requestService();
+
+    //! Serve the files below root from memory on mounts with origin_protocol
+    //! LWSMPRO_CALLBACK and origin "http". Call before initialize().
+    static bool startAssetCache(const std::string& root, std::vector<unsigned> cores) {
+        return m_assets.start(root, cores);
     }
 
-    void setCommandCallback(const std::string& command, std::function<void()> callback) {
-        m_commandCallbacks[command] = callback;
+    static const AssetCacheStats& getAssetCacheStats() { return m_assets.getStats(); }
+
+    //! Answer a LWSMPRO_CALLBACK mount with origin "http" from handler instead
+    //! of the asset cache. Call before initialize().
+    static void addHttpRoute(const std::string& mountpoint, HttpRouteHandler handler) {
+        m_httpHandlers[mountpoint] = std::move(handler);
     }
 
-    inline static json m_commandData;
-    const json& getCommandData() const { return m_commandData; }
+    static constexpr size_t        MaxPacketByteLen = 200000;      //! Max size of packet supported
+    static constexpr size_t        MaxBinaryFrameLen = 65536;      //! Max size of a received binary message
+
+    // Command registry, names are resolved to ids once at registration
+    inline static CommandRegistry m_commands;
+
+    //! Register a handler receiving its own decoded payload of type T
+    template <class T>
+    static CommandId registerCommand(const std::string& command, std::function<void(const T&)> handler) {
+        return m_commands.add<T>(command, std::move(handler));
+    }
+
+    static void clearCommandCallbacks() {
+        m_commands.clear();
+    }
 
 private:
+    //! Drives the session and command paths without a server, see bench/
+    friend class WebSystemBench;
 
-    //! Service thread that will check for lws services
+    //! Outbound message, shared by every session it is queued to
+    typedef PacketPtr OutboundMessage;
+
+    //! Per-session user area of the websocket protocols.
+    //! Constructed in LWS_CALLBACK_ESTABLISHED, destroyed in LWS_CALLBACK_CLOSED.
+    struct Session {
+        Session(lws* wsi, size_t depth) : wsi(wsi), outbound(depth) {}
+
+        lws*                         wsi;                   //! Connection owning this session
+        uint32_t                     id = 0;                //! Unique id, used to address replies
+        int                          tsi = 0;               //! Service thread owning the connection
+        std::mutex                   mutex;                 //! Guards the outbound ring
+        MessageRing<OutboundMessage> outbound;              //! Messages waiting for SERVER_WRITEABLE
+        uint64_t                     sent = 0;              //! Messages written to the socket
+        uint64_t                     sentBytes = 0;         //! Payload bytes written to the socket
+        uint64_t                     connectedNs = 0;       //! Time the connection was established
+
+        // Binary receive state, owning service thread only except rxResume
+        PacketPtr                    rxFrame;               //! Message being reassembled from fragments
+        bool                         rxOverflow = false;    //! Current message exceeds MaxBinaryFrameLen
+        bool                         rxPaused = false;      //! lws_rx_flow_control() disabled receiving
+        std::atomic<bool>            rxResume{false};       //! Set by resumeBinaryReceive()
+    };
+
+    //! Open sessions of one websocket protocol and its traffic metrics
+    struct SessionSet {
+        explicit SessionSet(const char* protocol);
+
+        const char*                  protocol;              //! Protocol name
+        std::vector<Session*>        sessions;              //! Guarded by m_sessionsMutex
+        std::atomic<size_t>          count{0};              //! Size of sessions, read without the lock
+        Counter&                     messagesIn;            //! Complete messages received
+        Counter&                     bytesIn;               //! Payload bytes received
+        Counter&                     messagesOut;           //! Messages written to the sockets
+        Counter&                     bytesOut;              //! Payload bytes written to the sockets
+        Counter&                     dropped;               //! Messages lost to full outbound queues
+    };
+
+    //! Per-request user area of the http protocol.
+    //! Constructed in LWS_CALLBACK_HTTP_BIND_PROTOCOL, destroyed in LWS_CALLBACK_HTTP_DROP_PROTOCOL.
+    struct HttpSession {
+        std::shared_ptr<const void>  owner;                 //! Keeps the body alive while it is sent
+        const std::string*           pBody = nullptr;       //! Body being sent, nullptr if none
+        size_t                       offset = 0;            //! Bytes of the body sent so far
+        uint64_t                     requestNs = 0;         //! Time the request arrived
+        std::function<void(uint64_t)> firstByte;            //! HttpContent::firstByte of the body
+    };
+
+    //! Mount answered by callbackHttp
+    struct StaticRoute {
+        std::string                  mountpoint;            //! URL prefix, e.g. "/superuser"
+        std::string                  def;                   //! File served for the mountpoint itself
+        HttpRouteHandler             handler;               //! Answers the mount, empty for the asset cache
+        const lws_protocol_vhost_options* pMimeTypes;       //! extra_mimetypes of the mount
+    };
+
+    static constexpr size_t        HttpChunkLen = 16384;        //! Body bytes written per writable callback
+
+    //! Answer a GET from the asset cache or the route's handler
+    static int serveAsset(lws* wsi, HttpSession* pSession);
+
+    //! Answer a GET from a route handler
+    static int serveContent(lws* wsi, HttpSession* pSession, const StaticRoute& route, std::string_view path);
+
+    //! Send the next chunk of a cached body
+    static int writeAsset(lws* wsi, HttpSession* pSession);
+
+    //! Queue a copy of data to one session of a protocol
+    static void sendTo(SessionSet& sessions, uint32_t sessionId, const void* pData, size_t len);
+
+    //! Reassemble a binary message and hand it to the frame handler
+    static void receiveBinary(lws* wsi, Session* pSession, const uint8_t* pData, size_t size);
+
+    //! Re-enable receiving for paused sessions of service thread tsi that were resumed
+    static void resumePausedSessions(int tsi);
+
+    //! Queue a message to every session of a protocol and wake the service threads
+    void enqueueAll(SessionSet& sessions, const OutboundMessage& message);
+
+    //! Session lifecycle and writable handling shared by the websocket protocols
+    static void openSession(SessionSet& sessions, lws* wsi, void* user);
+    static void closeSession(SessionSet& sessions, void* user);
+    static void requestWritable(SessionSet& sessions, int tsi);
+    static void writeSession(lws* wsi, void* user, lws_write_protocol type);
+
+    //! Called on each service thread when lws_cancel_service() wakes it up
+    static void onServiceWake(lws* wsi);
+
+    //! Control thread that runs the queued command handlers
+    //! \params void* args for the ControlParams_t
+    static void* controlThread(void* arg);
+    struct ControlParams_t
+    {
+        volatile bool exit = false;                         //! Signal thread to exit
+        volatile bool exited = false;                       //! Thread indicates it has exited
+    };
+
+    //! Run the handler of a dequeued command and acknowledge it, control thread only
+    static void runCommand(const QueuedCommand* pCommand);
+
+    //! Validate a received command and queue it for the control thread
+    static void enqueueCommand(lws* wsi, void* user, const char* pData, size_t size);
+
+    //! True if a binary message is a BinaryProtocol command rather than an upload frame
+    static bool isBinaryCommand(const uint8_t* pData, size_t size);
+
+    //! Decode a binary command straight into a queue slot
+    static void enqueueBinaryCommand(uint32_t sessionId, const uint8_t* pData, size_t size);
+
+    //! Reply to a command; status is "ok", "busy", "invalid" or "unknown"
+    static void sendAck(uint32_t sessionId, const char* command, uint32_t sequence,
+        const char* status, uint64_t queueNs);
+
+    //! Reply to a binary command with a BinaryProtocol::CommandAck
+    static void sendBinaryAck(uint32_t sessionId, uint8_t opcode, uint32_t sequence,
+        BinaryProtocol::CommandStatus status, uint64_t queueNs);
+
+    //! Service thread running the lws service loop of one thread service index
     //! \params void* args for the ServiceParams_t
     static void* serviceThread(void* arg);
     struct ServiceParams_t
@@ -116,21 +297,37 @@ private:
         volatile bool exit = false;                         //! Signal thread to exit
         volatile bool exited = false;                       //! Thread indicates it has exited
         lws_context*  context = nullptr;                    //! LWS context
+        int           tsi = 0;                              //! lws thread service index
+        Histogram*    pIterationTime = nullptr;             //! Duration of each lws_service_tsi() call
     };
 
-    ServiceParams_t         m_serviceParams;                //! Parameters for service thread
-    pthread_t               m_serviceThread;                //! Service thread to services the lws
+    lws_context*            m_context;                      //! LWS context shared by the service threads
+    std::vector<ServiceParams_t> m_serviceParams;           //! Parameters for each service thread
+    std::vector<pthread_t>  m_serviceThreads;               //! Service threads, indexed by tsi
+    ControlParams_t         m_controlParams;                //! Parameters for control thread
+    pthread_t               m_controlThread;                //! Control thread running command handlers
     const lws_protocols     m_protocols[4];                 //! Protocols supported
 
-    inline static std::mutex   m_readBufferTextMutex;       //! Data mutex for incoming requests
-    inline static std::string  m_readBufferText;            //! Text input buffer
-    inline static std::mutex   m_writeBufferTextMutex;      //! Data mutex for outgoing requests
-    inline static std::string  m_writeBufferText;           //! Write buffer for lws callback text protocol
+    inline static BinaryFrameHandler m_binaryFrameHandler;  //! Consumer of received binary messages
+    inline static BinaryCloseHandler m_binaryCloseHandler;  //! Told about closed binary sessions
+
+    inline static std::shared_mutex m_sessionsMutex;        //! Guards the session lists, shared by broadcasts
+    inline static SessionSet   m_textSessions{"ws-protocol-text"};     //! Open ws-protocol-text sessions
+    inline static SessionSet   m_binarySessions{"ws-protocol-binary"}; //! Open ws-protocol-binary sessions
+    inline static size_t       m_queueDepth = 64;           //! Outbound messages per session
+    inline static OverflowPolicy m_queuePolicy = OverflowPolicy::DropOldest; //! Outbound overflow behavior
+    inline static uint32_t     m_nextSessionId = 1;         //! Id of the next session, guarded by m_sessionsMutex
+
+    inline static CommandQueue m_commandQueue;              //! Commands waiting for the control thread
+    inline static uint32_t     m_commandSessionId = 0;      //! Sender of the running command, control thread only
 
-    inline static std::mutex   m_readBufferBinaryMutex;     //! Read binary buffer mutex
-    inline static std::vector<uint8_t> m_readBufferBinary;  //! Read binary buffer
-    inline static std::mutex   m_writeBufferBinaryMutex;    //! Data mutex for outgoing binary requests
-    inline static std::vector<uint8_t> m_writeBufferBinary; //! Write buffer for lws callback binary protocol
+    inline static AssetCache   m_assets;                    //! Static web files held in memory
+    inline static std::vector<StaticRoute> m_staticRoutes;  //! Callback mounts, longest mountpoint first
+    inline static std::map<std::string, HttpRouteHandler> m_httpHandlers; //! Handlers by mountpoint
+
+    inline static lws_context* m_pServiceContext = nullptr;  //! Context woken by requestService()
+    inline static std::atomic<uint64_t> m_wakeRequestNs{0}; //! Time of the oldest unserviced wake request, 0 if none
+    inline static ServiceWakeStats m_wakeStats;             //! Wake-to-dispatch latency of the service threads
 
     std::string m_applicationName;                          //! Name of the application
     
@@ -140,8 +337,32 @@ public:
 
     virtual ~WebSystem();
 
-    lws_context* contextPtr() { return m_serviceParams.context; }
+    lws_context* contextPtr() { return m_context; }
     
-    ServiceParams_t& getServiceParams();
+    std::vector<ServiceParams_t>& getServiceParams();
+
+    const ServiceWakeStats& getWakeStats() const { return m_wakeStats; }
+
+    //! Depth and queueing delay of the command queue
+    const CommandQueueStats& getCommandQueueStats() const { return m_commandQueue.stats(); }
+    size_t getCommandQueueDepth() const { return m_commandQueue.depth(); }
+
+    //! Configure the outbound queue of sessions opened after this call
+    //! \param depth Number of messages each session may hold
+    //! \param policy Overflow behavior once a session's queue is full
+    static void setOutboundQueuePolicy(size_t depth, OverflowPolicy policy);
+
+    //! Outbound queue statistics of one connected client
+    struct SessionStats {
+        std::string protocol;                               //! Protocol name of the session
+        uint32_t    id;                                     //! Session id
+        int         serviceThread;                          //! Index of the service thread owning it
+        size_t      queued;                                 //! Messages waiting to be written
+        uint64_t    sent;                                   //! Messages written to the socket
+        uint64_t    sentBytes;                              //! Payload bytes written to the socket
+        uint64_t    dropped;                                //! Messages lost to queue overflow
+        uint64_t    connectedMs;                            //! Time since the connection was established
+    };
+    static std::vector<SessionStats> getSessionStats();
 };
 
@@ -19,6 +19,33 @@ Settings::Settings(const std::string& filePath) {
     i >> j;
 
     serverSettings.port = j["Server"]["port"].get<int>();
+    serverSettings.outboundQueueDepth = j["Server"].value("outboundQueueDepth", 64);
+    serverSettings.outboundQueuePolicy = j["Server"].value("outboundQueuePolicy", "drop-oldest");
+    serverSettings.logLevel = j["Server"].value("logLevel", "info");
+    serverSettings.serviceCores = j["Server"].value("serviceCores", std::vector<unsigned>{0});
+    serverSettings.controlCore = j["Server"].value("controlCore", 1u);
+
+    // Upload, optional
+    json upload = j.value("Upload", json::object());
+    uploadSettings.directory = upload.value("directory", "/var/lib/jetson-embeddedUI/uploads");
+    uploadSettings.maxFileSize = upload.value("maxFileSize", (uint64_t)1 << 30);
+
+    // Telemetry, optional
+    json telemetry = j.value("Telemetry", json::object());
+    telemetrySettings.rateHz = telemetry.value("rateHz", 10u);
+    telemetrySettings.keyframeIntervalMs = telemetry.value("keyframeIntervalMs", 1000u);
+
+    // Stream, optional
+    json stream = j.value("Stream", json::object());
+    streamSettings.enabled = stream.value("enabled", false);
+    streamSettings.input = stream.value("input", "udp://192.168.10.10:1234");
+
+    // Hardware, optional
+    json hardware = j.value("Hardware", json::object());
+    hardwareSettings.backend = hardware.value("backend", "sysfs");
+    hardwareSettings.pwmBaseDir = hardware.value("pwmBaseDir", "/sys/class/pwm");
+    hardwareSettings.gpioBaseDir = hardware.value("gpioBaseDir", "/sys/class/gpio");
+    hardwareSettings.gpioDevDir = hardware.value("gpioDevDir", "/dev");
 
     // Parse IO
     for (auto& el : j["IO"].items()) {
@@ -45,6 +72,29 @@ void Settings::saveSettings(const std::string& filePath) {
 
     // Server
     j["Server"]["port"] = serverSettings.port; 
+    j["Server"]["outboundQueueDepth"] = serverSettings.outboundQueueDepth;
+    j["Server"]["outboundQueuePolicy"] = serverSettings.outboundQueuePolicy;
+    j["Server"]["logLevel"] = serverSettings.logLevel;
+    j["Server"]["serviceCores"] = serverSettings.serviceCores;
+    j["Server"]["controlCore"] = serverSettings.controlCore;
+
+    // Upload
+    j["Upload"]["directory"] = uploadSettings.directory;
+    j["Upload"]["maxFileSize"] = uploadSettings.maxFileSize;
+
+    // Telemetry
+    j["Telemetry"]["rateHz"] = telemetrySettings.rateHz;
+    j["Telemetry"]["keyframeIntervalMs"] = telemetrySettings.keyframeIntervalMs;
+
+    // Stream
+    j["Stream"]["enabled"] = streamSettings.enabled;
+    j["Stream"]["input"] = streamSettings.input;
+
+    // Hardware
+    j["Hardware"]["backend"] = hardwareSettings.backend;
+    j["Hardware"]["pwmBaseDir"] = hardwareSettings.pwmBaseDir;
+    j["Hardware"]["gpioBaseDir"] = hardwareSettings.gpioBaseDir;
+    j["Hardware"]["gpioDevDir"] = hardwareSettings.gpioDevDir;
 
     // IO
     for (const auto& ioPair : ioSettings) {
@@ -15,8 +15,35 @@ class Settings {
 public:
     struct Server {
         int port;
+        size_t outboundQueueDepth;              // Messages queued per websocket client
+        std::string outboundQueuePolicy;        // "drop-oldest" or "coalesce"
+        std::string logLevel;                   // "debug", "info", "warn", "error" or "off"
+        std::vector<unsigned> serviceCores;     // CPU cores of the websocket service threads, one thread each
+        unsigned controlCore;                   // CPU core of the command control thread
     }; // Server
 
+    struct Upload {
+        std::string directory;                  // Root of the firmware/maps/config upload directories
+        uint64_t maxFileSize;                   // Largest file accepted, in bytes
+    }; // Upload
+
+    struct Telemetry {
+        unsigned rateHz;                        // IO telemetry frames per second, 0 disables
+        unsigned keyframeIntervalMs;            // Time between frames carrying the full state
+    }; // Telemetry
+
+    struct Stream {
+        bool enabled;                           // Run the ffmpeg HLS encoder
+        std::string input;                      // ffmpeg input URL of the camera stream
+    }; // Stream
+
+    struct Hardware {
+        std::string backend;                    // "sysfs", "chardev" or "simulated"
+        std::string pwmBaseDir;                 // sysfs PWM class directory
+        std::string gpioBaseDir;                // sysfs GPIO class directory
+        std::string gpioDevDir;                 // Directory of the gpiochip devices
+    }; // Hardware
+
     struct IO {
         uint8_t pinNumber;
         std::string port;
@@ -35,6 +62,10 @@ public:
     std::string findIOKeyByPinName(const std::string& pinName) const;
 
     Server serverSettings;
+    Upload uploadSettings;
+    Telemetry telemetrySettings;
+    Stream streamSettings;
+    Hardware hardwareSettings;
     std::map<std::string, IO> ioSettings;
 
 private:
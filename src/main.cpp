@@ -1,32 +1,51 @@
 #include "configuration.hpp"
 #include "UiServer.h"
 #include "IO.h"
+#include "Logger.h"
+#include "TelemetryPublisher.h"
+#include "CommandTrace.h"
 #include <chrono>
 #include <thread>
 #include <iostream>
 #include <cstdlib>
 #include <filesystem>
+#include <csignal>
+
+//! Set by SIGUSR1, the main loop then prints the command latencies
+static volatile std::sig_atomic_t s_latencyDumpRequested = 0;
+
+static void requestLatencyDump(int) {
+    s_latencyDumpRequested = 1;
+}
 
 int main() {
     // Initialize settings from configuration file
     Settings settings("configuration/settings.json");
     int port = settings.serverSettings.port;
 
-    // Initialize UI server
-    UiServer uiServer;
-    if (!uiServer.initialize(port)) {
-        std::cerr << "Failed to initialize UiServer." << std::endl;
-        return -1;
+    // Start the asynchronous logger on any core, it runs at the lowest priority
+    Logger::setLevel(Logger::levelFromName(settings.serverSettings.logLevel.c_str()));
+    std::vector<unsigned> backgroundCores;
+    for (unsigned core = 0; core < std::thread::hardware_concurrency(); core++) {
+        backgroundCores.push_back(core);
     }
+    Logger::start(backgroundCores);
 
-    // Initialize timing variables
-    auto lastServiceTime = std::chrono::steady_clock::now();
-    const auto uiServiceInterval = std::chrono::milliseconds(1000);
+    // Bound the per-client outbound queues before any client connects
+    OverflowPolicy queuePolicy = (settings.serverSettings.outboundQueuePolicy == "coalesce") ?
+        OverflowPolicy::Coalesce : OverflowPolicy::DropOldest;
+    UiServer::setOutboundQueuePolicy(settings.serverSettings.outboundQueueDepth, queuePolicy);
+
+    // Initialize UI server, the web files are cached in memory when possible
+    UiServer uiServer;
+    if (!uiServer.enableAssetCache(backgroundCores)) {
+        std::cerr << "Serving web files from disk." << std::endl;
+    }
 
     // Initialize IOManager and configure PWM pins
     IOManager& ioManager = IOManager::getInstance();
     try {
-        ioManager.initialize(settings.ioSettings);
+        ioManager.initialize(settings.ioSettings, HardwareBackend::create(settings.hardwareSettings));
     } catch (const std::exception& e) {
         std::cerr << "Failed to initialize IOManager: " << e.what() << std::endl;
         return -1;
@@ -50,7 +69,7 @@ int main() {
 
     // Set up PWM control callback
     uiServer.setPwmControlCallback([&ioManager, &pwmIOKey](double setpoint) {
-        std::cout << "PWM control callback triggered with setpoint: " << setpoint << std::endl;
+        LOG_DEBUG("PWM control callback triggered with setpoint: %f", setpoint);
         if (!pwmIOKey.empty()) {
             IO* pwmIO = ioManager.getIO(pwmIOKey);
             if (pwmIO) {
@@ -59,17 +78,64 @@ int main() {
         }
     });
 
+    // Set up batched IO updates, applied back to back on the control thread
+    uiServer.setIoBatchCallback([&ioManager](const IoBatchCommand& command) {
+        IOManager::Transaction transaction = ioManager.beginTransaction();
+        for (uint32_t i = 0; i < command.count; i++) {
+            transaction.set(command.updates[i].io, command.updates[i].index);
+        }
+        transaction.commit();
+    });
+
+    TelemetryPublisher telemetry(ioManager);
+    telemetry.registerMetrics();
+    uiServer.setIoQueryCallback([&telemetry]() { telemetry.requestKeyframe(); });
+
+    // The callbacks are read by the control thread, so they are all set
+    // before initialize() starts it and accepts connections
+    if (!uiServer.initialize(port, settings.serverSettings.serviceCores, settings.serverSettings.controlCore)) {
+        std::cerr << "Failed to initialize UiServer." << std::endl;
+        return -1;
+    }
+
+    // Uploads are optional, the UI keeps running without them
+    if (!uiServer.enableUploads(settings.uploadSettings.directory, settings.uploadSettings.maxFileSize, backgroundCores)) {
+        std::cerr << "File uploads disabled." << std::endl;
+    }
+
+    // The camera stream is optional, ffmpeg is restarted if it fails
+    if (settings.streamSettings.enabled && !uiServer.enableStream(settings.streamSettings.input, backgroundCores)) {
+        std::cerr << "Video stream disabled." << std::endl;
+    }
+
+    // Stream IO state to the binary clients
+    if (settings.telemetrySettings.rateHz > 0) {
+        telemetry.start(settings.telemetrySettings.rateHz, settings.telemetrySettings.keyframeIntervalMs,
+            backgroundCores, [&uiServer](PacketPtr&& frame) { uiServer.publishTelemetry(std::move(frame)); });
+    }
+
+    // Initialize timing variables
+    auto lastServiceTime = std::chrono::steady_clock::now();
+    const auto uiServiceInterval = std::chrono::milliseconds(1000);
+
+    // `kill -USR1 <pid>` prints the command latency percentiles
+    std::signal(SIGUSR1, requestLatencyDump);
+
     // Main service loop
     while (true) {
         auto currentTime = std::chrono::steady_clock::now();
 
         // Service the UI
         if (currentTime - lastServiceTime >= uiServiceInterval) {
-            std::cout << "Calling UiServer::service()" << std::endl;
             uiServer.service();
             lastServiceTime = currentTime;
         }
 
+        if (s_latencyDumpRequested) {
+            s_latencyDumpRequested = 0;
+            std::cout << CommandTrace::reportText() << std::flush;
+        }
+
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 
@@ -1,37 +1,36 @@
 /**
-* Base hardware PWM control using Linux PWM sysfs interface.
+* Base hardware PWM control on a PwmChannel of the selected HardwareBackend.
 * Other classes will inherit this functionality for specific PWM applications
-* 
+*
+* The channel is opened for the lifetime of the object; a duty cycle that is
+* unchanged since the last write is not written again.
 */
 
 #ifndef PWM_H
 #define PWM_H
 
+#include <memory>
 #include <string>
 #include <stdexcept>
-#include <fstream>
+#include "HardwareBackend.h"
 
 class PWM {
 public:
-    PWM(const std::string& port, int chip, int chan, int freqHz);
+    PWM(HardwareBackend& backend, const std::string& port, int chip, int chan, int freqHz);
     virtual ~PWM();
 
     void setDutyCycle(float dutyNs);
     virtual void start();
     virtual void stop();
 
-    static constexpr const char* PWM_BASE_DIR = "/sys/class/pwm";
-
 protected:
     std::string port;
     int chipNum;
     int channel;
     int periodNs;  // Period in nanoseconds
     bool running;
-
-    void exportPWM();
-    void unexportPWM();
-    void writeSysfs(const std::string& path, const std::string& value);
+    long lastDutyNs;      // Last duty cycle written, -1 if unknown
+    std::unique_ptr<PwmChannel> pwmChannel;
 
 private:
 };
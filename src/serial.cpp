@@ -1,11 +1,21 @@
 #include "serial.h"
+#include "SerialReactor.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include <chrono>
 #include <cstring>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <poll.h>
 #include <iostream>
 
 const std::string Serial::deviceDirectory = "/dev";
 
+//! Totals of every port, the per-port counts are in getStats()
+static Counter& s_rxBytes = Metrics::counter("serial_received_bytes_total", "Bytes received on the serial ports");
+static Counter& s_txBytes = Metrics::counter("serial_transmitted_bytes_total", "Bytes written to the serial ports");
+
 /**
  * Constructor for Serial object.
  * 
@@ -59,7 +69,111 @@ Serial::Serial(const std::string& port, speed_t baud_rate) {
  * Destructor for Serial object.
 */
 Serial::~Serial() {
-    close(fd);
+    detach();
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+/**
+ * Writes bytes to the serial port without dropping any of them.
+ * On an attached port the bytes go straight to the fd while nothing is
+ * queued; whatever the fd does not accept is queued and flushed by the
+ * reactor, coalesced with later writes into one writev(). If the transmit
+ * ring cannot hold the bytes nothing is written and false is returned, so
+ * callers can back off and retry.
+ * 
+ * @param data Pointer to the data buffer to be written.
+ * @param size The number of bytes to write from the data buffer.
+ * @return bool True if all bytes were written or queued.
+ */
+bool Serial::transmit(const void* data, size_t size) {
+    const char* pBytes = static_cast<const char*>(data);
+    if (fd < 0 || (pBytes == nullptr && size > 0)) {
+        return false;
+    }
+    if (size == 0) {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lck(m_txMutex);
+
+    if (!m_txRing) {
+        return writeUnattached(pBytes, size);
+    }
+
+    if (size > m_txRing->space()) {
+        m_txRejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Nothing queued: skip the ring. Otherwise append so ordering is kept.
+    size_t written = 0;
+    if (m_txRing->size() == 0) {
+        ssize_t n = ::write(fd, pBytes, size);
+        if (n > 0) {
+            written = (size_t)n;
+            m_txBytes.fetch_add(written, std::memory_order_relaxed);
+            s_txBytes.add(written);
+            m_txSyscalls.fetch_add(1, std::memory_order_relaxed);
+        } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            LOG_WARN("Serial: write failed on fd %d: %s", fd, strerror(errno));
+            return false;
+        }
+        if (written == size) {
+            return true;
+        }
+    }
+
+    m_txRing->push(pBytes + written, size - written);
+
+    uint64_t queued = m_txRing->size();
+    if (queued > m_txHighWater.load(std::memory_order_relaxed)) {
+        m_txHighWater.store(queued, std::memory_order_relaxed);
+    }
+
+    if (!m_txArmed) {
+        m_txArmed = true;
+        m_pReactor->modify(this, true);
+    }
+    return true;
+}
+
+/**
+ * Writes all bytes to a port without a reactor, waiting for the fd to drain
+ * when the kernel buffer is full.
+ *
+ * @param pBytes Bytes to write.
+ * @param size Number of bytes.
+ * @return bool False on error or if the fd stalled for UnattachedWriteTimeoutMs.
+ */
+bool Serial::writeUnattached(const char* pBytes, size_t size) {
+    size_t written = 0;
+
+    while (written < size) {
+        ssize_t n = ::write(fd, pBytes + written, size - written);
+        if (n > 0) {
+            written += (size_t)n;
+            m_txBytes.fetch_add((uint64_t)n, std::memory_order_relaxed);
+            s_txBytes.add((uint64_t)n);
+            m_txSyscalls.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOG_WARN("Serial: write failed on fd %d: %s", fd, strerror(errno));
+            return false;
+        }
+
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, UnattachedWriteTimeoutMs) <= 0) {
+            LOG_WARN("Serial: write timed out on fd %d, %zu of %zu bytes written", fd, written, size);
+            return false;
+        }
+    }
+    return true;
 }
 
 /**
@@ -68,21 +182,20 @@ Serial::~Serial() {
  * 
  * @param data Pointer to the data buffer to be written.
  * @param size The number of bytes to write from the data buffer.
+ * @return bool True if all bytes were written or queued.
  */
-void Serial::writeBytestream(const void* data, size_t size) {
-    ::write(fd, data, size);
+bool Serial::writeBytestream(const void* data, size_t size) {
+    return transmit(data, size);
 }
 
 /**
  * Writes a string to the serial port.
  * 
  * @param str The string to be written to the serial port.
+ * @return bool True if the string was written or queued.
  */
-void Serial::writeString(const std::string& str) {
-    ssize_t bytes_written = write(fd, str.c_str(), str.size());
-    if (bytes_written < 0) {
-        std::cerr << "Failed to write to serial port: " << strerror(errno) << std::endl;
-    }
+bool Serial::writeString(const std::string& str) {
+    return transmit(str.data(), str.size());
 }
 
 /**
@@ -90,19 +203,32 @@ void Serial::writeString(const std::string& str) {
  * 
  * @param asciiData The ASCII string to be written to the serial port.
  * @param length The number of bytes to write.
+ * @return bool True if the data was written or queued.
  */
-void Serial::writeASCII(const char* asciiData, size_t length) {
-    if (asciiData != nullptr && length > 0) {
-        ::write(fd, asciiData, length);
+bool Serial::writeASCII(const char* asciiData, size_t length) {
+    if (asciiData == nullptr || length == 0) {
+        return false;
     }
+    return transmit(asciiData, length);
 }
 
 /**
  * Reads the data in the serial buffer and returns it as a string.
+ * When the port is attached to a reactor the contents of the receive ring
+ * are returned instead; prefer peek()/consume() there to avoid the copy.
  * 
  * @return std::string data
 */
 std::string Serial::read() {
+    if (m_rxRing) {
+        std::string data;
+        for (std::string_view slice = peek(); !slice.empty(); slice = peek()) {
+            data.append(slice);
+            consume(slice.size());
+        }
+        return data;
+    }
+
     char buf[256];
     ssize_t n = ::read(fd, buf, sizeof(buf));
     if (n > 0) {
@@ -110,3 +236,246 @@ std::string Serial::read() {
     }
     return "";
 }
+
+/**
+ * Attaches the port to a reactor. From then on the reactor thread reads the
+ * fd and the receive ring is the only way to get at incoming data. Attach
+ * before other threads start using the port.
+ *
+ * @param reactor Reactor that multiplexes this port.
+ * @param rxCapacity Receive ring size in bytes, rounded up to a power of two.
+ * @param callback Optional notification run on the reactor thread when bytes arrive.
+ * @param txCapacity Transmit ring size in bytes, rounded up to a power of two.
+ * @return bool True on success.
+ */
+bool Serial::attach(SerialReactor& reactor, size_t rxCapacity, ReceiveCallback callback, size_t txCapacity) {
+    if (fd < 0 || m_pReactor != nullptr) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lck(m_txMutex);
+        m_rxRing.reset(new ByteRing(rxCapacity));
+        m_txRing.reset(new ByteRing(txCapacity));
+        m_onReceive = std::move(callback);
+        m_rxStalled.store(false);
+        m_txArmed = false;
+        m_pReactor = &reactor;
+    }
+
+    if (!reactor.add(this)) {
+        std::lock_guard<std::mutex> lck(m_txMutex);
+        m_pReactor = nullptr;
+        m_onReceive = nullptr;
+        m_rxRing.reset();
+        m_txRing.reset();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Detaches the port from its reactor. Bytes still in the receive or transmit
+ * rings are discarded; call flush() first to send queued bytes. Must not be
+ * called from a reactor callback.
+ */
+void Serial::detach() {
+    if (m_pReactor == nullptr) {
+        return;
+    }
+
+    m_pReactor->remove(this);
+
+    std::lock_guard<std::mutex> lck(m_txMutex);
+    m_pReactor = nullptr;
+    m_onReceive = nullptr;
+    m_onDrain = nullptr;
+    m_rxRing.reset();
+    m_txRing.reset();
+    m_txArmed = false;
+    m_txDrained.notify_all();
+}
+
+/**
+ * Waits until every queued byte has been accepted by the fd.
+ *
+ * @param timeoutMs Maximum time to wait.
+ * @return bool True if the transmit ring is empty.
+ */
+bool Serial::flush(int timeoutMs) {
+    std::unique_lock<std::mutex> lck(m_txMutex);
+    return m_txDrained.wait_for(lck, std::chrono::milliseconds(timeoutMs), [this] {
+        return !m_txRing || m_txRing->size() == 0;
+    });
+}
+
+size_t Serial::pending() const {
+    std::lock_guard<std::mutex> lck(m_txMutex);
+    return m_txRing ? m_txRing->size() : 0;
+}
+
+/**
+ * Sets a callback run on the reactor thread each time the transmit ring
+ * drains, e.g. to resume a producer that saw transmit() return false.
+ *
+ * @param callback Drain notification, nullptr to clear.
+ */
+void Serial::setDrainCallback(DrainCallback callback) {
+    std::lock_guard<std::mutex> lck(m_txMutex);
+    m_onDrain = std::move(callback);
+}
+
+/**
+ * Returns the oldest received bytes without copying them. The slice ends at
+ * the ring wrap point; after consume() the next call returns the rest.
+ *
+ * @return std::string_view Received bytes, valid until consume().
+ */
+std::string_view Serial::peek() const {
+    return m_rxRing ? m_rxRing->peek() : std::string_view();
+}
+
+/**
+ * Releases received bytes. If the reactor paused this port because the ring
+ * was full, it is woken to resume reading.
+ *
+ * @param count Number of bytes to release.
+ */
+void Serial::consume(size_t count) {
+    if (!m_rxRing) {
+        return;
+    }
+
+    m_rxRing->consume(count);
+    if (m_rxStalled.load() && m_pReactor != nullptr) {
+        m_pReactor->wake();
+    }
+}
+
+size_t Serial::available() const {
+    return m_rxRing ? m_rxRing->size() : 0;
+}
+
+SerialStats Serial::getStats() const {
+    SerialStats stats;
+    stats.rxBytes = m_rxBytes.load(std::memory_order_relaxed);
+    stats.rxStalls = m_rxStalls.load(std::memory_order_relaxed);
+    stats.txBytes = m_txBytes.load(std::memory_order_relaxed);
+    stats.txSyscalls = m_txSyscalls.load(std::memory_order_relaxed);
+    stats.txRejected = m_txRejected.load(std::memory_order_relaxed);
+    stats.txHighWater = m_txHighWater.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/**
+ * Handles epoll events for this port. Runs on the reactor thread.
+ *
+ * @param events epoll event mask.
+ */
+void Serial::handleEvents(uint32_t events) {
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        readAvailable();
+    }
+    if (events & EPOLLOUT) {
+        writeQueued();
+    }
+}
+
+/**
+ * Drains the fd into the receive ring until the kernel buffer is empty or
+ * the ring is full. Reading straight into the ring's free space with readv()
+ * needs no intermediate buffer. A full ring pauses the port, leaving further
+ * bytes in the kernel, until consume() wakes the reactor.
+ */
+void Serial::readAvailable() {
+    size_t received = 0;
+    m_rxStalled.store(false);
+
+    while (true) {
+        struct iovec iov[2];
+        int count = m_rxRing->writable(iov);
+
+        if (count == 0) {
+            // Recheck after publishing the stall so a consume() racing with
+            // it either sees the flag or frees space seen here.
+            m_rxStalled.store(true);
+            if (m_rxRing->space() > 0) {
+                m_rxStalled.store(false);
+                continue;
+            }
+            m_rxStalls.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+
+        ssize_t n = ::readv(fd, iov, count);
+        if (n > 0) {
+            m_rxRing->commit((size_t)n);
+            received += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOG_WARN("Serial: read failed on fd %d: %s", fd, strerror(errno));
+        }
+        break;
+    }
+
+    if (received > 0) {
+        m_rxBytes.fetch_add(received, std::memory_order_relaxed);
+        s_rxBytes.add(received);
+        if (m_onReceive) {
+            m_onReceive(*this);
+        }
+    }
+}
+
+/**
+ * Flushes the transmit ring with writev() until it is empty or the fd stops
+ * accepting bytes. Runs on the reactor thread on EPOLLOUT; everything queued
+ * since the last flush goes out in one call, however many writes queued it.
+ */
+void Serial::writeQueued() {
+    DrainCallback onDrain;
+    {
+        std::lock_guard<std::mutex> lck(m_txMutex);
+        if (!m_txRing) {
+            return;
+        }
+
+        while (true) {
+            struct iovec iov[2];
+            int count = m_txRing->readable(iov);
+            if (count == 0) {
+                break;
+            }
+
+            ssize_t n = ::writev(fd, iov, count);
+            if (n > 0) {
+                m_txRing->consume((size_t)n);
+                m_txBytes.fetch_add((uint64_t)n, std::memory_order_relaxed);
+                s_txBytes.add((uint64_t)n);
+                m_txSyscalls.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_WARN("Serial: write failed on fd %d: %s", fd, strerror(errno));
+            }
+            return;     // Stay armed, EPOLLOUT fires again once the fd drains
+        }
+
+        m_txArmed = false;
+        m_pReactor->modify(this, false);
+        m_txDrained.notify_all();
+        onDrain = m_onDrain;
+    }
+
+    // Outside the lock so the callback may transmit again
+    if (onDrain) {
+        onDrain(*this);
+    }
+}
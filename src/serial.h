@@ -1,27 +1,111 @@
 /**
 * Basic driver for serial devices. 
+* A port can be attached to a SerialReactor, which drains the fd into a fixed
+* size receive ring; consumers then read contiguous slices with peek() and
+* release them with consume() instead of polling read().
+* Writes never drop bytes silently: an attached port queues what the fd does
+* not take immediately in a transmit ring that the reactor flushes on
+* EPOLLOUT, and rejects writes that do not fit so callers see backpressure.
 */
 
 #ifndef SERIALMANAGER_H
 #define SERIALMANAGER_H
 
+#include "ByteRing.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <termios.h>
 
+class SerialReactor;
+
+//! Transfer counters of a port
+struct SerialStats {
+    uint64_t rxBytes;       //! Bytes moved into the receive ring
+    uint64_t rxStalls;      //! Times reading paused because the ring was full
+    uint64_t txBytes;       //! Bytes accepted by the fd
+    uint64_t txSyscalls;    //! write()/writev() calls that transferred bytes
+    uint64_t txRejected;    //! Writes refused because the transmit ring was full
+    uint64_t txHighWater;   //! Most bytes ever queued in the transmit ring
+};
+
 class Serial {
 protected:
     int fd; // File descriptor for the serial port
 
 public:
-    Serial(){}
+    typedef std::function<void(Serial&)> ReceiveCallback;
+    typedef std::function<void(Serial&)> DrainCallback;
+
+    //! How long an unattached port waits for the fd to accept more bytes
+    static constexpr int UnattachedWriteTimeoutMs = 100;
+
+    Serial() : fd(-1) {}
     Serial(const std::string& port, speed_t baud_rate);
     virtual ~Serial();
 
-    void writeBytestream(const void* data, size_t size);
-    void writeString(const std::string& str);
-    void writeASCII(const char* asciiData, size_t length);
+    //! Write or queue all bytes. Returns false if they could not be taken,
+    //! in which case an attached port has queued none of them.
+    bool transmit(const void* data, size_t size);
+    bool writeBytestream(const void* data, size_t size);
+    bool writeString(const std::string& str);
+    bool writeASCII(const char* asciiData, size_t length);
     std::string read(); 
     static const std::string deviceDirectory; // Jetson Linux file system directory for devices/peripherals 
+
+    int fileDescriptor() const { return fd; }
+
+    //! Hand the fd to a reactor with rings of rxCapacity and txCapacity bytes.
+    //! The callback, if any, runs on the reactor thread after new bytes arrive.
+    bool attach(SerialReactor& reactor, size_t rxCapacity = 4096, ReceiveCallback callback = nullptr,
+                size_t txCapacity = 4096);
+    void detach();
+
+    //! Wait until the transmit ring is empty. Returns false on timeout.
+    bool flush(int timeoutMs);
+    //! Bytes queued for transmit
+    size_t pending() const;
+    //! Runs on the reactor thread whenever the transmit ring drains
+    void setDrainCallback(DrainCallback callback);
+
+    //! Oldest received bytes up to the ring wrap point; empty if none
+    std::string_view peek() const;
+    //! Release bytes returned by peek()
+    void consume(size_t count);
+    //! Bytes waiting in the receive ring
+    size_t available() const;
+
+    bool receiveStalled() const { return m_rxStalled.load(); }
+    SerialStats getStats() const;
+
+private:
+    friend class SerialReactor;
+    void handleEvents(uint32_t events);
+    void readAvailable();
+    void writeQueued();
+    bool writeUnattached(const char* pBytes, size_t size);
+
+    SerialReactor*             m_pReactor = nullptr;    //! Reactor servicing this port
+    std::unique_ptr<ByteRing>  m_rxRing;                //! Filled by the reactor thread
+    ReceiveCallback            m_onReceive;             //! Runs on the reactor thread
+    std::atomic<bool>          m_rxStalled{false};      //! Ring was full, kernel still holds data
+    std::atomic<uint64_t>      m_rxBytes{0};
+    std::atomic<uint64_t>      m_rxStalls{0};
+
+    mutable std::mutex         m_txMutex;               //! Guards the transmit side
+    std::condition_variable    m_txDrained;             //! Signaled when the transmit ring empties
+    std::unique_ptr<ByteRing>  m_txRing;                //! Bytes the fd has not accepted yet
+    DrainCallback              m_onDrain;               //! Runs on the reactor thread
+    bool                       m_txArmed = false;       //! Waiting for EPOLLOUT
+    std::atomic<uint64_t>      m_txBytes{0};
+    std::atomic<uint64_t>      m_txSyscalls{0};
+    std::atomic<uint64_t>      m_txRejected{0};
+    std::atomic<uint64_t>      m_txHighWater{0};
 };
 
 #endif // SERIALMANAGER_H
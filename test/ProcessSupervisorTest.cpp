@@ -0,0 +1,184 @@
+/**
+* Drives ProcessSupervisor with stand-in children run through sh: a child that
+* keeps crashing, one that ignores SIGTERM, a missing program and a stop and
+* restart. Checks the state and ProcessStats after each. Exits non-zero if a
+* check fails; run through ctest.
+*/
+
+#include "ProcessSupervisor.h"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int s_failures = 0;
+
+#define CHECK(condition)                                                                \
+    do {                                                                                \
+        if (!(condition)) {                                                             \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            s_failures++;                                                               \
+        }                                                                               \
+    } while (0)
+
+static std::vector<unsigned> allCores() {
+    std::vector<unsigned> cores;
+    for (unsigned core = 0; core < std::thread::hardware_concurrency(); core++) {
+        cores.push_back(core);
+    }
+    return cores;
+}
+
+static uint64_t elapsedMs(std::chrono::steady_clock::time_point since) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - since).count();
+}
+
+//! Polls condition every millisecond, false if it is still unmet after timeoutMs
+static bool waitFor(const std::function<bool()>& condition, int timeoutMs) {
+    auto start = std::chrono::steady_clock::now();
+    while (!condition()) {
+        if (elapsedMs(start) >= (uint64_t)timeoutMs) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+static bool waitForState(const ProcessSupervisor& supervisor, ProcessState state, int timeoutMs) {
+    return waitFor([&]() { return supervisor.state() == state; }, timeoutMs);
+}
+
+/**
+ * A child that exits on its own is restarted with a doubling backoff and
+ * every exit counts as a failure.
+ */
+static void testCrashBackoff() {
+    ProcessSupervisor supervisor("crash");
+    const ProcessStats& stats = supervisor.getStats();
+    CHECK(supervisor.start(allCores()));
+
+    auto launched = std::chrono::steady_clock::now();
+    supervisor.launch({ "sh", "-c", "exit 3" });
+
+    // Restarts follow after MinBackoffMs, then twice that
+    CHECK(waitFor([&]() { return stats.restarts.load() >= 2; }, 5000));
+    uint64_t restartMs = elapsedMs(launched);
+    CHECK(restartMs >= (uint64_t)(ProcessSupervisor::MinBackoffMs * 3));
+    CHECK(stats.failures.load() >= 2);
+    CHECK(stats.lastExitStatus.load() == 3);
+    CHECK(stats.kills.load() == 0);
+
+    supervisor.halt();
+    CHECK(waitForState(supervisor, ProcessState::Stopped, 1000));
+    supervisor.stop();
+}
+
+/**
+ * A child ignoring SIGTERM is killed once StopTimeoutMs has passed.
+ */
+static void testIgnoredTerm() {
+    ProcessSupervisor supervisor("ignore-term");
+    const ProcessStats& stats = supervisor.getStats();
+
+    // The child prints "ready" once SIGTERM is ignored
+    std::mutex mutex;
+    std::string output;
+    supervisor.setOutputHandler([&](const uint8_t* pData, size_t len) {
+        std::lock_guard<std::mutex> lck(mutex);
+        output.append((const char*)pData, len);
+    });
+    CHECK(supervisor.start(allCores()));
+
+    supervisor.launch({ "sh", "-c", "trap '' TERM; echo ready; while :; do sleep 0.1; done" });
+    CHECK(waitFor([&]() {
+        std::lock_guard<std::mutex> lck(mutex);
+        return output.find("ready") != std::string::npos;
+    }, 2000));
+
+    auto halted = std::chrono::steady_clock::now();
+    supervisor.halt();
+    CHECK(waitForState(supervisor, ProcessState::Stopping, 1000));
+    CHECK(waitForState(supervisor, ProcessState::Stopped, ProcessSupervisor::StopTimeoutMs + 2000));
+    CHECK(elapsedMs(halted) >= (uint64_t)ProcessSupervisor::StopTimeoutMs);
+    CHECK(stats.kills.load() == 1);
+    CHECK(stats.lastExitStatus.load() == -SIGKILL);
+    CHECK(stats.failures.load() == 0);
+    CHECK(stats.restarts.load() == 0);
+    supervisor.stop();
+}
+
+/**
+ * A program that cannot be started is retried with a backoff and never
+ * counts as started.
+ */
+static void testMissingProgram() {
+    ProcessSupervisor supervisor("missing");
+    const ProcessStats& stats = supervisor.getStats();
+    CHECK(supervisor.start(allCores()));
+
+    supervisor.launch({ "/nonexistent/embeddedui-test-program" });
+    CHECK(waitFor([&]() { return stats.failures.load() >= 1; }, 1000));
+    CHECK(supervisor.state() == ProcessState::Backoff);
+    CHECK(stats.starts.load() == 0);
+    CHECK(supervisor.pid() == -1);
+
+    supervisor.halt();
+    CHECK(waitForState(supervisor, ProcessState::Stopped, 1000));
+    CHECK(stats.starts.load() == 0);
+    supervisor.stop();
+}
+
+/**
+ * halt() stops the child with SIGTERM, and launching it again is a new start
+ * rather than a restart.
+ */
+static void testStopStart() {
+    ProcessSupervisor supervisor("stop-start");
+    const ProcessStats& stats = supervisor.getStats();
+    CHECK(supervisor.start(allCores()));
+
+    supervisor.launch({ "sh", "-c", "exec sleep 30" });
+    CHECK(waitForState(supervisor, ProcessState::Running, 1000));
+    pid_t firstPid = supervisor.pid();
+    CHECK(firstPid > 0);
+
+    supervisor.halt();
+    CHECK(waitForState(supervisor, ProcessState::Stopped, 1000));
+    CHECK(stats.lastExitStatus.load() == -SIGTERM);
+    CHECK(stats.kills.load() == 0);
+    CHECK(supervisor.pid() == -1);
+
+    supervisor.launch({ "sh", "-c", "exec sleep 30" });
+    CHECK(waitForState(supervisor, ProcessState::Running, 1000));
+    CHECK(supervisor.pid() > 0 && supervisor.pid() != firstPid);
+    CHECK(stats.starts.load() == 2);
+    CHECK(stats.restarts.load() == 0);
+    CHECK(stats.failures.load() == 0);
+
+    // stop() also stops the child
+    supervisor.stop();
+    CHECK(supervisor.state() == ProcessState::Stopped);
+    CHECK(stats.lastExitStatus.load() == -SIGTERM);
+}
+
+int main() {
+    const std::pair<const char*, void (*)()> tests[] = {
+        { "crash-backoff", testCrashBackoff },
+        { "ignored-term", testIgnoredTerm },
+        { "missing-program", testMissingProgram },
+        { "stop-start", testStopStart },
+    };
+
+    for (const auto& [name, test] : tests) {
+        int failuresBefore = s_failures;
+        test();
+        printf("%-16s %s\n", name, s_failures == failuresBefore ? "ok" : "FAILED");
+    }
+    return s_failures == 0 ? 0 : 1;
+}